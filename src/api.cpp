@@ -13,12 +13,14 @@
 // limitations under the License.
 
 #include "cl_headers.hpp"
+#include "command_buffer.hpp"
 #include "icd.hpp"
 #include "image_format.hpp"
 #include "init.hpp"
 #include "kernel.hpp"
 #include "log.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "objects.hpp"
 #include "program.hpp"
 #include "queue.hpp"
@@ -81,6 +83,15 @@ bool is_valid_semaphore(cl_semaphore_khr sem) {
     return sem != nullptr && icd_downcast(sem)->is_valid();
 }
 
+bool is_valid_command_buffer(cl_command_buffer_khr command_buffer) {
+    return command_buffer != nullptr &&
+           icd_downcast(command_buffer)->is_valid();
+}
+
+bool is_valid_mutable_command(cl_mutable_command_khr command) {
+    return command != nullptr && icd_downcast(command)->is_valid();
+}
+
 bool is_valid_event_wait_list(cl_uint num_events_in_wait_list,
                               const cl_event* event_wait_list) {
 
@@ -219,6 +230,9 @@ cl_int CLVK_API_CALL clGetPlatformInfo(cl_platform_id platform,
     cl_version val_version;
     api_query_string val_string;
     cl_ulong val_ulong;
+    cl_semaphore_type_khr val_semaphore_type;
+    std::vector<cl_external_semaphore_handle_type_khr> val_semaphore_handles;
+    std::vector<cl_external_memory_handle_type_khr> val_memory_handles;
 
     if (!is_valid_platform(platform)) {
         return CL_INVALID_PLATFORM;
@@ -274,6 +288,29 @@ cl_int CLVK_API_CALL clGetPlatformInfo(cl_platform_id platform,
         copy_ptr = &val_ulong;
         size_ret = sizeof(val_ulong);
         break;
+    case CL_PLATFORM_SEMAPHORE_TYPES_KHR:
+        val_semaphore_type = CL_SEMAPHORE_TYPE_BINARY_KHR;
+        copy_ptr = &val_semaphore_type;
+        size_ret = sizeof(val_semaphore_type);
+        break;
+    case CL_PLATFORM_SEMAPHORE_IMPORT_HANDLE_TYPES_KHR:
+        val_semaphore_handles = plat->semaphore_import_handle_types();
+        copy_ptr = val_semaphore_handles.data();
+        size_ret = val_semaphore_handles.size() *
+                   sizeof(cl_external_semaphore_handle_type_khr);
+        break;
+    case CL_PLATFORM_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR:
+        val_semaphore_handles = plat->semaphore_export_handle_types();
+        copy_ptr = val_semaphore_handles.data();
+        size_ret = val_semaphore_handles.size() *
+                   sizeof(cl_external_semaphore_handle_type_khr);
+        break;
+    case CL_PLATFORM_EXTERNAL_MEMORY_IMPORT_HANDLE_TYPES_KHR:
+        val_memory_handles = plat->external_memory_import_handle_types();
+        copy_ptr = val_memory_handles.data();
+        size_ret = val_memory_handles.size() *
+                   sizeof(cl_external_memory_handle_type_khr);
+        break;
     default:
         ret = CL_INVALID_VALUE;
         break;
@@ -309,6 +346,26 @@ static const std::unordered_map<std::string, void*> gExtensionEntrypoints = {
     EXTENSION_ENTRYPOINT(clGetSemaphoreInfoKHR),
     EXTENSION_ENTRYPOINT(clRetainSemaphoreKHR),
     EXTENSION_ENTRYPOINT(clReleaseSemaphoreKHR),
+    EXTENSION_ENTRYPOINT(clGetSemaphoreHandleForTypeKHR),
+    EXTENSION_ENTRYPOINT(clReImportSemaphoreSyncFdKHR),
+    EXTENSION_ENTRYPOINT(clEnqueueAcquireExternalMemObjectsKHR),
+    EXTENSION_ENTRYPOINT(clEnqueueReleaseExternalMemObjectsKHR),
+    EXTENSION_ENTRYPOINT(clCreateCommandBufferKHR),
+    EXTENSION_ENTRYPOINT(clFinalizeCommandBufferKHR),
+    EXTENSION_ENTRYPOINT(clRetainCommandBufferKHR),
+    EXTENSION_ENTRYPOINT(clReleaseCommandBufferKHR),
+    EXTENSION_ENTRYPOINT(clEnqueueCommandBufferKHR),
+    EXTENSION_ENTRYPOINT(clCommandBarrierWithWaitListKHR),
+    EXTENSION_ENTRYPOINT(clCommandCopyBufferKHR),
+    EXTENSION_ENTRYPOINT(clCommandCopyBufferToImageKHR),
+    EXTENSION_ENTRYPOINT(clCommandCopyImageKHR),
+    EXTENSION_ENTRYPOINT(clCommandCopyImageToBufferKHR),
+    EXTENSION_ENTRYPOINT(clCommandFillBufferKHR),
+    EXTENSION_ENTRYPOINT(clCommandNDRangeKernelKHR),
+    EXTENSION_ENTRYPOINT(clGetCommandBufferInfoKHR),
+    EXTENSION_ENTRYPOINT(clUpdateMutableCommandsKHR),
+    EXTENSION_ENTRYPOINT(clGetMutableCommandInfoKHR),
+    EXTENSION_ENTRYPOINT(clGetRuntimeMetricsCLVK),
 #undef EXTENSION_ENTRYPOINT
 #undef FUNC_PTR
 };
@@ -439,6 +496,9 @@ cl_int CLVK_API_CALL clGetDeviceInfo(cl_device_id dev,
     cl_device_integer_dot_product_acceleration_properties_khr
         val_int_dot_product_props;
     std::vector<size_t> val_subgroup_sizes;
+    cl_device_command_buffer_capabilities_khr val_command_buffer_caps;
+    cl_mutable_dispatch_fields_khr val_mutable_dispatch_caps;
+    cl_semaphore_type_khr val_semaphore_type;
 
     auto device = icd_downcast(dev);
 
@@ -802,6 +862,9 @@ cl_int CLVK_API_CALL clGetDeviceInfo(cl_device_id dev,
         break;
     case CL_DEVICE_SVM_CAPABILITIES:
         val_svmcaps = 0;
+        if (device->supports_svm()) {
+            val_svmcaps = CL_DEVICE_SVM_COARSE_GRAIN_BUFFER;
+        }
         copy_ptr = &val_svmcaps;
         size_ret = sizeof(val_svmcaps);
         break;
@@ -951,6 +1014,51 @@ cl_int CLVK_API_CALL clGetDeviceInfo(cl_device_id dev,
             ret = CL_INVALID_VALUE;
         }
         break;
+    case CL_DEVICE_COMMAND_BUFFER_CAPABILITIES_KHR:
+        val_command_buffer_caps =
+            CL_COMMAND_BUFFER_CAPABILITY_SIMULTANEOUS_USE_KHR;
+        copy_ptr = &val_command_buffer_caps;
+        size_ret = sizeof(val_command_buffer_caps);
+        break;
+    case CL_DEVICE_COMMAND_BUFFER_SUPPORTED_QUEUE_PROPERTIES_KHR:
+        val_queue_properties = CL_QUEUE_PROFILING_ENABLE;
+        copy_ptr = &val_queue_properties;
+        size_ret = sizeof(val_queue_properties);
+        break;
+    case CL_DEVICE_COMMAND_BUFFER_REQUIRED_QUEUE_PROPERTIES_KHR:
+        val_queue_properties = 0;
+        copy_ptr = &val_queue_properties;
+        size_ret = sizeof(val_queue_properties);
+        break;
+    case CL_DEVICE_MUTABLE_DISPATCH_CAPABILITIES_KHR:
+        val_mutable_dispatch_caps =
+            CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR |
+            CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR |
+            CL_MUTABLE_DISPATCH_LOCAL_SIZE_KHR |
+            CL_MUTABLE_DISPATCH_ARGUMENTS_KHR;
+        copy_ptr = &val_mutable_dispatch_caps;
+        size_ret = sizeof(val_mutable_dispatch_caps);
+        break;
+    case CL_DEVICE_SEMAPHORE_TYPES_KHR:
+        val_semaphore_type = CL_SEMAPHORE_TYPE_BINARY_KHR;
+        copy_ptr = &val_semaphore_type;
+        size_ret = sizeof(val_semaphore_type);
+        break;
+    case CL_DEVICE_SEMAPHORE_IMPORT_HANDLE_TYPES_KHR:
+        copy_ptr = device->semaphore_import_handle_types().data();
+        size_ret = device->semaphore_import_handle_types().size() *
+                   sizeof(cl_external_semaphore_handle_type_khr);
+        break;
+    case CL_DEVICE_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR:
+        copy_ptr = device->semaphore_export_handle_types().data();
+        size_ret = device->semaphore_export_handle_types().size() *
+                   sizeof(cl_external_semaphore_handle_type_khr);
+        break;
+    case CL_DEVICE_EXTERNAL_MEMORY_IMPORT_HANDLE_TYPES_KHR:
+        copy_ptr = device->external_memory_import_handle_types().data();
+        size_ret = device->external_memory_import_handle_types().size() *
+                   sizeof(cl_external_memory_handle_type_khr);
+        break;
     default:
         ret = CL_INVALID_VALUE;
         break;
@@ -1047,6 +1155,13 @@ cl_context CLVK_API_CALL clCreateContext(
         return nullptr;
     }
 
+    if (!icd_downcast(devices[0])->init_vulkan_device()) {
+        if (errcode_ret != nullptr) {
+            *errcode_ret = CL_OUT_OF_RESOURCES;
+        }
+        return nullptr;
+    }
+
     cl_context context =
         new cvk_context(icd_downcast(devices[0]), properties, user_data);
 
@@ -1744,6 +1859,65 @@ cl_int CLVK_API_CALL clSetCommandQueueProperty(
 }
 
 // Memory Object APIs
+// Validate the properties of a memory object and copy them to props. Only the
+// cl_khr_external_memory properties are supported.
+static cl_int cvk_parse_mem_properties(cvk_context* context,
+                                       const cl_mem_properties* properties,
+                                       cl_mem_flags flags, bool is_image,
+                                       std::vector<cl_mem_properties>& props,
+                                       bool* is_external) {
+    if (properties == nullptr) {
+        return CL_SUCCESS;
+    }
+
+    auto device = context->device();
+    bool has_handle = false;
+    while (*properties) {
+        auto key = *properties;
+        if (key == CL_MEM_DEVICE_HANDLE_LIST_KHR) {
+            props.push_back(key);
+            properties++;
+            while (*properties != CL_MEM_DEVICE_HANDLE_LIST_END_KHR) {
+                auto devapi = reinterpret_cast<cl_device_id>(*properties);
+                if (!is_valid_device(devapi) ||
+                    !context->has_device(icd_downcast(devapi))) {
+                    return CL_INVALID_DEVICE;
+                }
+                props.push_back(*properties);
+                properties++;
+            }
+            props.push_back(*properties);
+            properties++;
+        } else if ((key == CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR) ||
+                   (key == CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR)) {
+            // Importing dma_buf images would require knowing their layout
+            if (has_handle || !device->supports_external_memory_import(key) ||
+                (is_image && (key == CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR))) {
+                return CL_INVALID_PROPERTY;
+            }
+            has_handle = true;
+            props.push_back(key);
+            props.push_back(*(properties + 1));
+            properties += 2;
+        } else {
+            return CL_INVALID_PROPERTY;
+        }
+    }
+    props.push_back(0);
+
+    // The content of imported memory objects comes from the exporter
+    if (has_handle && (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR |
+                                CL_MEM_ALLOC_HOST_PTR))) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (is_external != nullptr) {
+        *is_external = has_handle;
+    }
+
+    return CL_SUCCESS;
+}
+
 static cl_mem CLVK_API_CALL cvk_create_buffer_with_properties(
     cl_context context, const cl_mem_properties* properties, cl_mem_flags flags,
     size_t size, void* host_ptr, cl_int* errcode_ret) {
@@ -1757,16 +1931,10 @@ static cl_mem CLVK_API_CALL cvk_create_buffer_with_properties(
 
     // Validate properties
     std::vector<cl_mem_properties> props;
-
-    if (properties != nullptr) {
-        while (*properties) {
-            // We dont't currently support any properties so return an error
-            *errcode_ret = CL_INVALID_PROPERTY;
-            return nullptr;
-            props.push_back(*properties);
-            properties++;
-        }
-        props.push_back(0);
+    *errcode_ret = cvk_parse_mem_properties(icd_downcast(context), properties,
+                                            flags, false, props, nullptr);
+    if (*errcode_ret != CL_SUCCESS) {
+        return nullptr;
     }
 
     // Validate flags
@@ -2915,15 +3083,58 @@ cl_int CLVK_API_CALL clSetKernelArg(cl_kernel kern, cl_uint arg_index,
     return kernel->set_arg(arg_index, arg_size, arg_value);
 }
 
-cl_int CLVK_API_CALL clSetKernelExecInfo(cl_kernel kernel,
+cl_int CLVK_API_CALL clSetKernelExecInfo(cl_kernel kern,
                                          cl_kernel_exec_info param_name,
                                          size_t param_value_size,
                                          const void* param_value) {
-    TRACE_FUNCTION("kernel", (uintptr_t)kernel);
+    TRACE_FUNCTION("kernel", (uintptr_t)kern);
     LOG_API_CALL("kernel = %p, param_name = %x, param_value_size = %zu, "
                  "param_value = %p",
-                 kernel, param_name, param_value_size, param_value);
-    return CL_INVALID_OPERATION;
+                 kern, param_name, param_value_size, param_value);
+
+    auto kernel = icd_downcast(kern);
+
+    if (!is_valid_kernel(kernel)) {
+        return CL_INVALID_KERNEL;
+    }
+
+    if (param_value == nullptr) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!kernel->context()->device()->supports_svm()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    switch (param_name) {
+    case CL_KERNEL_EXEC_INFO_SVM_PTRS: {
+        if (param_value_size % sizeof(void*) != 0) {
+            return CL_INVALID_VALUE;
+        }
+        // Kernels access SVM allocations through their device address, there
+        // is nothing to bind for pointers that are used indirectly
+        auto ptrs = static_cast<void* const*>(param_value);
+        auto context = kernel->context();
+        for (size_t i = 0; i < param_value_size / sizeof(void*); i++) {
+            size_t offset;
+            if (context->find_svm_allocation(ptrs[i], &offset) == nullptr) {
+                return CL_INVALID_VALUE;
+            }
+        }
+        return CL_SUCCESS;
+    }
+    case CL_KERNEL_EXEC_INFO_SVM_FINE_GRAIN_SYSTEM:
+        if (param_value_size != sizeof(cl_bool)) {
+            return CL_INVALID_VALUE;
+        }
+        // Fine-grained system SVM is not supported
+        if (*static_cast<const cl_bool*>(param_value) != CL_FALSE) {
+            return CL_INVALID_OPERATION;
+        }
+        return CL_SUCCESS;
+    default:
+        return CL_INVALID_VALUE;
+    }
 }
 
 cl_int CLVK_API_CALL clGetKernelInfo(cl_kernel kern, cl_kernel_info param_name,
@@ -3911,6 +4122,27 @@ cl_int CLVK_API_CALL clEnqueueUnmapMemObject(cl_command_queue cq, cl_mem mem,
         cmd, num_events_in_wait_list, event_wait_list, event);
 }
 
+static cl_int cvk_validate_ndrange_work_group_size(cvk_device* device,
+                                                   cvk_kernel* kernel,
+                                                   const cvk_ndrange& ndrange) {
+    // Check work-group size matches the required size if specified
+    auto reqd_work_group_size = kernel->required_work_group_size();
+    if (reqd_work_group_size[0] != 0) {
+        if (reqd_work_group_size != ndrange.lws) {
+            return CL_INVALID_WORK_GROUP_SIZE;
+        }
+    }
+
+    // Check uniformity of the NDRange if needed
+    if (!device->supports_non_uniform_workgroup()) {
+        if (!ndrange.is_uniform()) {
+            return CL_INVALID_WORK_GROUP_SIZE;
+        }
+    }
+
+    return CL_SUCCESS;
+}
+
 cl_int cvk_enqueue_ndrange_kernel(cvk_command_queue* command_queue,
                                   cvk_kernel* kernel, uint32_t dims,
                                   const cvk_ndrange& ndrange,
@@ -4012,19 +4244,9 @@ cl_int cvk_enqueue_ndrange_kernel(cvk_command_queue* command_queue,
     // passed as kernel arguments and the device does not support fine grain
     // system SVM allocations.
 
-    // Check work-group size matches the required size if specified
-    auto reqd_work_group_size = kernel->required_work_group_size();
-    if (reqd_work_group_size[0] != 0) {
-        if (reqd_work_group_size != ndrange.lws) {
-            return CL_INVALID_WORK_GROUP_SIZE;
-        }
-    }
-
-    // Check uniformity of the NDRange if needed
-    if (!command_queue->device()->supports_non_uniform_workgroup()) {
-        if (!ndrange.is_uniform()) {
-            return CL_INVALID_WORK_GROUP_SIZE;
-        }
+    auto err = cvk_validate_ndrange_work_group_size(device, kernel, ndrange);
+    if (err != CL_SUCCESS) {
+        return err;
     }
 
     auto cmd = new cvk_command_kernel(command_queue, kernel, dims, ndrange);
@@ -4074,9 +4296,8 @@ cl_int CLVK_API_CALL clEnqueueNDRangeKernel(
 
     // Try to pick a sensible work-group size if the user didn't specify one.
     if (local_work_size == nullptr) {
-        icd_downcast(command_queue)
-            ->device()
-            ->select_work_group_size(ndrange.gws, ndrange.lws);
+        icd_downcast(kernel)->select_work_group_size(
+            icd_downcast(command_queue)->device(), ndrange.gws, ndrange.lws);
         cvk_info_fn("selected local work size: {%u,%u,%u}", ndrange.lws[0],
                     ndrange.lws[1], ndrange.lws[2]);
     }
@@ -4421,15 +4642,29 @@ cl_mem CLVK_API_CALL clCreateImageWithProperties(
                  context, properties, flags, image_format, image_desc, host_ptr,
                  errcode_ret);
 
-    cl_int err;
+    if (!is_valid_context(context)) {
+        if (errcode_ret != nullptr) {
+            *errcode_ret = CL_INVALID_CONTEXT;
+        }
+        return nullptr;
+    }
+
     std::vector<cl_mem_properties> props;
+    bool is_external = false;
+    cl_int err = cvk_parse_mem_properties(icd_downcast(context), properties,
+                                          flags, true, props, &is_external);
 
-    if (properties != nullptr) {
-        while (*properties) {
-            props.push_back(*properties);
-            properties++;
+    // Images created from buffers cannot also import external memory
+    if ((err == CL_SUCCESS) && is_external && (image_desc != nullptr) &&
+        (image_desc->mem_object != nullptr)) {
+        err = CL_INVALID_OPERATION;
+    }
+
+    if (err != CL_SUCCESS) {
+        if (errcode_ret != nullptr) {
+            *errcode_ret = err;
         }
-        props.push_back(0);
+        return nullptr;
     }
 
     auto image = cvk_create_image(context, flags, image_format, image_desc,
@@ -5593,12 +5828,64 @@ void* CLVK_API_CALL clSVMAlloc(cl_context context, cl_svm_mem_flags flags,
     LOG_API_CALL("context = %p, flags = %lu, size = %zu, alignment = %u",
                  context, flags, size, alignment);
 
-    return nullptr;
+    if (!is_valid_context(context)) {
+        return nullptr;
+    }
+
+    auto ctx = icd_downcast(context);
+    auto device = ctx->device();
+
+    if (!device->supports_svm()) {
+        return nullptr;
+    }
+
+    // Only coarse-grained buffer allocations are supported
+    cl_svm_mem_flags valid_flags =
+        CL_MEM_READ_WRITE | CL_MEM_WRITE_ONLY | CL_MEM_READ_ONLY;
+    if ((flags & ~valid_flags) != 0) {
+        return nullptr;
+    }
+    if ((flags & CL_MEM_READ_WRITE) && (flags & CL_MEM_WRITE_ONLY)) {
+        return nullptr;
+    }
+    if ((flags & CL_MEM_READ_ONLY) &&
+        (flags & (CL_MEM_WRITE_ONLY | CL_MEM_READ_WRITE))) {
+        return nullptr;
+    }
+
+    if ((size == 0) || !ctx->is_mem_alloc_size_valid(size)) {
+        return nullptr;
+    }
+
+    // Allocations are aligned to the placed map alignment
+    if (((alignment & (alignment - 1)) != 0) ||
+        (alignment > device->svm_alignment())) {
+        return nullptr;
+    }
+
+    cl_int err;
+    auto buffer = cvk_buffer::create_svm(ctx, flags, size, &err);
+    if (err != CL_SUCCESS) {
+        return nullptr;
+    }
+
+    auto ptr = reinterpret_cast<void*>(buffer->device_address());
+    ctx->add_svm_allocation(buffer.release());
+
+    return ptr;
 }
 
 void CLVK_API_CALL clSVMFree(cl_context context, void* svm_pointer) {
     TRACE_FUNCTION("context", (uintptr_t)context);
     LOG_API_CALL("context = %p, svm_pointer = %p", context, svm_pointer);
+
+    if (!is_valid_context(context) || (svm_pointer == nullptr)) {
+        return;
+    }
+
+    if (!icd_downcast(context)->remove_svm_allocation(svm_pointer)) {
+        cvk_warn_fn("%p is not an SVM allocation", svm_pointer);
+    }
 }
 
 cl_int CLVK_API_CALL clEnqueueSVMFree(
@@ -5612,15 +5899,36 @@ cl_int CLVK_API_CALL clEnqueueSVMFree(
     TRACE_FUNCTION("command_queue", (uintptr_t)command_queue,
                    "num_svm_pointers", num_svm_pointers,
                    "num_events_in_wait_list", num_events_in_wait_list);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(num_svm_pointers);
-    UNUSED(svm_pointers);
-    UNUSED(pfn_free_func);
-    UNUSED(user_data);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
+    LOG_API_CALL("command_queue = %p, num_svm_pointers = %u, "
+                 "svm_pointers = %p, pfn_free_func = %p, user_data = %p",
+                 command_queue, num_svm_pointers, svm_pointers, pfn_free_func,
+                 user_data);
+
+    auto queue = icd_downcast(command_queue);
+
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if ((num_svm_pointers == 0) != (svm_pointers == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    std::vector<void*> pointers(svm_pointers, svm_pointers + num_svm_pointers);
+    auto cmd = new cvk_command_svm_free(queue, std::move(pointers),
+                                        pfn_free_func, user_data);
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
 }
 
 cl_int CLVK_API_CALL clEnqueueSVMMap(cl_command_queue command_queue,
@@ -5629,16 +5937,49 @@ cl_int CLVK_API_CALL clEnqueueSVMMap(cl_command_queue command_queue,
                                      cl_uint num_events_in_wait_list,
                                      const cl_event* event_wait_list,
                                      cl_event* event) {
-    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(blocking_map);
-    UNUSED(flags);
-    UNUSED(svm_ptr);
-    UNUSED(size);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue, "blocking_map",
+                   blocking_map, "map_flags", flags, "size", size,
+                   "num_events_in_wait_list", num_events_in_wait_list);
+    LOG_API_CALL("command_queue = %p, blocking_map = %d, flags = %lx, "
+                 "svm_ptr = %p, size = %zu",
+                 command_queue, blocking_map, flags, svm_ptr, size);
+
+    auto queue = icd_downcast(command_queue);
+
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if ((svm_ptr == nullptr) || (size == 0) || !map_flags_are_valid(flags)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    size_t offset;
+    auto buffer = queue->context()->find_svm_allocation(svm_ptr, &offset);
+    if ((buffer == nullptr) || (offset + size > buffer->size())) {
+        return CL_INVALID_VALUE;
+    }
+
+    // SVM allocations are always mapped at the same address, the mapping only
+    // takes care of the cache maintenance for non-coherent memory.
+    cl_int err;
+    auto map_ptr = cvk_enqueue_map_buffer(
+        queue, buffer, blocking_map, offset, size, flags,
+        num_events_in_wait_list, event_wait_list, event, &err,
+        CL_COMMAND_SVM_MAP);
+    CVK_ASSERT((err != CL_SUCCESS) || (map_ptr == svm_ptr));
+    UNUSED(map_ptr);
+
+    return err;
 }
 
 cl_int CLVK_API_CALL clEnqueueSVMMemcpy(cl_command_queue command_queue,
@@ -5647,77 +5988,262 @@ cl_int CLVK_API_CALL clEnqueueSVMMemcpy(cl_command_queue command_queue,
                                         cl_uint num_events_in_wait_list,
                                         const cl_event* event_wait_list,
                                         cl_event* event) {
-    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(blocking_copy);
-    UNUSED(dst_ptr);
-    UNUSED(src_ptr);
-    UNUSED(size);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
-}
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue, "blocking_copy",
+                   blocking_copy, "size", size, "num_events_in_wait_list",
+                   num_events_in_wait_list);
+    LOG_API_CALL("command_queue = %p, blocking_copy = %d, dst_ptr = %p, "
+                 "src_ptr = %p, size = %zu",
+                 command_queue, blocking_copy, dst_ptr, src_ptr, size);
 
-cl_int CLVK_API_CALL clEnqueueSVMMemFill(cl_command_queue command_queue,
-                                         void* svm_ptr, const void* pattern,
-                                         size_t pattern_size, size_t size,
-                                         cl_uint num_events_in_wait_list,
-                                         const cl_event* event_wait_list,
-                                         cl_event* event) {
-    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(svm_ptr);
-    UNUSED(pattern);
-    UNUSED(pattern_size);
-    UNUSED(size);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
-}
+    auto queue = icd_downcast(command_queue);
 
-cl_int CLVK_API_CALL clEnqueueSVMMigrateMem(
-    cl_command_queue command_queue, cl_uint num_svm_pointers,
-    const void** svm_pointers, const size_t* sizes,
-    cl_mem_migration_flags flags, cl_uint num_events_in_wait_list,
-    const cl_event* event_wait_list, cl_event* event) {
-    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(num_svm_pointers);
-    UNUSED(svm_pointers);
-    UNUSED(sizes);
-    UNUSED(flags);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
-}
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
 
-cl_int CLVK_API_CALL clEnqueueSVMUnmap(cl_command_queue command_queue,
-                                       void* svm_ptr,
-                                       cl_uint num_events_in_wait_list,
-                                       const cl_event* event_wait_list,
+    if ((dst_ptr == nullptr) || (src_ptr == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    auto dst = reinterpret_cast<uintptr_t>(dst_ptr);
+    auto src = reinterpret_cast<uintptr_t>(src_ptr);
+    if ((dst < src + size) && (src < dst + size)) {
+        return CL_MEM_COPY_OVERLAP;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    auto context = queue->context();
+    size_t dst_offset, src_offset;
+    auto dst_buffer = context->find_svm_allocation(dst_ptr, &dst_offset);
+    auto src_buffer = context->find_svm_allocation(src_ptr, &src_offset);
+
+    if (((dst_buffer != nullptr) && (dst_offset + size > dst_buffer->size())) ||
+        ((src_buffer != nullptr) && (src_offset + size > src_buffer->size()))) {
+        return CL_INVALID_VALUE;
+    }
+
+    cvk_command* cmd;
+    if ((dst_buffer != nullptr) && (src_buffer != nullptr)) {
+        // Copies between SVM allocations are executed on the device and can
+        // be batched with kernels
+        cmd = new cvk_command_device_copy_buffer(queue, src_buffer, dst_buffer,
+                                                 src_offset, dst_offset, size,
+                                                 CL_COMMAND_SVM_MEMCPY);
+    } else {
+        cmd = new cvk_command_svm_memcpy(queue, dst_ptr, src_ptr, size,
+                                         dst_buffer, dst_offset, src_buffer,
+                                         src_offset);
+    }
+
+    return queue->enqueue_command_with_deps(cmd, blocking_copy,
+                                            num_events_in_wait_list,
+                                            event_wait_list, event);
+}
+
+cl_int CLVK_API_CALL clEnqueueSVMMemFill(cl_command_queue command_queue,
+                                         void* svm_ptr, const void* pattern,
+                                         size_t pattern_size, size_t size,
+                                         cl_uint num_events_in_wait_list,
+                                         const cl_event* event_wait_list,
+                                         cl_event* event) {
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue, "pattern_size",
+                   pattern_size, "size", size, "num_events_in_wait_list",
+                   num_events_in_wait_list);
+    LOG_API_CALL("command_queue = %p, svm_ptr = %p, pattern = %p, "
+                 "pattern_size = %zu, size = %zu",
+                 command_queue, svm_ptr, pattern, pattern_size, size);
+
+    auto queue = icd_downcast(command_queue);
+
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if ((svm_ptr == nullptr) || (pattern == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Check the pattern size is valid
+    size_t valid_pattern_sizes[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    bool pattern_size_valid = false;
+    for (auto size : valid_pattern_sizes) {
+        if (size == pattern_size) {
+            pattern_size_valid = true;
+            break;
+        }
+    }
+    if (!pattern_size_valid) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Check that svm_ptr and size are a multiple of pattern_size
+    if ((reinterpret_cast<uintptr_t>(svm_ptr) % pattern_size != 0) ||
+        (size % pattern_size != 0)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    size_t offset;
+    auto buffer = queue->context()->find_svm_allocation(svm_ptr, &offset);
+    if ((buffer == nullptr) || (offset + size > buffer->size())) {
+        return CL_INVALID_VALUE;
+    }
+
+    cvk_command* cmd;
+    if ((pattern_size <= 4) && (offset % 4 == 0) && (size % 4 == 0)) {
+        // Use vkCmdFillBuffer so that the fill can be batched with kernels
+        uint32_t data = 0;
+        for (size_t i = 0; i < sizeof(data); i += pattern_size) {
+            memcpy(reinterpret_cast<char*>(&data) + i, pattern, pattern_size);
+        }
+        cmd = new cvk_command_device_fill_buffer(queue, buffer, offset, size,
+                                                 data, CL_COMMAND_SVM_MEMFILL);
+    } else {
+        cmd = new cvk_command_fill_buffer(queue, buffer, offset, size, pattern,
+                                          pattern_size, CL_COMMAND_SVM_MEMFILL);
+    }
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
+}
+
+cl_int CLVK_API_CALL clEnqueueSVMMigrateMem(
+    cl_command_queue command_queue, cl_uint num_svm_pointers,
+    const void** svm_pointers, const size_t* sizes,
+    cl_mem_migration_flags flags, cl_uint num_events_in_wait_list,
+    const cl_event* event_wait_list, cl_event* event) {
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue,
+                   "num_svm_pointers", num_svm_pointers,
+                   "num_events_in_wait_list", num_events_in_wait_list);
+    LOG_API_CALL("command_queue = %p, num_svm_pointers = %u, "
+                 "svm_pointers = %p, sizes = %p, flags = %lx",
+                 command_queue, num_svm_pointers, svm_pointers, sizes, flags);
+
+    auto queue = icd_downcast(command_queue);
+
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if ((num_svm_pointers == 0) || (svm_pointers == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    cl_mem_migration_flags valid_flags =
+        CL_MIGRATE_MEM_OBJECT_HOST | CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED;
+    if ((flags & ~valid_flags) != 0) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    auto context = queue->context();
+    for (cl_uint i = 0; i < num_svm_pointers; i++) {
+        size_t offset;
+        auto buffer = context->find_svm_allocation(svm_pointers[i], &offset);
+        if (buffer == nullptr) {
+            return CL_INVALID_VALUE;
+        }
+        if ((sizes != nullptr) && (offset + sizes[i] > buffer->size())) {
+            return CL_INVALID_VALUE;
+        }
+    }
+
+    // There is a single device and SVM allocations are not migrated
+    auto cmd = new cvk_command_dep(queue, CL_COMMAND_SVM_MIGRATE_MEM);
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
+}
+
+cl_int CLVK_API_CALL clEnqueueSVMUnmap(cl_command_queue command_queue,
+                                       void* svm_ptr,
+                                       cl_uint num_events_in_wait_list,
+                                       const cl_event* event_wait_list,
                                        cl_event* event) {
-    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
-    LOG_API_CALL("command_queue = %p", command_queue);
-    UNUSED(svm_ptr);
-    UNUSED(num_events_in_wait_list);
-    UNUSED(event_wait_list);
-    UNUSED(event);
-    return CL_INVALID_OPERATION;
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue,
+                   "num_events_in_wait_list", num_events_in_wait_list);
+    LOG_API_CALL("command_queue = %p, svm_ptr = %p", command_queue, svm_ptr);
+
+    auto queue = icd_downcast(command_queue);
+
+    if (!is_valid_command_queue(queue)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if (svm_ptr == nullptr) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    size_t offset;
+    auto buffer = queue->context()->find_svm_allocation(svm_ptr, &offset);
+    if (buffer == nullptr) {
+        return CL_INVALID_VALUE;
+    }
+
+    auto cmd = new cvk_command_unmap_buffer(queue, buffer, svm_ptr,
+                                           CL_COMMAND_SVM_UNMAP);
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
 }
 
-cl_int CLVK_API_CALL clSetKernelArgSVMPointer(cl_kernel kernel,
+cl_int CLVK_API_CALL clSetKernelArgSVMPointer(cl_kernel kern,
                                               cl_uint arg_index,
                                               const void* arg_value) {
-    TRACE_FUNCTION("kernel", (uintptr_t)kernel, "arg_index", arg_index);
-    LOG_API_CALL("kernel = %p, arg_index = %u, arg_value = %p", kernel,
+    TRACE_FUNCTION("kernel", (uintptr_t)kern, "arg_index", arg_index);
+    LOG_API_CALL("kernel = %p, arg_index = %u, arg_value = %p", kern,
                  arg_index, arg_value);
-    UNUSED(kernel);
-    UNUSED(arg_index);
-    UNUSED(arg_value);
-    return CL_INVALID_OPERATION;
+
+    auto kernel = icd_downcast(kern);
+
+    if (!is_valid_kernel(kernel)) {
+        return CL_INVALID_KERNEL;
+    }
+
+    if (!kernel->context()->device()->supports_svm()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if (arg_index >= kernel->num_args()) {
+        cvk_error_fn("the program has only %u arguments", kernel->num_args());
+        return CL_INVALID_ARG_INDEX;
+    }
+
+    // arg_value may be any pointer in an SVM allocation or null
+    return kernel->set_arg_svm_pointer(arg_index, arg_value);
 }
 
 // Pipes
@@ -5824,6 +6350,11 @@ cl_semaphore_khr cvk_create_semaphore_with_properties_khr(
     cl_semaphore_type_khr type = 0;
     std::vector<cl_semaphore_properties_khr> properties;
     std::vector<cl_device_id> devices;
+    std::vector<cl_external_semaphore_handle_type_khr> export_types;
+    cl_external_semaphore_handle_type_khr import_type = 0;
+    int import_fd = -1;
+    bool has_import = false;
+    auto device = icd_downcast(context)->device();
 
     if (sema_props) {
         bool has_type = false;
@@ -5857,6 +6388,34 @@ cl_semaphore_khr cvk_create_semaphore_with_properties_khr(
                 }
                 properties.push_back(*sema_props);
                 sema_props++;
+            } else if (key == CL_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR) {
+                properties.push_back(key);
+                sema_props++;
+                while (*sema_props !=
+                       CL_SEMAPHORE_EXPORT_HANDLE_TYPES_LIST_END_KHR) {
+                    auto handle_type = *sema_props;
+                    if (!device->supports_semaphore_export(handle_type)) {
+                        *errcode_ret = CL_INVALID_PROPERTY;
+                        return nullptr;
+                    }
+                    export_types.push_back(handle_type);
+                    properties.push_back(handle_type);
+                    sema_props++;
+                }
+                properties.push_back(*sema_props);
+                sema_props++;
+            } else if ((key == CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR) ||
+                       (key == CL_SEMAPHORE_HANDLE_SYNC_FD_KHR)) {
+                if (has_import || !device->supports_semaphore_import(key)) {
+                    *errcode_ret = CL_INVALID_PROPERTY;
+                    return nullptr;
+                }
+                properties.push_back(key);
+                properties.push_back(value);
+                import_type = key;
+                import_fd = static_cast<int>(value);
+                has_import = true;
+                sema_props += 2;
             } else {
                 *errcode_ret = CL_INVALID_PROPERTY;
                 return nullptr;
@@ -5877,7 +6436,8 @@ cl_semaphore_khr cvk_create_semaphore_with_properties_khr(
     }
 
     auto sem = std::make_unique<cvk_semaphore>(
-        icd_downcast(context), type, std::move(devices), std::move(properties));
+        icd_downcast(context), type, std::move(devices), std::move(properties),
+        std::move(export_types));
 
     auto err = sem->init();
     if (err != CL_SUCCESS) {
@@ -5885,6 +6445,14 @@ cl_semaphore_khr cvk_create_semaphore_with_properties_khr(
         return nullptr;
     }
 
+    if (has_import) {
+        err = sem->import_fd(import_type, import_fd);
+        if (err != CL_SUCCESS) {
+            *errcode_ret = err;
+            return nullptr;
+        }
+    }
+
     *errcode_ret = CL_SUCCESS;
 
     return sem.release();
@@ -5965,7 +6533,17 @@ clEnqueueWaitSemaphoresKHR(cl_command_queue command_queue,
         }
     }
 
-    return CL_INVALID_OPERATION;
+    std::vector<cvk_semaphore_holder> semaphores;
+    for (cl_uint i = 0; i < num_sema_objects; i++) {
+        semaphores.emplace_back(icd_downcast(sema_objects[i]));
+    }
+
+    auto queue = icd_downcast(command_queue);
+    auto cmd = new cvk_command_semaphores(
+        queue, CL_COMMAND_SEMAPHORE_WAIT_KHR, std::move(semaphores));
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
 }
 
 cl_int
@@ -6024,7 +6602,17 @@ clEnqueueSignalSemaphoresKHR(cl_command_queue command_queue,
         }
     }
 
-    return CL_INVALID_OPERATION;
+    std::vector<cvk_semaphore_holder> semaphores;
+    for (cl_uint i = 0; i < num_sema_objects; i++) {
+        semaphores.emplace_back(icd_downcast(sema_objects[i]));
+    }
+
+    auto queue = icd_downcast(command_queue);
+    auto cmd = new cvk_command_semaphores(
+        queue, CL_COMMAND_SEMAPHORE_SIGNAL_KHR, std::move(semaphores));
+
+    return queue->enqueue_command_with_deps(cmd, num_events_in_wait_list,
+                                            event_wait_list, event);
 }
 
 cl_int clGetSemaphoreInfoKHR(const cl_semaphore_khr sema_object,
@@ -6081,6 +6669,11 @@ cl_int clGetSemaphoreInfoKHR(const cl_semaphore_khr sema_object,
         copy_ptr = sem->devices().data();
         ret_size = sem->devices().size() * sizeof(cl_device_id);
         break;
+    case CL_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR:
+        copy_ptr = sem->export_handle_types().data();
+        ret_size = sem->export_handle_types().size() *
+                   sizeof(cl_external_semaphore_handle_type_khr);
+        break;
     default:
         ret = CL_INVALID_VALUE;
     }
@@ -6125,76 +6718,1423 @@ cl_int clRetainSemaphoreKHR(cl_semaphore_khr sema_object) {
     return CL_SUCCESS;
 }
 
-// clang-format off
-cl_icd_dispatch gDispatchTable = {
-    // OpenCL 1.0
-    clGetPlatformIDs,
-    clGetPlatformInfo,
-    clGetDeviceIDs,
-    clGetDeviceInfo,
-    clCreateContext,
-    clCreateContextFromType,
-    clRetainContext,
-    clReleaseContext,
-    clGetContextInfo,
-    clCreateCommandQueue,
-    clRetainCommandQueue,
-    clReleaseCommandQueue,
-    clGetCommandQueueInfo,
-    clSetCommandQueueProperty,
-    clCreateBuffer,
-    clCreateImage2D,
-    clCreateImage3D,
-    clRetainMemObject,
-    clReleaseMemObject,
-    clGetSupportedImageFormats,
-    clGetMemObjectInfo,
-    clGetImageInfo,
-    clCreateSampler,
-    clRetainSampler,
-    clReleaseSampler,
-    clGetSamplerInfo,
-    clCreateProgramWithSource,
-    clCreateProgramWithBinary,
-    clRetainProgram,
-    clReleaseProgram,
-    clBuildProgram,
-    clUnloadCompiler,
-    clGetProgramInfo,
-    clGetProgramBuildInfo,
-    clCreateKernel,
-    clCreateKernelsInProgram,
-    clRetainKernel,
-    clReleaseKernel,
-    clSetKernelArg,
-    clGetKernelInfo,
-    clGetKernelWorkGroupInfo,
-    clWaitForEvents,
-    clGetEventInfo,
-    clRetainEvent,
-    clReleaseEvent,
-    clGetEventProfilingInfo,
-    clFlush,
-    clFinish,
-    clEnqueueReadBuffer,
-    clEnqueueWriteBuffer,
-    clEnqueueCopyBuffer,
-    clEnqueueReadImage,
-    clEnqueueWriteImage,
-    clEnqueueCopyImage,
-    clEnqueueCopyImageToBuffer,
-    clEnqueueCopyBufferToImage,
-    clEnqueueMapBuffer,
-    clEnqueueMapImage,
-    clEnqueueUnmapMemObject,
-    clEnqueueNDRangeKernel,
-    clEnqueueTask,
-    clEnqueueNativeKernel,
-    clEnqueueMarker,
-    clEnqueueWaitForEvents,
-    clEnqueueBarrier,
-    clGetExtensionFunctionAddress,
-    nullptr, // clCreateFromGLBuffer;
+// cl_khr_external_semaphore
+cl_int clGetSemaphoreHandleForTypeKHR(
+    cl_semaphore_khr sema_object, cl_device_id device,
+    cl_external_semaphore_handle_type_khr handle_type, size_t handle_size,
+    void* handle_ptr, size_t* handle_size_ret) {
+    TRACE_FUNCTION("sema_object", (uintptr_t)sema_object);
+    LOG_API_CALL("sema_object = %p, device = %p, handle_type = %x, "
+                 "handle_size = %zu, handle_ptr = %p, handle_size_ret = %p",
+                 sema_object, device, handle_type, handle_size, handle_ptr,
+                 handle_size_ret);
+
+    if (!is_valid_semaphore(sema_object)) {
+        return CL_INVALID_SEMAPHORE_KHR;
+    }
+
+    auto sem = icd_downcast(sema_object);
+
+    if (!is_valid_device(device) ||
+        !sem->can_be_used_with_device(icd_downcast(device))) {
+        return CL_INVALID_DEVICE;
+    }
+
+    if (!sem->can_export(handle_type)) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Both supported handle types are file descriptors
+    if (handle_size_ret != nullptr) {
+        *handle_size_ret = sizeof(int);
+    }
+
+    if (handle_ptr == nullptr) {
+        return CL_SUCCESS;
+    }
+
+    if (handle_size < sizeof(int)) {
+        return CL_INVALID_VALUE;
+    }
+
+    return sem->export_fd(handle_type, static_cast<int*>(handle_ptr));
+}
+
+cl_int clReImportSemaphoreSyncFdKHR(
+    cl_semaphore_khr sema_object,
+    cl_semaphore_reimport_properties_khr* reimport_props, int fd) {
+    TRACE_FUNCTION("sema_object", (uintptr_t)sema_object);
+    LOG_API_CALL("sema_object = %p, reimport_props = %p, fd = %d",
+                 sema_object, reimport_props, fd);
+
+    if (!is_valid_semaphore(sema_object)) {
+        return CL_INVALID_SEMAPHORE_KHR;
+    }
+
+    // No reimport properties are defined
+    if ((reimport_props != nullptr) && (*reimport_props != 0)) {
+        return CL_INVALID_VALUE;
+    }
+
+    auto sem = icd_downcast(sema_object);
+    if (!sem->context()->device()->supports_semaphore_import(
+            CL_SEMAPHORE_HANDLE_SYNC_FD_KHR)) {
+        return CL_INVALID_OPERATION;
+    }
+
+    return sem->import_fd(CL_SEMAPHORE_HANDLE_SYNC_FD_KHR, fd);
+}
+
+// cl_khr_external_memory
+static cl_int cvk_enqueue_external_mem_objects(
+    cl_command_queue cq, cl_command_type type, cl_uint num_mem_objects,
+    const cl_mem* mem_objects, cl_uint num_events_in_wait_list,
+    const cl_event* event_wait_list, cl_event* event) {
+    if (!is_valid_command_queue(cq)) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    if ((num_mem_objects == 0) || (mem_objects == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    for (cl_uint i = 0; i < num_mem_objects; i++) {
+        if (!is_valid_mem_object(mem_objects[i])) {
+            return CL_INVALID_MEM_OBJECT;
+        }
+        cl_external_memory_handle_type_khr handle_type;
+        int fd;
+        if (!icd_downcast(mem_objects[i])
+                 ->external_memory_handle(&handle_type, &fd)) {
+            return CL_INVALID_MEM_OBJECT;
+        }
+        if (!is_same_context(cq, mem_objects[i])) {
+            return CL_INVALID_CONTEXT;
+        }
+    }
+
+    if (!is_same_context(cq, num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    // The accesses of the other APIs are ordered using semaphores. Acquiring
+    // and releasing memory objects transfers their ownership between queue
+    // families so that the writes of each side are visible to the other.
+    auto command_queue = icd_downcast(cq);
+    std::vector<cvk_mem_holder> mems;
+    for (cl_uint i = 0; i < num_mem_objects; i++) {
+        mems.push_back(icd_downcast(mem_objects[i]));
+    }
+    auto cmd = new cvk_command_external_mem_objects(command_queue, type,
+                                                    std::move(mems));
+
+    auto err = command_queue->enqueue_command_with_deps(
+        cmd, num_events_in_wait_list, event_wait_list, event);
+    if ((err != CL_SUCCESS) ||
+        (type != CL_COMMAND_ACQUIRE_EXTERNAL_MEM_OBJECTS_KHR)) {
+        return err;
+    }
+
+    // Acquiring images that have not been used yet transitions them to the
+    // layout all other commands use
+    for (cl_uint i = 0; i < num_mem_objects; i++) {
+        auto mem = icd_downcast(mem_objects[i]);
+        if (!mem->is_image_type()) {
+            continue;
+        }
+        auto& tracker = mem->init_tracker();
+        std::lock_guard<std::mutex> lock(tracker.mutex());
+        if (tracker.state() == cvk_mem_init_state::required) {
+            tracker.set_state(cvk_mem_init_state::completed);
+        }
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int clEnqueueAcquireExternalMemObjectsKHR(
+    cl_command_queue command_queue, cl_uint num_mem_objects,
+    const cl_mem* mem_objects, cl_uint num_events_in_wait_list,
+    const cl_event* event_wait_list, cl_event* event) {
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
+    LOG_API_CALL("command_queue = %p, num_mem_objects = %u, mem_objects = %p, "
+                 "num_events_in_wait_list = %u, event_wait_list = %p, "
+                 "event = %p",
+                 command_queue, num_mem_objects, mem_objects,
+                 num_events_in_wait_list, event_wait_list, event);
+
+    return cvk_enqueue_external_mem_objects(
+        command_queue, CL_COMMAND_ACQUIRE_EXTERNAL_MEM_OBJECTS_KHR,
+        num_mem_objects, mem_objects, num_events_in_wait_list,
+        event_wait_list, event);
+}
+
+cl_int clEnqueueReleaseExternalMemObjectsKHR(
+    cl_command_queue command_queue, cl_uint num_mem_objects,
+    const cl_mem* mem_objects, cl_uint num_events_in_wait_list,
+    const cl_event* event_wait_list, cl_event* event) {
+    TRACE_FUNCTION("command_queue", (uintptr_t)command_queue);
+    LOG_API_CALL("command_queue = %p, num_mem_objects = %u, mem_objects = %p, "
+                 "num_events_in_wait_list = %u, event_wait_list = %p, "
+                 "event = %p",
+                 command_queue, num_mem_objects, mem_objects,
+                 num_events_in_wait_list, event_wait_list, event);
+
+    return cvk_enqueue_external_mem_objects(
+        command_queue, CL_COMMAND_RELEASE_EXTERNAL_MEM_OBJECTS_KHR,
+        num_mem_objects, mem_objects, num_events_in_wait_list,
+        event_wait_list, event);
+}
+
+// cl_khr_command_buffer
+cl_command_buffer_khr cvk_create_command_buffer_khr(
+    cl_uint num_queues, const cl_command_queue* queues,
+    const cl_command_buffer_properties_khr* properties, cl_int* errcode_ret) {
+
+    // Only a single queue is supported
+    if ((num_queues != 1) || (queues == nullptr)) {
+        *errcode_ret = CL_INVALID_VALUE;
+        return nullptr;
+    }
+
+    if (!is_valid_command_queue(queues[0])) {
+        *errcode_ret = CL_INVALID_COMMAND_QUEUE;
+        return nullptr;
+    }
+
+    cl_command_buffer_flags_khr flags = 0;
+    std::vector<cl_command_buffer_properties_khr> props;
+
+    if (properties != nullptr) {
+        while (*properties) {
+            auto key = *properties;
+            auto value = *(properties + 1);
+
+            if (key == CL_COMMAND_BUFFER_FLAGS_KHR) {
+                flags = value;
+            } else {
+                *errcode_ret = CL_INVALID_VALUE;
+                return nullptr;
+            }
+
+            props.push_back(key);
+            props.push_back(value);
+            properties += 2;
+        }
+
+        props.push_back(0);
+    }
+
+    if ((flags & ~(CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR |
+                   CL_COMMAND_BUFFER_MUTABLE_KHR)) != 0) {
+        *errcode_ret = CL_INVALID_VALUE;
+        return nullptr;
+    }
+
+    *errcode_ret = CL_SUCCESS;
+
+    return new cvk_command_buffer_khr(icd_downcast(queues[0]), flags,
+                                      std::move(props));
+}
+
+cl_command_buffer_khr CLVK_API_CALL clCreateCommandBufferKHR(
+    cl_uint num_queues, const cl_command_queue* queues,
+    const cl_command_buffer_properties_khr* properties, cl_int* errcode_ret) {
+    TRACE_FUNCTION("num_queues", num_queues);
+    LOG_API_CALL("num_queues = %u, queues = %p, properties = %p, "
+                 "errcode_ret = %p",
+                 num_queues, queues, properties, errcode_ret);
+
+    cl_int err;
+    auto command_buffer =
+        cvk_create_command_buffer_khr(num_queues, queues, properties, &err);
+
+    if (errcode_ret != nullptr) {
+        *errcode_ret = err;
+    }
+
+    return command_buffer;
+}
+
+cl_int CLVK_API_CALL
+clFinalizeCommandBufferKHR(cl_command_buffer_khr command_buffer) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer);
+    LOG_API_CALL("command_buffer = %p", command_buffer);
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (cmdbuf->is_finalized()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    return cmdbuf->finalize();
+}
+
+cl_int CLVK_API_CALL
+clRetainCommandBufferKHR(cl_command_buffer_khr command_buffer) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer);
+    LOG_API_CALL("command_buffer = %p", command_buffer);
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    icd_downcast(command_buffer)->retain();
+
+    return CL_SUCCESS;
+}
+
+cl_int CLVK_API_CALL
+clReleaseCommandBufferKHR(cl_command_buffer_khr command_buffer) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer);
+    LOG_API_CALL("command_buffer = %p", command_buffer);
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    icd_downcast(command_buffer)->release();
+
+    return CL_SUCCESS;
+}
+
+cl_int CLVK_API_CALL clGetCommandBufferInfoKHR(
+    cl_command_buffer_khr command_buffer,
+    cl_command_buffer_info_khr param_name, size_t param_value_size,
+    void* param_value, size_t* param_value_size_ret) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "param_name",
+                   param_name);
+    LOG_API_CALL("command_buffer = %p, param_name = %x, param_value_size = "
+                 "%zu, param_value = %p, param_value_size_ret = %p",
+                 command_buffer, param_name, param_value_size, param_value,
+                 param_value_size_ret);
+
+    cl_int ret = CL_SUCCESS;
+    size_t ret_size = 0;
+    const void* copy_ptr = nullptr;
+    cl_uint val_uint;
+    cl_command_queue val_queue;
+    cl_context val_context;
+    cl_command_buffer_state_khr val_state;
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    switch (param_name) {
+    case CL_COMMAND_BUFFER_QUEUES_KHR:
+        val_queue = cmdbuf->queue();
+        copy_ptr = &val_queue;
+        ret_size = sizeof(val_queue);
+        break;
+    case CL_COMMAND_BUFFER_NUM_QUEUES_KHR:
+        val_uint = 1;
+        copy_ptr = &val_uint;
+        ret_size = sizeof(val_uint);
+        break;
+    case CL_COMMAND_BUFFER_REFERENCE_COUNT_KHR:
+        val_uint = cmdbuf->refcount();
+        copy_ptr = &val_uint;
+        ret_size = sizeof(val_uint);
+        break;
+    case CL_COMMAND_BUFFER_STATE_KHR:
+        val_state = cmdbuf->state();
+        copy_ptr = &val_state;
+        ret_size = sizeof(val_state);
+        break;
+    case CL_COMMAND_BUFFER_PROPERTIES_ARRAY_KHR:
+        copy_ptr = cmdbuf->properties().data();
+        ret_size = cmdbuf->properties().size() *
+                   sizeof(cl_command_buffer_properties_khr);
+        break;
+    case CL_COMMAND_BUFFER_CONTEXT_KHR:
+        val_context = cmdbuf->context();
+        copy_ptr = &val_context;
+        ret_size = sizeof(val_context);
+        break;
+    default:
+        ret = CL_INVALID_VALUE;
+    }
+
+    if ((param_value != nullptr) && (copy_ptr != nullptr)) {
+        if (param_value_size < ret_size) {
+            ret = CL_INVALID_VALUE;
+        }
+        memcpy(param_value, copy_ptr, std::min(param_value_size, ret_size));
+    }
+
+    if (param_value_size_ret != nullptr) {
+        *param_value_size_ret = ret_size;
+    }
+
+    return ret;
+}
+
+cl_int CLVK_API_CALL clEnqueueCommandBufferKHR(
+    cl_uint num_queues, cl_command_queue* queues,
+    cl_command_buffer_khr command_buffer, cl_uint num_events_in_wait_list,
+    const cl_event* event_wait_list, cl_event* event) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer,
+                   "num_events_in_wait_list", num_events_in_wait_list);
+    LOG_API_CALL("num_queues = %u, queues = %p, command_buffer = %p, "
+                 "num_events_in_wait_list = %u, event_wait_list = %p, "
+                 "event = %p",
+                 num_queues, queues, command_buffer, num_events_in_wait_list,
+                 event_wait_list, event);
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (((num_queues == 0) && (queues != nullptr)) ||
+        ((num_queues != 0) && (queues == nullptr)) || (num_queues > 1)) {
+        return CL_INVALID_VALUE;
+    }
+
+    auto command_queue = cmdbuf->queue();
+
+    if (num_queues == 1) {
+        if (!is_valid_command_queue(queues[0])) {
+            return CL_INVALID_COMMAND_QUEUE;
+        }
+        // Commands are recorded for the queue the command buffer was created
+        // with and cannot be replayed on another one.
+        if (icd_downcast(queues[0]) != command_queue) {
+            return CL_INCOMPATIBLE_COMMAND_QUEUE_KHR;
+        }
+    }
+
+    if (!cmdbuf->is_executable()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if (cmdbuf->is_pending() && !cmdbuf->allows_simultaneous_use()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if (!is_valid_event_wait_list(num_events_in_wait_list, event_wait_list)) {
+        return CL_INVALID_EVENT_WAIT_LIST;
+    }
+
+    if (!is_same_context(command_queue, num_events_in_wait_list,
+                         event_wait_list)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    auto cmd = new cvk_command_execute_command_buffer(command_queue, cmdbuf);
+
+    return command_queue->enqueue_command_with_deps(
+        cmd, num_events_in_wait_list, event_wait_list, event);
+}
+
+// Validate the parameters common to all clCommand*KHR functions
+static cl_int cvk_validate_command_buffer_command(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list) {
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    // Commands are always recorded for the queue the command buffer was
+    // created with
+    if (command_queue != nullptr) {
+        return CL_INVALID_COMMAND_QUEUE;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (cmdbuf->is_finalized()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if (!cmdbuf->is_valid_sync_point_wait_list(num_sync_points_in_wait_list,
+                                               sync_point_wait_list)) {
+        return CL_INVALID_SYNC_POINT_WAIT_LIST_KHR;
+    }
+
+    return CL_SUCCESS;
+}
+
+// Validate the properties and mutable handle of commands other than kernels
+static cl_int
+cvk_validate_command_properties(const cl_command_properties_khr* properties,
+                                cl_mutable_command_khr* mutable_handle) {
+    if ((properties != nullptr) && (*properties != 0)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (mutable_handle != nullptr) {
+        return CL_INVALID_VALUE;
+    }
+
+    return CL_SUCCESS;
+}
+
+static cl_int
+cvk_command_buffer_add_command(cl_command_buffer_khr command_buffer,
+                               std::unique_ptr<cvk_command_batchable>&& cmd,
+                               cl_sync_point_khr* sync_point) {
+    auto point = icd_downcast(command_buffer)->add_command(std::move(cmd));
+
+    if (sync_point != nullptr) {
+        *sync_point = point;
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int CLVK_API_CALL clCommandBarrierWithWaitListKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties,
+    cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto point = icd_downcast(command_buffer)->add_barrier();
+
+    if (sync_point != nullptr) {
+        *sync_point = point;
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int CLVK_API_CALL clCommandCopyBufferKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_mem src_buffer,
+    cl_mem dst_buffer, size_t src_offset, size_t dst_offset, size_t size,
+    cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "src_buffer",
+                   (uintptr_t)src_buffer, "dst_buffer", (uintptr_t)dst_buffer,
+                   "size", size);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "src_buffer = %p, dst_buffer = %p, src_offset = %zu, "
+                 "dst_offset = %zu, size = %zu, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, src_buffer,
+                 dst_buffer, src_offset, dst_offset, size,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (!is_valid_buffer(src_buffer) || !is_valid_buffer(dst_buffer)) {
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    if (!is_same_context(cmdbuf->queue(), src_buffer) ||
+        !is_same_context(cmdbuf->queue(), dst_buffer)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    auto src = static_cast<cvk_buffer*>(icd_downcast(src_buffer));
+    auto dst = static_cast<cvk_buffer*>(icd_downcast(dst_buffer));
+
+    if ((size == 0) || (src_offset + size > src->size()) ||
+        (dst_offset + size > dst->size())) {
+        return CL_INVALID_VALUE;
+    }
+
+    if ((src == dst) && (src_offset < dst_offset + size) &&
+        (dst_offset < src_offset + size)) {
+        return CL_MEM_COPY_OVERLAP;
+    }
+
+    auto cmd = std::make_unique<cvk_command_device_copy_buffer>(
+        cmdbuf->queue(), src, dst, src_offset, dst_offset, size);
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+cl_int CLVK_API_CALL clCommandFillBufferKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_mem buffer,
+    const void* pattern, size_t pattern_size, size_t offset, size_t size,
+    cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "buffer",
+                   (uintptr_t)buffer, "offset", offset, "size", size);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "buffer = %p, pattern = %p, pattern_size = %zu, "
+                 "offset = %zu, size = %zu, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, buffer, pattern,
+                 pattern_size, offset, size, num_sync_points_in_wait_list,
+                 sync_point_wait_list, sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (!is_valid_buffer(buffer)) {
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    if (!is_same_context(cmdbuf->queue(), buffer)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if (pattern == nullptr) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Check the pattern size is valid
+    size_t valid_pattern_sizes[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    bool pattern_size_valid = false;
+    for (auto size : valid_pattern_sizes) {
+        if (size == pattern_size) {
+            pattern_size_valid = true;
+            break;
+        }
+    }
+    if (!pattern_size_valid) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Check that offset and size are a multiple of pattern_size
+    if ((offset % pattern_size != 0) || (size % pattern_size != 0)) {
+        return CL_INVALID_VALUE;
+    }
+
+    auto buf = static_cast<cvk_buffer*>(icd_downcast(buffer));
+
+    if (offset + size > buf->size()) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Fills are recorded with vkCmdFillBuffer which only supports 32-bit
+    // patterns written at 4-byte aligned offsets.
+    if ((pattern_size > 4) || (offset % 4 != 0) || (size % 4 != 0)) {
+        cvk_error_fn("unsupported fill: pattern_size = %zu, offset = %zu, "
+                     "size = %zu",
+                     pattern_size, offset, size);
+        return CL_INVALID_OPERATION;
+    }
+
+    uint32_t data = 0;
+    for (size_t i = 0; i < sizeof(data); i += pattern_size) {
+        memcpy(reinterpret_cast<char*>(&data) + i, pattern, pattern_size);
+    }
+
+    auto cmd = std::make_unique<cvk_command_device_fill_buffer>(
+        cmdbuf->queue(), buf, offset, size, data);
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+cl_int CLVK_API_CALL clCommandCopyImageKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_mem src_image,
+    cl_mem dst_image, const size_t* src_origin, const size_t* dst_origin,
+    const size_t* region, cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "src_image",
+                   (uintptr_t)src_image, "dst_image", (uintptr_t)dst_image);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "src_image = %p, dst_image = %p, src_origin = %p, "
+                 "dst_origin = %p, region = %p, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, src_image,
+                 dst_image, src_origin, dst_origin, region,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+    auto queue = cmdbuf->queue();
+
+    if (!is_valid_image(src_image) || !is_valid_image(dst_image)) {
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    if (!is_same_context(queue, src_image) ||
+        !is_same_context(queue, dst_image)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if ((src_origin == nullptr) || (dst_origin == nullptr) ||
+        (region == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!queue->device()->supports_images()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    auto src_img = static_cast<cvk_image*>(icd_downcast(src_image));
+    auto dst_img = static_cast<cvk_image*>(icd_downcast(dst_image));
+
+    if (!src_img->has_same_format(dst_img)) {
+        return CL_IMAGE_FORMAT_MISMATCH;
+    }
+
+    std::array<size_t, 3> src_orig = {src_origin[0], src_origin[1],
+                                      src_origin[2]};
+    std::array<size_t, 3> dst_orig = {dst_origin[0], dst_origin[1],
+                                      dst_origin[2]};
+    std::array<size_t, 3> reg = {region[0], region[1], region[2]};
+
+    std::unique_ptr<cvk_command_batchable> cmd;
+    if (src_img->is_backed_by_buffer_view() &&
+        dst_img->is_backed_by_buffer_view()) {
+        cmd = std::make_unique<cvk_command_device_copy_buffer>(
+            queue, static_cast<cvk_buffer*>(src_img->buffer()),
+            static_cast<cvk_buffer*>(dst_img->buffer()),
+            src_origin[0] * src_img->element_size(),
+            dst_origin[0] * dst_img->element_size(),
+            region[0] * src_img->element_size());
+    } else if (src_img->is_backed_by_buffer_view()) {
+        cmd = std::make_unique<cvk_command_buffer_image_copy>(
+            CL_COMMAND_COPY_IMAGE, CL_COMMAND_COPY_BUFFER_TO_IMAGE, queue,
+            static_cast<cvk_buffer*>(src_img->buffer()), dst_img,
+            src_origin[0] * src_img->element_size(), dst_orig, reg);
+    } else if (dst_img->is_backed_by_buffer_view()) {
+        cmd = std::make_unique<cvk_command_buffer_image_copy>(
+            CL_COMMAND_COPY_IMAGE, CL_COMMAND_COPY_IMAGE_TO_BUFFER, queue,
+            static_cast<cvk_buffer*>(dst_img->buffer()), src_img,
+            dst_origin[0] * dst_img->element_size(), src_orig, reg);
+    } else {
+        cmd = std::make_unique<cvk_command_image_image_copy>(
+            queue, src_img, dst_img, src_orig, dst_orig, reg);
+    }
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+cl_int CLVK_API_CALL clCommandCopyBufferToImageKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_mem src_buffer,
+    cl_mem dst_image, size_t src_offset, const size_t* dst_origin,
+    const size_t* region, cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "src_buffer",
+                   (uintptr_t)src_buffer, "dst_image", (uintptr_t)dst_image);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "src_buffer = %p, dst_image = %p, src_offset = %zu, "
+                 "dst_origin = %p, region = %p, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, src_buffer,
+                 dst_image, src_offset, dst_origin, region,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+    auto queue = cmdbuf->queue();
+
+    if (!is_valid_image(dst_image) || !is_valid_buffer(src_buffer)) {
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    if (!is_same_context(queue, src_buffer) ||
+        !is_same_context(queue, dst_image)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if ((dst_origin == nullptr) || (region == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!queue->device()->supports_images()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    auto image = static_cast<cvk_image*>(icd_downcast(dst_image));
+    auto buffer = static_cast<cvk_buffer*>(icd_downcast(src_buffer));
+
+    std::array<size_t, 3> origin = {dst_origin[0], dst_origin[1],
+                                    dst_origin[2]};
+    std::array<size_t, 3> reg = {region[0], region[1], region[2]};
+
+    std::unique_ptr<cvk_command_batchable> cmd;
+    if (image->is_backed_by_buffer_view()) {
+        cmd = std::make_unique<cvk_command_device_copy_buffer>(
+            queue, buffer, static_cast<cvk_buffer*>(image->buffer()),
+            src_offset, dst_origin[0] * image->element_size(),
+            region[0] * image->element_size());
+    } else {
+        cmd = std::make_unique<cvk_command_buffer_image_copy>(
+            CL_COMMAND_COPY_BUFFER_TO_IMAGE, queue, buffer, image, src_offset,
+            origin, reg);
+    }
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+cl_int CLVK_API_CALL clCommandCopyImageToBufferKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_mem src_image,
+    cl_mem dst_buffer, const size_t* src_origin, const size_t* region,
+    size_t dst_offset, cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "src_image",
+                   (uintptr_t)src_image, "dst_buffer", (uintptr_t)dst_buffer);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "src_image = %p, dst_buffer = %p, src_origin = %p, "
+                 "region = %p, dst_offset = %zu, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, src_image,
+                 dst_buffer, src_origin, region, dst_offset,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    err = cvk_validate_command_properties(properties, mutable_handle);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+    auto queue = cmdbuf->queue();
+
+    if (!is_valid_image(src_image) || !is_valid_buffer(dst_buffer)) {
+        return CL_INVALID_MEM_OBJECT;
+    }
+
+    if (!is_same_context(queue, src_image) ||
+        !is_same_context(queue, dst_buffer)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if ((src_origin == nullptr) || (region == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (!queue->device()->supports_images()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    auto image = static_cast<cvk_image*>(icd_downcast(src_image));
+    auto buffer = static_cast<cvk_buffer*>(icd_downcast(dst_buffer));
+
+    std::array<size_t, 3> origin = {src_origin[0], src_origin[1],
+                                    src_origin[2]};
+    std::array<size_t, 3> reg = {region[0], region[1], region[2]};
+
+    std::unique_ptr<cvk_command_batchable> cmd;
+    if (image->is_backed_by_buffer_view()) {
+        cmd = std::make_unique<cvk_command_device_copy_buffer>(
+            queue, static_cast<cvk_buffer*>(image->buffer()), buffer,
+            src_origin[0] * image->element_size(), dst_offset,
+            region[0] * image->element_size());
+    } else {
+        cmd = std::make_unique<cvk_command_buffer_image_copy>(
+            CL_COMMAND_COPY_IMAGE_TO_BUFFER, queue, buffer, image, dst_offset,
+            origin, reg);
+    }
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+cl_int CLVK_API_CALL clCommandNDRangeKernelKHR(
+    cl_command_buffer_khr command_buffer, cl_command_queue command_queue,
+    const cl_command_properties_khr* properties, cl_kernel kernel,
+    cl_uint work_dim, const size_t* global_work_offset,
+    const size_t* global_work_size, const size_t* local_work_size,
+    cl_uint num_sync_points_in_wait_list,
+    const cl_sync_point_khr* sync_point_wait_list,
+    cl_sync_point_khr* sync_point, cl_mutable_command_khr* mutable_handle) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "kernel",
+                   (uintptr_t)kernel);
+    LOG_API_CALL("command_buffer = %p, command_queue = %p, properties = %p, "
+                 "kernel = %p, work_dim = %u, "
+                 "num_sync_points_in_wait_list = %u, "
+                 "sync_point_wait_list = %p, sync_point = %p, "
+                 "mutable_handle = %p",
+                 command_buffer, command_queue, properties, kernel, work_dim,
+                 num_sync_points_in_wait_list, sync_point_wait_list,
+                 sync_point, mutable_handle);
+
+    auto err = cvk_validate_command_buffer_command(
+        command_buffer, command_queue, num_sync_points_in_wait_list,
+        sync_point_wait_list);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+    auto queue = cmdbuf->queue();
+    auto device = queue->device();
+
+    // Unless specified otherwise, everything the device supports can be
+    // updated
+    cl_mutable_dispatch_fields_khr updatable_fields =
+        CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR |
+        CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR |
+        CL_MUTABLE_DISPATCH_LOCAL_SIZE_KHR | CL_MUTABLE_DISPATCH_ARGUMENTS_KHR;
+
+    if (properties != nullptr) {
+        while (*properties) {
+            auto key = *properties;
+            auto value = *(properties + 1);
+
+            if (key == CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR) {
+                if ((value & ~updatable_fields) != 0) {
+                    return CL_INVALID_VALUE;
+                }
+                updatable_fields = value;
+            } else {
+                return CL_INVALID_VALUE;
+            }
+
+            properties += 2;
+        }
+    }
+
+    if (!is_valid_kernel(kernel)) {
+        return CL_INVALID_KERNEL;
+    }
+
+    if (!is_same_context(queue, kernel)) {
+        return CL_INVALID_CONTEXT;
+    }
+
+    if ((work_dim < 1) || (work_dim > device->max_work_item_dimensions())) {
+        return CL_INVALID_WORK_DIMENSION;
+    }
+
+    if (global_work_size == nullptr) {
+        return CL_INVALID_GLOBAL_WORK_SIZE;
+    }
+
+    auto kern = icd_downcast(kernel);
+
+    if (kern->program()->binary_type(device) !=
+        CL_PROGRAM_BINARY_TYPE_EXECUTABLE) {
+        return CL_INVALID_PROGRAM_EXECUTABLE;
+    }
+
+    if (!kern->args_valid()) {
+        return CL_INVALID_KERNEL_ARGS;
+    }
+
+    // The printf output is only processed for kernels executed on a queue
+    if (kern->uses_printf()) {
+        cvk_error_fn("kernels using printf cannot be recorded");
+        return CL_INVALID_OPERATION;
+    }
+
+    cvk_ndrange ndrange(work_dim, global_work_offset, global_work_size,
+                        local_work_size);
+
+    if (local_work_size == nullptr) {
+        kern->select_work_group_size(device, ndrange.gws, ndrange.lws);
+        cvk_info_fn("selected local work size: {%u,%u,%u}", ndrange.lws[0],
+                    ndrange.lws[1], ndrange.lws[2]);
+    }
+
+    err = cvk_validate_ndrange_work_group_size(device, kern, ndrange);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    // Record a clone of the kernel so that later changes to the arguments of
+    // the kernel do not affect the command buffer
+    auto clone = kern->clone(&err);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    auto cmd = std::make_unique<cvk_command_kernel>(queue, clone.get(),
+                                                    work_dim, ndrange);
+    // The command holds its own reference on the clone
+    clone.release()->release();
+
+    if (mutable_handle != nullptr) {
+        *mutable_handle = cmdbuf->add_mutable_command(
+            cmd.get(), updatable_fields, local_work_size == nullptr);
+    }
+
+    return cvk_command_buffer_add_command(command_buffer, std::move(cmd),
+                                          sync_point);
+}
+
+// cl_khr_command_buffer_mutable_dispatch
+struct cvk_mutable_dispatch_update {
+    cvk_mutable_command* mutable_command;
+    cvk_ndrange saved_ndrange;
+    cvk_ndrange ndrange;
+    std::shared_ptr<cvk_kernel_argument_values> saved_argument_values;
+};
+
+// Validate an update without applying it. The new NDRange is computed in
+// update.ndrange so that several configs can target the same command.
+static cl_int
+cvk_validate_mutable_dispatch(cvk_mutable_dispatch_update& update,
+                              const cl_mutable_dispatch_config_khr* config) {
+    auto mutable_command = update.mutable_command;
+    auto cmd = mutable_command->command();
+    auto kernel = cmd->kernel();
+    auto fields = mutable_command->updatable_fields();
+
+    if ((config->num_svm_args > 0) || (config->num_exec_infos > 0)) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if ((config->num_args > 0) && (config->arg_list == nullptr)) {
+        return CL_INVALID_VALUE;
+    }
+
+    if ((config->num_args > 0) &&
+        !(fields & CL_MUTABLE_DISPATCH_ARGUMENTS_KHR)) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if ((config->work_dim != 0) && (config->work_dim != cmd->dimensions())) {
+        return CL_INVALID_VALUE;
+    }
+
+    if (((config->global_work_offset != nullptr) &&
+         !(fields & CL_MUTABLE_DISPATCH_GLOBAL_OFFSET_KHR)) ||
+        ((config->global_work_size != nullptr) &&
+         !(fields & CL_MUTABLE_DISPATCH_GLOBAL_SIZE_KHR)) ||
+        ((config->local_work_size != nullptr) &&
+         !(fields & CL_MUTABLE_DISPATCH_LOCAL_SIZE_KHR))) {
+        return CL_INVALID_OPERATION;
+    }
+
+    for (cl_uint i = 0; i < config->num_args; i++) {
+        auto& arg = config->arg_list[i];
+        if (arg.arg_index >= kernel->num_args()) {
+            return CL_INVALID_ARG_INDEX;
+        }
+        if ((arg.arg_value == nullptr) &&
+            !((kernel->arg_kind(arg.arg_index) ==
+               kernel_argument_kind::local) ||
+              (kernel->arg_kind(arg.arg_index) ==
+               kernel_argument_kind::unused))) {
+            return CL_INVALID_ARG_VALUE;
+        }
+    }
+
+    // Compute the new NDRange
+    auto ndrange = update.ndrange;
+    for (cl_uint dim = 0; dim < cmd->dimensions(); dim++) {
+        if (config->global_work_offset != nullptr) {
+            ndrange.offset[dim] = config->global_work_offset[dim];
+        }
+        if (config->global_work_size != nullptr) {
+            ndrange.gws[dim] = config->global_work_size[dim];
+        }
+        if (config->local_work_size != nullptr) {
+            ndrange.lws[dim] = config->local_work_size[dim];
+        }
+    }
+
+    if ((config->global_work_size != nullptr) &&
+        (config->local_work_size == nullptr) &&
+        mutable_command->local_work_size_selected()) {
+        kernel->select_work_group_size(cmd->queue()->device(), ndrange.gws,
+                                       ndrange.lws);
+    }
+
+    auto err = cvk_validate_ndrange_work_group_size(cmd->queue()->device(),
+                                                    kernel, ndrange);
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    update.ndrange = ndrange;
+
+    return CL_SUCCESS;
+}
+
+static void cvk_rollback_mutable_dispatch(
+    std::vector<cvk_mutable_dispatch_update>& updates) {
+    for (auto& update : updates) {
+        auto cmd = update.mutable_command->command();
+        cmd->kernel()->restore_argument_values(update.saved_argument_values);
+        cmd->set_ndrange(update.saved_ndrange);
+    }
+}
+
+cl_int CLVK_API_CALL clUpdateMutableCommandsKHR(
+    cl_command_buffer_khr command_buffer, cl_uint num_configs,
+    const cl_command_buffer_update_type_khr* config_types,
+    const void** configs) {
+    TRACE_FUNCTION("command_buffer", (uintptr_t)command_buffer, "num_configs",
+                   num_configs);
+    LOG_API_CALL("command_buffer = %p, num_configs = %u, config_types = %p, "
+                 "configs = %p",
+                 command_buffer, num_configs, config_types, configs);
+
+    if (!is_valid_command_buffer(command_buffer)) {
+        return CL_INVALID_COMMAND_BUFFER_KHR;
+    }
+
+    auto cmdbuf = icd_downcast(command_buffer);
+
+    if (!cmdbuf->is_finalized() || !cmdbuf->is_mutable()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    // The recorded Vulkan command buffer is replaced on update so it must not
+    // be in use
+    if (cmdbuf->is_pending()) {
+        return CL_INVALID_OPERATION;
+    }
+
+    if ((num_configs > 0) &&
+        ((config_types == nullptr) || (configs == nullptr))) {
+        return CL_INVALID_VALUE;
+    }
+
+    // Validate every config before changing anything so that an invalid
+    // config leaves all the commands untouched
+    std::vector<cvk_mutable_dispatch_update> updates;
+    std::vector<size_t> config_updates(num_configs);
+    for (cl_uint i = 0; i < num_configs; i++) {
+        if ((config_types[i] !=
+             CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR) ||
+            (configs[i] == nullptr)) {
+            return CL_INVALID_VALUE;
+        }
+
+        auto config =
+            static_cast<const cl_mutable_dispatch_config_khr*>(configs[i]);
+
+        if (!is_valid_mutable_command(config->command)) {
+            return CL_INVALID_MUTABLE_COMMAND_KHR;
+        }
+
+        auto mutable_command = icd_downcast(config->command);
+
+        if (!cmdbuf->has_mutable_command(mutable_command)) {
+            return CL_INVALID_MUTABLE_COMMAND_KHR;
+        }
+
+        size_t idx = 0;
+        while ((idx < updates.size()) &&
+               (updates[idx].mutable_command != mutable_command)) {
+            idx++;
+        }
+        if (idx == updates.size()) {
+            auto& ndrange = mutable_command->command()->ndrange();
+            updates.push_back({mutable_command, ndrange, ndrange, nullptr});
+        }
+        config_updates[i] = idx;
+
+        auto err = cvk_validate_mutable_dispatch(updates[idx], config);
+        if (err != CL_SUCCESS) {
+            return err;
+        }
+    }
+
+    if (num_configs == 0) {
+        return CL_SUCCESS;
+    }
+
+    // Argument values of the recorded kernels are snapshotted on update so
+    // only the changed descriptors are written again when re-recording. The
+    // previous values are kept to roll back on failure.
+    for (auto& update : updates) {
+        auto cmd = update.mutable_command->command();
+        update.saved_argument_values = cmd->kernel()->save_argument_values();
+        cmd->set_ndrange(update.ndrange);
+    }
+
+    for (cl_uint i = 0; i < num_configs; i++) {
+        auto config =
+            static_cast<const cl_mutable_dispatch_config_khr*>(configs[i]);
+        auto& update = updates[config_updates[i]];
+        auto kernel = update.mutable_command->command()->kernel();
+        for (cl_uint j = 0; j < config->num_args; j++) {
+            auto& arg = config->arg_list[j];
+            auto err =
+                kernel->set_arg(arg.arg_index, arg.arg_size, arg.arg_value);
+            if (err != CL_SUCCESS) {
+                cvk_rollback_mutable_dispatch(updates);
+                return err;
+            }
+        }
+    }
+
+    auto err = cmdbuf->record();
+    if (err != CL_SUCCESS) {
+        // Record the previous commands again. If that fails too, the command
+        // buffer is left without recorded commands and cannot be enqueued.
+        cvk_rollback_mutable_dispatch(updates);
+        if (cmdbuf->record() != CL_SUCCESS) {
+            cvk_error_fn("could not record command buffer again after a "
+                         "failed update");
+        }
+    }
+
+    return err;
+}
+
+cl_int CLVK_API_CALL clGetMutableCommandInfoKHR(
+    cl_mutable_command_khr command, cl_mutable_command_info_khr param_name,
+    size_t param_value_size, void* param_value, size_t* param_value_size_ret) {
+    TRACE_FUNCTION("command", (uintptr_t)command, "param_name", param_name);
+    LOG_API_CALL("command = %p, param_name = %x, param_value_size = %zu, "
+                 "param_value = %p, param_value_size_ret = %p",
+                 command, param_name, param_value_size, param_value,
+                 param_value_size_ret);
+
+    cl_int ret = CL_SUCCESS;
+    size_t ret_size = 0;
+    const void* copy_ptr = nullptr;
+    cl_command_queue val_queue;
+    cl_command_buffer_khr val_command_buffer;
+    cl_command_type val_command_type;
+    cl_kernel val_kernel;
+    cl_uint val_uint;
+    cl_mutable_dispatch_fields_khr val_fields;
+    size_t val_sizes[3];
+
+    if (!is_valid_mutable_command(command)) {
+        return CL_INVALID_MUTABLE_COMMAND_KHR;
+    }
+
+    auto mutable_command = icd_downcast(command);
+    auto cmd = mutable_command->command();
+    auto dims = cmd->dimensions();
+
+    switch (param_name) {
+    case CL_MUTABLE_COMMAND_COMMAND_QUEUE_KHR:
+        val_queue = cmd->queue();
+        copy_ptr = &val_queue;
+        ret_size = sizeof(val_queue);
+        break;
+    case CL_MUTABLE_COMMAND_COMMAND_BUFFER_KHR:
+        val_command_buffer = mutable_command->command_buffer();
+        copy_ptr = &val_command_buffer;
+        ret_size = sizeof(val_command_buffer);
+        break;
+    case CL_MUTABLE_COMMAND_COMMAND_TYPE_KHR:
+        val_command_type = CL_COMMAND_NDRANGE_KERNEL;
+        copy_ptr = &val_command_type;
+        ret_size = sizeof(val_command_type);
+        break;
+    case CL_MUTABLE_DISPATCH_KERNEL_KHR:
+        val_kernel = cmd->kernel();
+        copy_ptr = &val_kernel;
+        ret_size = sizeof(val_kernel);
+        break;
+    case CL_MUTABLE_DISPATCH_DIMENSIONS_KHR:
+        val_uint = dims;
+        copy_ptr = &val_uint;
+        ret_size = sizeof(val_uint);
+        break;
+    case CL_MUTABLE_DISPATCH_GLOBAL_WORK_OFFSET_KHR:
+        for (cl_uint i = 0; i < dims; i++) {
+            val_sizes[i] = cmd->ndrange().offset[i];
+        }
+        copy_ptr = val_sizes;
+        ret_size = dims * sizeof(size_t);
+        break;
+    case CL_MUTABLE_DISPATCH_GLOBAL_WORK_SIZE_KHR:
+        for (cl_uint i = 0; i < dims; i++) {
+            val_sizes[i] = cmd->ndrange().gws[i];
+        }
+        copy_ptr = val_sizes;
+        ret_size = dims * sizeof(size_t);
+        break;
+    case CL_MUTABLE_DISPATCH_LOCAL_WORK_SIZE_KHR:
+        for (cl_uint i = 0; i < dims; i++) {
+            val_sizes[i] = cmd->ndrange().lws[i];
+        }
+        copy_ptr = val_sizes;
+        ret_size = dims * sizeof(size_t);
+        break;
+    case CL_MUTABLE_DISPATCH_UPDATABLE_FIELDS_KHR:
+        val_fields = mutable_command->updatable_fields();
+        copy_ptr = &val_fields;
+        ret_size = sizeof(val_fields);
+        break;
+    default:
+        ret = CL_INVALID_VALUE;
+    }
+
+    if ((param_value != nullptr) && (copy_ptr != nullptr)) {
+        if (param_value_size < ret_size) {
+            ret = CL_INVALID_VALUE;
+        }
+        memcpy(param_value, copy_ptr, std::min(param_value_size, ret_size));
+    }
+
+    if (param_value_size_ret != nullptr) {
+        *param_value_size_ret = ret_size;
+    }
+
+    return ret;
+}
+
+// clang-format off
+cl_icd_dispatch gDispatchTable = {
+    // OpenCL 1.0
+    clGetPlatformIDs,
+    clGetPlatformInfo,
+    clGetDeviceIDs,
+    clGetDeviceInfo,
+    clCreateContext,
+    clCreateContextFromType,
+    clRetainContext,
+    clReleaseContext,
+    clGetContextInfo,
+    clCreateCommandQueue,
+    clRetainCommandQueue,
+    clReleaseCommandQueue,
+    clGetCommandQueueInfo,
+    clSetCommandQueueProperty,
+    clCreateBuffer,
+    clCreateImage2D,
+    clCreateImage3D,
+    clRetainMemObject,
+    clReleaseMemObject,
+    clGetSupportedImageFormats,
+    clGetMemObjectInfo,
+    clGetImageInfo,
+    clCreateSampler,
+    clRetainSampler,
+    clReleaseSampler,
+    clGetSamplerInfo,
+    clCreateProgramWithSource,
+    clCreateProgramWithBinary,
+    clRetainProgram,
+    clReleaseProgram,
+    clBuildProgram,
+    clUnloadCompiler,
+    clGetProgramInfo,
+    clGetProgramBuildInfo,
+    clCreateKernel,
+    clCreateKernelsInProgram,
+    clRetainKernel,
+    clReleaseKernel,
+    clSetKernelArg,
+    clGetKernelInfo,
+    clGetKernelWorkGroupInfo,
+    clWaitForEvents,
+    clGetEventInfo,
+    clRetainEvent,
+    clReleaseEvent,
+    clGetEventProfilingInfo,
+    clFlush,
+    clFinish,
+    clEnqueueReadBuffer,
+    clEnqueueWriteBuffer,
+    clEnqueueCopyBuffer,
+    clEnqueueReadImage,
+    clEnqueueWriteImage,
+    clEnqueueCopyImage,
+    clEnqueueCopyImageToBuffer,
+    clEnqueueCopyBufferToImage,
+    clEnqueueMapBuffer,
+    clEnqueueMapImage,
+    clEnqueueUnmapMemObject,
+    clEnqueueNDRangeKernel,
+    clEnqueueTask,
+    clEnqueueNativeKernel,
+    clEnqueueMarker,
+    clEnqueueWaitForEvents,
+    clEnqueueBarrier,
+    clGetExtensionFunctionAddress,
+    nullptr, // clCreateFromGLBuffer;
     nullptr, // clCreateFromGLTexture2D;
     nullptr, // clCreateFromGLTexture3D;
     nullptr, // clCreateFromGLRenderbuffer;
@@ -6390,9 +8330,9 @@ cl_int CLVK_API_CALL clGetKernelSuggestedLocalWorkSizeKHR(
     cvk_ndrange ndrange(work_dim, global_work_offset, global_work_size,
                         nullptr);
 
-    icd_downcast(command_queue)
-        ->device()
-        ->select_work_group_size(ndrange.gws, ndrange.lws);
+    // Use the same selection as clEnqueueNDRangeKernel
+    icd_downcast(kernel)->select_work_group_size(
+        icd_downcast(command_queue)->device(), ndrange.gws, ndrange.lws);
 
     for (cl_uint i = 0; i < work_dim; i++) {
         suggested_local_work_size[i] = ndrange.lws[i];
@@ -6400,3 +8340,30 @@ cl_int CLVK_API_CALL clGetKernelSuggestedLocalWorkSizeKHR(
 
     return CL_SUCCESS;
 }
+
+cl_int CLVK_API_CALL clGetRuntimeMetricsCLVK(size_t param_value_size,
+                                             void* param_value,
+                                             size_t* param_value_size_ret) {
+    TRACE_FUNCTION();
+    LOG_API_CALL("param_value_size = %zu, param_value = %p, "
+                 "param_value_size_ret = %p",
+                 param_value_size, param_value, param_value_size_ret);
+
+    auto metrics = cvk_metrics_to_json();
+    size_t ret_size = metrics.size() + 1;
+
+    if (param_value_size_ret != nullptr) {
+        *param_value_size_ret = ret_size;
+    }
+
+    if (param_value != nullptr) {
+        // Metrics may have changed since the size was queried, report the
+        // new size without writing a truncated snapshot
+        if (param_value_size < ret_size) {
+            return CL_INVALID_VALUE;
+        }
+        memcpy(param_value, metrics.c_str(), ret_size);
+    }
+
+    return CL_SUCCESS;
+}
@@ -0,0 +1,164 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "command_buffer.hpp"
+#include "log.hpp"
+
+bool cvk_command_buffer_khr::is_valid_sync_point_wait_list(
+    cl_uint num_sync_points, const cl_sync_point_khr* sync_points) {
+    if ((num_sync_points > 0) && (sync_points == nullptr)) {
+        return false;
+    }
+    if ((num_sync_points == 0) && (sync_points != nullptr)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (cl_uint i = 0; i < num_sync_points; i++) {
+        if (sync_points[i] >= m_num_sync_points) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+cl_sync_point_khr cvk_command_buffer_khr::add_command(
+    std::unique_ptr<cvk_command_batchable>&& cmd) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_commands.push_back(std::move(cmd));
+    return m_num_sync_points++;
+}
+
+cl_sync_point_khr cvk_command_buffer_khr::add_barrier() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_num_sync_points++;
+}
+
+cvk_mutable_command* cvk_command_buffer_khr::add_mutable_command(
+    cvk_command_kernel* cmd, cl_mutable_dispatch_fields_khr updatable_fields,
+    bool local_work_size_selected) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto mcmd = std::make_unique<cvk_mutable_command>(
+        this, cmd, updatable_fields, local_work_size_selected);
+    auto ret = mcmd.get();
+    m_mutable_commands.push_back(std::move(mcmd));
+    return ret;
+}
+
+bool cvk_command_buffer_khr::has_mutable_command(
+    const cvk_mutable_command* cmd) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& mcmd : m_mutable_commands) {
+        if (mcmd.get() == cmd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+cl_int cvk_command_buffer_khr::finalize() {
+    auto err = record();
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    m_finalized = true;
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_buffer_khr::record() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    CVK_ASSERT(!is_pending());
+
+    m_command_buffer.reset();
+
+    auto command_buffer = std::make_unique<cvk_command_buffer>(m_queue);
+
+    VkCommandBufferUsageFlags usage = 0;
+    if (allows_simultaneous_use()) {
+        usage |= VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    }
+
+    if (!command_buffer->begin(usage)) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    {
+        cvk_command_pool_lock_holder pool_lock(m_queue);
+
+        for (size_t i = 0; i < m_commands.size(); i++) {
+            // Serialise all commands so that sync points are always
+            // satisfied
+            if (i > 0) {
+                VkMemoryBarrier memoryBarrier = {
+                    VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr,
+                    VK_ACCESS_MEMORY_WRITE_BIT,
+                    VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT};
+                vkCmdPipelineBarrier(
+                    *command_buffer,
+                    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // srcStageMask
+                    VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, // dstStageMask
+                    0,                                  // dependencyFlags
+                    1,                                  // memoryBarrierCount
+                    &memoryBarrier,
+                    0,        // bufferMemoryBarrierCount
+                    nullptr,  // pBufferMemoryBarriers
+                    0,        // imageMemoryBarrierCount
+                    nullptr); // pImageMemoryBarriers
+            }
+
+            auto err = m_commands[i]->build(*command_buffer);
+            if (err != CL_SUCCESS) {
+                cvk_error_fn("could not record command %zu", i);
+                return err;
+            }
+        }
+
+        if (!command_buffer->end()) {
+            return CL_OUT_OF_RESOURCES;
+        }
+    }
+
+    m_command_buffer = std::move(command_buffer);
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_buffer_khr::execute() {
+    if (!m_command_buffer) {
+        cvk_error_fn("command buffer has no recorded commands");
+        return CL_INVALID_OPERATION;
+    }
+
+    cvk_info_fn("executing command buffer with %zu commands",
+                m_commands.size());
+
+    if (!m_command_buffer->submit_and_wait()) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    return CL_COMPLETE;
+}
+
+std::vector<cvk_mem*> cvk_command_buffer_khr::memory_objects() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::vector<cvk_mem*> ret;
+    for (auto& cmd : m_commands) {
+        auto const mems = cmd->memory_objects();
+        ret.insert(std::end(ret), std::begin(mems), std::end(mems));
+    }
+    return ret;
+}
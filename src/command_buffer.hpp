@@ -0,0 +1,195 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cl_headers.hpp"
+#include "context.hpp"
+#include "icd.hpp"
+#include "objects.hpp"
+#include "queue.hpp"
+#include "utils.hpp"
+
+struct cvk_command_buffer_khr;
+
+// A kernel command recorded in a command buffer that can be updated after the
+// command buffer has been finalized. Mutable commands are owned by their
+// command buffer.
+struct cvk_mutable_command
+    : public _cl_mutable_command_khr,
+      object_magic_header<object_magic::mutable_command> {
+
+    cvk_mutable_command(cvk_command_buffer_khr* command_buffer,
+                        cvk_command_kernel* command,
+                        cl_mutable_dispatch_fields_khr updatable_fields,
+                        bool local_work_size_selected)
+        : m_command_buffer(command_buffer), m_command(command),
+          m_updatable_fields(updatable_fields),
+          m_local_work_size_selected(local_work_size_selected) {}
+
+    cvk_command_buffer_khr* command_buffer() const { return m_command_buffer; }
+    cvk_command_kernel* command() const { return m_command; }
+    cl_mutable_dispatch_fields_khr updatable_fields() const {
+        return m_updatable_fields;
+    }
+
+    // Whether the local work size was picked by the implementation, in which
+    // case it is selected again when the global work size is updated.
+    bool local_work_size_selected() const { return m_local_work_size_selected; }
+
+private:
+    cvk_command_buffer_khr* m_command_buffer;
+    cvk_command_kernel* m_command;
+    cl_mutable_dispatch_fields_khr m_updatable_fields;
+    bool m_local_work_size_selected;
+};
+
+static inline cvk_mutable_command* icd_downcast(cl_mutable_command_khr cmd) {
+    return static_cast<cvk_mutable_command*>(cmd);
+}
+
+// A sequence of commands recorded once in a Vulkan command buffer and
+// submitted as a whole each time the command buffer is enqueued. Kernel
+// commands keep their descriptor sets and POD buffers for the lifetime of the
+// command buffer. Commands are executed in the order they were recorded, so
+// sync points are always satisfied.
+struct cvk_command_buffer_khr : public _cl_command_buffer_khr,
+                                api_object<object_magic::command_buffer> {
+
+    cvk_command_buffer_khr(
+        cvk_command_queue* queue, cl_command_buffer_flags_khr flags,
+        std::vector<cl_command_buffer_properties_khr>&& properties)
+        : api_object(queue->context()), m_queue(queue), m_flags(flags),
+          m_properties(std::move(properties)), m_finalized(false),
+          m_num_pending(0), m_num_sync_points(0) {}
+
+    cvk_command_queue* queue() const { return m_queue; }
+
+    const std::vector<cl_command_buffer_properties_khr>& properties() const {
+        return m_properties;
+    }
+
+    bool is_mutable() const { return m_flags & CL_COMMAND_BUFFER_MUTABLE_KHR; }
+
+    bool allows_simultaneous_use() const {
+        return m_flags & CL_COMMAND_BUFFER_SIMULTANEOUS_USE_KHR;
+    }
+
+    bool is_finalized() const { return m_finalized; }
+
+    // Whether the command buffer can be enqueued. It cannot once recording it
+    // again after an update has failed.
+    bool is_executable() const { return m_finalized && m_command_buffer; }
+
+    bool is_pending() const { return m_num_pending > 0; }
+
+    cl_command_buffer_state_khr state() const {
+        if (!m_finalized) {
+            return CL_COMMAND_BUFFER_STATE_RECORDING_KHR;
+        } else if (is_pending()) {
+            return CL_COMMAND_BUFFER_STATE_PENDING_KHR;
+        } else {
+            return CL_COMMAND_BUFFER_STATE_EXECUTABLE_KHR;
+        }
+    }
+
+    bool is_valid_sync_point_wait_list(cl_uint num_sync_points,
+                                       const cl_sync_point_khr* sync_points);
+
+    // Add a command to the command buffer and return its sync point.
+    cl_sync_point_khr add_command(std::unique_ptr<cvk_command_batchable>&& cmd);
+
+    // Commands are always serialised so a barrier only needs a sync point.
+    cl_sync_point_khr add_barrier();
+
+    cvk_mutable_command*
+    add_mutable_command(cvk_command_kernel* cmd,
+                        cl_mutable_dispatch_fields_khr updatable_fields,
+                        bool local_work_size_selected);
+
+    bool has_mutable_command(const cvk_mutable_command* cmd);
+
+    CHECK_RETURN cl_int finalize();
+
+    // Record all the commands in a new Vulkan command buffer, e.g. after some
+    // have been updated. Must not be called while the command buffer is
+    // pending. When recording fails, the previous Vulkan command buffer is
+    // discarded as the commands may already have released the state it uses.
+    CHECK_RETURN cl_int record();
+
+    // Submit the recorded commands and wait for their completion.
+    CHECK_RETURN cl_int execute();
+
+    void execution_enqueued() { m_num_pending++; }
+    void execution_completed() { m_num_pending--; }
+
+    std::vector<cvk_mem*> memory_objects();
+
+private:
+    cvk_command_queue_holder m_queue;
+    cl_command_buffer_flags_khr m_flags;
+    std::vector<cl_command_buffer_properties_khr> m_properties;
+
+    std::mutex m_lock;
+    bool m_finalized;
+    std::atomic<uint32_t> m_num_pending;
+    cl_sync_point_khr m_num_sync_points;
+    std::vector<std::unique_ptr<cvk_command_batchable>> m_commands;
+    std::vector<std::unique_ptr<cvk_mutable_command>> m_mutable_commands;
+    std::unique_ptr<cvk_command_buffer> m_command_buffer;
+};
+
+static inline cvk_command_buffer_khr*
+icd_downcast(cl_command_buffer_khr command_buffer) {
+    return static_cast<cvk_command_buffer_khr*>(command_buffer);
+}
+
+using cvk_command_buffer_khr_holder = refcounted_holder<cvk_command_buffer_khr>;
+
+struct cvk_command_execute_command_buffer final : public cvk_command {
+
+    cvk_command_execute_command_buffer(cvk_command_queue* queue,
+                                       cvk_command_buffer_khr* command_buffer)
+        : cvk_command(CL_COMMAND_COMMAND_BUFFER_KHR, queue),
+          m_command_buffer(command_buffer), m_executed(false) {
+        m_command_buffer->execution_enqueued();
+    }
+
+    ~cvk_command_execute_command_buffer() {
+        if (!m_executed) {
+            m_command_buffer->execution_completed();
+        }
+    }
+
+    CHECK_RETURN cl_int do_action() override final {
+        auto status = m_command_buffer->execute();
+        // The command buffer is no longer pending once the event completes
+        m_executed = true;
+        m_command_buffer->execution_completed();
+        return status;
+    }
+
+    const std::vector<cvk_mem*> memory_objects() const override final {
+        return m_command_buffer->memory_objects();
+    }
+
+private:
+    cvk_command_buffer_khr_holder m_command_buffer;
+    bool m_executed;
+};
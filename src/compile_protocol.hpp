@@ -0,0 +1,190 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Messages exchanged between clvk and compiler workers or servers. Shared
+// with the standalone compile server, so this must not depend on the rest of
+// clvk.
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+struct cvk_compile_request {
+    std::vector<std::string> programs;
+    std::string options;
+    bool build_to_ir;
+};
+
+struct cvk_compile_result {
+    int status;
+    std::vector<uint32_t> binary;
+    std::string build_log;
+};
+
+#ifndef WIN32
+
+namespace cvk_compile_protocol {
+
+// Compile servers exchange messages with clvk on this file descriptor. Their
+// standard output goes to clvk's standard error so that messages printed by
+// the compiler cannot corrupt the stream.
+static constexpr int SERVER_FD = 3;
+
+#ifdef MSG_NOSIGNAL
+static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+static constexpr int SEND_FLAGS = 0;
+#endif
+
+inline bool write_all(int fd, const void* data, size_t size) {
+    auto ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        auto written = send(fd, ptr, size, SEND_FLAGS);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Wait for data to read on `fd` for at most `timeout_ms`, or forever if it is
+// negative
+inline bool wait_readable(int fd, int timeout_ms) {
+    if (timeout_ms < 0) {
+        return true;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while (true) {
+        auto ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        return ret > 0;
+    }
+}
+
+inline bool read_all(int fd, void* data, size_t size, int timeout_ms = -1) {
+    auto ptr = static_cast<char*>(data);
+    while (size > 0) {
+        if (!wait_readable(fd, timeout_ms)) {
+            return false;
+        }
+        auto nread = read(fd, ptr, size);
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            return false;
+        }
+        ptr += nread;
+        size -= nread;
+    }
+    return true;
+}
+
+template <typename T> inline bool write_value(int fd, T value) {
+    return write_all(fd, &value, sizeof(value));
+}
+
+template <typename T>
+inline bool read_value(int fd, T& value, int timeout_ms = -1) {
+    return read_all(fd, &value, sizeof(value), timeout_ms);
+}
+
+inline bool write_string(int fd, const std::string& str) {
+    return write_value<uint64_t>(fd, str.size()) &&
+           write_all(fd, str.data(), str.size());
+}
+
+inline bool read_string(int fd, std::string& str, int timeout_ms = -1) {
+    uint64_t size;
+    if (!read_value(fd, size, timeout_ms)) {
+        return false;
+    }
+    str.resize(size);
+    return read_all(fd, str.data(), size, timeout_ms);
+}
+
+inline bool write_request(int fd, const cvk_compile_request& request) {
+    if (!write_value<uint32_t>(fd, request.build_to_ir) ||
+        !write_string(fd, request.options) ||
+        !write_value<uint32_t>(fd, request.programs.size())) {
+        return false;
+    }
+    for (auto& program : request.programs) {
+        if (!write_string(fd, program)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool read_request(int fd, cvk_compile_request& request) {
+    uint32_t build_to_ir, num_programs;
+    if (!read_value(fd, build_to_ir) || !read_string(fd, request.options) ||
+        !read_value(fd, num_programs)) {
+        return false;
+    }
+    request.build_to_ir = build_to_ir != 0;
+    request.programs.resize(num_programs);
+    for (auto& program : request.programs) {
+        if (!read_string(fd, program)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool write_result(int fd, const cvk_compile_result& result) {
+    return write_value<int32_t>(fd, result.status) &&
+           write_value<uint64_t>(fd, result.binary.size()) &&
+           write_all(fd, result.binary.data(),
+                     result.binary.size() * sizeof(uint32_t)) &&
+           write_string(fd, result.build_log);
+}
+
+// Waits at most `timeout_ms` for each part of the result, or forever if it is
+// negative
+inline bool read_result(int fd, cvk_compile_result& result,
+                        int timeout_ms = -1) {
+    int32_t status;
+    uint64_t num_words;
+    if (!read_value(fd, status, timeout_ms) ||
+        !read_value(fd, num_words, timeout_ms)) {
+        return false;
+    }
+    result.status = status;
+    result.binary.resize(num_words);
+    return read_all(fd, result.binary.data(), num_words * sizeof(uint32_t),
+                    timeout_ms) &&
+           read_string(fd, result.build_log, timeout_ms);
+}
+
+} // namespace cvk_compile_protocol
+
+#endif // WIN32
@@ -0,0 +1,44 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Long-lived clspv compile server. clvk starts it on first use, sends build
+// requests and reads SPIR-V (or LLVM IR) and the build log back on a socket
+// passed as file descriptor 3. This avoids paying for process startup, LLVM
+// initialisation and temporary files on every build.
+
+#include <cstdlib>
+
+#include "clspv/Compiler.h"
+
+#include "compile_protocol.hpp"
+
+int main() {
+    using namespace cvk_compile_protocol;
+
+    while (true) {
+        cvk_compile_request request;
+        if (!read_request(SERVER_FD, request)) {
+            return EXIT_SUCCESS;
+        }
+
+        cvk_compile_result result;
+        result.status = clspv::CompileFromSourcesString(
+            request.programs, request.options, &result.binary,
+            &result.build_log);
+
+        if (!write_result(SERVER_FD, result)) {
+            return EXIT_FAILURE;
+        }
+    }
+}
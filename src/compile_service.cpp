@@ -0,0 +1,197 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "compile_service.hpp"
+#include "tracing.hpp"
+
+#include <algorithm>
+#include <climits>
+
+#ifndef WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef WIN32
+
+using namespace cvk_compile_protocol;
+
+cvk_compile_service::cvk_compile_service(uint32_t num_workers,
+                                         const std::string& server_path,
+                                         uint32_t timeout_ms)
+    : m_server_path(server_path), m_timeout_ms(timeout_ms) {
+    start_workers(num_workers);
+}
+
+void cvk_compile_service::start_workers(uint32_t num_workers) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_workers.resize(num_workers, {-1, -1});
+    for (auto& w : m_workers) {
+        if (!start_worker(w)) {
+            cvk_warn_fn("could not start compiler worker, will retry on use");
+        }
+        m_idle_workers.push_back(&w);
+    }
+    cvk_info_fn("started %u compiler workers", num_workers);
+}
+
+cvk_compile_service::~cvk_compile_service() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& w : m_workers) {
+        stop_worker(w);
+    }
+}
+
+bool cvk_compile_service::start_worker(worker& w) {
+    // Sockets are not inherited by other processes started by the
+    // application (or by other servers)
+    int fds[2];
+#ifdef SOCK_CLOEXEC
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        return false;
+    }
+#else
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    // Other threads may hold locks when forking, so only async-signal-safe
+    // calls are allowed between fork and exec.
+    const char* server_path = m_server_path.c_str();
+    char* const argv[] = {const_cast<char*>(server_path), nullptr};
+
+    auto pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        // Compile servers exchange messages on a dedicated descriptor and
+        // anything they print goes to stderr. dup2 clears the close-on-exec
+        // flag of the new descriptor, unless it is already the socket.
+        int server_fd = SERVER_FD;
+        if (fds[1] == server_fd) {
+            if (fcntl(server_fd, F_SETFD, 0) == -1) {
+                _exit(EXIT_FAILURE);
+            }
+        } else if (dup2(fds[1], server_fd) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        if (dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        execv(server_path, argv);
+        _exit(EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    w.pid = pid;
+    w.fd = fds[0];
+    cvk_debug_fn("started compiler worker %d", pid);
+    return true;
+}
+
+void cvk_compile_service::stop_worker(worker& w) {
+    if (w.pid == -1) {
+        return;
+    }
+    // Closing the socket makes an idle worker exit. Kill it in case it is
+    // stuck.
+    close(w.fd);
+    kill(w.pid, SIGKILL);
+    waitpid(w.pid, nullptr, 0);
+    cvk_debug_fn("stopped compiler worker %d", w.pid);
+    w.pid = -1;
+    w.fd = -1;
+}
+
+bool cvk_compile_service::compile(const cvk_compile_request& request,
+                                  cvk_compile_result& result) {
+    TRACE_FUNCTION();
+    worker* w;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cv.wait(lock, [this] { return !m_idle_workers.empty(); });
+        if (m_disabled) {
+            return false;
+        }
+        w = m_idle_workers.back();
+        m_idle_workers.pop_back();
+        if ((w->pid == -1) && !start_worker(*w)) {
+            m_idle_workers.push_back(w);
+            m_cv.notify_one();
+            return false;
+        }
+    }
+
+    // A timeout of 0 means waiting for results forever
+    int timeout_ms = m_timeout_ms == 0
+                         ? -1
+                         : static_cast<int>(std::min<uint32_t>(m_timeout_ms,
+                                                               INT_MAX));
+    bool success = write_request(w->fd, request) &&
+                   read_result(w->fd, result, timeout_ms);
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!success) {
+            cvk_warn_fn("compiler worker %d failed, restarting it", w->pid);
+            stop_worker(*w);
+            if (++m_consecutive_failures >= MAX_CONSECUTIVE_FAILURES) {
+                cvk_warn_fn("too many compiler worker failures, disabling");
+                m_disabled = true;
+            }
+        } else {
+            m_consecutive_failures = 0;
+        }
+        m_idle_workers.push_back(w);
+    }
+    m_cv.notify_one();
+
+    return success;
+}
+
+#else // WIN32
+
+cvk_compile_service::cvk_compile_service(uint32_t num_workers,
+                                         const std::string& server_path,
+                                         uint32_t timeout_ms)
+    : m_server_path(server_path), m_timeout_ms(timeout_ms) {
+    if (num_workers > 0) {
+        cvk_warn_fn("compile servers are not supported on this platform");
+    }
+}
+
+cvk_compile_service::~cvk_compile_service() {}
+
+void cvk_compile_service::start_workers(uint32_t) {}
+
+bool cvk_compile_service::start_worker(worker&) { return false; }
+
+void cvk_compile_service::stop_worker(worker&) {}
+
+bool cvk_compile_service::compile(const cvk_compile_request&,
+                                  cvk_compile_result&) {
+    return false;
+}
+
+#endif // WIN32
@@ -0,0 +1,69 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "compile_protocol.hpp"
+#include "utils.hpp"
+
+// A pool of long-lived compile server processes started from `server_path`.
+// Each server runs one compilation at a time, so compilers relying on global
+// state (e.g. LLVM command-line options) can build several programs
+// concurrently. Servers are always exec'd, never just forked, so that they do
+// not inherit locks held by other threads of the application. Requests and
+// results are streamed over a socket per server. A server that dies or does
+// not answer within `timeout_ms` is killed and restarted on its next use.
+struct cvk_compile_service {
+
+    cvk_compile_service(uint32_t num_workers, const std::string& server_path,
+                        uint32_t timeout_ms);
+    ~cvk_compile_service();
+
+    bool available() const { return !m_workers.empty() && !m_disabled; }
+
+    // Run `request` on a worker, waiting for one to be idle. Returns false
+    // when the request could not be handled by a worker, in which case the
+    // caller is expected to compile in-process.
+    CHECK_RETURN bool compile(const cvk_compile_request& request,
+                              cvk_compile_result& result);
+
+private:
+    struct worker {
+        int pid;
+        int fd;
+    };
+
+    void start_workers(uint32_t num_workers);
+    CHECK_RETURN bool start_worker(worker& w);
+    void stop_worker(worker& w);
+
+    // Give up on workers after this many consecutive failures
+    static constexpr uint32_t MAX_CONSECUTIVE_FAILURES = 3;
+
+    std::string m_server_path;
+    uint32_t m_timeout_ms;
+    uint32_t m_consecutive_failures{};
+    std::atomic<bool> m_disabled{};
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    std::vector<worker> m_workers;
+    std::vector<worker*> m_idle_workers;
+};
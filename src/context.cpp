@@ -32,3 +32,41 @@ cvk_command_queue* cvk_context::get_or_create_image_init_command_queue() {
 }
 
 void cvk_context::free_image_init_command_queue() { delete m_queue_image_init; }
+
+void cvk_context::add_svm_allocation(cvk_buffer* buffer) {
+    std::lock_guard<std::mutex> lock(m_svm_allocations_lock);
+    // SVM allocations are mapped on the host at their device address
+    m_svm_allocations[buffer->device_address()] = buffer;
+}
+
+bool cvk_context::remove_svm_allocation(void* ptr) {
+    cvk_buffer* buffer;
+    {
+        std::lock_guard<std::mutex> lock(m_svm_allocations_lock);
+        auto it = m_svm_allocations.find(reinterpret_cast<uintptr_t>(ptr));
+        if (it == m_svm_allocations.end()) {
+            return false;
+        }
+        buffer = it->second;
+        m_svm_allocations.erase(it);
+    }
+    // Releasing the last reference to the buffer may release the context
+    buffer->release();
+    return true;
+}
+
+cvk_buffer* cvk_context::find_svm_allocation(const void* ptr, size_t* offset) {
+    std::lock_guard<std::mutex> lock(m_svm_allocations_lock);
+    auto address = reinterpret_cast<uintptr_t>(ptr);
+    auto it = m_svm_allocations.upper_bound(address);
+    if (it == m_svm_allocations.begin()) {
+        return nullptr;
+    }
+    --it;
+    auto buffer = it->second;
+    if (address - it->first >= buffer->size()) {
+        return nullptr;
+    }
+    *offset = address - it->first;
+    return buffer;
+}
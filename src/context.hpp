@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <map>
+
 #include "device.hpp"
 #include "objects.hpp"
 #include "unit.hpp"
@@ -29,6 +31,7 @@ struct cvk_context_callback {
     void* data;
 };
 
+struct cvk_buffer;
 struct cvk_command_queue;
 
 struct cvk_context : public _cl_context,
@@ -122,6 +125,16 @@ struct cvk_context : public _cl_context,
     cvk_command_queue* get_or_create_image_init_command_queue();
     void free_image_init_command_queue();
 
+    // Coarse-grained SVM allocations made in the context, keyed by address.
+    // The context holds a reference to the buffer backing each allocation
+    // until it is removed.
+    void add_svm_allocation(cvk_buffer* buffer);
+    // Return false if ptr is not the start of an SVM allocation
+    bool remove_svm_allocation(void* ptr);
+    // Find the SVM allocation containing ptr and the offset of ptr in it.
+    // Return nullptr if ptr is not in an SVM allocation.
+    cvk_buffer* find_svm_allocation(const void* ptr, size_t* offset);
+
 private:
     cvk_device* m_device;
     std::mutex m_callbacks_lock;
@@ -133,6 +146,9 @@ private:
 
     std::mutex m_queue_image_init_lock;
     cvk_command_queue* m_queue_image_init = nullptr;
+
+    std::mutex m_svm_allocations_lock;
+    std::map<uintptr_t, cvk_buffer*> m_svm_allocations;
 };
 
 static inline cvk_context* icd_downcast(cl_context context) {
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <array>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <iterator>
@@ -57,6 +58,10 @@ void cvk_device::init_vulkan_properties(VkInstance instance) {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FLOAT_CONTROLS_PROPERTIES;
     m_integer_dot_product_properties.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_INTEGER_DOT_PRODUCT_PROPERTIES;
+    m_external_memory_host_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+    m_map_memory_placed_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAP_MEMORY_PLACED_PROPERTIES_EXT;
 
     //--- Get maxMemoryAllocationSize for figuring out the  max single buffer
     // allocation size and default init when the extension is not supported
@@ -77,6 +82,8 @@ void cvk_device::init_vulkan_properties(VkInstance instance) {
                          m_driver_properties),
             VER_EXT_PROP(0, VK_EXT_PCI_BUS_INFO_EXTENSION_NAME,
                          m_pci_bus_info_properties),
+            VER_EXT_PROP(0, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+                         m_external_memory_host_properties),
             VER_EXT_PROP(VK_MAKE_VERSION(1, 1, 0), nullptr,
                          m_subgroup_properties),
             VER_EXT_PROP(VK_MAKE_VERSION(1, 3, 0), nullptr,
@@ -87,6 +94,8 @@ void cvk_device::init_vulkan_properties(VkInstance instance) {
                          m_float_controls_properties),
             VER_EXT_PROP(VK_MAKE_VERSION(1, 3, 0), nullptr,
                          m_integer_dot_product_properties),
+            VER_EXT_PROP(0, VK_EXT_MAP_MEMORY_PLACED_EXTENSION_NAME,
+                         m_map_memory_placed_properties),
         };
 #undef VER_EXT_PROP
 
@@ -280,8 +289,19 @@ bool cvk_device::init_extensions() {
         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
         VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME,
+        VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+        VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+        VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
+        VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME,
+        VK_KHR_MAP_MEMORY_2_EXTENSION_NAME,
+        VK_EXT_MAP_MEMORY_PLACED_EXTENSION_NAME,
     };
 
+    // VK_EXT_host_image_copy depends on features that are core in Vulkan 1.3
+    if (m_properties.apiVersion >= VK_MAKE_VERSION(1, 3, 0)) {
+        desired_extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+    }
+
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 2, 0)) {
         desired_extensions.push_back(VK_KHR_SPIRV_1_4_EXTENSION_NAME);
         desired_extensions.push_back(
@@ -290,6 +310,9 @@ bool cvk_device::init_extensions() {
 
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
         desired_extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+        desired_extensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+        desired_extensions.push_back(
+            VK_KHR_EXTERNAL_SEMAPHORE_EXTENSION_NAME);
     }
 
     if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
@@ -343,6 +366,10 @@ void cvk_device::init_features(VkInstance instance) {
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_INTEGER_DOT_PRODUCT_FEATURES;
     m_features_queue_global_priority.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GLOBAL_PRIORITY_QUERY_FEATURES_KHR;
+    m_features_host_image_copy.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+    m_features_map_memory_placed.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAP_MEMORY_PLACED_FEATURES_EXT;
 
     std::vector<std::tuple<uint32_t, const char*, VkBaseOutStructure*>>
         coreversion_extension_features = {
@@ -379,6 +406,10 @@ void cvk_device::init_features(VkInstance instance) {
                          m_features_shader_integer_dot_product),
             VER_EXT_FEAT(0, VK_KHR_GLOBAL_PRIORITY_EXTENSION_NAME,
                          m_features_queue_global_priority),
+            VER_EXT_FEAT(0, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME,
+                         m_features_host_image_copy),
+            VER_EXT_FEAT(0, VK_EXT_MAP_MEMORY_PLACED_EXTENSION_NAME,
+                         m_features_map_memory_placed),
 
 #undef VER_EXT_FEAT
         };
@@ -459,6 +490,138 @@ void cvk_device::init_command_pointers(VkInstance instance) {
         m_vkfns.vkGetBufferDeviceAddressKHR =
             GET_INSTANCE_PROC(instance, vkGetBufferDeviceAddressKHR);
     }
+
+    // Host pointer import
+    if (is_vulkan_extension_enabled(
+            VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) &&
+        ((m_properties.apiVersion >= VK_MAKE_VERSION(1, 1, 0)) ||
+         is_vulkan_extension_enabled(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME))) {
+        m_vkfns.vkGetMemoryHostPointerPropertiesEXT =
+            GET_INSTANCE_PROC(instance, vkGetMemoryHostPointerPropertiesEXT);
+        cvk_info("minImportedHostPointerAlignment = %lu",
+                 m_external_memory_host_properties
+                     .minImportedHostPointerAlignment);
+    }
+
+    // Host image copy
+    if (is_vulkan_extension_enabled(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) &&
+        m_features_host_image_copy.hostImageCopy) {
+        m_vkfns.vkCopyMemoryToImageEXT =
+            GET_INSTANCE_PROC(instance, vkCopyMemoryToImageEXT);
+        m_vkfns.vkTransitionImageLayoutEXT =
+            GET_INSTANCE_PROC(instance, vkTransitionImageLayoutEXT);
+    }
+
+    // External memory and semaphores
+    if (is_vulkan_extension_enabled(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME)) {
+        m_vkfns.vkGetMemoryFdPropertiesKHR =
+            GET_INSTANCE_PROC(instance, vkGetMemoryFdPropertiesKHR);
+        m_vkfns.vkGetMemoryFdKHR =
+            GET_INSTANCE_PROC(instance, vkGetMemoryFdKHR);
+    }
+    if (is_vulkan_extension_enabled(
+            VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME)) {
+        m_vkfns.vkGetSemaphoreFdKHR =
+            GET_INSTANCE_PROC(instance, vkGetSemaphoreFdKHR);
+        m_vkfns.vkImportSemaphoreFdKHR =
+            GET_INSTANCE_PROC(instance, vkImportSemaphoreFdKHR);
+    }
+
+    // Placed memory maps, used for SVM allocations
+    if (is_vulkan_extension_enabled(VK_EXT_MAP_MEMORY_PLACED_EXTENSION_NAME) &&
+        m_features_map_memory_placed.memoryMapPlaced) {
+        m_vkfns.vkMapMemory2KHR = GET_INSTANCE_PROC(instance, vkMapMemory2KHR);
+        cvk_info("minPlacedMemoryMapAlignment = %lu",
+                 m_map_memory_placed_properties.minPlacedMemoryMapAlignment);
+    }
+}
+
+void cvk_device::init_external_handle_types() {
+    // The external capability queries are core in Vulkan 1.1
+    if (m_properties.apiVersion < VK_MAKE_VERSION(1, 1, 0)) {
+        return;
+    }
+
+    if ((m_vkfns.vkGetSemaphoreFdKHR != nullptr) &&
+        (m_vkfns.vkImportSemaphoreFdKHR != nullptr)) {
+        for (cl_external_semaphore_handle_type_khr type :
+             {CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR,
+              CL_SEMAPHORE_HANDLE_SYNC_FD_KHR}) {
+            VkPhysicalDeviceExternalSemaphoreInfo info = {
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_SEMAPHORE_INFO,
+                nullptr, vulkan_external_semaphore_handle_type(type)};
+            VkExternalSemaphoreProperties props = {
+                VK_STRUCTURE_TYPE_EXTERNAL_SEMAPHORE_PROPERTIES};
+            vkGetPhysicalDeviceExternalSemaphoreProperties(m_pdev, &info,
+                                                           &props);
+            cvk_info("external semaphore handle type %x: features = %x",
+                     type, props.externalSemaphoreFeatures);
+            if (props.externalSemaphoreFeatures &
+                VK_EXTERNAL_SEMAPHORE_FEATURE_IMPORTABLE_BIT) {
+                m_semaphore_import_handle_types.push_back(type);
+            }
+            if (props.externalSemaphoreFeatures &
+                VK_EXTERNAL_SEMAPHORE_FEATURE_EXPORTABLE_BIT) {
+                m_semaphore_export_handle_types.push_back(type);
+            }
+        }
+    }
+
+    std::vector<std::pair<cl_external_memory_handle_type_khr, const char*>>
+        memory_handle_types = {
+            {CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR,
+             VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME},
+            {CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR,
+             VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME},
+        };
+    for (auto& type_ext : memory_handle_types) {
+        auto type = type_ext.first;
+        if ((m_vkfns.vkGetMemoryFdPropertiesKHR == nullptr) ||
+            !is_vulkan_extension_enabled(type_ext.second)) {
+            continue;
+        }
+        auto features = external_buffer_features(
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            vulkan_external_memory_handle_type(type));
+        cvk_info("external memory handle type %x: features = %x", type,
+                 features);
+        if (features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT) {
+            m_external_memory_import_handle_types.push_back(type);
+        }
+    }
+}
+
+bool cvk_device::supports_host_image_copy(VkFormat format, VkImageType type,
+                                          VkImageUsageFlags usage) const {
+    if ((m_vkfns.vkCopyMemoryToImageEXT == nullptr) ||
+        (m_vkfns.vkTransitionImageLayoutEXT == nullptr)) {
+        return false;
+    }
+
+    // Fails if the format does not support
+    // VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT
+    VkPhysicalDeviceImageFormatInfo2 info = {
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+        nullptr,
+        format,
+        type,
+        VK_IMAGE_TILING_OPTIMAL,
+        usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT,
+        0, // flags
+    };
+    VkHostImageCopyDevicePerformanceQueryEXT perf = {
+        VK_STRUCTURE_TYPE_HOST_IMAGE_COPY_DEVICE_PERFORMANCE_QUERY_EXT,
+        nullptr, VK_FALSE, VK_FALSE};
+    VkImageFormatProperties2 props = {
+        VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2, &perf, {}};
+    auto res = vkGetPhysicalDeviceImageFormatProperties2(m_pdev, &info, &props);
+    if (res != VK_SUCCESS) {
+        return false;
+    }
+
+    return perf.optimalDeviceAccess == VK_TRUE;
 }
 
 void cvk_device::init_compiler_options() {
@@ -634,7 +797,9 @@ void cvk_device::build_extension_ils_list() {
         MAKE_NAME_VERSION(1, 0, 0, "cl_arm_printf"),
         MAKE_NAME_VERSION(1, 0, 0, "cl_khr_suggested_local_work_size"),
         MAKE_NAME_VERSION(1, 0, 0, "cl_khr_3d_image_writes"),
-        // MAKE_NAME_VERSION(0, 9, 0, "cl_khr_semaphore"),
+        MAKE_NAME_VERSION(0, 9, 0, "cl_khr_semaphore"),
+        MAKE_NAME_VERSION(0, 9, 5, "cl_khr_command_buffer"),
+        MAKE_NAME_VERSION(0, 9, 3, "cl_khr_command_buffer_mutable_dispatch"),
         MAKE_NAME_VERSION(1, 0, 0, "cl_khr_spirv_linkonce_odr"),
     };
 
@@ -691,6 +856,37 @@ void cvk_device::build_extension_ils_list() {
         m_has_subgroup_size_selection = true;
     }
 
+    if (!m_semaphore_import_handle_types.empty() ||
+        !m_semaphore_export_handle_types.empty()) {
+        m_extensions.push_back(
+            MAKE_NAME_VERSION(0, 9, 1, "cl_khr_external_semaphore"));
+        if (supports_semaphore_import(CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR) ||
+            supports_semaphore_export(CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR)) {
+            m_extensions.push_back(MAKE_NAME_VERSION(
+                0, 9, 0, "cl_khr_external_semaphore_opaque_fd"));
+        }
+        if (supports_semaphore_import(CL_SEMAPHORE_HANDLE_SYNC_FD_KHR) ||
+            supports_semaphore_export(CL_SEMAPHORE_HANDLE_SYNC_FD_KHR)) {
+            m_extensions.push_back(MAKE_NAME_VERSION(
+                0, 9, 0, "cl_khr_external_semaphore_sync_fd"));
+        }
+    }
+
+    if (!m_external_memory_import_handle_types.empty()) {
+        m_extensions.push_back(
+            MAKE_NAME_VERSION(0, 9, 1, "cl_khr_external_memory"));
+        if (supports_external_memory_import(
+                CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR)) {
+            m_extensions.push_back(MAKE_NAME_VERSION(
+                0, 9, 0, "cl_khr_external_memory_opaque_fd"));
+        }
+        if (supports_external_memory_import(
+                CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR)) {
+            m_extensions.push_back(MAKE_NAME_VERSION(
+                0, 9, 0, "cl_khr_external_memory_dma_buf"));
+        }
+    }
+
     if (supports_dot_product()) {
         if (supports_int8()) {
             m_extensions.push_back(MAKE_NAME_VERSION(
@@ -961,28 +1157,25 @@ cvk_device::get_pipeline_cache_filename(const cvk_sha1_hash& sha1) const {
     return cache_path;
 }
 
-bool cvk_device::get_pipeline_cache(const std::vector<uint32_t>& spirv,
-                                    VkPipelineCache& pipeline_cache) {
+bool cvk_device::get_pipeline_cache(const cvk_sha1_hash& sha1,
+                                    VkPipelineCache& pipeline_cache,
+                                    const std::vector<char>& initial_data) {
 
     std::lock_guard<std::mutex> lock(m_pipeline_cache_mutex);
 
     pipeline_cache = VK_NULL_HANDLE;
 
-    // Compute SHA-1 hash of the SPIR-V binary
-    cvk_sha1_hash sha1 =
-        cvk_sha1(spirv.data(), spirv.size() * sizeof(uint32_t));
-
     // Check the in-memory cache of pipeline caches
     if (m_pipeline_caches.count(sha1)) {
         pipeline_cache = m_pipeline_caches.at(sha1);
         return true;
     }
 
-    std::vector<char> cache_data;
+    std::vector<char> cache_data = initial_data;
 
     // Load pipeline cache data from file if this is enabled
     std::string cache_path = get_pipeline_cache_filename(sha1);
-    if (!cache_path.empty()) {
+    if (cache_data.empty() && !cache_path.empty()) {
         cvk_info("Looking for pipeline cache at %s", cache_path.c_str());
         std::ifstream cache_file(cache_path, std::ios::in | std::ios::binary);
         if (cache_file.is_open()) {
@@ -1025,29 +1218,115 @@ bool cvk_device::get_pipeline_cache(const std::vector<uint32_t>& spirv,
     return cache_data.size() != 0;
 }
 
+bool cvk_device::get_pipeline_cache_data(VkPipelineCache pipeline_cache,
+                                         std::vector<char>& data) const {
+    size_t size;
+    VkResult res =
+        vkGetPipelineCacheData(m_dev, pipeline_cache, &size, nullptr);
+    if (res != VK_SUCCESS) {
+        cvk_error("Failed to retrieve pipeline cache size");
+        return false;
+    }
+    data.resize(size);
+    res = vkGetPipelineCacheData(m_dev, pipeline_cache, &size, data.data());
+    if (res != VK_SUCCESS) {
+        cvk_error("Failed to retrieve pipeline cache data");
+        return false;
+    }
+    data.resize(size);
+    return true;
+}
+
+// Returns the validation record file path for a given validation key.
+// If the cache directory is not set, an empty string is returned.
+std::string
+cvk_device::get_validation_record_filename(const cvk_sha1_hash& key) const {
+    if (config.cache_dir().empty()) {
+        return "";
+    }
+
+    // The validation record file path is:
+    // ${CLVK_CACHE_DIR}/clvk-validated.<UUID>.<KEY>
+    std::string record_path = config.cache_dir;
+    record_path += "/";
+    record_path += "clvk-validated.";
+    record_path += to_hex_string(m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+    record_path += ".";
+    record_path += to_hex_string(reinterpret_cast<const uint8_t*>(key.data()),
+                                 SHA1_DIGEST_NUM_BYTES);
+    return record_path;
+}
+
+bool cvk_device::is_module_validated(const cvk_sha1_hash& key) {
+    std::lock_guard<std::mutex> lock(m_validated_modules_mutex);
+
+    if (m_validated_modules.count(key)) {
+        return true;
+    }
+
+    std::string record_path = get_validation_record_filename(key);
+    if (record_path.empty()) {
+        return false;
+    }
+
+    std::ifstream record_file(record_path, std::ios::in | std::ios::binary);
+    if (!record_file.is_open()) {
+        return false;
+    }
+
+    // The record holds the key it was written for, check it to reject
+    // truncated or unrelated files.
+    cvk_sha1_hash recorded;
+    record_file.read(reinterpret_cast<char*>(recorded.data()),
+                     SHA1_DIGEST_NUM_BYTES);
+    if (!record_file.good() || (recorded != key)) {
+        cvk_warn("Ignoring invalid validation record %s", record_path.c_str());
+        return false;
+    }
+
+    cvk_info("Found validation record at %s", record_path.c_str());
+    m_validated_modules.insert(key);
+    return true;
+}
+
+void cvk_device::record_module_validated(const cvk_sha1_hash& key) {
+    std::lock_guard<std::mutex> lock(m_validated_modules_mutex);
+
+    if (!m_validated_modules.insert(key).second) {
+        return;
+    }
+
+    std::string record_path = get_validation_record_filename(key);
+    if (record_path.empty()) {
+        return;
+    }
+
+    std::ofstream record_file(record_path, std::ios::out | std::ios::binary);
+    if (!record_file.is_open()) {
+        cvk_warn("Failed to open validation record file for writing: %s",
+                 record_path.c_str());
+        return;
+    }
+    record_file.write(reinterpret_cast<const char*>(key.data()),
+                      SHA1_DIGEST_NUM_BYTES);
+    if (!record_file.good()) {
+        cvk_warn("Failed to write validation record");
+    }
+}
+
 void cvk_device::save_pipeline_cache(
     const cvk_sha1_hash& sha1, const VkPipelineCache& pipeline_cache) const {
-    VkResult res;
-
     std::string cache_path = get_pipeline_cache_filename(sha1);
     if (cache_path.empty()) {
         return;
     }
 
     // Retrieve the pipeline cache data from the Vulkan implementation
-    size_t size;
-    res = vkGetPipelineCacheData(m_dev, pipeline_cache, &size, nullptr);
-    if (res != VK_SUCCESS) {
-        cvk_error("Failed to retrieve pipeline cache size");
-        return;
-    }
-    std::vector<char> cache_data(size);
-    res =
-        vkGetPipelineCacheData(m_dev, pipeline_cache, &size, cache_data.data());
-    if (res != VK_SUCCESS) {
-        cvk_error("Failed to retrieve pipeline cache data");
+    std::vector<char> cache_data;
+    if (!get_pipeline_cache_data(pipeline_cache, cache_data)) {
         return;
     }
+    size_t size = cache_data.size();
 
     cvk_info("Writing %lu bytes of pipeline cache data to file", size);
 
@@ -1136,12 +1415,12 @@ void cvk_device::log_limits_and_memory_information() {
 }
 
 bool cvk_device::init(VkInstance instance) {
+    TRACE_FUNCTION("device", (uintptr_t)this);
     cvk_info("Initialising device %s", m_properties.deviceName);
     cvk_info("  API Version: %s",
              vulkan_version_string(m_properties.apiVersion).c_str());
 
-    uint32_t num_queues, queue_family;
-    if (!init_queues(&num_queues, &queue_family)) {
+    if (!init_queues(&m_num_queues, &m_queue_family)) {
         return false;
     }
 
@@ -1159,26 +1438,95 @@ bool cvk_device::init(VkInstance instance) {
 
     init_command_pointers(instance);
 
+    init_external_handle_types();
+
     build_extension_ils_list();
 
     if (!init_time_management(instance)) {
         return false;
     }
 
-    if (!create_vulkan_queues_and_device(num_queues, queue_family)) {
-        return false;
-    }
-
     init_spirv_environment();
 
-    log_limits_and_memory_information();
-
     // Must be done last as it relies on info set up in several of the above.
     init_compiler_options();
 
+    log_limits_and_memory_information();
+
+    return true;
+}
+
+bool cvk_device::init_vulkan_device() {
+    std::lock_guard<std::mutex> lock(m_vulkan_device_init_lock);
+    if (m_vulkan_device_initialised) {
+        return true;
+    }
+
+    TRACE_FUNCTION("device", (uintptr_t)this);
+    cvk_info("Creating Vulkan device for %s", m_properties.deviceName);
+
+    if (!create_vulkan_queues_and_device(m_num_queues, m_queue_family)) {
+        return false;
+    }
+
+    if (m_physical_addressing && (m_vkfns.vkMapMemory2KHR != nullptr) &&
+        (sizeof(void*) == sizeof(uint64_t))) {
+        m_svm_supported = probe_svm_allocation();
+        cvk_info("SVM %s", m_svm_supported ? "supported" : "not supported");
+    }
+
+    m_vulkan_device_initialised = true;
+
     return true;
 }
 
+// The host address range at the device address of SVM allocations may not be
+// available in the process, try mapping a buffer there.
+bool cvk_device::probe_svm_allocation() {
+    const VkBufferCreateInfo createInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        nullptr,
+        0, // flags
+        svm_alignment(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,       // queueFamilyIndexCount
+        nullptr, // pQueueFamilyIndices
+    };
+    VkBuffer buffer;
+    if (vkCreateBuffer(m_dev, &createInfo, nullptr, &buffer) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkMemoryRequirements memreqs;
+    vkGetBufferMemoryRequirements(m_dev, buffer, &memreqs);
+    auto type_index = memory_type_index_for_buffer(memreqs.memoryTypeBits);
+
+    // The buffer is destroyed before the memory it is bound to is freed
+    std::unique_ptr<cvk_memory_allocation> memory;
+    bool mapped = false;
+    if (type_index != VK_MAX_MEMORY_TYPES) {
+        auto alignment = svm_alignment();
+        memory = std::make_unique<cvk_memory_allocation>(
+            m_dev, ceil_div(memreqs.size, alignment) * alignment, type_index,
+            memory_heap_index(type_index),
+            memory_index_is_coherent(type_index));
+        if ((memory->allocate(true) == VK_SUCCESS) &&
+            (vkBindBufferMemory(m_dev, buffer, memory->vulkan_memory(), 0) ==
+             VK_SUCCESS)) {
+            const VkBufferDeviceAddressInfo info = {
+                VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, buffer};
+            auto address = m_vkfns.vkGetBufferDeviceAddressKHR(m_dev, &info);
+            mapped = memory->map_at_address(this,
+                                            reinterpret_cast<void*>(address));
+        }
+    }
+    vkDestroyBuffer(m_dev, buffer, nullptr);
+
+    return mapped;
+}
+
 std::string cvk_device::vendor() const {
     // Is this a Khronos vendor ID?
     if (m_properties.vendorID > 0xFFFF) {
@@ -1256,51 +1604,134 @@ bool cvk_device::supports_capability(spv::Capability capability) const {
     }
 }
 
+double
+cvk_device::work_group_size_score(const std::array<uint32_t, 3>& global_size,
+                                  const std::array<uint32_t, 3>& local_size,
+                                  uint32_t subgroup_size,
+                                  uint64_t target_num_groups) {
+    uint32_t size = local_size[0] * local_size[1] * local_size[2];
+    double score = static_cast<double>(size) / round_up(size, subgroup_size);
+
+    uint64_t num_items = 1;
+    uint64_t num_padded_items = 1;
+    uint64_t num_groups = 1;
+    for (int i = 0; i < 3; i++) {
+        uint64_t groups = ceil_div(global_size[i], local_size[i]);
+        num_items *= global_size[i];
+        num_padded_items *= groups * local_size[i];
+        num_groups *= groups;
+        // Partial work-groups need their own dispatch
+        if (global_size[i] % local_size[i] != 0) {
+            score *= 0.9;
+        }
+    }
+    score *= static_cast<double>(num_items) / num_padded_items;
+
+    if (num_groups < target_num_groups) {
+        score *= static_cast<double>(num_groups) / target_num_groups;
+    }
+
+    return score;
+}
+
 void cvk_device::select_work_group_size(
     const std::array<uint32_t, 3>& global_size,
-    std::array<uint32_t, 3>& local_size) const {
+    std::array<uint32_t, 3>& local_size, bool allow_non_uniform) const {
+    auto key = std::make_pair(global_size, allow_non_uniform);
+    {
+        std::lock_guard<std::mutex> lock(m_work_group_sizes_mutex);
+        auto cached = m_work_group_sizes.find(key);
+        if (cached != m_work_group_sizes.end()) {
+            local_size = cached->second;
+            return;
+        }
+    }
 
-    // Start at (1,1,1), which is always valid.
-    local_size = {1, 1, 1};
+    compute_work_group_size(global_size, local_size, allow_non_uniform);
+
+    std::lock_guard<std::mutex> lock(m_work_group_sizes_mutex);
+    if (m_work_group_sizes.size() >= MAX_CACHED_WORK_GROUP_SIZES) {
+        m_work_group_sizes.clear();
+    }
+    m_work_group_sizes[key] = local_size;
+}
+
+void cvk_device::compute_work_group_size(
+    const std::array<uint32_t, 3>& global_size,
+    std::array<uint32_t, 3>& local_size, bool allow_non_uniform) const {
+
+    auto tuning = m_clvk_properties->get_work_group_size_tuning();
+    auto& limits = m_properties.limits;
+
+    uint32_t max_size = std::min(limits.maxComputeWorkGroupInvocations,
+                                 std::max(tuning.max_work_group_size, 1u));
+    uint32_t subgroup_size = std::max(sub_group_size(), 1u);
+    uint64_t target_num_groups = static_cast<uint64_t>(num_compute_units()) *
+                                 tuning.work_groups_per_compute_unit;
+
+    // Consider all the divisors of the global size in each dimension and,
+    // when partial work-groups are allowed, powers of two that don't divide
+    // it.
+    std::array<std::vector<uint32_t>, 3> candidates;
+    for (int i = 0; i < 3; i++) {
+        uint32_t limit = std::min(
+            {global_size[i], limits.maxComputeWorkGroupSize[i], max_size});
+        for (uint32_t size = 1; size <= limit; size++) {
+            if (global_size[i] % size == 0 ||
+                (allow_non_uniform && (size & (size - 1)) == 0)) {
+                candidates[i].push_back(size);
+            }
+        }
+    }
 
-    // Cap the total work-group size to the Vulkan device's limit.
-    uint32_t max_size = m_properties.limits.maxComputeWorkGroupInvocations;
-
-    // Further cap the total size to 64, as this is expected to be a
-    // reasonable size on many devices.
-    max_size = std::min(max_size, UINT32_C(64));
-
-    // TODO: We should also take into account the total number of
-    // work-groups that would be launched, to ensure the device is fully
-    // utilized for smaller global work sizes.
-
-    // Increase the work-group size until we hit device limits.
-    bool changed;
-    do {
-        changed = false;
-
-        // Alternate between increasing the X and Y dimensions.
-        // TODO: Consider increasing the Z dimension as well?
-        for (int i = 0; i < 2; i++) {
-            // Double the dimension if we can.
-            // TODO: Allow non power-of-two sizes?
-            // TODO: Allow non-uniform sizes if supported?
-            std::array<uint32_t, 3> new_local_size = local_size;
-            new_local_size[i] *= 2;
-            if (global_size[i] % new_local_size[i] == 0 &&
-                new_local_size[i] <=
-                    m_properties.limits.maxComputeWorkGroupCount[i] &&
-                new_local_size[0] * new_local_size[1] * new_local_size[2] <=
-                    max_size) {
-                local_size = new_local_size;
-                changed = true;
+    // Pick the best scoring size. Ties are broken in favour of larger
+    // work-groups and then of work-groups with a smaller largest dimension,
+    // so that 2D and 3D NDRanges get square-ish work-groups.
+    local_size = {1, 1, 1};
+    double best_score = -1.0;
+    uint32_t best_size = 0;
+    uint32_t best_max_dim = 0;
+    for (auto x : candidates[0]) {
+        for (auto y : candidates[1]) {
+            if (x * y > max_size) {
+                break;
+            }
+            for (auto z : candidates[2]) {
+                uint32_t size = x * y * z;
+                if (size > max_size) {
+                    break;
+                }
+                std::array<uint32_t, 3> lws = {x, y, z};
+                double score = work_group_size_score(
+                    global_size, lws, subgroup_size, target_num_groups);
+                uint32_t max_dim = std::max({x, y, z});
+
+                bool better;
+                if (std::abs(score - best_score) > 1e-9) {
+                    better = score > best_score;
+                } else if (size != best_size) {
+                    better = size > best_size;
+                } else {
+                    better = max_dim < best_max_dim;
+                }
+
+                if (better) {
+                    local_size = lws;
+                    best_score = score;
+                    best_size = size;
+                    best_max_dim = max_dim;
+                }
             }
         }
-    } while (changed);
+    }
 }
 
 cl_int cvk_device::get_device_host_timer(cl_ulong* device_timestamp,
-                                         cl_ulong* host_timestamp) const {
+                                         cl_ulong* host_timestamp) {
+    // Timers can be queried before any context has been created.
+    if (!init_vulkan_device()) {
+        return CL_OUT_OF_RESOURCES;
+    }
     auto vkdev = vulkan_device();
 
     uint64_t timestamps[2];
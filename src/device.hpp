@@ -15,9 +15,13 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "spirv-tools/libspirv.h"
@@ -34,8 +38,39 @@
 struct cvk_vulkan_extension_functions {
     PFN_vkGetCalibratedTimestampsEXT vkGetCalibratedTimestampsEXT;
     PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
+    PFN_vkGetMemoryHostPointerPropertiesEXT vkGetMemoryHostPointerPropertiesEXT;
+    PFN_vkCopyMemoryToImageEXT vkCopyMemoryToImageEXT;
+    PFN_vkTransitionImageLayoutEXT vkTransitionImageLayoutEXT;
+    PFN_vkGetMemoryFdPropertiesKHR vkGetMemoryFdPropertiesKHR;
+    PFN_vkGetMemoryFdKHR vkGetMemoryFdKHR;
+    PFN_vkGetSemaphoreFdKHR vkGetSemaphoreFdKHR;
+    PFN_vkImportSemaphoreFdKHR vkImportSemaphoreFdKHR;
+    PFN_vkMapMemory2KHR vkMapMemory2KHR;
 };
 
+static inline VkExternalMemoryHandleTypeFlagBits
+vulkan_external_memory_handle_type(cl_external_memory_handle_type_khr type) {
+    switch (type) {
+    case CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR:
+        return VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+    case CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR:
+    default:
+        return VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+    }
+}
+
+static inline VkExternalSemaphoreHandleTypeFlagBits
+vulkan_external_semaphore_handle_type(
+    cl_external_semaphore_handle_type_khr type) {
+    switch (type) {
+    case CL_SEMAPHORE_HANDLE_SYNC_FD_KHR:
+        return VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT;
+    case CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR:
+    default:
+        return VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_OPAQUE_FD_BIT;
+    }
+}
+
 #define MAKE_NAME_VERSION(major, minor, patch, name)                           \
     cl_name_version { CL_MAKE_VERSION(major, minor, patch), name }
 
@@ -76,6 +111,12 @@ struct cvk_device : public _cl_device_id,
     static cvk_device* create(cvk_platform* platform, VkInstance instance,
                               VkPhysicalDevice pdev);
 
+    // Create the Vulkan device and queues. This is deferred until the device
+    // is first used to create a context or to sample its timers. Everything
+    // reported through clGetDeviceInfo is computed by create() and must not
+    // depend on the Vulkan device. Safe to call more than once.
+    CHECK_RETURN bool init_vulkan_device();
+
     virtual ~cvk_device() {
         for (auto entry : m_pipeline_caches) {
             save_pipeline_cache(entry.first, entry.second);
@@ -87,11 +128,18 @@ struct cvk_device : public _cl_device_id,
 #ifdef CLVK_UNIT_TESTING_ENABLED
 
     VkPhysicalDeviceLimits& vulkan_limits_writable() {
+        clear_work_group_size_cache();
         return m_properties.limits;
     }
 
     void restore_device_properties() {
         vkGetPhysicalDeviceProperties(m_pdev, &m_properties);
+        clear_work_group_size_cache();
+    }
+
+    void clear_work_group_size_cache() {
+        std::lock_guard<std::mutex> lock(m_work_group_sizes_mutex);
+        m_work_group_sizes.clear();
     }
 
 #endif
@@ -162,6 +210,10 @@ struct cvk_device : public _cl_device_id,
                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     }
 
+    uint32_t memory_heap_index(uint32_t type_index) const {
+        return m_mem_properties.memoryTypes[type_index].heapIndex;
+    }
+
     struct allocation_parameters {
         VkDeviceSize size;
         uint32_t memory_type_index;
@@ -226,6 +278,111 @@ struct cvk_device : public _cl_device_id,
         return ret;
     }
 
+    // Select a memory type for a buffer backed by host memory imported with
+    // VK_EXT_external_memory_host.
+    CHECK_RETURN allocation_parameters
+    select_memory_for(VkBuffer buffer, void* host_ptr) const {
+        allocation_parameters ret;
+        ret.memory_type_index = VK_MAX_MEMORY_TYPES;
+
+        VkMemoryHostPointerPropertiesEXT hostprops = {
+            VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT, nullptr, 0};
+        auto res = m_vkfns.vkGetMemoryHostPointerPropertiesEXT(
+            m_dev, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+            host_ptr, &hostprops);
+        if (res != VK_SUCCESS) {
+            return ret;
+        }
+
+        VkMemoryRequirements memreqs;
+        vkGetBufferMemoryRequirements(m_dev, buffer, &memreqs);
+
+        ret.size = memreqs.size;
+        ret.memory_type_index = memory_type_index_for_buffer(
+            memreqs.memoryTypeBits & hostprops.memoryTypeBits);
+        if (ret.memory_type_index != VK_MAX_MEMORY_TYPES) {
+            ret.memory_coherent =
+                memory_index_is_coherent(ret.memory_type_index);
+        }
+
+        return ret;
+    }
+
+    // Memory types that memory imported from a file descriptor can use. Those
+    // of dma_buf file descriptors are queried. Those of opaque file
+    // descriptors must match the exporting allocation and cannot be queried,
+    // so all are returned. Return 0 when the query fails.
+    uint32_t external_memory_type_bits(
+        cl_external_memory_handle_type_khr handle_type, int fd) const {
+        if (handle_type != CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR) {
+            return UINT32_MAX;
+        }
+        VkMemoryFdPropertiesKHR fdprops = {
+            VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR, nullptr, 0};
+        auto res = m_vkfns.vkGetMemoryFdPropertiesKHR(
+            m_dev, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, fd,
+            &fdprops);
+        if (res != VK_SUCCESS) {
+            return 0;
+        }
+        return fdprops.memoryTypeBits;
+    }
+
+    // Import capabilities of buffers and images for a handle type. Return 0
+    // when the resource cannot be imported with the handle type.
+    VkExternalMemoryFeatureFlags
+    external_buffer_features(VkBufferUsageFlags usage,
+                             VkExternalMemoryHandleTypeFlagBits type) const {
+        VkPhysicalDeviceExternalBufferInfo info = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_BUFFER_INFO, nullptr,
+            0, // flags
+            usage, type};
+        VkExternalBufferProperties props = {
+            VK_STRUCTURE_TYPE_EXTERNAL_BUFFER_PROPERTIES};
+        vkGetPhysicalDeviceExternalBufferProperties(m_pdev, &info, &props);
+        return props.externalMemoryProperties.externalMemoryFeatures;
+    }
+
+    VkExternalMemoryFeatureFlags
+    external_image_features(const VkImageCreateInfo& create_info,
+                            VkExternalMemoryHandleTypeFlagBits type) const {
+        VkPhysicalDeviceExternalImageFormatInfo external_info = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO,
+            nullptr, type};
+        VkPhysicalDeviceImageFormatInfo2 info = {
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+            &external_info,
+            create_info.format,
+            create_info.imageType,
+            create_info.tiling,
+            create_info.usage,
+            create_info.flags};
+        VkExternalImageFormatProperties external_props = {
+            VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES};
+        VkImageFormatProperties2 props = {
+            VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2, &external_props};
+        auto res =
+            vkGetPhysicalDeviceImageFormatProperties2(m_pdev, &info, &props);
+        if (res != VK_SUCCESS) {
+            return 0;
+        }
+        return external_props.externalMemoryProperties.externalMemoryFeatures;
+    }
+
+    // Whether a CL_MEM_USE_HOST_PTR allocation can be imported directly as the
+    // backing memory of a buffer.
+    bool can_import_host_ptr(const void* host_ptr, size_t size) const {
+        if (!config.import_host_ptr ||
+            m_vkfns.vkGetMemoryHostPointerPropertiesEXT == nullptr) {
+            return false;
+        }
+        auto alignment =
+            m_external_memory_host_properties.minImportedHostPointerAlignment;
+        return (alignment != 0) &&
+               (reinterpret_cast<uintptr_t>(host_ptr) % alignment == 0) &&
+               (size % alignment == 0);
+    }
+
     uint64_t global_mem_size() const {
         // Return the size of the smallest memory heap that can be used to
         // allocate images or buffers
@@ -451,6 +608,11 @@ struct cvk_device : public _cl_device_id,
         return m_has_subgroup_size_selection;
     }
 
+    // Whether images with the given parameters can be initialised from host
+    // memory with VK_EXT_host_image_copy, without degrading device access.
+    bool supports_host_image_copy(VkFormat format, VkImageType type,
+                                  VkImageUsageFlags usage) const;
+
     bool supports_non_uniform_decoration() const {
         return (m_properties.apiVersion >= VK_MAKE_VERSION(1, 2, 0) ||
                 is_vulkan_extension_enabled(
@@ -597,8 +759,22 @@ struct cvk_device : public _cl_device_id,
 
     bool supports_non_uniform_workgroup() const { return true; }
 
+    // Score a work-group size between 0 and 1 based on how well it uses the
+    // invocations of each subgroup, how many invocations are wasted in
+    // partial work-groups and whether enough work-groups are launched to fill
+    // the device.
+    static double
+    work_group_size_score(const std::array<uint32_t, 3>& global_size,
+                          const std::array<uint32_t, 3>& local_size,
+                          uint32_t subgroup_size, uint64_t target_num_groups);
+
+    // Pick a work-group size for the global size, using partial work-groups
+    // only if allow_non_uniform is true. Use
+    // cvk_kernel::select_work_group_size to take the kernel into account.
+    // Selections are cached per global size.
     void select_work_group_size(const std::array<uint32_t, 3>& global_size,
-                                std::array<uint32_t, 3>& local_size) const;
+                                std::array<uint32_t, 3>& local_size,
+                                bool allow_non_uniform) const;
 
     bool is_vulkan_extension_enabled(const char* ext) const {
         return std::find(m_vulkan_device_extensions.begin(),
@@ -606,18 +782,37 @@ struct cvk_device : public _cl_device_id,
                          ext) != m_vulkan_device_extensions.end();
     }
 
-    // Get a previously created Vulkan pipeline cache for a given SPIR-V binary,
-    // or create a new one if necessary. Returns true if an existing pipeline
-    // cache was found and reused.
-    bool get_pipeline_cache(const std::vector<uint32_t>& spirv,
-                            VkPipelineCache& pipeline_cache);
+    // Get a previously created Vulkan pipeline cache for a given SPIR-V binary
+    // hash, or create a new one if necessary. Returns true if an existing
+    // pipeline cache was found and reused.
+    // When no pipeline cache exists in memory for the binary, `initial_data`
+    // is used to initialise it if it is not empty, in place of the data
+    // stored in the cache directory.
+    bool get_pipeline_cache(const cvk_sha1_hash& sha1,
+                            VkPipelineCache& pipeline_cache,
+                            const std::vector<char>& initial_data = {});
+
+    // Retrieve the data of a pipeline cache, to be saved or embedded in a
+    // program binary.
+    CHECK_RETURN bool get_pipeline_cache_data(VkPipelineCache pipeline_cache,
+                                              std::vector<char>& data) const;
+
+    const uint8_t* pipeline_cache_uuid() const {
+        return m_properties.pipelineCacheUUID;
+    }
+
+    // Whether a SPIR-V module is known to have passed validation on this
+    // device, in this process or a previous one. `key` identifies the module
+    // together with the validator's target environment and options.
+    bool is_module_validated(const cvk_sha1_hash& key);
+    void record_module_validated(const cvk_sha1_hash& key);
 
     spv_target_env vulkan_spirv_env() const { return m_vulkan_spirv_env; }
 
     CHECK_RETURN bool has_timer_support() const { return m_has_timer_support; }
 
     CHECK_RETURN cl_int get_device_host_timer(cl_ulong* dev_ts,
-                                              cl_ulong* host_ts) const;
+                                              cl_ulong* host_ts);
     cl_ulong device_timer_to_host(cl_ulong dev, cl_ulong sync_dev,
                                   cl_ulong sync_host) const;
 
@@ -687,12 +882,61 @@ struct cvk_device : public _cl_device_id,
     cl_uint address_bits() const { return m_spirv_arch == "spir64" ? 64 : 32; }
     bool uses_physical_addressing() const { return m_physical_addressing; }
 
+    // Coarse-grained buffer SVM allocations are buffers whose memory is mapped
+    // on the host at the buffer's device address, so that pointers have the
+    // same value on the host and in kernels. Support is only known once the
+    // Vulkan device has been created and a first such allocation could be
+    // made, SVM is not reported before a context is created.
+    bool supports_svm() const { return m_svm_supported; }
+
+    // Alignment of the address and size of SVM allocations
+    VkDeviceSize svm_alignment() const {
+        return m_map_memory_placed_properties.minPlacedMemoryMapAlignment;
+    }
+
     const std::string& get_device_specific_compile_options() const {
         return m_device_compiler_options;
     }
 
     const cvk_vulkan_extension_functions& vkfns() const { return m_vkfns; }
 
+    const std::vector<cl_external_semaphore_handle_type_khr>&
+    semaphore_import_handle_types() const {
+        return m_semaphore_import_handle_types;
+    }
+
+    const std::vector<cl_external_semaphore_handle_type_khr>&
+    semaphore_export_handle_types() const {
+        return m_semaphore_export_handle_types;
+    }
+
+    const std::vector<cl_external_memory_handle_type_khr>&
+    external_memory_import_handle_types() const {
+        return m_external_memory_import_handle_types;
+    }
+
+    bool supports_semaphore_import(
+        cl_external_semaphore_handle_type_khr handle_type) const {
+        return std::find(m_semaphore_import_handle_types.begin(),
+                         m_semaphore_import_handle_types.end(),
+                         handle_type) != m_semaphore_import_handle_types.end();
+    }
+
+    bool supports_semaphore_export(
+        cl_external_semaphore_handle_type_khr handle_type) const {
+        return std::find(m_semaphore_export_handle_types.begin(),
+                         m_semaphore_export_handle_types.end(),
+                         handle_type) != m_semaphore_export_handle_types.end();
+    }
+
+    bool supports_external_memory_import(
+        cl_external_memory_handle_type_khr handle_type) const {
+        return std::find(m_external_memory_import_handle_types.begin(),
+                         m_external_memory_import_handle_types.end(),
+                         handle_type) !=
+               m_external_memory_import_handle_types.end();
+    }
+
     bool is_bgra_format_not_supported_for_image1d_buffer() const {
         return m_clvk_properties
             ->is_bgra_format_not_supported_for_image1d_buffer();
@@ -718,8 +962,10 @@ private:
     void init_driver_behaviors();
     void init_features(VkInstance instance);
     void init_command_pointers(VkInstance instance);
+    void init_external_handle_types();
     void init_compiler_options();
     void build_extension_ils_list();
+    CHECK_RETURN bool probe_svm_allocation();
     CHECK_RETURN bool create_vulkan_queues_and_device(uint32_t num_queues,
                                                       uint32_t queue_family);
     CHECK_RETURN bool init_time_management(VkInstance instance);
@@ -742,8 +988,18 @@ private:
     VkPhysicalDeviceSubgroupSizeControlProperties
         m_subgroup_size_control_properties{};
     VkPhysicalDevicePCIBusInfoPropertiesEXT m_pci_bus_info_properties;
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT
+        m_external_memory_host_properties{};
+    std::vector<cl_external_semaphore_handle_type_khr>
+        m_semaphore_import_handle_types;
+    std::vector<cl_external_semaphore_handle_type_khr>
+        m_semaphore_export_handle_types;
+    std::vector<cl_external_memory_handle_type_khr>
+        m_external_memory_import_handle_types;
     VkPhysicalDeviceShaderIntegerDotProductProperties
         m_integer_dot_product_properties{};
+    VkPhysicalDeviceMapMemoryPlacedPropertiesEXT
+        m_map_memory_placed_properties{};
     // Vulkan features
     VkPhysicalDeviceFeatures2 m_features{};
     VkPhysicalDeviceVariablePointerFeatures m_features_variable_pointer{};
@@ -765,12 +1021,20 @@ private:
         m_features_shader_integer_dot_product{};
     VkPhysicalDeviceGlobalPriorityQueryFeaturesKHR
         m_features_queue_global_priority{};
+    VkPhysicalDeviceHostImageCopyFeaturesEXT m_features_host_image_copy{};
+    VkPhysicalDeviceMapMemoryPlacedFeaturesEXT m_features_map_memory_placed{};
 
-    VkDevice m_dev;
+    VkDevice m_dev{VK_NULL_HANDLE};
     std::vector<const char*> m_vulkan_device_extensions;
+    std::mutex m_vulkan_device_init_lock;
+    bool m_vulkan_device_initialised{};
+
+    std::atomic<bool> m_svm_supported{};
 
     std::vector<cvk_vulkan_queue_wrapper> m_vulkan_queues;
     uint32_t m_vulkan_queue_alloc_index;
+    uint32_t m_num_queues{};
+    uint32_t m_queue_family{};
 
     std::string m_extension_string;
     std::vector<cl_name_version> m_extensions;
@@ -801,6 +1065,23 @@ private:
         m_pipeline_caches;
     std::mutex m_pipeline_cache_mutex;
 
+    // Validation records
+    std::string get_validation_record_filename(const cvk_sha1_hash& key) const;
+    std::unordered_set<cvk_sha1_hash, sha1_hasher> m_validated_modules;
+    std::mutex m_validated_modules_mutex;
+
+    // Work-group sizes selected for a global size, with and without partial
+    // work-groups. Applications tend to use a few global sizes, the cache is
+    // simply cleared when it grows too large.
+    static constexpr size_t MAX_CACHED_WORK_GROUP_SIZES = 256;
+    void compute_work_group_size(const std::array<uint32_t, 3>& global_size,
+                                 std::array<uint32_t, 3>& local_size,
+                                 bool allow_non_uniform) const;
+    mutable std::map<std::pair<std::array<uint32_t, 3>, bool>,
+                     std::array<uint32_t, 3>>
+        m_work_group_sizes;
+    mutable std::mutex m_work_group_sizes_mutex;
+
     bool m_has_timer_support{};
     bool m_has_fp16_support{};
     bool m_has_int8_support{};
@@ -884,6 +1165,23 @@ struct cvk_platform : public _cl_platform_id,
 
     const std::string& extension_string() const { return m_extension_string; }
 
+    // External handle types supported by all the devices
+    std::vector<cl_external_semaphore_handle_type_khr>
+    semaphore_import_handle_types() const {
+        return common_handle_types(&cvk_device::semaphore_import_handle_types);
+    }
+
+    std::vector<cl_external_semaphore_handle_type_khr>
+    semaphore_export_handle_types() const {
+        return common_handle_types(&cvk_device::semaphore_export_handle_types);
+    }
+
+    std::vector<cl_external_memory_handle_type_khr>
+    external_memory_import_handle_types() const {
+        return common_handle_types(
+            &cvk_device::external_memory_import_handle_types);
+    }
+
     cl_ulong host_timer_resolution() const {
         for (auto dev : m_devices) {
             if (!dev->has_timer_support()) {
@@ -894,6 +1192,30 @@ struct cvk_platform : public _cl_platform_id,
     }
 
 private:
+    template <typename T>
+    std::vector<T> common_handle_types(
+        const std::vector<T>& (cvk_device::*device_types)() const) const {
+        std::vector<T> ret;
+        if (m_devices.empty()) {
+            return ret;
+        }
+        for (auto type : (m_devices[0]->*device_types)()) {
+            bool supported = true;
+            for (auto dev : m_devices) {
+                auto& types = (dev->*device_types)();
+                if (std::find(types.begin(), types.end(), type) ==
+                    types.end()) {
+                    supported = false;
+                    break;
+                }
+            }
+            if (supported) {
+                ret.push_back(type);
+            }
+        }
+        return ret;
+    }
+
     std::vector<cl_name_version> m_extensions;
     std::string m_extension_string;
     std::vector<cvk_device*> m_devices;
@@ -29,6 +29,11 @@ struct cvk_device_properties_mali : public cvk_device_properties {
     cvk_device_properties_mali(const uint32_t deviceID)
         : m_deviceID(deviceID) {}
 
+    cvk_work_group_size_tuning
+    get_work_group_size_tuning() const override final {
+        return {64, 4};
+    }
+
     bool is_non_uniform_decoration_broken() const override final {
 #define GPU_ID2_ARCH_MAJOR_SHIFT 28
 #define GPU_ID2_ARCH_MAJOR (0xF << GPU_ID2_ARCH_MAJOR_SHIFT)
@@ -64,6 +69,10 @@ static bool isMaliDevice(const char* name, const uint32_t vendorID) {
 
 struct cvk_device_properties_adreno : public cvk_device_properties {
     std::string vendor() const override final { return "Qualcomm"; }
+    cvk_work_group_size_tuning
+    get_work_group_size_tuning() const override final {
+        return {128, 4};
+    }
 };
 
 struct cvk_device_properties_adreno_615 : public cvk_device_properties_adreno {
@@ -108,6 +117,10 @@ struct cvk_device_properties_intel : public cvk_device_properties {
                "-hack-image1d-buffer-bgra";
     }
     uint32_t get_preferred_subgroup_size() const override final { return 16; }
+    cvk_work_group_size_tuning
+    get_work_group_size_tuning() const override final {
+        return {128, 8};
+    }
     bool
     is_bgra_format_not_supported_for_image1d_buffer() const override final {
         return true;
@@ -152,6 +165,10 @@ struct cvk_device_properties_amd : public cvk_device_properties {
     std::string get_compile_options() const override final {
         return "-hack-convert-to-float";
     }
+    cvk_work_group_size_tuning
+    get_work_group_size_tuning() const override final {
+        return {256, 4};
+    }
 };
 
 static bool isAMDDevice(const char* name, const uint32_t vendorID) {
@@ -244,6 +261,10 @@ struct cvk_device_properties_nvidia : public cvk_device_properties {
             "sqrt",           "tanh",        "trunc",
         });
     }
+    cvk_work_group_size_tuning
+    get_work_group_size_tuning() const override final {
+        return {256, 4};
+    }
 };
 
 static bool isNVIDIADevice(const uint32_t vendorID) {
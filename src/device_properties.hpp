@@ -23,6 +23,17 @@
 #include "config.hpp"
 #include "image_format.hpp"
 
+// Parameters used to pick a work-group size for kernels launched without one.
+struct cvk_work_group_size_tuning {
+    // Largest work-group size to consider, further capped by the device's
+    // maxComputeWorkGroupInvocations.
+    uint32_t max_work_group_size;
+    // Number of work-groups per compute unit needed to keep the device busy.
+    // Smaller work-groups are preferred when larger ones would not launch
+    // enough work-groups.
+    uint32_t work_groups_per_compute_unit;
+};
+
 struct cvk_device_properties {
     virtual std::string vendor() const { return "Unknown vendor"; }
     virtual cl_ulong get_global_mem_cache_size() const { return 0; }
@@ -56,6 +67,10 @@ struct cvk_device_properties {
         return config.preferred_subgroup_size();
     }
 
+    virtual cvk_work_group_size_tuning get_work_group_size_tuning() const {
+        return {64, 1};
+    }
+
     virtual bool is_non_uniform_decoration_broken() const { return false; }
 
     virtual bool is_bgra_format_not_supported_for_image1d_buffer() const {
@@ -12,7 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
+#include "config.hpp"
 #include "event.hpp"
+#include "metrics.hpp"
 #include "queue.hpp"
 
 static const cl_profiling_info status_to_profiling_info[4] = {
@@ -67,3 +71,83 @@ void cvk_event::set_status(cl_int status) {
         m_cv.notify_all();
     }
 }
+
+uint64_t cvk_event_wait_estimator::spin_window_ns() {
+    uint64_t max_ns = config.event_wait_spin_max_us() * 1000ull;
+    uint64_t average_ns = m_average_ns.load(std::memory_order_relaxed);
+    auto num_waits = m_num_waits.fetch_add(1, std::memory_order_relaxed);
+    if ((average_ns == NO_SAMPLES) || (num_waits % PROBE_PERIOD == 0)) {
+        return max_ns;
+    }
+
+    // Spinning only pays off when events usually complete within the window
+    if (average_ns > max_ns) {
+        return 0;
+    }
+
+    return std::min(2 * average_ns, max_ns);
+}
+
+void cvk_event_wait_estimator::record_wait(uint64_t duration_ns) {
+    uint64_t average_ns = m_average_ns.load(std::memory_order_relaxed);
+    if (average_ns == NO_SAMPLES) {
+        average_ns = duration_ns;
+    } else {
+        average_ns = average_ns - average_ns / 8 + duration_ns / 8;
+    }
+    m_average_ns.store(average_ns, std::memory_order_relaxed);
+}
+
+cl_int cvk_event::wait() {
+    cvk_debug_group(loggroup::event, "cvk_event::wait: event = %p, status = %d",
+                    this, m_status.load());
+    if (completed() || terminated()) {
+        // As when spinning, set_status() may still be setting the profiling
+        // info and calling the callbacks
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_status;
+    }
+
+    TRACE_BEGIN_EVENT(command_type(), "queue", (uintptr_t)m_queue, "command",
+                      (uintptr_t)m_cmd);
+
+    auto start = sample_clock();
+
+    // User events are completed by the application, only spin for commands
+    cvk_event_wait_estimator* estimator = nullptr;
+    uint64_t spin_deadline = start;
+    if (!is_user_event()) {
+        estimator = &m_queue->event_wait_estimator();
+        spin_deadline += estimator->spin_window_ns();
+    }
+
+    bool done = false;
+    while (!done && (sample_clock() < spin_deadline)) {
+        for (uint32_t i = 0; i < 64; i++) {
+            if (completed() || terminated()) {
+                done = true;
+                break;
+            }
+            cpu_relax();
+        }
+    }
+
+    if (done) {
+        // The status is updated before set_status() has finished setting
+        // the profiling info and calling the callbacks, wait for it
+        std::lock_guard<std::mutex> lock(m_lock);
+        cvk_metric_add(cvk_metric::event_waits_completed_spinning);
+    } else {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cv.wait(lock, [this] { return completed() || terminated(); });
+        cvk_metric_add(cvk_metric::event_waits_blocked);
+    }
+
+    if (estimator != nullptr) {
+        estimator->record_wait(sample_clock() - start);
+    }
+
+    TRACE_END();
+
+    return m_status;
+}
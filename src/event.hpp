@@ -21,6 +21,7 @@
 #include "tracing.hpp"
 #include "utils.hpp"
 
+#include <atomic>
 #include <mutex>
 #include <unordered_map>
 
@@ -35,6 +36,25 @@ struct cvk_event_callback {
     void* data;
 };
 
+// Keeps track of how long recent waits for the events of a queue took to
+// decide how long waiting for an event should spin before blocking. Spinning
+// avoids the latency of waking up a blocked thread when commands complete
+// quickly.
+struct cvk_event_wait_estimator {
+    uint64_t spin_window_ns();
+    void record_wait(uint64_t duration_ns);
+
+private:
+    // Waits always spin for the maximum time allowed every so often so that
+    // the estimate does not only include the wake-up latency of blocked
+    // threads
+    static constexpr uint32_t PROBE_PERIOD = 16;
+    static constexpr uint64_t NO_SAMPLES = UINT64_MAX;
+
+    std::atomic<uint64_t> m_average_ns{NO_SAMPLES};
+    std::atomic<uint32_t> m_num_waits{0};
+};
+
 struct cvk_event : public _cl_event, api_object<object_magic::event> {
 
     cvk_event(cvk_context* ctx, cvk_command* cmd, cvk_command_queue* queue);
@@ -69,20 +89,10 @@ struct cvk_event : public _cl_event, api_object<object_magic::event> {
         return m_queue;
     }
 
-    cl_int wait() {
-        std::unique_lock<std::mutex> lock(m_lock);
-        cvk_debug_group(loggroup::event,
-                        "cvk_event::wait: event = %p, status = %d", this,
-                        m_status);
-        if ((m_status != CL_COMPLETE) && (m_status >= 0)) {
-            TRACE_BEGIN_EVENT(command_type(), "queue", (uintptr_t)m_queue,
-                              "command", (uintptr_t)m_cmd);
-            m_cv.wait(lock);
-            TRACE_END();
-        }
-
-        return m_status;
-    }
+    // Wait for the event to complete. Events of commands are first waited on
+    // by spinning on their status for a time that depends on how long recent
+    // waits took (see CLVK_EVENT_WAIT_SPIN_MAX_US) before blocking.
+    cl_int wait();
 
     void set_profiling_info(cl_profiling_info pinfo, uint64_t val) {
         m_profiling_data[pinfo - CL_PROFILING_COMMAND_QUEUED] = val;
@@ -115,7 +125,7 @@ private:
 
     std::mutex m_lock;
     std::condition_variable m_cv;
-    cl_int m_status;
+    std::atomic<cl_int> m_status;
     cl_ulong m_profiling_data[4]{};
     cl_command_type m_command_type;
     cvk_command* m_cmd;
@@ -22,6 +22,7 @@
 #include "init.hpp"
 #include "log.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "objects.hpp"
 #include "queue.hpp"
 #include "tracing.hpp"
@@ -200,6 +201,7 @@ void clvk_global_state::term_vulkan() {
 }
 
 void clvk_global_state::init_platform() {
+    TRACE_FUNCTION();
 
     m_platform = new cvk_platform();
 
@@ -244,6 +246,7 @@ clvk_global_state::clvk_global_state() {
     init_config();
     cvk_info("Starting initialisation");
     init_tracing();
+    cvk_metrics_init();
     init_vulkan();
     init_platform();
     init_executors();
@@ -251,6 +254,7 @@ clvk_global_state::clvk_global_state() {
 }
 
 clvk_global_state::~clvk_global_state() {
+    cvk_metrics_term();
     if (config.destroy_global_state) {
         term_executors();
         term_platform();
@@ -56,14 +56,189 @@ cl_int cvk_kernel::init() {
         return CL_OUT_OF_RESOURCES;
     }
 
+    resolve_launch_layout();
+
     return CL_SUCCESS;
 }
 
+void cvk_kernel::resolve_launch_layout() {
+    auto& layout = m_launch_layout;
+    auto& constants = m_program->spec_constants();
+
+    auto spec_id = [&constants](spec_constant constant, uint32_t default_id) {
+        auto where = constants.find(constant);
+        if (where != constants.end()) {
+            return where->second;
+        }
+        return default_id;
+    };
+
+    // TODO: if all kernels in the module use the same reqd_workgroup_size ,
+    // clspv will not generate specialization constants for workgroup size, but
+    // these values should be error checked.
+    layout.workgroup_size_ids = {spec_id(spec_constant::workgroup_size_x, 0),
+                                 spec_id(spec_constant::workgroup_size_y, 1),
+                                 spec_id(spec_constant::workgroup_size_z, 2)};
+    // Clspv allocates a spec constant for work dimensions if get_work_dim() is
+    // used.
+    layout.work_dim_id = spec_id(spec_constant::work_dim,
+                                 cvk_kernel_launch_layout::INVALID_SPEC_ID);
+    layout.subgroup_max_size_id =
+        spec_id(spec_constant::subgroup_max_size,
+                cvk_kernel_launch_layout::INVALID_SPEC_ID);
+    // Clspv can allocate spec constants for global offset.
+    layout.global_offset_ids = {
+        spec_id(spec_constant::global_offset_x,
+                cvk_kernel_launch_layout::INVALID_SPEC_ID),
+        spec_id(spec_constant::global_offset_y,
+                cvk_kernel_launch_layout::INVALID_SPEC_ID),
+        spec_id(spec_constant::global_offset_z,
+                cvk_kernel_launch_layout::INVALID_SPEC_ID)};
+
+    layout.global_offset =
+        m_program->push_constant(pushconstant::global_offset);
+    layout.enqueued_local_size =
+        m_program->push_constant(pushconstant::enqueued_local_size);
+    layout.global_size = m_program->push_constant(pushconstant::global_size);
+    layout.num_workgroups =
+        m_program->push_constant(pushconstant::num_workgroups);
+    layout.module_constants_pointer =
+        m_program->push_constant(pushconstant::module_constants_pointer);
+    layout.printf_buffer_pointer =
+        m_program->push_constant(pushconstant::printf_buffer_pointer);
+    layout.region_offset =
+        m_program->push_constant(pushconstant::region_offset);
+    layout.region_group_offset =
+        m_program->push_constant(pushconstant::region_group_offset);
+
+    // Image and sampler metadata are pushed as a single range
+    uint32_t image_metadata_pc_start = UINT32_MAX;
+    uint32_t image_metadata_pc_end = 0;
+    if (m_image_metadata != nullptr) {
+        for (const auto& md : *m_image_metadata) {
+            if (md.second.has_valid_order()) {
+                auto order_offset = md.second.order_offset;
+                image_metadata_pc_start =
+                    std::min(image_metadata_pc_start, order_offset);
+                image_metadata_pc_end =
+                    std::max(image_metadata_pc_end,
+                             order_offset + (uint32_t)sizeof(uint32_t));
+            }
+            if (md.second.has_valid_data_type()) {
+                auto data_type_offset = md.second.data_type_offset;
+                image_metadata_pc_start =
+                    std::min(image_metadata_pc_start, data_type_offset);
+                image_metadata_pc_end =
+                    std::max(image_metadata_pc_end,
+                             data_type_offset + (uint32_t)sizeof(uint32_t));
+            }
+        }
+    }
+    if (m_sampler_metadata != nullptr) {
+        for (const auto& md : *m_sampler_metadata) {
+            auto offset = md.second;
+            image_metadata_pc_start = std::min(image_metadata_pc_start, offset);
+            image_metadata_pc_end = std::max(
+                image_metadata_pc_end, offset + (uint32_t)sizeof(uint32_t));
+        }
+    }
+    if (image_metadata_pc_start < image_metadata_pc_end) {
+        uint32_t offset = image_metadata_pc_start & ~0x3U;
+        uint32_t size = round_up(image_metadata_pc_end - offset, 4);
+        layout.pod_push_constants.push_back({offset, size});
+    }
+
+    if (has_pod_arguments() && !has_pod_buffer_arguments()) {
+        for (auto& arg : m_args) {
+            if (arg.kind == kernel_argument_kind::pod_pushconstant ||
+                arg.kind == kernel_argument_kind::pointer_pushconstant) {
+                // Vulkan valid usage states push constants can only be updated
+                // in chunks whose offset and size are a multiple of 4.
+                uint32_t size = round_up(arg.size, 4);
+                uint32_t offset = arg.offset & ~0x3U;
+                layout.pod_push_constants.push_back({offset, size});
+            }
+        }
+    }
+}
+
 VkPipeline
 cvk_kernel::create_pipeline(const cvk_spec_constant_map& spec_constants) {
     return m_entry_point->create_pipeline(spec_constants);
 }
 
+VkPipeline cvk_kernel::get_pipeline(const cvk_kernel_argument_values& argvals,
+                                    uint32_t dims,
+                                    const std::array<uint32_t, 3>& offset,
+                                    const std::array<uint32_t, 3>& lws) {
+    auto& layout = m_launch_layout;
+
+    // Only keep the parts of the launch the pipeline is specialized for, so
+    // that launches differing in anything else share the pipeline.
+    launch_pipeline key = {argvals.specialization_constants_version(),
+                           0,
+                           {0, 0, 0},
+                           lws,
+                           VK_NULL_HANDLE};
+    if (layout.work_dim_id != cvk_kernel_launch_layout::INVALID_SPEC_ID) {
+        key.dims = dims;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (layout.global_offset_ids[i] !=
+            cvk_kernel_launch_layout::INVALID_SPEC_ID) {
+            key.offset[i] = offset[i];
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_launch_pipelines_lock);
+
+    for (uint32_t i = 0; i < m_num_launch_pipelines; i++) {
+        auto& entry = m_launch_pipelines[i];
+        if ((entry.spec_constants_version == key.spec_constants_version) &&
+            (entry.dims == key.dims) && (entry.offset == key.offset) &&
+            (entry.lws == key.lws)) {
+            return entry.pipeline;
+        }
+    }
+
+    cvk_spec_constant_map spec_constants = {
+        {layout.workgroup_size_ids[0], lws[0]},
+        {layout.workgroup_size_ids[1], lws[1]},
+        {layout.workgroup_size_ids[2], lws[2]},
+    };
+    for (auto const& spec_value : argvals.specialization_constants()) {
+        spec_constants[spec_value.first] = spec_value.second;
+    }
+    if (layout.work_dim_id != cvk_kernel_launch_layout::INVALID_SPEC_ID) {
+        spec_constants[layout.work_dim_id] = dims;
+    }
+    if (layout.subgroup_max_size_id !=
+        cvk_kernel_launch_layout::INVALID_SPEC_ID) {
+        spec_constants[layout.subgroup_max_size_id] =
+            m_program->context()->device()->sub_group_size();
+    }
+    for (int i = 0; i < 3; i++) {
+        if (layout.global_offset_ids[i] !=
+            cvk_kernel_launch_layout::INVALID_SPEC_ID) {
+            spec_constants[layout.global_offset_ids[i]] = offset[i];
+        }
+    }
+
+    key.pipeline = m_entry_point->create_pipeline(spec_constants);
+    if (key.pipeline == VK_NULL_HANDLE) {
+        return VK_NULL_HANDLE;
+    }
+
+    // Pipelines are owned by the entry point, evicting them is free
+    m_launch_pipelines[m_next_launch_pipeline] = key;
+    m_next_launch_pipeline =
+        (m_next_launch_pipeline + 1) % LAUNCH_PIPELINE_CACHE_SIZE;
+    m_num_launch_pipelines =
+        std::min(m_num_launch_pipelines + 1, LAUNCH_PIPELINE_CACHE_SIZE);
+
+    return key.pipeline;
+}
+
 std::unique_ptr<cvk_kernel> cvk_kernel::clone(cl_int* errcode_ret) const {
 
     auto kernel = std::make_unique<cvk_kernel>(m_program, m_name.c_str());
@@ -75,7 +250,7 @@ std::unique_ptr<cvk_kernel> cvk_kernel::clone(cl_int* errcode_ret) const {
     }
 
     kernel->m_argument_values =
-        cvk_kernel_argument_values::create(*m_argument_values.get());
+        cvk_kernel_argument_values::create(m_argument_values);
 
     return kernel;
 }
@@ -145,17 +320,18 @@ void cvk_kernel::set_sampler_metadata(cl_uint index, const void* sampler) {
     }
 }
 
-cl_int cvk_kernel::set_arg(cl_uint index, size_t size, const void* value) {
-    std::lock_guard<std::mutex> lock(m_lock);
-
-    // Clone argument values if they have been used in an enqueue
+void cvk_kernel::snapshot_argument_values_if_enqueued() {
     if (m_argument_values->is_enqueued()) {
         m_argument_values =
-            cvk_kernel_argument_values::create(*m_argument_values);
-        if (m_argument_values == nullptr) {
-            return CL_OUT_OF_RESOURCES;
-        }
+            cvk_kernel_argument_values::create(m_argument_values);
     }
+}
+
+cl_int cvk_kernel::set_arg(cl_uint index, size_t size, const void* value) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    // Snapshot argument values if they have been used in an enqueue
+    snapshot_argument_values_if_enqueued();
 
     auto const& arg = m_args[index];
 
@@ -177,8 +353,49 @@ cl_int cvk_kernel::set_arg(cl_uint index, size_t size, const void* value) {
     return ret;
 }
 
+cl_int cvk_kernel::set_arg_svm_pointer(cl_uint index, const void* ptr) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    snapshot_argument_values_if_enqueued();
+
+    return m_argument_values->set_arg_svm_pointer(m_args[index], ptr);
+}
+
+std::shared_ptr<cvk_kernel_argument_values>
+cvk_kernel::save_argument_values() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto saved = m_argument_values;
+    m_argument_values = cvk_kernel_argument_values::create(saved);
+    return saved;
+}
+
+void cvk_kernel::restore_argument_values(
+    const std::shared_ptr<cvk_kernel_argument_values>& values) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_argument_values = values;
+}
+
 bool cvk_kernel::args_valid() const { return m_argument_values->args_valid(); }
 
+void cvk_kernel::select_work_group_size(
+    const cvk_device* device, const std::array<uint32_t, 3>& global_size,
+    std::array<uint32_t, 3>& local_size) const {
+    auto& reqd_work_group_size = required_work_group_size();
+    if (reqd_work_group_size[0] != 0) {
+        local_size = reqd_work_group_size;
+        return;
+    }
+
+    // Partial work-groups are dispatched as separate regions
+    bool allow_non_uniform = device->supports_non_uniform_workgroup() &&
+                             program()->can_split_region();
+
+    device->select_work_group_size(global_size, local_size, allow_non_uniform);
+}
+
+std::atomic<uint64_t>
+    cvk_kernel_argument_values::s_specialization_constants_version{0};
+
 bool cvk_kernel_argument_values::setup_descriptor_sets() {
     std::lock_guard<std::mutex> lock(m_lock);
 
@@ -196,6 +413,33 @@ bool cvk_kernel_argument_values::setup_descriptor_sets() {
     }
     VkDescriptorSet* ds = descriptor_sets();
 
+    // Descriptors that did not change since the values these were created
+    // from are copied from their descriptor sets, as long as they are alive.
+    auto parent = std::move(m_parent);
+    std::unique_lock<std::mutex> parent_lock;
+    const VkDescriptorSet* parent_ds = nullptr;
+    if (parent != nullptr) {
+        parent_lock = std::unique_lock<std::mutex>(parent->m_lock);
+        if (parent->m_is_enqueued) {
+            parent_ds = parent->descriptor_sets();
+        }
+    }
+    std::vector<VkCopyDescriptorSet> descriptor_copies;
+    auto copy_descriptor = [&](uint32_t set, uint32_t binding) {
+        VkCopyDescriptorSet copyDescriptorSet = {
+            VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET,
+            nullptr,
+            parent_ds[set], // srcSet
+            binding,        // srcBinding
+            0,              // srcArrayElement
+            ds[set],        // dstSet
+            binding,        // dstBinding
+            0,              // dstArrayElement
+            1,              // descriptorCount
+        };
+        descriptor_copies.push_back(copyDescriptorSet);
+    };
+
     // Make enough space to store all descriptor write structures
     size_t max_descriptor_writes =
         m_args.size() // upper bound that includes POD buffers
@@ -213,7 +457,13 @@ bool cvk_kernel_argument_values::setup_descriptor_sets() {
     // Setup module-scope variables
     if (program->module_constant_data_buffer() != nullptr &&
         program->module_constant_data_buffer_info()->type ==
-            module_buffer_type::storage_buffer) {
+            module_buffer_type::storage_buffer &&
+        parent_ds != nullptr) {
+        auto info = program->module_constant_data_buffer_info();
+        copy_descriptor(info->set, info->binding);
+    } else if (program->module_constant_data_buffer() != nullptr &&
+               program->module_constant_data_buffer_info()->type ==
+                   module_buffer_type::storage_buffer) {
         auto buffer = program->module_constant_data_buffer();
         auto info = program->module_constant_data_buffer_info();
         cvk_debug_fn(
@@ -242,39 +492,58 @@ bool cvk_kernel_argument_values::setup_descriptor_sets() {
 
     // Setup descriptors for POD arguments
     if (m_entry_point->has_pod_buffer_arguments()) {
-        // Create POD buffer
-        if (!create_pod_buffer()) {
+        bool reuse_pod_buffer = !m_pod_dirty && (parent != nullptr) &&
+                                (parent->m_pod_buffer != nullptr);
+        if (reuse_pod_buffer) {
+            // The POD data did not change, share the parent's POD buffer
+            m_pod_buffer = parent->m_pod_buffer;
+        } else if (!create_pod_buffer()) {
+            // Create POD buffer
             return false;
         }
 
-        // Update descriptors
-        cvk_debug_fn("pod buffer %p, size = %zu @ set = %u, binding = %u",
-                     m_pod_buffer->vulkan_buffer(), m_pod_buffer->size(),
-                     m_pod_arg->descriptorSet, m_pod_arg->binding);
-        VkDescriptorBufferInfo bufferInfo = {m_pod_buffer->vulkan_buffer(),
-                                             0, // offset
-                                             VK_WHOLE_SIZE};
-        buffer_info.push_back(bufferInfo);
+        if (reuse_pod_buffer && (parent_ds != nullptr)) {
+            copy_descriptor(m_pod_arg->descriptorSet, m_pod_arg->binding);
+        } else {
+            // Update descriptors
+            cvk_debug_fn("pod buffer %p, size = %zu @ set = %u, binding = %u",
+                         m_pod_buffer->vulkan_buffer(), m_pod_buffer->size(),
+                         m_pod_arg->descriptorSet, m_pod_arg->binding);
+            VkDescriptorBufferInfo bufferInfo = {m_pod_buffer->vulkan_buffer(),
+                                                 0, // offset
+                                                 VK_WHOLE_SIZE};
+            buffer_info.push_back(bufferInfo);
 
-        VkWriteDescriptorSet writeDescriptorSet = {
-            VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            nullptr,
-            ds[m_pod_arg->descriptorSet],
-            m_pod_arg->binding,                   // dstBinding
-            0,                                    // dstArrayElement
-            1,                                    // descriptorCount
-            m_entry_point->pod_descriptor_type(), // descriptorType
-            nullptr,                              // pImageInfo
-            &buffer_info.back(),
-            nullptr, // pTexelBufferView
-        };
-        descriptor_writes.push_back(writeDescriptorSet);
+            VkWriteDescriptorSet writeDescriptorSet = {
+                VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                nullptr,
+                ds[m_pod_arg->descriptorSet],
+                m_pod_arg->binding,                   // dstBinding
+                0,                                    // dstArrayElement
+                1,                                    // descriptorCount
+                m_entry_point->pod_descriptor_type(), // descriptorType
+                nullptr,                              // pImageInfo
+                &buffer_info.back(),
+                nullptr, // pTexelBufferView
+            };
+            descriptor_writes.push_back(writeDescriptorSet);
+        }
     }
 
     // Setup other kernel argument descriptors
     for (cl_uint i = 0; i < m_args.size(); i++) {
         auto const& arg = m_args[i];
 
+        if ((parent_ds != nullptr) && !m_args_dirty[i] &&
+            (arg.is_mem_object_backed() ||
+             arg.kind == kernel_argument_kind::sampler)) {
+            // NULL buffers have no descriptor to copy
+            if (get_arg_value(arg) != nullptr) {
+                copy_descriptor(arg.descriptorSet, arg.binding);
+            }
+            continue;
+        }
+
         switch (arg.kind) {
 
         case kernel_argument_kind::buffer:
@@ -437,6 +706,10 @@ bool cvk_kernel_argument_values::setup_descriptor_sets() {
     // Setup literal samplers
     for (size_t i = 0; i < program->literal_sampler_descs().size(); i++) {
         auto desc = program->literal_sampler_descs()[i];
+        if (parent_ds != nullptr) {
+            copy_descriptor(desc.descriptorSet, desc.binding);
+            continue;
+        }
         auto clsampler = icd_downcast(program->literal_samplers()[i]);
         auto sampler = clsampler->vulkan_sampler();
 
@@ -465,8 +738,12 @@ bool cvk_kernel_argument_values::setup_descriptor_sets() {
     m_is_enqueued = true;
 
     // Write descriptors to device
+    cvk_debug_fn("%zu descriptor writes, %zu descriptor copies",
+                 descriptor_writes.size(), descriptor_copies.size());
     vkUpdateDescriptorSets(dev, static_cast<uint32_t>(descriptor_writes.size()),
-                           descriptor_writes.data(), 0, nullptr);
+                           descriptor_writes.data(),
+                           static_cast<uint32_t>(descriptor_copies.size()),
+                           descriptor_copies.data());
 
     return true;
 }
@@ -15,7 +15,10 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <limits>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -27,6 +30,31 @@
 
 struct cvk_kernel_argument_values;
 
+// Launch state that only depends on the program's reflection, resolved once
+// per kernel so that enqueueing it does not have to look it up again.
+struct cvk_kernel_launch_layout {
+    static constexpr uint32_t INVALID_SPEC_ID =
+        std::numeric_limits<uint32_t>::max();
+
+    std::array<uint32_t, 3> workgroup_size_ids;
+    uint32_t work_dim_id;
+    uint32_t subgroup_max_size_id;
+    std::array<uint32_t, 3> global_offset_ids;
+
+    const pushconstant_desc* global_offset;
+    const pushconstant_desc* enqueued_local_size;
+    const pushconstant_desc* global_size;
+    const pushconstant_desc* num_workgroups;
+    const pushconstant_desc* module_constants_pointer;
+    const pushconstant_desc* printf_buffer_pointer;
+    const pushconstant_desc* region_offset;
+    const pushconstant_desc* region_group_offset;
+
+    // Ranges of the POD data pushed as push constants (image and sampler
+    // metadata, POD arguments), aligned to 4 bytes as Vulkan requires.
+    std::vector<pushconstant_desc> pod_push_constants;
+};
+
 struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
 
     cvk_kernel(cvk_program* program, const char* name)
@@ -56,9 +84,28 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
     void set_image_metadata(cl_uint index, const void* image);
 
     CHECK_RETURN cl_int set_arg(cl_uint index, size_t size, const void* value);
+    CHECK_RETURN cl_int set_arg_svm_pointer(cl_uint index, const void* ptr);
+
+    // Save the argument values so that changes made afterwards can be undone
+    // by restoring them. The saved values are not modified by later changes.
+    std::shared_ptr<cvk_kernel_argument_values> save_argument_values();
+    void restore_argument_values(
+        const std::shared_ptr<cvk_kernel_argument_values>& values);
     CHECK_RETURN VkPipeline
     create_pipeline(const cvk_spec_constant_map& spec_constants);
 
+    // Get the pipeline for a region of an NDRange launched with `argvals`.
+    // The last few pipelines are cached by specialization state so repeated
+    // launches of the same shape skip building the specialization constants.
+    CHECK_RETURN VkPipeline get_pipeline(
+        const cvk_kernel_argument_values& argvals, uint32_t dims,
+        const std::array<uint32_t, 3>& offset,
+        const std::array<uint32_t, 3>& lws);
+
+    const cvk_kernel_launch_layout& launch_layout() const {
+        return m_launch_layout;
+    }
+
     bool has_pod_arguments() const {
         return m_entry_point->has_pod_arguments();
     }
@@ -123,6 +170,12 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
         return m_program->required_work_group_size(m_name);
     }
 
+    // Pick a work-group size for a launch that doesn't specify one. This is
+    // the required work-group size if the kernel has one.
+    void select_work_group_size(const cvk_device* device,
+                                const std::array<uint32_t, 3>& global_size,
+                                std::array<uint32_t, 3>& local_size) const;
+
     bool args_valid() const;
 
     bool has_extended_arg_info(cl_uint arg_index) const {
@@ -153,11 +206,23 @@ struct cvk_kernel : public _cl_kernel, api_object<object_magic::kernel> {
 
     bool uses_printf() const { return m_entry_point->uses_printf(); }
 
-    bool requires_serialized_execution() const { return uses_printf(); }
-
 private:
     friend cvk_kernel_argument_values;
 
+    void resolve_launch_layout();
+    void snapshot_argument_values_if_enqueued();
+
+    struct launch_pipeline {
+        uint64_t spec_constants_version;
+        uint32_t dims;
+        std::array<uint32_t, 3> offset;
+        std::array<uint32_t, 3> lws;
+        VkPipeline pipeline;
+    };
+
+    // A non-uniform NDRange is split in at most 8 regions
+    static constexpr uint32_t LAUNCH_PIPELINE_CACHE_SIZE = 8;
+
     std::mutex m_lock;
     cvk_program_holder m_program;
     std::shared_ptr<cvk_entry_point> m_entry_point;
@@ -166,6 +231,12 @@ private:
     std::shared_ptr<cvk_kernel_argument_values> m_argument_values;
     const kernel_sampler_metadata_map* m_sampler_metadata;
     const kernel_image_metadata_map* m_image_metadata;
+    cvk_kernel_launch_layout m_launch_layout;
+
+    std::mutex m_launch_pipelines_lock;
+    std::array<launch_pipeline, LAUNCH_PIPELINE_CACHE_SIZE> m_launch_pipelines;
+    uint32_t m_num_launch_pipelines{};
+    uint32_t m_next_launch_pipeline{};
 };
 
 static inline cvk_kernel* icd_downcast(cl_kernel kernel) {
@@ -174,24 +245,53 @@ static inline cvk_kernel* icd_downcast(cl_kernel kernel) {
 
 using cvk_kernel_holder = refcounted_holder<cvk_kernel>;
 
+// Copy-on-write holder for the parts of the argument values shared between
+// snapshots. Snapshots that have been enqueued are never modified, so a copy
+// is only made by the snapshot being modified, under the kernel lock.
+template <typename T> struct cvk_cow {
+    cvk_cow() : m_ptr(std::make_shared<T>()) {}
+    explicit cvk_cow(T&& val) : m_ptr(std::make_shared<T>(std::move(val))) {}
+
+    const T& get() const { return *m_ptr; }
+
+    T& mutate() {
+        if (m_ptr.use_count() > 1) {
+            m_ptr = std::make_shared<T>(*m_ptr);
+        }
+        return *m_ptr;
+    }
+
+private:
+    std::shared_ptr<T> m_ptr;
+};
+
 struct cvk_kernel_argument_values {
 
     cvk_kernel_argument_values(std::shared_ptr<cvk_entry_point> entry_point)
         : m_entry_point(entry_point), m_is_enqueued(false),
           m_args(m_entry_point->args()), m_pod_arg(nullptr),
-          m_kernel_resources(m_entry_point->num_resource_slots()),
-          m_local_args_size(m_entry_point->args().size(), 0),
-          m_args_set(m_args.size(), false), m_descriptor_sets{VK_NULL_HANDLE},
-          m_descriptor_sets_refcount(0) {}
-
+          m_kernel_resources(std::vector<refcounted*>(
+              m_entry_point->num_resource_slots())),
+          m_local_args_size(std::vector<size_t>(m_entry_point->args().size())),
+          m_specialization_constants_version(0),
+          m_args_set(m_args.size(), false), m_num_args_unset(m_args.size()),
+          m_args_dirty(m_args.size(), true), m_pod_dirty(true),
+          m_descriptor_sets{VK_NULL_HANDLE}, m_descriptor_sets_refcount(0) {}
+
+    // The new values share their state with `other` until they are modified.
     cvk_kernel_argument_values(const cvk_kernel_argument_values& other)
-        : m_entry_point(other.m_entry_point), m_is_enqueued(false),
-          m_args(m_entry_point->args()), m_pod_arg(nullptr),
+        : m_entry_point(other.m_entry_point), m_pod_data(other.m_pod_data),
+          m_is_enqueued(false), m_args(m_entry_point->args()),
+          m_pod_arg(other.m_pod_arg),
           m_kernel_resources(other.m_kernel_resources),
           m_local_args_size(other.m_local_args_size),
           m_specialization_constants(other.m_specialization_constants),
-          m_args_set(other.m_args_set), m_descriptor_sets{VK_NULL_HANDLE},
-          m_descriptor_sets_refcount(0) {}
+          m_specialization_constants_version(
+              other.m_specialization_constants_version),
+          m_args_set(other.m_args_set),
+          m_num_args_unset(other.m_num_args_unset),
+          m_args_dirty(m_args.size(), false), m_pod_dirty(false),
+          m_descriptor_sets{VK_NULL_HANDLE}, m_descriptor_sets_refcount(0) {}
 
     ~cvk_kernel_argument_values() {
         for (auto ds : m_descriptor_sets) {
@@ -212,18 +312,11 @@ struct cvk_kernel_argument_values {
         return val;
     }
 
+    // Create a snapshot of `other` that can be modified without affecting it.
     static std::shared_ptr<cvk_kernel_argument_values>
-    create(const cvk_kernel_argument_values& other) {
-        auto val = std::make_shared<cvk_kernel_argument_values>(other);
-
-        if (!val->init()) {
-            return nullptr;
-        }
-
-        if (!val->init_copy(other)) {
-            return nullptr;
-        }
-
+    create(const std::shared_ptr<cvk_kernel_argument_values>& other) {
+        auto val = std::make_shared<cvk_kernel_argument_values>(*other);
+        val->m_parent = other;
         return val;
     }
 
@@ -247,25 +340,16 @@ struct cvk_kernel_argument_values {
             m_entry_point->has_image_metadata() ||
             m_entry_point->has_sampler_metadata()) {
             // TODO(#101): host out-of-memory errors are currently unhandled.
-            auto buffer = std::make_unique<std::vector<uint8_t>>(
-                m_entry_point->pod_buffer_size());
-            m_pod_data = std::move(buffer);
+            m_pod_data = cvk_cow<std::vector<uint8_t>>(
+                std::vector<uint8_t>(m_entry_point->pod_buffer_size()));
         }
 
         return true;
     }
 
-    bool init_copy(const cvk_kernel_argument_values& other) {
-        if (m_entry_point->has_pod_arguments()) {
-            memcpy(&pod_data()[0], &other.pod_data()[0], pod_data().size());
-            return true;
-        } else {
-            return true;
-        }
-    }
-
     void set_pod_data(uint32_t offset, size_t size, const void* value) {
-        memcpy(&pod_data()[offset], value, size);
+        memcpy(&m_pod_data.mutate()[offset], value, size);
+        m_pod_dirty = true;
     }
 
     cl_int set_arg(const kernel_argument& arg, size_t size, const void* value) {
@@ -298,10 +382,12 @@ struct cvk_kernel_argument_values {
             set_pod_data(arg.offset, arg.size, value);
         } else if (arg.kind == kernel_argument_kind::local) {
             CVK_ASSERT(value == nullptr);
-            m_local_args_size[arg.pos] = size;
+            m_local_args_size.mutate()[arg.pos] = size;
             CVK_ASSERT(size % arg.local_elem_size == 0);
-            m_specialization_constants[arg.local_spec_id] =
+            m_specialization_constants.mutate()[arg.local_spec_id] =
                 size / arg.local_elem_size;
+            m_specialization_constants_version =
+                ++s_specialization_constants_version;
         } else if (!arg.is_unused()) {
             // We only expect cl_mem or cl_sampler here
             if (size != sizeof(void*)) {
@@ -317,7 +403,7 @@ struct cvk_kernel_argument_values {
                     return CL_INVALID_SAMPLER;
                 }
 
-                m_kernel_resources[arg.binding] = sampler;
+                m_kernel_resources.mutate()[arg.binding] = sampler;
             } else {
                 auto apimem = *reinterpret_cast<const cl_mem*>(value);
                 if (apimem == nullptr) {
@@ -327,28 +413,46 @@ struct cvk_kernel_argument_values {
                 if (!mem->is_valid()) {
                     return CL_INVALID_MEM_OBJECT;
                 }
-                m_kernel_resources[arg.binding] = mem;
+                m_kernel_resources.mutate()[arg.binding] = mem;
             }
         }
 
-        m_args_set[arg.pos] = true;
+        mark_arg_set(arg);
         return CL_SUCCESS;
     }
 
-    refcounted* get_arg_value(const kernel_argument& arg) {
-        return m_kernel_resources[arg.binding];
+    // SVM pointers are device addresses and are passed to kernels as is
+    cl_int set_arg_svm_pointer(const kernel_argument& arg, const void* ptr) {
+        if (!arg.is_pod_pointer()) {
+            return CL_INVALID_ARG_VALUE;
+        }
+        uint64_t address = reinterpret_cast<uintptr_t>(ptr);
+        set_pod_data(arg.offset, arg.size, &address);
+        mark_arg_set(arg);
+        return CL_SUCCESS;
+    }
+
+    refcounted* get_arg_value(const kernel_argument& arg) const {
+        return m_kernel_resources.get()[arg.binding];
     }
 
     bool is_enqueued() const { return m_is_enqueued; }
 
-    const std::vector<uint8_t>& pod_data() const { return *m_pod_data; }
-    std::vector<uint8_t>& pod_data() { return *m_pod_data; }
+    const std::vector<uint8_t>& pod_data() const { return m_pod_data.get(); }
 
-    size_t local_arg_size(int pos) const { return m_local_args_size[pos]; }
+    size_t local_arg_size(int pos) const {
+        return m_local_args_size.get()[pos];
+    }
 
     const std::unordered_map<uint32_t, uint32_t>&
     specialization_constants() const {
-        return m_specialization_constants;
+        return m_specialization_constants.get();
+    }
+
+    // Identifies the contents of specialization_constants(). Values that
+    // share a version have the same specialization constants.
+    uint64_t specialization_constants_version() const {
+        return m_specialization_constants_version;
     }
 
     CHECK_RETURN bool setup_descriptor_sets();
@@ -357,7 +461,7 @@ struct cvk_kernel_argument_values {
 
     // Take ownership of resources and retain them.
     void retain_resources() {
-        for (auto& resource : m_kernel_resources) {
+        for (auto& resource : m_kernel_resources.get()) {
             if (resource)
                 resource->retain();
         }
@@ -367,7 +471,7 @@ struct cvk_kernel_argument_values {
 
     // Release all resources owned resources.
     void release_resources() {
-        for (auto& resource : m_kernel_resources) {
+        for (auto& resource : m_kernel_resources.get()) {
             if (resource)
                 resource->release();
         }
@@ -388,44 +492,58 @@ struct cvk_kernel_argument_values {
         mems.reserve(m_args.size());
         for (auto& arg : m_args) {
             if (arg.is_mem_object_backed()) {
-                auto mem =
-                    static_cast<cvk_mem*>(m_kernel_resources[arg.binding]);
+                auto mem = static_cast<cvk_mem*>(get_arg_value(arg));
                 mems.push_back(mem);
             }
         }
         return mems;
     }
 
-    bool args_valid() const {
-        return std::all_of(m_args_set.cbegin(), m_args_set.cend(),
-                           [](bool b) { return b; });
-    }
+    bool args_valid() const { return m_num_args_unset == 0; }
 
 private:
+    void mark_arg_set(const kernel_argument& arg) {
+        if (!m_args_set[arg.pos]) {
+            m_args_set[arg.pos] = true;
+            m_num_args_unset--;
+        }
+        m_args_dirty[arg.pos] = true;
+    }
+
     bool create_pod_buffer() {
-        CVK_ASSERT(m_pod_data->size() >= m_entry_point->pod_buffer_size());
+        CVK_ASSERT(pod_data().size() >= m_entry_point->pod_buffer_size());
 
         // Create POD buffer and copy data to it
         m_pod_buffer = m_entry_point->allocate_pod_buffer();
         if (m_pod_buffer == nullptr) {
             return false;
         }
-        return m_pod_buffer->copy_from(m_pod_data->data(), 0,
+        return m_pod_buffer->copy_from(pod_data().data(), 0,
                                        m_entry_point->pod_buffer_size());
     }
 
     std::mutex m_lock;
     std::shared_ptr<cvk_entry_point> m_entry_point;
-    std::unique_ptr<std::vector<uint8_t>> m_pod_data;
+    cvk_cow<std::vector<uint8_t>> m_pod_data;
     bool m_is_enqueued;
     const std::vector<kernel_argument>& m_args;
     const kernel_argument* m_pod_arg;
-    std::vector<refcounted*> m_kernel_resources;
-    std::vector<size_t> m_local_args_size;
-    std::unordered_map<uint32_t, uint32_t> m_specialization_constants;
+    cvk_cow<std::vector<refcounted*>> m_kernel_resources;
+    cvk_cow<std::vector<size_t>> m_local_args_size;
+    cvk_cow<std::unordered_map<uint32_t, uint32_t>> m_specialization_constants;
+    uint64_t m_specialization_constants_version;
+    static std::atomic<uint64_t> s_specialization_constants_version;
     std::vector<bool> m_args_set;
+    uint32_t m_num_args_unset;
+
+    // The values these were created from and what changed since. Descriptors
+    // for unchanged arguments are copied from the parent's descriptor sets,
+    // and its POD buffer is reused if no POD data changed.
+    std::shared_ptr<cvk_kernel_argument_values> m_parent;
+    std::vector<bool> m_args_dirty;
+    bool m_pod_dirty;
 
-    std::unique_ptr<cvk_buffer> m_pod_buffer;
+    std::shared_ptr<cvk_buffer> m_pod_buffer;
     std::array<VkDescriptorSet, spir_binary::MAX_DESCRIPTOR_SETS>
         m_descriptor_sets;
     uint32_t m_descriptor_sets_refcount;
@@ -14,6 +14,7 @@
 
 #include "log.hpp"
 #include "config.hpp"
+#include "log_ring.hpp"
 #include "queue.hpp"
 
 #include <cerrno>
@@ -43,6 +44,9 @@ static int gLoggingLevel;
 static uint64_t gLoggingGroupMask;
 static bool gLoggingColour;
 static FILE* gLoggingFile;
+static bool gLoggingRing;
+
+uint64_t gLoggingEnabledGroups[loglevel::debug + 1];
 
 static uint64_t init_logging_groups() {
     uint64_t mask = loggroup::all;
@@ -114,8 +118,13 @@ void init_logging() {
             gLoggingFile = stdout;
         } else if (val == "stderr") {
             gLoggingFile = stderr;
-        } else if (val.rfind("file:", 0) == 0) {
+        } else if (val == "ring") {
+            gLoggingFile = stderr;
+            gLoggingRing = true;
+        } else if ((val.rfind("file:", 0) == 0) ||
+                   (val.rfind("ring:", 0) == 0)) {
 
+            gLoggingRing = val.rfind("ring:", 0) == 0;
             val.erase(0, strlen("file:"));
 
             gLoggingFile = fopen(val.c_str(), "w+");
@@ -144,9 +153,25 @@ void init_logging() {
     if (config.log_colour.set) {
         gLoggingColour = config.log_colour;
     }
+
+    if (gLoggingRing) {
+        // Records are formatted at exit, colours would not help.
+        gLoggingColour = false;
+        cvk_log_ring_init(config.log_ring_size);
+    }
+
+    for (int level = loglevel::fatal; level <= loglevel::debug; level++) {
+        gLoggingEnabledGroups[level] =
+            cvk_log_level_enabled(static_cast<loglevel>(level))
+                ? gLoggingGroupMask
+                : 0;
+    }
 }
 
 void term_logging() {
+    if (gLoggingRing) {
+        cvk_log_ring_dump(gLoggingFile);
+    }
     if ((gLoggingFile != stdout) && (gLoggingFile != stderr)) {
         fclose(gLoggingFile);
     }
@@ -231,6 +256,13 @@ void cvk_log(uint64_t group_mask, loglevel level, const char* fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
+    // Errors are still written directly so that they are visible even if the
+    // process never gets to term_logging.
+    if (gLoggingRing && (level > loglevel::error)) {
+        cvk_log_ring_append(level, fmt, args);
+        va_end(args);
+        return;
+    }
 #ifdef __ANDROID__
     if (gLoggingFile == stdout || gLoggingFile == stderr) {
         cvk_log_android(level, fmt, args);
@@ -512,8 +544,16 @@ const char* cl_command_type_to_string(cl_command_type type) {
         CASE(CL_COMMAND_MARKER);
         CASE(CL_COMMAND_ACQUIRE_GL_OBJECTS);
         CASE(CL_COMMAND_RELEASE_GL_OBJECTS);
+        CASE(CL_COMMAND_SVM_FREE);
+        CASE(CL_COMMAND_SVM_MEMCPY);
+        CASE(CL_COMMAND_SVM_MEMFILL);
+        CASE(CL_COMMAND_SVM_MAP);
+        CASE(CL_COMMAND_SVM_UNMAP);
+        CASE(CL_COMMAND_SVM_MIGRATE_MEM);
         CASE(CL_COMMAND_SEMAPHORE_WAIT_KHR);
         CASE(CL_COMMAND_SEMAPHORE_SIGNAL_KHR);
+        CASE(CL_COMMAND_ACQUIRE_EXTERNAL_MEM_OBJECTS_KHR);
+        CASE(CL_COMMAND_RELEASE_EXTERNAL_MEM_OBJECTS_KHR);
         CASE(CLVK_COMMAND_BATCH);
         CASE(CLVK_COMMAND_IMAGE_INIT);
     default:
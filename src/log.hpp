@@ -53,16 +53,34 @@ void cvk_log(uint64_t group_mask, loglevel level, const char* fmt, ...)
 bool cvk_log_level_enabled(loglevel level);
 bool cvk_log_group_enabled(uint64_t group_mask);
 
+// Enabled groups for each log level, 0 when the level is disabled. Filled by
+// init_logging so that the macros below can skip disabled messages without a
+// function call or evaluating their arguments.
+extern uint64_t gLoggingEnabledGroups[loglevel::debug + 1];
+
+static inline bool cvk_log_enabled(uint64_t group_mask, loglevel level) {
+    return (gLoggingEnabledGroups[level] & group_mask) != 0;
+}
+
+#define cvk_log_if_enabled(mask, level, fmt, ...)                              \
+    (cvk_log_enabled(mask, level) ? cvk_log(mask, level, fmt, ##__VA_ARGS__)   \
+                                  : (void)0)
+
 #define cvk_fatal(fmt, ...)                                                    \
-    cvk_log(loggroup::none, loglevel::fatal, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(loggroup::none, loglevel::fatal, fmt "\n",              \
+                       ##__VA_ARGS__)
 #define cvk_error(fmt, ...)                                                    \
-    cvk_log(loggroup::none, loglevel::error, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(loggroup::none, loglevel::error, fmt "\n",              \
+                       ##__VA_ARGS__)
 #define cvk_warn(fmt, ...)                                                     \
-    cvk_log(loggroup::none, loglevel::warn, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(loggroup::none, loglevel::warn, fmt "\n",               \
+                       ##__VA_ARGS__)
 #define cvk_info(fmt, ...)                                                     \
-    cvk_log(loggroup::none, loglevel::info, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(loggroup::none, loglevel::info, fmt "\n",               \
+                       ##__VA_ARGS__)
 #define cvk_debug(fmt, ...)                                                    \
-    cvk_log(loggroup::none, loglevel::debug, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(loggroup::none, loglevel::debug, fmt "\n",              \
+                       ##__VA_ARGS__)
 
 #define cvk_fatal_fn(fmt, ...) cvk_fatal("%s: " fmt, __func__, ##__VA_ARGS__)
 #define cvk_error_fn(fmt, ...) cvk_error("%s: " fmt, __func__, ##__VA_ARGS__)
@@ -71,18 +89,18 @@ bool cvk_log_group_enabled(uint64_t group_mask);
 #define cvk_debug_fn(fmt, ...) cvk_debug("%s: " fmt, __func__, ##__VA_ARGS__)
 
 #define cvk_fatal_group(mask, fmt, ...)                                        \
-    cvk_log(mask, loglevel::fatal, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(mask, loglevel::fatal, fmt "\n", ##__VA_ARGS__)
 #define cvk_error_group(mask, fmt, ...)                                        \
-    cvk_log(mask, loglevel::error, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(mask, loglevel::error, fmt "\n", ##__VA_ARGS__)
 #define cvk_warn_group(mask, fmt, ...)                                         \
-    cvk_log(mask, loglevel::warn, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(mask, loglevel::warn, fmt "\n", ##__VA_ARGS__)
 #define cvk_info_group(mask, fmt, ...)                                         \
-    cvk_log(mask, loglevel::info, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(mask, loglevel::info, fmt "\n", ##__VA_ARGS__)
 #define cvk_debug_group(mask, fmt, ...)                                        \
-    cvk_log(mask, loglevel::debug, fmt "\n", ##__VA_ARGS__)
+    cvk_log_if_enabled(mask, loglevel::debug, fmt "\n", ##__VA_ARGS__)
 
 #define cvk_fatal_group_fn(mask, fmt, ...)                                     \
-    cvk_fatalgroup(mask, "%s: " fmt, __func__, ##__VA_ARGS__)
+    cvk_fatal_group(mask, "%s: " fmt, __func__, ##__VA_ARGS__)
 #define cvk_error_group_fn(mask, fmt, ...)                                     \
     cvk_error_group(mask, "%s: " fmt, __func__, ##__VA_ARGS__)
 #define cvk_warn_group_fn(mask, fmt, ...)                                      \
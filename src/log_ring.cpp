@@ -0,0 +1,375 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "log_ring.hpp"
+
+namespace {
+
+constexpr unsigned RECORD_MAX_ARGS = 12;
+constexpr unsigned RECORD_STRINGS_SIZE = 160;
+
+// A fixed-size log record. When 'fmt' is null, the message could not be
+// captured (unsupported conversion or too many arguments) and was formatted
+// eagerly into 'strings'.
+struct log_record {
+    uint64_t timestamp;
+    const char* fmt;
+    uint32_t level;
+    uint16_t num_args;
+    uint16_t strings_used;
+    uint64_t args[RECORD_MAX_ARGS];
+    char strings[RECORD_STRINGS_SIZE];
+};
+
+enum class length_modifier
+{
+    none,
+    hh,
+    h,
+    l,
+    ll,
+    z,
+    j,
+    t,
+    L,
+};
+
+struct conversion_spec {
+    size_t size; // number of characters after '%', conversion included
+    char conversion;
+    length_modifier length;
+};
+
+// Parse the conversion specification that follows a '%'. Returns false for
+// specifications the ring cannot capture (e.g. '*' width or precision).
+bool parse_conversion(const char* fmt, conversion_spec& spec) {
+    const char* p = fmt;
+    while (*p != '\0' && strchr("-+ #0", *p) != nullptr) {
+        p++;
+    }
+    while (*p != '\0' && strchr("0123456789.", *p) != nullptr) {
+        p++;
+    }
+    spec.length = length_modifier::none;
+    if (p[0] == 'h' && p[1] == 'h') {
+        spec.length = length_modifier::hh;
+        p += 2;
+    } else if (p[0] == 'l' && p[1] == 'l') {
+        spec.length = length_modifier::ll;
+        p += 2;
+    } else if (*p != '\0' && strchr("hlzjtL", *p) != nullptr) {
+        switch (*p) {
+        case 'h':
+            spec.length = length_modifier::h;
+            break;
+        case 'l':
+            spec.length = length_modifier::l;
+            break;
+        case 'z':
+            spec.length = length_modifier::z;
+            break;
+        case 'j':
+            spec.length = length_modifier::j;
+            break;
+        case 't':
+            spec.length = length_modifier::t;
+            break;
+        case 'L':
+            spec.length = length_modifier::L;
+            break;
+        }
+        p++;
+    }
+    if (*p == '\0' || strchr("diouxXcfFeEgGaAsp%", *p) == nullptr) {
+        return false;
+    }
+    spec.conversion = *p;
+    spec.size = p - fmt + 1;
+    return true;
+}
+
+bool is_signed_conversion(char c) { return c == 'd' || c == 'i'; }
+
+bool is_floating_conversion(char c) { return strchr("fFeEgGaA", c) != nullptr; }
+
+uint64_t read_integer_arg(length_modifier length, bool is_signed,
+                          va_list& args) {
+    switch (length) {
+    case length_modifier::l:
+        return is_signed ? va_arg(args, long) : va_arg(args, unsigned long);
+    case length_modifier::ll:
+        return is_signed ? va_arg(args, long long)
+                         : va_arg(args, unsigned long long);
+    case length_modifier::z:
+        return va_arg(args, size_t);
+    case length_modifier::j:
+        return is_signed ? va_arg(args, intmax_t) : va_arg(args, uintmax_t);
+    case length_modifier::t:
+        return va_arg(args, ptrdiff_t);
+    default:
+        return is_signed ? va_arg(args, int) : va_arg(args, unsigned);
+    }
+}
+
+bool capture_record(log_record& rec, const char* fmt, va_list& args) {
+    rec.num_args = 0;
+    rec.strings_used = 0;
+    for (const char* p = fmt; *p != '\0'; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        conversion_spec spec;
+        if (!parse_conversion(p + 1, spec)) {
+            return false;
+        }
+        p += spec.size;
+        if (spec.conversion == '%') {
+            continue;
+        }
+        if (rec.num_args == RECORD_MAX_ARGS) {
+            return false;
+        }
+        uint64_t& arg = rec.args[rec.num_args++];
+        if (spec.conversion == 's') {
+            const char* str = va_arg(args, const char*);
+            if (str == nullptr) {
+                str = "(null)";
+            }
+            size_t avail = RECORD_STRINGS_SIZE - rec.strings_used;
+            size_t len = std::min(strlen(str), avail - 1);
+            memcpy(&rec.strings[rec.strings_used], str, len);
+            rec.strings[rec.strings_used + len] = '\0';
+            arg = rec.strings_used;
+            rec.strings_used += len;
+            if (rec.strings_used < RECORD_STRINGS_SIZE - 1) {
+                rec.strings_used++;
+            }
+        } else if (spec.conversion == 'p') {
+            arg = reinterpret_cast<uintptr_t>(va_arg(args, void*));
+        } else if (is_floating_conversion(spec.conversion)) {
+            double val = spec.length == length_modifier::L
+                             ? static_cast<double>(va_arg(args, long double))
+                             : va_arg(args, double);
+            memcpy(&arg, &val, sizeof(val));
+        } else {
+            arg = read_integer_arg(spec.length,
+                                   is_signed_conversion(spec.conversion), args);
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void append_formatted(std::string& out, const std::string& spec, T value) {
+    char buf[256];
+    int size = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    if (size < 0) {
+        return;
+    }
+    if (static_cast<size_t>(size) < sizeof(buf)) {
+        out.append(buf, size);
+    } else {
+        std::vector<char> big(size + 1);
+        snprintf(big.data(), big.size(), spec.c_str(), value);
+        out.append(big.data(), size);
+    }
+}
+
+void append_integer(std::string& out, const std::string& spec,
+                    const conversion_spec& conv, uint64_t arg) {
+    bool is_signed = is_signed_conversion(conv.conversion);
+    switch (conv.length) {
+    case length_modifier::l:
+        if (is_signed) {
+            append_formatted(out, spec, static_cast<long>(arg));
+        } else {
+            append_formatted(out, spec, static_cast<unsigned long>(arg));
+        }
+        break;
+    case length_modifier::ll:
+        if (is_signed) {
+            append_formatted(out, spec, static_cast<long long>(arg));
+        } else {
+            append_formatted(out, spec, static_cast<unsigned long long>(arg));
+        }
+        break;
+    case length_modifier::z:
+        append_formatted(out, spec, static_cast<size_t>(arg));
+        break;
+    case length_modifier::j:
+        if (is_signed) {
+            append_formatted(out, spec, static_cast<intmax_t>(arg));
+        } else {
+            append_formatted(out, spec, static_cast<uintmax_t>(arg));
+        }
+        break;
+    case length_modifier::t:
+        append_formatted(out, spec, static_cast<ptrdiff_t>(arg));
+        break;
+    default:
+        if (is_signed) {
+            append_formatted(out, spec, static_cast<int>(arg));
+        } else {
+            append_formatted(out, spec, static_cast<unsigned>(arg));
+        }
+        break;
+    }
+}
+
+std::string format_record(const log_record& rec) {
+    if (rec.fmt == nullptr) {
+        return std::string(rec.strings);
+    }
+
+    std::string out;
+    unsigned argidx = 0;
+    for (const char* p = rec.fmt; *p != '\0'; p++) {
+        if (*p != '%') {
+            out += *p;
+            continue;
+        }
+        conversion_spec conv;
+        // Records are only kept if their format could be parsed.
+        parse_conversion(p + 1, conv);
+        std::string spec(p, conv.size + 1);
+        p += conv.size;
+        if (conv.conversion == '%') {
+            out += '%';
+            continue;
+        }
+        uint64_t arg = rec.args[argidx++];
+        if (conv.conversion == 's') {
+            append_formatted(out, spec, &rec.strings[arg]);
+        } else if (conv.conversion == 'p') {
+            append_formatted(
+                out, spec, reinterpret_cast<void*>(static_cast<uintptr_t>(arg)));
+        } else if (is_floating_conversion(conv.conversion)) {
+            double val;
+            memcpy(&val, &arg, sizeof(val));
+            if (conv.length == length_modifier::L) {
+                append_formatted(out, spec, static_cast<long double>(val));
+            } else {
+                append_formatted(out, spec, val);
+            }
+        } else {
+            append_integer(out, spec, conv, arg);
+        }
+    }
+    return out;
+}
+
+struct log_ring {
+    explicit log_ring(uint32_t size) : records(size), head(0) {}
+
+    std::vector<log_record> records;
+    // Only written by the owning thread. Published with release semantics so
+    // that a dump sees complete records.
+    std::atomic<uint64_t> head;
+};
+
+uint32_t gRingSize;
+std::mutex gRingsLock;
+std::vector<std::shared_ptr<log_ring>> gRings;
+// Bumped when the rings are discarded so that threads create new ones.
+std::atomic<uint32_t> gRingsGeneration{1};
+
+log_ring* get_thread_ring() {
+    // The rings are owned by gRings so that records outlive their thread.
+    thread_local log_ring* ring = nullptr;
+    thread_local uint32_t ring_generation = 0;
+    auto generation = gRingsGeneration.load(std::memory_order_acquire);
+    if (ring == nullptr || ring_generation != generation) {
+        auto new_ring = std::make_shared<log_ring>(gRingSize);
+        ring = new_ring.get();
+        ring_generation = generation;
+        std::lock_guard<std::mutex> lock(gRingsLock);
+        gRings.push_back(std::move(new_ring));
+    }
+    return ring;
+}
+
+uint64_t sample_clock() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+} // namespace
+
+void cvk_log_ring_init(uint32_t records_per_thread) {
+    gRingSize = std::max(records_per_thread, 1u);
+}
+
+void cvk_log_ring_reset(uint32_t records_per_thread) {
+    std::lock_guard<std::mutex> lock(gRingsLock);
+    gRings.clear();
+    gRingSize = std::max(records_per_thread, 1u);
+    gRingsGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void cvk_log_ring_append(loglevel level, const char* fmt, va_list& args) {
+    auto ring = get_thread_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    auto& rec = ring->records[head % ring->records.size()];
+
+    rec.timestamp = sample_clock();
+    rec.level = level;
+
+    va_list args_copy;
+    va_copy(args_copy, args);
+    if (capture_record(rec, fmt, args)) {
+        rec.fmt = fmt;
+    } else {
+        rec.fmt = nullptr;
+        rec.num_args = 0;
+        vsnprintf(rec.strings, RECORD_STRINGS_SIZE, fmt, args_copy);
+    }
+    va_end(args_copy);
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void cvk_log_ring_dump(FILE* file) {
+    std::vector<const log_record*> records;
+    {
+        std::lock_guard<std::mutex> lock(gRingsLock);
+        for (auto& ring : gRings) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t size = ring->records.size();
+            uint64_t first = head > size ? head - size : 0;
+            for (uint64_t i = first; i < head; i++) {
+                records.push_back(&ring->records[i % size]);
+            }
+        }
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const log_record* a, const log_record* b) {
+                         return a->timestamp < b->timestamp;
+                     });
+
+    for (auto rec : records) {
+        fprintf(file, "[CLVK] %s", format_record(*rec).c_str());
+    }
+    fflush(file);
+}
@@ -0,0 +1,35 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+
+#include "log.hpp"
+
+// Binary logging backend. Each thread appends fixed-size records holding the
+// format string and the raw arguments to its own ring, without taking any
+// lock. Records are only formatted when the rings are dumped. When a ring is
+// full, the oldest records are overwritten.
+
+void cvk_log_ring_init(uint32_t records_per_thread);
+// Discard the records of all the rings and use rings of
+// `records_per_thread` records from now on. Must not be called while other
+// threads are logging.
+void cvk_log_ring_reset(uint32_t records_per_thread);
+void cvk_log_ring_append(loglevel level, const char* fmt, va_list& args);
+// Format the records of all the rings in timestamp order. Must not be called
+// while other threads are logging.
+void cvk_log_ring_dump(FILE* file);
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cmath>
 
 #include "image_format.hpp"
@@ -19,63 +20,131 @@
 #include "queue.hpp"
 
 bool cvk_mem::map_memory() {
-    std::lock_guard<std::mutex> lock(m_map_lock);
     cvk_debug("%p::map", this);
 
-    if (m_map_count == 0) {
-        if (m_parent != nullptr) {
-            if (!m_parent->map()) {
-                return false;
-            }
-            m_map_ptr = pointer_offset(m_parent->host_va(), m_parent_offset);
-            cvk_debug("%p::map, sub-buffer, map_ptr = %p", this, m_map_ptr);
-        } else {
-            auto res = m_memory->map(&m_map_ptr);
-            if (res != VK_SUCCESS) {
-                return false;
+    {
+        // Persistently mapped memory is never unmapped, maps don't need the
+        // lock once it has been mapped
+        std::unique_lock<std::mutex> lock(m_map_lock, std::defer_lock);
+        if (!m_map_persistent.load(std::memory_order_acquire)) {
+            lock.lock();
+        }
+
+        if (m_map_ptr.load(std::memory_order_relaxed) == nullptr) {
+            void* map_ptr;
+            bool persistent;
+            if (m_parent != nullptr) {
+                if (!m_parent->map_memory()) {
+                    return false;
+                }
+                map_ptr = pointer_offset(m_parent->host_va(), m_parent_offset);
+                // The parent stays mapped while the sub-buffer is mapped,
+                // unless it is persistently mapped
+                persistent =
+                    m_parent->m_map_persistent.load(std::memory_order_acquire);
+                if (persistent) {
+                    m_parent->unmap_memory();
+                }
+                cvk_debug("%p::map, sub-buffer, map_ptr = %p", this, map_ptr);
+            } else {
+                auto res = m_memory->map(&map_ptr);
+                if (res != VK_SUCCESS) {
+                    return false;
+                }
+                persistent = m_memory->persistent_map();
+                cvk_debug("%p::map, map_ptr = %p, persistent = %d", this,
+                          map_ptr, persistent);
             }
-            cvk_debug("%p::map, map_ptr = %p", this, m_map_ptr);
+            m_map_ptr.store(map_ptr, std::memory_order_release);
+            m_map_persistent.store(persistent, std::memory_order_release);
         }
+
+        auto map_count = ++m_map_count;
+        cvk_debug("%p::map, new map_count = %u", this, map_count);
     }
 
-    m_map_count++;
     retain();
-    cvk_debug("%p::map, new map_count = %u", this, m_map_count);
 
     return true;
 }
 
 void cvk_mem::unmap_memory() {
-    std::lock_guard<std::mutex> lock(m_map_lock);
     cvk_debug("%p::unmap", this);
 
-    CVK_ASSERT(m_map_count > 0);
-    m_map_count--;
-    release();
-    if (m_map_count == 0) {
-        if (m_parent != nullptr) {
-            m_parent->unmap();
-            cvk_debug("%p::unmap, sub-buffer", this);
-        } else {
-            m_memory->unmap();
-            m_map_ptr = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_map_lock, std::defer_lock);
+        bool persistent = m_map_persistent.load(std::memory_order_acquire);
+        if (!persistent) {
+            lock.lock();
+        }
+
+        CVK_ASSERT(m_map_count > 0);
+        auto map_count = --m_map_count;
+        cvk_debug("%p::unmap, new map_count = %u", this, map_count);
+
+        if (!persistent && (map_count == 0)) {
+            if (m_parent != nullptr) {
+                m_parent->unmap_memory();
+                cvk_debug("%p::unmap, sub-buffer", this);
+            } else {
+                m_memory->unmap();
+            }
+            m_map_ptr.store(nullptr, std::memory_order_relaxed);
         }
     }
-    cvk_debug("%p::unmap, new map_count = %u", this, m_map_count);
+
+    // The last reference may be released here
+    release();
+}
+
+// Ranges passed to vkInvalidateMappedMemoryRanges and
+// vkFlushMappedMemoryRanges must start and end on nonCoherentAtomSize
+// boundaries, or at the end of the allocation.
+static void align_to_non_coherent_atoms(const cvk_device* device,
+                                        VkDeviceSize memory_size,
+                                        VkDeviceSize& offset,
+                                        VkDeviceSize& size) {
+    auto atom = device->vulkan_limits().nonCoherentAtomSize;
+    auto end = std::min(ceil_div(offset + size, atom) * atom, memory_size);
+    offset -= offset % atom;
+    size = end - offset;
 }
 
 void cvk_mem::invalidate_memory(VkDeviceSize offset, VkDeviceSize size) {
     if (m_parent != nullptr) {
         m_parent->invalidate_memory(offset + m_parent_offset, size);
-    } else {
+    } else if (size != 0) {
+        align_to_non_coherent_atoms(m_context->device(), m_memory->size(),
+                                    offset, size);
         m_memory->invalidate(offset, size);
     }
 }
 
+void cvk_mem::invalidate_partial_atoms(VkDeviceSize offset,
+                                       VkDeviceSize size) {
+    if (m_parent != nullptr) {
+        m_parent->invalidate_partial_atoms(offset + m_parent_offset, size);
+    } else if (size != 0) {
+        auto atom = m_context->device()->vulkan_limits().nonCoherentAtomSize;
+        auto end = offset + size;
+        bool partial_head = (offset % atom) != 0;
+        bool partial_tail = ((end % atom) != 0) && (end < m_memory->size());
+        if (partial_head) {
+            invalidate_memory(offset, 1);
+        }
+        if (partial_tail &&
+            !(partial_head && ((end - 1) / atom == offset / atom))) {
+            invalidate_memory(end - 1, 1);
+        }
+    }
+}
+
 void cvk_mem::flush_memory(VkDeviceSize offset, VkDeviceSize size) {
     if (m_parent != nullptr) {
         m_parent->flush_memory(offset + m_parent_offset, size);
-    } else {
+    } else if (size != 0) {
+        align_to_non_coherent_atoms(m_context->device(), m_memory->size(),
+                                    offset, size);
         m_memory->flush(offset, size);
     }
 }
@@ -96,15 +165,222 @@ cvk_buffer::create(cvk_context* context, cl_mem_flags flags, size_t size,
     return buffer;
 }
 
+std::unique_ptr<cvk_buffer> cvk_buffer::create_svm(cvk_context* context,
+                                                   cl_mem_flags flags,
+                                                   size_t size,
+                                                   cl_int* errcode_ret) {
+    std::vector<cl_mem_properties> properties;
+    auto buffer = std::make_unique<cvk_buffer>(
+        context, flags, size, nullptr, nullptr, 0, std::move(properties));
+    buffer->m_svm = true;
+
+    if (!buffer->init()) {
+        *errcode_ret = CL_OUT_OF_RESOURCES;
+        return nullptr;
+    }
+
+    *errcode_ret = CL_SUCCESS;
+    return buffer;
+}
+
+bool cvk_memory_allocation::map_at_address(const cvk_device* device,
+                                           void* address) {
+    // The host address range is already in use when the regular mapping is
+    // at the device address, as on devices that share their address space
+    // with the host
+    void* map_ptr;
+    if (map(&map_ptr) == VK_SUCCESS) {
+        if (map_ptr == address) {
+            m_persistent_map = true;
+            return true;
+        }
+        unmap();
+    }
+
+    if (reinterpret_cast<uintptr_t>(address) % device->svm_alignment() != 0) {
+        cvk_error_fn("device address %p is not aligned for a placed map",
+                     address);
+        return false;
+    }
+
+    if (!cvk_reserve_address_range(address, m_size)) {
+        cvk_error_fn("host address range at %p (%zu bytes) is not available",
+                     address, static_cast<size_t>(m_size));
+        return false;
+    }
+
+    auto res = map_placed(device->vkfns(), address);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not map memory at %p: %s", address,
+                     vulkan_error_string(res));
+        cvk_release_address_range(address, m_size);
+        return false;
+    }
+
+    return true;
+}
+
+bool cvk_buffer::map_at_device_address() {
+    auto device = m_context->device();
+    auto address = reinterpret_cast<void*>(device_address());
+
+    if (!m_memory->map_at_address(device, address)) {
+        return false;
+    }
+
+    cvk_debug_fn("%p mapped at its device address %p", this, address);
+
+    return true;
+}
+
+bool cvk_buffer::import_host_ptr() {
+    auto device = m_context->device();
+    auto vkdev = device->vulkan_device();
+
+    cvk_device::allocation_parameters params =
+        device->select_memory_for(m_buffer, m_host_ptr);
+    if ((params.memory_type_index == VK_MAX_MEMORY_TYPES) ||
+        (params.size > m_size)) {
+        return false;
+    }
+
+    auto memory = std::make_shared<cvk_memory_allocation>(
+        vkdev, m_size, params.memory_type_index,
+        device->memory_heap_index(params.memory_type_index),
+        params.memory_coherent);
+    auto res =
+        memory->import_host_ptr(device->uses_physical_addressing(), m_host_ptr);
+    if (res != VK_SUCCESS) {
+        cvk_debug_fn("could not import host pointer %p: %s", m_host_ptr,
+                     vulkan_error_string(res));
+        return false;
+    }
+
+    res = vkBindBufferMemory(vkdev, m_buffer, memory->vulkan_memory(), 0);
+    if (res != VK_SUCCESS) {
+        return false;
+    }
+
+    m_memory = std::move(memory);
+    m_imported_host_ptr = true;
+    cvk_debug_fn("%p uses imported host pointer %p", this, m_host_ptr);
+
+    return true;
+}
+
+// Import the memory of a resource from a file descriptor. The allocation
+// covers the whole exported payload when its size can be queried. The memory
+// type of an opaque file descriptor must match the exporting allocation but
+// cannot be queried. Imports into another type are rejected by drivers so the
+// candidate types are tried in order of preference.
+static std::shared_ptr<cvk_memory_allocation>
+import_fd_memory(cvk_device* device, const VkMemoryRequirements& memreqs,
+                 uint32_t (cvk_device::*select_type)(uint32_t) const,
+                 cl_external_memory_handle_type_khr type, int fd,
+                 const VkMemoryDedicatedAllocateInfo* dedicated) {
+    auto size = std::max<VkDeviceSize>(memreqs.size, cvk_fd_size(fd));
+    auto handle_type = vulkan_external_memory_handle_type(type);
+    uint32_t type_bits =
+        memreqs.memoryTypeBits & device->external_memory_type_bits(type, fd);
+
+    while (true) {
+        auto type_index = (device->*select_type)(type_bits);
+        if (type_index == VK_MAX_MEMORY_TYPES) {
+            cvk_error_fn("no memory type to import fd %d into", fd);
+            return nullptr;
+        }
+
+        auto memory = std::make_shared<cvk_memory_allocation>(
+            device->vulkan_device(), size, type_index,
+            device->memory_heap_index(type_index),
+            device->memory_index_is_coherent(type_index));
+        auto res = memory->import_fd(device->uses_physical_addressing(),
+                                     handle_type, fd, dedicated);
+        if (res == VK_SUCCESS) {
+            cvk_debug_fn("imported fd %d into memory type %u (%zu bytes)", fd,
+                         type_index, static_cast<size_t>(size));
+            return memory;
+        }
+        if (res != VK_ERROR_INVALID_EXTERNAL_HANDLE) {
+            cvk_error_fn("could not import fd %d: %s", fd,
+                         vulkan_error_string(res));
+            return nullptr;
+        }
+        type_bits &= ~(1U << type_index);
+    }
+}
+
+bool cvk_buffer::import_external_memory(
+    cl_external_memory_handle_type_khr type, int fd) {
+    auto device = m_context->device();
+    auto vkdev = device->vulkan_device();
+
+    auto features = device->external_buffer_features(
+        prepare_usage_flags(), vulkan_external_memory_handle_type(type));
+    if (!(features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT)) {
+        cvk_error_fn("buffer cannot be imported from handle type %x", type);
+        return false;
+    }
+
+    const VkMemoryDedicatedAllocateInfo dedicatedInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO, nullptr,
+        VK_NULL_HANDLE, // image
+        m_buffer,       // buffer
+    };
+    bool dedicated = features & VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT;
+
+    // Buffers are mapped directly so the memory must be host visible
+    VkMemoryRequirements memreqs;
+    vkGetBufferMemoryRequirements(vkdev, m_buffer, &memreqs);
+    auto memory = import_fd_memory(
+        device, memreqs, &cvk_device::memory_type_index_for_buffer, type, fd,
+        dedicated ? &dedicatedInfo : nullptr);
+    if (memory == nullptr) {
+        return false;
+    }
+
+    auto res = vkBindBufferMemory(vkdev, m_buffer, memory->vulkan_memory(), 0);
+    if (res != VK_SUCCESS) {
+        return false;
+    }
+
+    m_memory = std::move(memory);
+    cvk_debug_fn("%p uses memory imported from fd %d", this, fd);
+
+    return true;
+}
+
 bool cvk_buffer::init() {
     auto device = m_context->device();
     auto vkdev = device->vulkan_device();
 
+    // Try to use the application's memory directly for CL_MEM_USE_HOST_PTR
+    // buffers. The buffer can still be bound to regular memory if the import
+    // fails.
+    bool try_import = has_flags(CL_MEM_USE_HOST_PTR) &&
+                      device->can_import_host_ptr(m_host_ptr, m_size);
+
+    VkExternalMemoryBufferCreateInfo externalInfo = {
+        VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO, nullptr,
+        VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT};
+
+    // Buffers created from an external memory handle are always backed by
+    // the imported memory
+    cl_external_memory_handle_type_khr external_type;
+    int external_fd;
+    bool is_external = external_memory_handle(&external_type, &external_fd);
+    if (is_external) {
+        externalInfo.handleTypes =
+            vulkan_external_memory_handle_type(external_type);
+    }
+
+    bool use_external_info = try_import || is_external;
+
     // Create the buffer
     const VkBufferCreateInfo createInfo = {
-        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, // sType
-        nullptr,                              // pNext
-        0,                                    // flags
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,        // sType
+        use_external_info ? &externalInfo : nullptr, // pNext
+        0,                                           // flags
         m_size,
         prepare_usage_flags(), // usage
         VK_SHARING_MODE_EXCLUSIVE,
@@ -118,6 +394,14 @@ bool cvk_buffer::init() {
         return false;
     }
 
+    if (is_external) {
+        return import_external_memory(external_type, external_fd);
+    }
+
+    if (try_import && import_host_ptr()) {
+        return true;
+    }
+
     // Select memory type
     cvk_device::allocation_parameters params =
         device->select_memory_for(m_buffer, flags());
@@ -125,9 +409,18 @@ bool cvk_buffer::init() {
         return false;
     }
 
+    // Placed maps of SVM allocations cover whole multiples of the placed map
+    // alignment
+    if (m_svm) {
+        auto alignment = device->svm_alignment();
+        params.size = ceil_div(params.size, alignment) * alignment;
+    }
+
     // Allocate memory
     m_memory = std::make_shared<cvk_memory_allocation>(
-        vkdev, params.size, params.memory_type_index, params.memory_coherent);
+        vkdev, params.size, params.memory_type_index,
+        device->memory_heap_index(params.memory_type_index),
+        params.memory_coherent);
     res = m_memory->allocate(device->uses_physical_addressing());
 
     if (res != VK_SUCCESS) {
@@ -141,6 +434,10 @@ bool cvk_buffer::init() {
         return false;
     }
 
+    if (m_svm) {
+        return map_at_device_address();
+    }
+
     if (has_any_flag(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR)) {
         if (!copy_from(m_host_ptr, 0, m_size)) {
             return false;
@@ -403,6 +700,18 @@ bool cvk_image::init_vulkan_image() {
         return false; // TODO error code
     }
 
+    // Images created with host data are initialised directly from the host
+    // when possible
+    bool has_host_data =
+        has_any_flag(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR);
+    VkImageUsageFlags usage = prepare_usage_flags();
+    bool use_host_image_copy =
+        has_host_data && config.host_image_copy() &&
+        device->supports_host_image_copy(fmt.vkfmt, image_type, usage);
+    if (use_host_image_copy) {
+        usage |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    }
+
     // Create Image
     VkImageCreateInfo imageCreateInfo = {
         VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -415,13 +724,36 @@ bool cvk_image::init_vulkan_image() {
         array_layers,              // arrayLayers
         VK_SAMPLE_COUNT_1_BIT,     // samples
         VK_IMAGE_TILING_OPTIMAL,   // tiling
-        prepare_usage_flags(),     // usage
+        usage,                     // usage
         VK_SHARING_MODE_EXCLUSIVE, // sharingMode
         0,                         // queueFamilyIndexCount
         nullptr,                   // pQueueFamilyIndices
         VK_IMAGE_LAYOUT_UNDEFINED, // initialLayout
     };
 
+    // Images created from an external memory handle are backed by the
+    // imported memory
+    cl_external_memory_handle_type_khr external_type;
+    int external_fd;
+    bool is_external = external_memory_handle(&external_type, &external_fd);
+    VkExternalMemoryImageCreateInfo externalInfo = {
+        VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO, nullptr,
+        0, // handleTypes
+    };
+    VkExternalMemoryFeatureFlags external_features = 0;
+    if (is_external) {
+        externalInfo.handleTypes =
+            vulkan_external_memory_handle_type(external_type);
+        imageCreateInfo.pNext = &externalInfo;
+        external_features = device->external_image_features(
+            imageCreateInfo, vulkan_external_memory_handle_type(external_type));
+        if (!(external_features & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT)) {
+            cvk_error_fn("image cannot be imported from handle type %x",
+                         external_type);
+            return false;
+        }
+    }
+
     auto vkdev = device->vulkan_device();
 
     auto res = vkCreateImage(vkdev, &imageCreateInfo, nullptr, &m_image);
@@ -431,23 +763,44 @@ bool cvk_image::init_vulkan_image() {
     }
 
     CVK_ASSERT(m_desc.image_type != CL_MEM_OBJECT_IMAGE1D_BUFFER);
-    // Select memory type
-    cvk_device::allocation_parameters params =
-        device->select_memory_for(m_image);
-    if (params.memory_type_index == VK_MAX_MEMORY_TYPES) {
-        cvk_error_fn("Could not get memory type!");
-        return false;
-    }
+    if (is_external) {
+        const VkMemoryDedicatedAllocateInfo dedicatedInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO, nullptr,
+            m_image,        // image
+            VK_NULL_HANDLE, // buffer
+        };
+        bool dedicated =
+            external_features & VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT;
+
+        VkMemoryRequirements memreqs;
+        vkGetImageMemoryRequirements(vkdev, m_image, &memreqs);
+        m_memory = import_fd_memory(
+            device, memreqs, &cvk_device::memory_type_index_for_image,
+            external_type, external_fd, dedicated ? &dedicatedInfo : nullptr);
+        if (m_memory == nullptr) {
+            return false;
+        }
+    } else {
+        // Select memory type
+        cvk_device::allocation_parameters params =
+            device->select_memory_for(m_image);
+        if (params.memory_type_index == VK_MAX_MEMORY_TYPES) {
+            cvk_error_fn("Could not get memory type!");
+            return false;
+        }
 
-    // Allocate memory
-    m_memory = std::make_unique<cvk_memory_allocation>(
-        vkdev, params.size, params.memory_type_index, params.memory_coherent);
+        // Allocate memory
+        m_memory = std::make_unique<cvk_memory_allocation>(
+            vkdev, params.size, params.memory_type_index,
+            device->memory_heap_index(params.memory_type_index),
+            params.memory_coherent);
 
-    res = m_memory->allocate(device->uses_physical_addressing());
+        res = m_memory->allocate(device->uses_physical_addressing());
 
-    if (res != VK_SUCCESS) {
-        cvk_error_fn("Could not allocate memory!");
-        return false;
+        if (res != VK_SUCCESS) {
+            cvk_error_fn("Could not allocate memory!");
+            return false;
+        }
     }
 
     // Bind the image to memory
@@ -493,44 +846,294 @@ bool cvk_image::init_vulkan_image() {
         return false;
     }
 
-    if (has_any_flag(CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR)) {
-        // Create a staging buffer to copy to the device later.
-        cl_int ret;
-        m_init_data = cvk_buffer::create(m_context, CL_MEM_READ_ONLY,
-                                         host_ptr_size, nullptr, &ret);
-        if (ret != CL_SUCCESS) {
-            cvk_error("Could not create staging buffer for image host_ptr");
+    // Imported images start in the VK_IMAGE_LAYOUT_UNDEFINED layout. Their
+    // first acquire transitions them from the VK_IMAGE_LAYOUT_GENERAL layout
+    // the exporter has to release them in, which preserves their content.
+    // Images used before being acquired are initialised on first use like
+    // any other image.
+    if (is_external) {
+        return true;
+    }
+
+    if (has_host_data) {
+        bool uploaded =
+            use_host_image_copy
+                ? upload_host_data_with_host_image_copy(host_ptr_size)
+                : upload_host_data_through_staging(host_ptr_size);
+        if (!uploaded) {
+            cvk_error_fn("Could not initialise image with host_ptr data");
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_init_tracker.mutex());
+        m_init_tracker.set_state(cvk_mem_init_state::completed);
+    } else if (config.init_image_at_creation()) {
+        auto queue = m_context->get_or_create_image_init_command_queue();
+        if (queue == nullptr) {
             return false;
         }
 
-        if (!m_init_data->copy_from(m_host_ptr, 0, host_ptr_size)) {
-            cvk_error(
-                "Could not copy image host_ptr data to the staging buffer");
+        auto initimage = new cvk_command_image_init(queue, this);
+        auto ret =
+            queue->enqueue_command_with_deps(initimage, 0, nullptr, nullptr);
+        if (ret != CL_SUCCESS) {
             return false;
         }
+        ret = queue->finish();
+        if (ret != CL_SUCCESS) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_init_tracker.mutex());
+        m_init_tracker.set_state(cvk_mem_init_state::completed);
+    }
+
+    return true;
+}
+
+VkBufferImageCopy cvk_image::host_data_copy_region() const {
+    uint32_t row_length = row_pitch() ? row_pitch() / element_size() : width();
+    uint32_t image_height = slice_pitch()
+                                ? slice_pitch() / row_length / element_size()
+                                : height();
+    uint32_t layer_count = 1;
+    if ((type() == CL_MEM_OBJECT_IMAGE1D_ARRAY) ||
+        (type() == CL_MEM_OBJECT_IMAGE2D_ARRAY)) {
+        layer_count = array_size();
+    }
+    VkImageSubresourceLayers subresource = {
+        VK_IMAGE_ASPECT_COLOR_BIT, // aspectMask
+        0,                         // mipLevel
+        0,                         // baseArrayLayer
+        layer_count,               // layerCount
+    };
 
-        if (config.init_image_at_creation()) {
-            auto queue = m_context->get_or_create_image_init_command_queue();
-            if (queue == nullptr) {
-                return false;
+    VkExtent3D extent;
+    extent.width = width();
+    extent.height = height();
+    extent.depth = depth();
+
+    switch (type()) {
+    case CL_MEM_OBJECT_IMAGE2D:
+    case CL_MEM_OBJECT_IMAGE2D_ARRAY:
+        extent.depth = 1;
+        break;
+    case CL_MEM_OBJECT_IMAGE1D_BUFFER:
+    case CL_MEM_OBJECT_IMAGE1D:
+    case CL_MEM_OBJECT_IMAGE1D_ARRAY:
+        extent.height = 1;
+        extent.depth = 1;
+        break;
+    default:
+        break;
+    }
+
+    return {
+        0,            // bufferOffset
+        row_length,   // bufferRowLength
+        image_height, // bufferImageHeight
+        subresource,  // imageSubresource
+        {0, 0, 0},    // imageOffset
+        extent,       // imageExtent
+    };
+}
+
+bool cvk_image::upload_host_data_with_host_image_copy(size_t host_ptr_size) {
+    TRACE_FUNCTION("image", (uintptr_t)this, "size", host_ptr_size);
+
+    auto device = m_context->device();
+    auto vkdev = device->vulkan_device();
+    auto& vkfns = device->vkfns();
+    auto region = host_data_copy_region();
+
+    // VK_IMAGE_LAYOUT_GENERAL is always supported for host copies
+    VkHostImageLayoutTransitionInfoEXT transition = {
+        VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT,
+        nullptr,
+        m_image,                   // image
+        VK_IMAGE_LAYOUT_UNDEFINED, // oldLayout
+        VK_IMAGE_LAYOUT_GENERAL,   // newLayout
+        {
+            VK_IMAGE_ASPECT_COLOR_BIT, // aspectMask
+            0,                         // baseMipLevel
+            VK_REMAINING_MIP_LEVELS,   // levelCount
+            0,                         // baseArrayLayer
+            VK_REMAINING_ARRAY_LAYERS, // layerCount
+        }, // subresourceRange
+    };
+    auto res = vkfns.vkTransitionImageLayoutEXT(vkdev, 1, &transition);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not transition image layout: %s",
+                     vulkan_error_string(res));
+        return false;
+    }
+
+    VkMemoryToImageCopyEXT copy = {
+        VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT,
+        nullptr,
+        m_host_ptr,                // pHostPointer
+        region.bufferRowLength,    // memoryRowLength
+        region.bufferImageHeight,  // memoryImageHeight
+        region.imageSubresource,   // imageSubresource
+        region.imageOffset,        // imageOffset
+        region.imageExtent,        // imageExtent
+    };
+    VkCopyMemoryToImageInfoEXT copyInfo = {
+        VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT,
+        nullptr,
+        0,                       // flags
+        m_image,                 // dstImage
+        VK_IMAGE_LAYOUT_GENERAL, // dstImageLayout
+        1,                       // regionCount
+        &copy,                   // pRegions
+    };
+    res = vkfns.vkCopyMemoryToImageEXT(vkdev, &copyInfo);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not copy host data to image: %s",
+                     vulkan_error_string(res));
+        return false;
+    }
+
+    cvk_metric_add(cvk_metric::bytes_copied_to_device, host_ptr_size);
+
+    return true;
+}
+
+bool cvk_image::upload_host_data_through_staging(size_t host_ptr_size) {
+    TRACE_FUNCTION("image", (uintptr_t)this, "size", host_ptr_size);
+
+    // Split the upload into chunks of whole slices (or array layers), or of
+    // rows within a slice when a single slice does not fit in a staging slot
+    struct chunk {
+        size_t offset;
+        size_t size;
+        VkBufferImageCopy region;
+    };
+    std::vector<chunk> chunks;
+
+    auto full = host_data_copy_region();
+    bool is_3d = type() == CL_MEM_OBJECT_IMAGE3D;
+    uint32_t num_slices =
+        is_3d ? full.imageExtent.depth : full.imageSubresource.layerCount;
+    uint32_t rows_per_slice = full.bufferImageHeight
+                                  ? full.bufferImageHeight
+                                  : full.imageExtent.height;
+    size_t row_size = full.bufferRowLength * element_size();
+    size_t slice_size = row_size * rows_per_slice;
+
+    size_t staging_size =
+        std::min(static_cast<size_t>(config.image_upload_staging_size_kb()) *
+                     1024,
+                 host_ptr_size);
+    size_t slot_size = std::max(staging_size / NUM_UPLOAD_STAGING_SLOTS,
+                                std::min(row_size, host_ptr_size));
+
+    auto set_slices = [is_3d](VkBufferImageCopy& region, uint32_t first,
+                              uint32_t count) {
+        if (is_3d) {
+            region.imageOffset.z = first;
+            region.imageExtent.depth = count;
+        } else {
+            region.imageSubresource.baseArrayLayer = first;
+            region.imageSubresource.layerCount = count;
+        }
+    };
+
+    if (slice_size <= slot_size) {
+        uint32_t slices_per_chunk = slot_size / slice_size;
+        for (uint32_t z = 0; z < num_slices; z += slices_per_chunk) {
+            uint32_t count = std::min(slices_per_chunk, num_slices - z);
+            auto region = full;
+            set_slices(region, z, count);
+            chunks.push_back({z * slice_size, count * slice_size, region});
+        }
+    } else {
+        uint32_t rows_per_chunk = slot_size / row_size;
+        for (uint32_t z = 0; z < num_slices; z++) {
+            for (uint32_t y = 0; y < full.imageExtent.height;
+                 y += rows_per_chunk) {
+                uint32_t count =
+                    std::min(rows_per_chunk, full.imageExtent.height - y);
+                auto region = full;
+                region.bufferImageHeight = 0;
+                region.imageOffset.y = y;
+                region.imageExtent.height = count;
+                set_slices(region, z, 1);
+                chunks.push_back(
+                    {z * slice_size + y * row_size, count * row_size, region});
             }
+        }
+    }
 
-            auto initimage = new cvk_command_image_init(queue, this);
-            ret = queue->enqueue_command_with_deps(initimage, 0, nullptr,
-                                                   nullptr);
-            if (ret != CL_SUCCESS) {
-                return false;
+    auto queue = m_context->get_or_create_image_init_command_queue();
+    if (queue == nullptr) {
+        return false;
+    }
+
+    // Reuse a small ring of staging buffers so that filling a slot on the
+    // host overlaps with the copy of the previous one on the device
+    std::array<std::unique_ptr<cvk_buffer>, NUM_UPLOAD_STAGING_SLOTS> slots;
+    std::array<cvk_event*, NUM_UPLOAD_STAGING_SLOTS> slot_events{};
+    bool success = true;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto& chunk = chunks[i];
+        auto slot = i % NUM_UPLOAD_STAGING_SLOTS;
+
+        // Wait for the previous copy from this slot to complete
+        if (slot_events[slot] != nullptr) {
+            success = slot_events[slot]->wait() == CL_COMPLETE;
+            slot_events[slot]->release();
+            slot_events[slot] = nullptr;
+            if (!success) {
+                break;
             }
-            ret = queue->finish();
+        }
+
+        if (slots[slot] == nullptr) {
+            cl_int ret;
+            slots[slot] = cvk_buffer::create(m_context, CL_MEM_READ_ONLY,
+                                             slot_size, nullptr, &ret);
             if (ret != CL_SUCCESS) {
-                return false;
+                cvk_error_fn("could not create staging buffer");
+                success = false;
+                break;
             }
-            std::lock_guard<std::mutex> lock(m_init_tracker.mutex());
-            m_init_tracker.set_state(cvk_mem_init_state::completed);
+        }
+
+        auto size = std::min(chunk.size, host_ptr_size - chunk.offset);
+        if (!slots[slot]->copy_from(pointer_offset(m_host_ptr, chunk.offset),
+                                    0, size)) {
+            success = false;
+            break;
+        }
+
+        auto cmd = new cvk_command_image_upload(
+            queue, this, slots[slot].get(), chunk.region, i == 0,
+            i == chunks.size() - 1);
+        _cl_event* event;
+        if (queue->enqueue_command_with_deps(cmd, 0, nullptr, &event) !=
+            CL_SUCCESS) {
+            success = false;
+            break;
+        }
+        slot_events[slot] = icd_downcast(event);
+
+        if (queue->flush() != CL_SUCCESS) {
+            success = false;
+            break;
         }
     }
 
-    return true;
+    // The staging buffers must outlive all the copies
+    for (auto event : slot_events) {
+        if (event != nullptr) {
+            if (event->wait() != CL_COMPLETE) {
+                success = false;
+            }
+            event->release();
+        }
+    }
+
+    return success;
 }
 
 bool cvk_image::init_vulkan_texel_buffer() {
@@ -17,21 +17,31 @@
 #include <array>
 #include <list>
 
+#include "config.hpp"
 #include "device.hpp"
 #include "event.hpp"
+#include "metrics.hpp"
 #include "objects.hpp"
 #include "utils.hpp"
 
 struct cvk_memory_allocation {
 
     cvk_memory_allocation(VkDevice dev, VkDeviceSize size, uint32_t type_index,
-                          bool coherent)
+                          uint32_t heap_index, bool coherent)
         : m_device(dev), m_size(size), m_memory(VK_NULL_HANDLE),
-          m_memory_type_index(type_index), m_coherent(coherent) {}
+          m_memory_type_index(type_index), m_memory_heap_index(heap_index),
+          m_coherent(coherent),
+          m_persistent_map(coherent &&
+                           (size <= config.persistent_map_max_size_kb() *
+                                        1024ull)) {}
 
     ~cvk_memory_allocation() {
         if (m_memory != VK_NULL_HANDLE) {
+            if (m_map_ptr != nullptr) {
+                vkUnmapMemory(m_device, m_memory);
+            }
             vkFreeMemory(m_device, m_memory, nullptr);
+            cvk_metrics_memory_freed(m_device, m_memory_heap_index, m_size);
         }
     }
 
@@ -47,7 +57,73 @@ struct cvk_memory_allocation {
             m_memory_type_index,
         };
 
-        return vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
+        auto res =
+            vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
+        if (res == VK_SUCCESS) {
+            cvk_metrics_memory_allocated(m_device, m_memory_heap_index,
+                                         m_size);
+        }
+        return res;
+    }
+
+    // Use the host allocation at host_ptr as device memory instead of
+    // allocating new memory.
+    VkResult import_host_ptr(bool physical_addressing, void* host_ptr) {
+        const VkImportMemoryHostPointerInfoEXT importInfo = {
+            VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT, nullptr,
+            VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, host_ptr};
+
+        const VkMemoryAllocateFlagsInfo flagsInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, &importInfo,
+            VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+
+        const VkMemoryAllocateInfo memoryAllocateInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            physical_addressing ? static_cast<const void*>(&flagsInfo)
+                                : static_cast<const void*>(&importInfo),
+            m_size,
+            m_memory_type_index,
+        };
+
+        auto res =
+            vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
+        if (res == VK_SUCCESS) {
+            cvk_metrics_memory_allocated(m_device, m_memory_heap_index,
+                                         m_size);
+        }
+        return res;
+    }
+
+    // Use memory exported by another API or process as a file descriptor
+    // instead of allocating new memory. The file descriptor is owned by the
+    // allocation when the import is successful. dedicated must be passed for
+    // handle types that can only be imported as dedicated allocations.
+    VkResult import_fd(bool physical_addressing,
+                       VkExternalMemoryHandleTypeFlagBits handle_type, int fd,
+                       const VkMemoryDedicatedAllocateInfo* dedicated) {
+        const VkImportMemoryFdInfoKHR importInfo = {
+            VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR, dedicated,
+            handle_type, fd};
+
+        const VkMemoryAllocateFlagsInfo flagsInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, &importInfo,
+            VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+
+        const VkMemoryAllocateInfo memoryAllocateInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            physical_addressing ? static_cast<const void*>(&flagsInfo)
+                                : static_cast<const void*>(&importInfo),
+            m_size,
+            m_memory_type_index,
+        };
+
+        auto res =
+            vkAllocateMemory(m_device, &memoryAllocateInfo, 0, &m_memory);
+        if (res == VK_SUCCESS) {
+            cvk_metrics_memory_allocated(m_device, m_memory_heap_index,
+                                         m_size);
+        }
+        return res;
     }
 
     void invalidate(VkDeviceSize offset, VkDeviceSize size) {
@@ -72,20 +148,77 @@ struct cvk_memory_allocation {
         }
     }
 
-    VkResult map(void** map_ptr) {
-        return vkMapMemory(m_device, m_memory, 0, m_size, 0, map_ptr);
+    // Map the whole allocation at placed_address, which must be a reserved
+    // host address range. map() then returns placed_address.
+    VkResult map_placed(const cvk_vulkan_extension_functions& fns,
+                        void* placed_address) {
+        const VkMemoryMapPlacedInfoEXT placedInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_MAP_PLACED_INFO_EXT, nullptr,
+            placed_address};
+
+        const VkMemoryMapInfoKHR mapInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_MAP_INFO_KHR,
+            &placedInfo,
+            VK_MEMORY_MAP_PLACED_BIT_EXT,
+            m_memory,
+            0,
+            VK_WHOLE_SIZE,
+        };
+
+        void* map_ptr;
+        auto res = fns.vkMapMemory2KHR(m_device, &mapInfo, &map_ptr);
+        if (res == VK_SUCCESS) {
+            CVK_ASSERT(map_ptr == placed_address);
+            m_map_ptr = map_ptr;
+            m_persistent_map = true;
+        }
+        return res;
     }
 
-    void unmap() { vkUnmapMemory(m_device, m_memory); }
+    // Map the whole allocation on the host at address, which is where SVM
+    // allocations must be visible. Devices whose device addresses are host
+    // pointers already map the allocation there, others need a placed map.
+    CHECK_RETURN bool map_at_address(const cvk_device* device, void* address);
+
+    void unmap() {
+        if (m_map_ptr != nullptr) {
+            vkUnmapMemory(m_device, m_memory);
+            m_map_ptr = nullptr;
+        }
+    }
+
+    // Whether the allocation stays mapped until it is freed once it has been
+    // mapped. Small host-coherent allocations and allocations mapped at a
+    // given address do, others are unmapped when they are no longer in use.
+    bool persistent_map() const { return m_persistent_map; }
+
+    // Map the allocation if it is not already mapped. Callers must serialise
+    // calls to map() and unmap().
+    VkResult map(void** map_ptr) {
+        if (m_map_ptr == nullptr) {
+            void* ptr;
+            auto res = vkMapMemory(m_device, m_memory, 0, m_size, 0, &ptr);
+            if (res != VK_SUCCESS) {
+                return res;
+            }
+            m_map_ptr = ptr;
+        }
+        *map_ptr = m_map_ptr;
+        return VK_SUCCESS;
+    }
 
     VkDeviceMemory vulkan_memory() { return m_memory; }
+    VkDeviceSize size() const { return m_size; }
 
 private:
     VkDevice m_device;
     VkDeviceSize m_size;
     VkDeviceMemory m_memory;
     uint32_t m_memory_type_index;
+    uint32_t m_memory_heap_index;
     bool m_coherent;
+    bool m_persistent_map;
+    void* m_map_ptr{};
 };
 
 using cvk_mem_callback_pointer_type = void(CL_CALLBACK*)(cl_mem mem,
@@ -187,6 +320,33 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
         return m_properties;
     }
 
+    // Find the external memory handle the memory object is imported from.
+    // Return false when the memory object is not imported.
+    bool external_memory_handle(cl_external_memory_handle_type_khr* type,
+                                int* fd) const {
+        size_t i = 0;
+        while (i + 1 < m_properties.size()) {
+            auto key = m_properties[i];
+            if (key == CL_MEM_DEVICE_HANDLE_LIST_KHR) {
+                i++;
+                while ((i < m_properties.size()) &&
+                       (m_properties[i] != CL_MEM_DEVICE_HANDLE_LIST_END_KHR)) {
+                    i++;
+                }
+                i++;
+                continue;
+            }
+            if ((key == CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR) ||
+                (key == CL_EXTERNAL_MEMORY_HANDLE_DMA_BUF_KHR)) {
+                *type = key;
+                *fd = static_cast<int>(m_properties[i + 1]);
+                return true;
+            }
+            i += 2;
+        }
+        return false;
+    }
+
     std::shared_ptr<cvk_memory_allocation> memory() const {
         if (m_parent == nullptr) {
             return m_memory;
@@ -228,8 +388,9 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
     }
 
     void* host_va() const {
-        CVK_ASSERT(m_map_ptr != nullptr);
-        return m_map_ptr;
+        auto ptr = m_map_ptr.load(std::memory_order_acquire);
+        CVK_ASSERT(ptr != nullptr);
+        return ptr;
     }
 
     bool CHECK_RETURN map() {
@@ -261,9 +422,10 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
 
     bool CHECK_RETURN copy_to(void* dst, size_t offset, size_t size) {
         if (map_to_read(offset, size)) {
-            void* src = pointer_offset(m_map_ptr, offset);
+            void* src = pointer_offset(host_va(), offset);
             memcpy(dst, src, size);
             unmap_read_only();
+            cvk_metric_add(cvk_metric::bytes_copied_from_device, size);
             return true;
         }
         return false;
@@ -272,7 +434,7 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
     bool CHECK_RETURN copy_to(cvk_mem* dst, size_t src_offset,
                               size_t dst_offset, size_t size) {
         if (map_to_read(src_offset, size) && dst->map_write_only()) {
-            void* src_ptr = pointer_offset(m_map_ptr, src_offset);
+            void* src_ptr = pointer_offset(host_va(), src_offset);
             void* dst_ptr = pointer_offset(dst->host_va(), dst_offset);
             memcpy(dst_ptr, src_ptr, size);
             dst->unmap_to_write(dst_offset, size);
@@ -284,9 +446,10 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
 
     bool CHECK_RETURN copy_from(const void* src, size_t offset, size_t size) {
         if (map_write_only()) {
-            void* dst = pointer_offset(m_map_ptr, offset);
+            void* dst = pointer_offset(host_va(), offset);
             memcpy(dst, src, size);
             unmap_to_write(offset, size);
+            cvk_metric_add(cvk_metric::bytes_copied_to_device, size);
             return true;
         }
         return false;
@@ -295,17 +458,25 @@ struct cvk_mem : public _cl_mem, api_object<object_magic::memory_object> {
     cvk_mem_init_tracker& init_tracker() { return m_init_tracker; }
 
     void invalidate_memory(VkDeviceSize offset, VkDeviceSize size);
+    // Invalidate the non-coherent atoms that the range only partly covers.
+    // Flushes cover whole atoms, so the bytes of those atoms outside the range
+    // must be up to date when the range itself is not invalidated.
+    void invalidate_partial_atoms(VkDeviceSize offset, VkDeviceSize size);
 
-private:
+protected:
+    // Map and unmap the memory without any cache maintenance
     bool CHECK_RETURN map_memory();
     void unmap_memory();
     void flush_memory(VkDeviceSize offset, VkDeviceSize size);
 
+private:
     cl_mem_object_type m_type;
     std::mutex m_map_lock;
     cl_mem_flags m_flags;
-    uint32_t m_map_count;
-    void* m_map_ptr;
+    std::atomic<uint32_t> m_map_count;
+    // Set by the first map when the memory stays mapped from then on
+    std::atomic<bool> m_map_persistent{};
+    std::atomic<void*> m_map_ptr;
     std::mutex m_callbacks_lock;
     std::vector<cvk_mem_callback> m_callbacks;
     std::vector<cl_mem_properties> m_properties;
@@ -374,6 +545,15 @@ struct cvk_buffer : public cvk_mem {
            std::vector<cl_mem_properties>&& properties, cl_int* errcode_ret);
     cvk_mem* create_subbuffer(cl_mem_flags, size_t origin, size_t size);
 
+    // Create the buffer backing a coarse-grained SVM allocation. Its memory
+    // is mapped on the host at its device address for its whole lifetime.
+    static std::unique_ptr<cvk_buffer> create_svm(cvk_context* context,
+                                                  cl_mem_flags flags,
+                                                  size_t size,
+                                                  cl_int* errcode_ret);
+
+    bool is_svm() const { return m_svm; }
+
     VkBufferUsageFlags prepare_usage_flags() {
         VkBufferUsageFlags usage_flags =
             VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
@@ -401,6 +581,18 @@ struct cvk_buffer : public cvk_mem {
         return m_parent_offset;
     }
 
+    // Whether the buffer memory is the application's CL_MEM_USE_HOST_PTR
+    // allocation. When it is, no copy to or from host_ptr() is needed.
+    bool uses_imported_host_ptr() const {
+        if (m_parent == nullptr) {
+            return m_imported_host_ptr;
+        } else {
+            const cvk_mem* parent = m_parent;
+            return static_cast<const cvk_buffer*>(parent)
+                ->uses_imported_host_ptr();
+        }
+    }
+
     void* map_ptr(size_t offset) const {
         void* ptr;
         if (has_flags(CL_MEM_USE_HOST_PTR)) {
@@ -418,7 +610,8 @@ struct cvk_buffer : public cvk_mem {
                                 size_t size, cl_map_flags flags,
                                 cvk_image* image) {
 
-        if (!map()) {
+        // The mapped range is invalidated when the mapping is inserted
+        if (!map_memory()) {
             return false;
         }
 
@@ -434,57 +627,114 @@ struct cvk_buffer : public cvk_mem {
 
     bool insert_mapping(const cvk_buffer_mapping& mapping) {
         std::lock_guard<std::mutex> lock(m_mappings_lock);
-        auto num_mappings_with_same_pointer = m_mappings.count(mapping.ptr);
-        // TODO support multiple mappings with the same pointer
-        if (num_mappings_with_same_pointer != 0) {
-            return false;
-        }
 
         // memory has been mapped when the mapping has been created (when the
         // enqueue command has been created). We need to invalidate it before
-        // the command execution to make sure of the content of the memory.
-        invalidate_memory(mapping.offset, mapping.size);
+        // the command execution to make sure of the content of the memory,
+        // unless the application discards it.
+        if ((mapping.flags & CL_MAP_WRITE_INVALIDATE_REGION) == 0) {
+            invalidate_memory(mapping.offset, mapping.size);
+        } else {
+            invalidate_partial_atoms(mapping.offset, mapping.size);
+        }
 
-        m_mappings.insert({mapping.ptr, mapping});
+        m_mappings[mapping.ptr].mappings.push_back(mapping);
 
         return true;
     }
 
+    // The size of the returned mapping is that of the range the application
+    // may have written to and that must be written back to the buffer. It is
+    // only non-zero for the last unmap of a pointer.
     cvk_buffer_mapping remove_mapping(void* ptr) {
         std::lock_guard<std::mutex> lock(m_mappings_lock);
         CVK_ASSERT(m_mappings.count(ptr) > 0);
-        auto mapping = m_mappings.at(ptr);
-        m_mappings.erase(ptr);
-        mapping.buffer->unmap();
+        auto& entry = m_mappings.at(ptr);
+        auto& mappings = entry.mappings;
+        auto mapping = mappings.front();
+        mappings.pop_front();
+        if (mapping.flags != CL_MAP_READ) {
+            entry.written_size = std::max(entry.written_size, mapping.size);
+        }
+        mapping.size = 0;
+        if (mappings.empty()) {
+            mapping.size = entry.written_size;
+            m_mappings.erase(ptr);
+        }
+        mapping.buffer->flush_memory(mapping.offset, mapping.size);
+        mapping.buffer->unmap_memory();
         mapping.image.reset(nullptr);
         return mapping;
     }
 
     void cleanup_mapping(cvk_buffer_mapping& mapping) {
         std::lock_guard<std::mutex> lock(m_mappings_lock);
-        if (m_mappings.count(mapping.ptr)) {
-            m_mappings.erase(mapping.ptr);
+        auto it = m_mappings.find(mapping.ptr);
+        if (it != m_mappings.end()) {
+            // Remove one mapping identical to the one being cleaned up, if it
+            // was inserted
+            auto& mappings = it->second.mappings;
+            for (auto m = mappings.begin(); m != mappings.end(); ++m) {
+                if ((m->offset == mapping.offset) &&
+                    (m->size == mapping.size) && (m->flags == mapping.flags)) {
+                    mappings.erase(m);
+                    break;
+                }
+            }
+            if (mappings.empty()) {
+                mapping.buffer->flush_memory(mapping.offset,
+                                             it->second.written_size);
+                m_mappings.erase(it);
+            }
         }
-        mapping.buffer->unmap();
+        mapping.buffer->unmap_memory();
     }
 
+    // The address of the parent buffer is queried once, sub-buffer addresses
+    // are derived from it. Kernels taking many sub-buffers of one buffer do
+    // not need any Vulkan call to set their arguments.
     uint64_t device_address() const {
-        VkBufferDeviceAddressInfo info{};
-        info.buffer = vulkan_buffer();
-        info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-        info.pNext = NULL;
-        auto device = context()->device();
-        auto vkdev = device->vulkan_device();
-        auto device_address =
-            device->vkfns().vkGetBufferDeviceAddressKHR(vkdev, &info);
-        return device_address + vulkan_buffer_offset();
+        if (m_parent != nullptr) {
+            const cvk_mem* parent = m_parent;
+            return static_cast<const cvk_buffer*>(parent)->device_address() +
+                   vulkan_buffer_offset();
+        }
+        auto device_address = m_device_address.load(std::memory_order_relaxed);
+        if (device_address == 0) {
+            VkBufferDeviceAddressInfo info{};
+            info.buffer = vulkan_buffer();
+            info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+            info.pNext = NULL;
+            auto device = context()->device();
+            auto vkdev = device->vulkan_device();
+            device_address =
+                device->vkfns().vkGetBufferDeviceAddressKHR(vkdev, &info);
+            m_device_address.store(device_address, std::memory_order_relaxed);
+        }
+        return device_address;
     }
 
 private:
     bool init();
+    bool import_host_ptr();
+    bool import_external_memory(cl_external_memory_handle_type_khr type,
+                                int fd);
+    bool map_at_device_address();
 
     VkBuffer m_buffer;
-    std::unordered_map<void*, cvk_buffer_mapping> m_mappings;
+    bool m_imported_host_ptr{};
+    bool m_svm{};
+    mutable std::atomic<uint64_t> m_device_address{};
+    // Mappings returning the same pointer all start at the same offset. They
+    // are unmapped in the order they were made but the application may write
+    // through the pointer until all of them have been unmapped, so the ranges
+    // of the write mappings are flushed together with the last unmap.
+    struct pointer_mappings {
+        std::list<cvk_buffer_mapping> mappings;
+        // Size of the written range of the write mappings already unmapped
+        size_t written_size{};
+    };
+    std::unordered_map<void*, pointer_mappings> m_mappings;
     std::mutex m_mappings_lock;
 };
 
@@ -790,10 +1040,6 @@ struct cvk_image : public cvk_mem {
         }
     }
 
-    const cvk_buffer* init_data() const { return m_init_data.get(); }
-
-    void discard_init_data() { m_init_data.reset(); }
-
     static constexpr int MAX_NUM_CHANNELS = 4;
     static constexpr int MAX_CHANNEL_SIZE = 4;
     static constexpr int FILL_PATTERN_MAX_SIZE =
@@ -808,6 +1054,14 @@ private:
     bool init_vulkan_texel_buffer();
     bool init();
 
+    // Copy region describing the whole image and the layout of its host data
+    VkBufferImageCopy host_data_copy_region() const;
+    bool upload_host_data_with_host_image_copy(size_t host_ptr_size);
+    // Stream the host data through a ring of staging buffers whose total size
+    // is bounded by config.image_upload_staging_size_kb
+    bool upload_host_data_through_staging(size_t host_ptr_size);
+    static constexpr size_t NUM_UPLOAD_STAGING_SLOTS = 2;
+
     size_t num_channels() const {
         switch (m_format.image_channel_order) {
         case CL_R:
@@ -862,5 +1116,4 @@ private:
     VkBufferView m_buffer_view;
     std::unordered_map<void*, std::list<cvk_image_mapping>> m_mappings;
     std::mutex m_mappings_lock;
-    std::unique_ptr<cvk_buffer> m_init_data;
 };
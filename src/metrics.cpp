@@ -0,0 +1,319 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#include "config.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+std::atomic<uint64_t> gMetrics[static_cast<uint32_t>(cvk_metric::count)];
+
+namespace {
+
+// Find the slot of a non-zero 64-bit key in a table of N keys. Keys claim a
+// slot with a CAS the first time they are seen and are never removed.
+// Returns N when the key does not fit in the table.
+template <uint32_t N>
+uint32_t find_key_slot(std::atomic<uint64_t> (&keys)[N], uint64_t key) {
+    uint32_t start = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    for (uint32_t i = 0; i < N; i++) {
+        uint32_t idx = (start + i) % N;
+        uint64_t slot_key = keys[idx].load(std::memory_order_relaxed);
+        if (slot_key == 0) {
+            // compare_exchange_strong updates slot_key if the slot was
+            // claimed by another thread in the meantime
+            if (keys[idx].compare_exchange_strong(slot_key, key,
+                                                  std::memory_order_relaxed)) {
+                slot_key = key;
+            }
+        }
+        if (slot_key == key) {
+            return idx;
+        }
+    }
+    return N;
+}
+
+// Counters keyed by a non-zero 64-bit value. Updates for keys that do not fit
+// in the table are only counted in 'overflow'.
+template <uint32_t N> struct keyed_counters {
+    std::atomic<uint64_t> keys[N];
+    std::atomic<uint64_t> counts[N];
+    std::atomic<uint64_t> overflow;
+
+    void add(uint64_t key, uint64_t value = 1) {
+        uint32_t idx = find_key_slot(keys, key);
+        if (idx < N) {
+            counts[idx].fetch_add(value, std::memory_order_relaxed);
+        } else {
+            overflow.fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Batches of 2^i to 2^(i+1)-1 commands are counted in bucket i, the last
+// bucket counts all the larger batches.
+constexpr uint32_t BATCH_SIZE_BUCKETS = 16;
+
+struct heap_metrics {
+    std::atomic<uint64_t> allocated_bytes;
+    std::atomic<uint64_t> peak_allocated_bytes;
+    std::atomic<uint64_t> live_allocations;
+};
+
+// Heap metrics are kept per Vulkan device. Allocations made on devices that
+// do not fit in the table are accounted to 'gOtherDevicesHeaps'.
+constexpr uint32_t MAX_METRICS_DEVICES = 8;
+
+keyed_counters<64> gCommandsByType;
+keyed_counters<32> gSubmissionsByQueue;
+std::atomic<uint64_t> gBatchSizes[BATCH_SIZE_BUCKETS];
+std::atomic<uint64_t> gHeapsDevices[MAX_METRICS_DEVICES];
+heap_metrics gHeaps[MAX_METRICS_DEVICES][VK_MAX_MEMORY_HEAPS];
+heap_metrics gOtherDevicesHeaps[VK_MAX_MEMORY_HEAPS];
+
+heap_metrics& get_heap_metrics(VkDevice device, uint32_t heap_index) {
+    auto key = reinterpret_cast<uintptr_t>(device);
+    auto idx = find_key_slot(gHeapsDevices, key);
+    if (idx == MAX_METRICS_DEVICES) {
+        return gOtherDevicesHeaps[heap_index];
+    }
+    return gHeaps[idx][heap_index];
+}
+
+uint64_t load(const std::atomic<uint64_t>& value) {
+    return value.load(std::memory_order_relaxed);
+}
+
+void append_key(std::string& json, const char* key) {
+    json += '"';
+    json += key;
+    json += "\":";
+}
+
+void append_value(std::string& json, const char* key, uint64_t value,
+                  bool& first) {
+    if (!first) {
+        json += ',';
+    }
+    first = false;
+    append_key(json, key);
+    json += std::to_string(value);
+}
+
+std::mutex gDumpLock;
+std::condition_variable gDumpCond;
+bool gDumpStop;
+// Not a static std::thread so that a dump thread still running at exit (when
+// the global state is not destroyed) does not terminate the process.
+std::thread* gDumpThread;
+
+void dump_metrics() {
+    auto& path = config.metrics_dump_file();
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        cvk_warn("Could not open metrics dump file '%s'", path.c_str());
+        return;
+    }
+    auto json = cvk_metrics_to_json();
+    fputs(json.c_str(), file);
+    fputc('\n', file);
+    fclose(file);
+}
+
+void dump_thread_main(uint32_t interval_ms) {
+    std::unique_lock<std::mutex> lock(gDumpLock);
+    while (!gDumpCond.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                               [] { return gDumpStop; })) {
+        dump_metrics();
+    }
+}
+
+} // namespace
+
+void cvk_metrics_command_enqueued(cl_command_type type) {
+    cvk_metric_add(cvk_metric::commands_enqueued);
+    gCommandsByType.add(type);
+}
+
+void cvk_metrics_batch_submitted(uint32_t num_commands) {
+    cvk_metric_add(cvk_metric::batches_submitted);
+    cvk_metric_add(cvk_metric::batched_commands, num_commands);
+    uint32_t bucket = 0;
+    while ((bucket < BATCH_SIZE_BUCKETS - 1) && (num_commands >> 1)) {
+        num_commands >>= 1;
+        bucket++;
+    }
+    gBatchSizes[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void cvk_metrics_queue_submission(VkQueue queue) {
+    cvk_metric_add(cvk_metric::vulkan_queue_submissions);
+    gSubmissionsByQueue.add(reinterpret_cast<uintptr_t>(queue));
+}
+
+void cvk_metrics_memory_allocated(VkDevice device, uint32_t heap_index,
+                                  VkDeviceSize size) {
+    cvk_metric_add(cvk_metric::device_memory_allocations);
+    auto& heap = get_heap_metrics(device, heap_index);
+    heap.live_allocations.fetch_add(1, std::memory_order_relaxed);
+    uint64_t allocated =
+        heap.allocated_bytes.fetch_add(size, std::memory_order_relaxed) +
+        size;
+    uint64_t peak = load(heap.peak_allocated_bytes);
+    while ((allocated > peak) &&
+           !heap.peak_allocated_bytes.compare_exchange_weak(
+               peak, allocated, std::memory_order_relaxed)) {
+    }
+}
+
+void cvk_metrics_memory_freed(VkDevice device, uint32_t heap_index,
+                              VkDeviceSize size) {
+    cvk_metric_add(cvk_metric::device_memory_frees);
+    auto& heap = get_heap_metrics(device, heap_index);
+    heap.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+    heap.allocated_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+std::string cvk_metrics_to_json() {
+    std::string json = "{";
+    bool first = true;
+
+#define METRIC(name)                                                           \
+    append_value(json, #name,                                                  \
+                 load(gMetrics[static_cast<uint32_t>(cvk_metric::name)]),      \
+                 first);
+#include "metrics.def"
+#undef METRIC
+
+    json += ',';
+    append_key(json, "commands_enqueued_by_type");
+    json += '{';
+    first = true;
+    for (uint32_t i = 0; i < std::size(gCommandsByType.keys); i++) {
+        auto type = load(gCommandsByType.keys[i]);
+        if (type != 0) {
+            append_value(json, cl_command_type_to_string(type),
+                         load(gCommandsByType.counts[i]), first);
+        }
+    }
+    append_value(json, "other", load(gCommandsByType.overflow), first);
+    json += '}';
+
+    json += ',';
+    append_key(json, "batch_size_histogram");
+    json += '{';
+    first = true;
+    for (uint32_t i = 0; i < BATCH_SIZE_BUCKETS; i++) {
+        auto label = std::to_string(1u << i);
+        if (i == BATCH_SIZE_BUCKETS - 1) {
+            label += '+';
+        }
+        append_value(json, label.c_str(), load(gBatchSizes[i]), first);
+    }
+    json += '}';
+
+    json += ',';
+    append_key(json, "vulkan_queue_submissions_by_queue");
+    json += '{';
+    first = true;
+    for (uint32_t i = 0; i < std::size(gSubmissionsByQueue.keys); i++) {
+        auto queue = load(gSubmissionsByQueue.keys[i]);
+        if (queue != 0) {
+            char label[32];
+            snprintf(label, sizeof(label), "%#" PRIx64, queue);
+            append_value(json, label, load(gSubmissionsByQueue.counts[i]),
+                         first);
+        }
+    }
+    append_value(json, "other", load(gSubmissionsByQueue.overflow), first);
+    json += '}';
+
+    json += ',';
+    append_key(json, "memory_heaps");
+    json += '[';
+    bool first_heap = true;
+    for (uint32_t d = 0; d <= MAX_METRICS_DEVICES; d++) {
+        std::string device_label = "other";
+        heap_metrics* heaps = gOtherDevicesHeaps;
+        if (d < MAX_METRICS_DEVICES) {
+            auto device = load(gHeapsDevices[d]);
+            if (device == 0) {
+                continue;
+            }
+            char label[32];
+            snprintf(label, sizeof(label), "%#" PRIx64, device);
+            device_label = label;
+            heaps = gHeaps[d];
+        }
+        for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; i++) {
+            auto& heap = heaps[i];
+            if (load(heap.peak_allocated_bytes) == 0) {
+                continue;
+            }
+            if (!first_heap) {
+                json += ',';
+            }
+            first_heap = false;
+            json += '{';
+            append_key(json, "device");
+            json += '"' + device_label + "\",";
+            first = true;
+            append_value(json, "heap", i, first);
+            append_value(json, "allocated_bytes", load(heap.allocated_bytes),
+                         first);
+            append_value(json, "peak_allocated_bytes",
+                         load(heap.peak_allocated_bytes), first);
+            append_value(json, "live_allocations",
+                         load(heap.live_allocations), first);
+            json += '}';
+        }
+    }
+    json += ']';
+
+    json += '}';
+    return json;
+}
+
+void cvk_metrics_init() {
+    if (config.metrics_dump_file().empty() ||
+        config.metrics_dump_interval_ms == 0) {
+        return;
+    }
+    gDumpStop = false;
+    gDumpThread =
+        new std::thread(dump_thread_main, config.metrics_dump_interval_ms());
+}
+
+void cvk_metrics_term() {
+    if (gDumpThread != nullptr) {
+        {
+            std::lock_guard<std::mutex> lock(gDumpLock);
+            gDumpStop = true;
+        }
+        gDumpCond.notify_one();
+        gDumpThread->join();
+        delete gDumpThread;
+        gDumpThread = nullptr;
+    }
+    if (!config.metrics_dump_file().empty()) {
+        dump_metrics();
+    }
+}
@@ -0,0 +1,83 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+#include "cl_headers.hpp"
+
+// Process-wide runtime metrics. They are always collected: updating a metric
+// is a relaxed atomic operation and never takes a lock on the hot paths.
+// Metrics can be queried as JSON with clGetRuntimeMetricsCLVK or dumped to a
+// file periodically and at exit.
+
+enum class cvk_metric : uint32_t
+{
+#define METRIC(name) name,
+#include "metrics.def"
+#undef METRIC
+    count,
+};
+
+extern std::atomic<uint64_t>
+    gMetrics[static_cast<uint32_t>(cvk_metric::count)];
+
+static inline void cvk_metric_add(cvk_metric metric, uint64_t value = 1) {
+    gMetrics[static_cast<uint32_t>(metric)].fetch_add(
+        value, std::memory_order_relaxed);
+}
+
+// Add the time spent in a scope to a metric, in nanoseconds
+class cvk_metric_scoped_timer {
+public:
+    cvk_metric_scoped_timer(cvk_metric metric)
+        : m_metric(metric), m_start(std::chrono::steady_clock::now()) {}
+
+    ~cvk_metric_scoped_timer() {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        cvk_metric_add(
+            m_metric,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                .count());
+    }
+
+private:
+    cvk_metric m_metric;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+void cvk_metrics_command_enqueued(cl_command_type type);
+void cvk_metrics_batch_submitted(uint32_t num_commands);
+void cvk_metrics_queue_submission(VkQueue queue);
+void cvk_metrics_memory_allocated(VkDevice device, uint32_t heap_index,
+                                  VkDeviceSize size);
+void cvk_metrics_memory_freed(VkDevice device, uint32_t heap_index,
+                              VkDeviceSize size);
+
+// Return a snapshot of all the metrics as a JSON object
+std::string cvk_metrics_to_json();
+
+// Start the periodic dump of the metrics if one was requested
+void cvk_metrics_init();
+// Stop the periodic dump and dump the metrics one last time
+void cvk_metrics_term();
+
+extern CL_API_ENTRY cl_int CL_API_CALL clGetRuntimeMetricsCLVK(
+    size_t param_value_size, void* param_value, size_t* param_value_size_ret);
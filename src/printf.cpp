@@ -268,16 +268,17 @@ void process_printf(char*& data, const printf_descriptor_map_t& descs,
     }
 }
 
-cl_int cvk_printf(cvk_mem* printf_buffer,
+cl_int cvk_printf(cvk_mem* printf_buffer, size_t offset, size_t size,
                   const printf_descriptor_map_t& descriptors,
                   cvk_printf_callback_t printf_cb, void* printf_userdata) {
     CVK_ASSERT(printf_buffer);
-    if (!printf_buffer->map()) {
+    if (!printf_buffer->map_to_read(offset, size)) {
         cvk_error("Could not map printf buffer");
         return CL_OUT_OF_RESOURCES;
     }
-    char* data = static_cast<char*>(printf_buffer->host_va());
-    auto buffer_size = printf_buffer->size();
+    char* data =
+        static_cast<char*>(pointer_offset(printf_buffer->host_va(), offset));
+    auto buffer_size = size;
     const auto bytes_written_size = sizeof(uint32_t);
     const size_t data_size = buffer_size - bytes_written_size;
     const size_t bytes_written = read_inc_buff<uint32_t>(data) * 4;
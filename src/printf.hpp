@@ -27,7 +27,8 @@ struct printf_descriptor {
 
 using printf_descriptor_map_t = std::unordered_map<uint32_t, printf_descriptor>;
 
-// Process the contents of the printf buffer and print the results to stdout
-cl_int cvk_printf(cvk_mem* printf_buffer,
+// Process the contents of the printf buffer slice starting at 'offset' and
+// print the results to stdout
+cl_int cvk_printf(cvk_mem* printf_buffer, size_t offset, size_t size,
                   const printf_descriptor_map_t& descriptors,
                   cvk_printf_callback_t cb_func, void* printf_userdata);
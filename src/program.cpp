@@ -19,12 +19,14 @@
 #include <map>
 #include <sstream>
 #include <system_error>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include <vulkan/vulkan.h>
 
 #include "clspv/Sampler.h"
+#include "compile_service.hpp"
 #include "utils.hpp"
 
 #ifdef CLSPV_ONLINE_COMPILER
@@ -38,7 +40,6 @@
 #endif
 
 #include "spirv-tools/linker.hpp"
-#include "spirv-tools/optimizer.hpp"
 #include "spirv/unified1/NonSemanticClspvReflection.h"
 #include "spirv/unified1/spirv.hpp"
 
@@ -612,93 +613,106 @@ bool spir_binary::validate(const spirv_validation_options& val_options) const {
     return res == SPV_SUCCESS;
 }
 
-bool spir_binary::strip_reflection(std::vector<uint32_t>* stripped) {
-    const spvtools::MessageConsumer consumer =
-        [](spv_message_level_t level, const char*,
-           const spv_position_t& position, const char* message) {
-
-#define msgtpl "spvtools says '%s' at position %zu"
-            switch (level) {
-            case SPV_MSG_FATAL:
-            case SPV_MSG_INTERNAL_ERROR:
-            case SPV_MSG_ERROR:
-                cvk_error(msgtpl, message, position.index);
-                break;
-            case SPV_MSG_WARNING:
-                cvk_warn(msgtpl, message, position.index);
-                break;
-            case SPV_MSG_INFO:
-                cvk_info(msgtpl, message, position.index);
-                break;
-            case SPV_MSG_DEBUG:
-                cvk_debug(msgtpl, message, position.index);
-                break;
-            }
-#undef msgtpl
-        };
+namespace {
+
+struct ingest_parse_data {
+    reflection_parse_data reflection;
+    std::vector<spv::Capability>* capabilities;
+    const uint32_t* code;
+    cvk_sha1_stream sha1;
+    std::vector<uint32_t>* stripped;
+    std::unordered_set<uint32_t> non_semantic_sets;
+};
+
+spv_result_t ingest_header(void* user_data, spv_endianness_t, uint32_t,
+                           uint32_t, uint32_t, uint32_t, uint32_t) {
+    auto* data = reinterpret_cast<ingest_parse_data*>(user_data);
+    data->sha1.update(data->code, SPV_INDEX_INSTRUCTION * sizeof(uint32_t));
+    if (data->stripped != nullptr) {
+        data->stripped->insert(data->stripped->end(), data->code,
+                               data->code + SPV_INDEX_INSTRUCTION);
+    }
+    return SPV_SUCCESS;
+}
 
-#if COMPILER_AVAILABLE || USING_SWIFTSHADER
-    spvtools::Optimizer opt(m_target_env);
-    opt.SetMessageConsumer(consumer);
-    opt.RegisterPass(spvtools::CreateStripReflectInfoPass());
-    spvtools::OptimizerOptions options;
-    options.set_run_validator(false);
-    if (!opt.Run(m_code.data(), m_code.size(), stripped, options)) {
+// Returns true if the instruction is removed when stripping reflection. This
+// mirrors what the SPIRV-Tools strip pass does for non-semantic instructions:
+// all non-semantic instruction sets, their instructions and the extension
+// enabling them are removed.
+bool strip_instruction(ingest_parse_data* data,
+                       const spv_parsed_instruction_t* inst) {
+    switch (inst->opcode) {
+    case spv::OpExtension: {
+        auto name = reinterpret_cast<const char*>(&inst->words[1]);
+        return strcmp(name, "SPV_KHR_non_semantic_info") == 0;
+    }
+    case spv::OpExtInstImport: {
+        auto name = reinterpret_cast<const char*>(&inst->words[2]);
+        if (strncmp(name, "NonSemantic.", strlen("NonSemantic.")) == 0) {
+            data->non_semantic_sets.insert(inst->result_id);
+            return true;
+        }
+        return false;
+    }
+    case spv::OpExtInst:
+        return data->non_semantic_sets.count(inst->words[3]) != 0;
+    default:
         return false;
     }
-#else
-    *stripped = m_code;
-#endif
-    return true;
 }
 
-bool spir_binary::load_descriptor_map() {
-    reflection_parse_data parse_data;
-    parse_data.binary = this;
+spv_result_t ingest_instruction(void* user_data,
+                                const spv_parsed_instruction_t* inst) {
+    auto* data = reinterpret_cast<ingest_parse_data*>(user_data);
 
-    // TODO: The parser assumes a valid SPIR-V module, but validation is not
-    // run until later.
-    auto result =
-        spvBinaryParse(m_context, &parse_data, m_code.data(), m_code.size(),
-                       nullptr, parse_reflection, nullptr);
-    if (result != SPV_SUCCESS) {
-        cvk_error_fn("Parsing SPIR-V module reflection failed: %d", result);
-        return false;
+    data->sha1.update(inst->words, inst->num_words * sizeof(uint32_t));
+
+    if (inst->opcode == spv::OpCapability) {
+        uint32_t capability = inst->words[inst->operands[0].offset];
+        data->capabilities->push_back(static_cast<spv::Capability>(capability));
     }
 
-    return true;
+    if ((data->stripped != nullptr) && !strip_instruction(data, inst)) {
+        data->stripped->insert(data->stripped->end(), inst->words,
+                               inst->words + inst->num_words);
+    }
+
+    return parse_reflection(&data->reflection, inst);
 }
 
-bool spir_binary::get_capabilities(
-    std::vector<spv::Capability>& capabilities) const {
-    // Callback for receiving parsed instructions.
-    // The `user_data` parameter will be a pointer to the vector of
-    // capabilities (we cannot use a lambda capture for this as it prevents the
-    // lambda from being able to be converted to a function pointer).
-    auto parse_inst = [](void* user_data,
-                         const spv_parsed_instruction_t* inst) {
-        // Stop parsing at first instruction that is not an OpCapability.
-        if (inst->opcode != spv::Op::OpCapability) {
-            return SPV_END_OF_STREAM;
-        }
+} // namespace
 
-        // Add the capability to the list.
-        uint32_t capability = inst->words[inst->operands[0].offset];
-        auto capabilities =
-            reinterpret_cast<std::vector<spv::Capability>*>(user_data);
-        capabilities->push_back(static_cast<spv::Capability>(capability));
+bool spir_binary::ingest(std::vector<uint32_t>* stripped) {
+    TRACE_FUNCTION("size", m_code.size());
 
-        return SPV_SUCCESS;
-    };
+    ingest_parse_data data;
+    data.reflection.binary = this;
+    data.capabilities = &m_capabilities;
+    data.code = m_code.data();
+    data.stripped = stripped;
+
+    m_capabilities.clear();
+    if (stripped != nullptr) {
+        stripped->clear();
+        stripped->reserve(m_code.size());
+    }
+
+    if (m_code.size() < SPV_INDEX_INSTRUCTION) {
+        cvk_error_fn("SPIR-V module is too small (%zu words)", m_code.size());
+        return false;
+    }
 
-    // Parse the SPIR-V binary to build the list of required capabilities.
-    spv_result_t result =
-        spvBinaryParse(m_context, &capabilities, m_code.data(), m_code.size(),
-                       nullptr, parse_inst, nullptr);
-    if (result != SPV_SUCCESS && result != SPV_END_OF_STREAM) {
+    // TODO: The parser assumes a valid SPIR-V module, but validation is not
+    // run until later.
+    auto result = spvBinaryParse(m_context, &data, m_code.data(), m_code.size(),
+                                 ingest_header, ingest_instruction, nullptr);
+    if (result != SPV_SUCCESS) {
         cvk_error_fn("Parsing SPIR-V module failed: %d", result);
         return false;
     }
+
+    m_sha1 = data.sha1.finish();
+
     return true;
 }
 
@@ -740,6 +754,21 @@ bool save_il_to_file(const std::string& fname, const std::vector<uint8_t>& il) {
                                 il.size(), std::ios::binary);
 }
 #endif // CLSPV_ONLINE_COMPILER
+
+bool create_temp_folder(std::string& tmp_folder) {
+    std::filesystem::path tmp_prefix(config.compiler_temp_dir());
+    std::filesystem::path tmp_suffix("clvk-XXXXXX");
+    std::string tmp_template = (tmp_prefix / tmp_suffix).string();
+    const char* tmp = cvk_mkdtemp(tmp_template);
+    if (tmp == nullptr) {
+        cvk_error_fn("Could not create temporary folder \"%s\"",
+                     tmp_template.c_str());
+        return false;
+    }
+    tmp_folder = tmp;
+    cvk_info("Created temporary folder \"%s\"", tmp_folder.c_str());
+    return true;
+}
 #endif // COMPILER_AVAILABLE
 
 struct temp_folder_deletion {
@@ -760,8 +789,11 @@ enum class spirv_validation_level
     error,
 };
 
+// `validated` is set when the binary was validated and found to be valid.
 bool validate_binary(spir_binary const& binary,
-                     spirv_validation_options const& val_options) {
+                     spirv_validation_options const& val_options,
+                     bool& validated) {
+    validated = false;
     spirv_validation_level level = spirv_validation_level::error;
     if (config.spirv_validation.set) {
         if (config.spirv_validation == 0) {
@@ -778,6 +810,7 @@ bool validate_binary(spir_binary const& binary,
 
     if (binary.validate(val_options)) {
         cvk_info("SPIR-V binary is valid.");
+        validated = true;
         return true;
     }
 
@@ -790,9 +823,28 @@ bool validate_binary(spir_binary const& binary,
     return false;
 }
 
+// Validation results depend on the module, the target environment and the
+// validator options, so validation records are keyed by a hash of all of
+// them.
+cvk_sha1_hash validation_key(const cvk_sha1_hash& module_sha1,
+                             spv_target_env env,
+                             spirv_validation_options const& val_options) {
+    cvk_sha1_stream stream;
+    stream.update(module_sha1.data(), SHA1_DIGEST_NUM_BYTES);
+    uint32_t target_env = env;
+    stream.update(&target_env, sizeof(target_env));
+    uint32_t uniform_buffer_std_layout = val_options.uniform_buffer_std_layout;
+    stream.update(&uniform_buffer_std_layout,
+                  sizeof(uniform_buffer_std_layout));
+    return stream.finish();
+}
+
 const uint32_t clvk_binary_magic =
     0x6B766C63; // "clvk" in ASCII in little-endian
-const uint32_t clvk_binary_version = 1;
+// Version 1 binaries hold the header followed by the SPIR-V module or the LLVM
+// IR. Version 2 binaries hold the header followed by a section table.
+const uint32_t clvk_binary_version_1 = 1;
+const uint32_t clvk_binary_version = 2;
 struct clvk_binary_header {
     uint32_t magic;
     uint32_t version;
@@ -806,6 +858,53 @@ struct clvk_binary_header {
         ((unsigned char*)dst)[3] = ((unsigned char*)(src))[3];                 \
     } while (0)
 
+// Section payloads are aligned so that SPIR-V words are naturally aligned in
+// binaries. They are still copied when a binary is loaded.
+const size_t clvk_binary_section_alignment = 16;
+
+enum clvk_binary_section_type : uint32_t
+{
+    // SPIR-V module, with reflection
+    clvk_binary_section_spirv = 1,
+    // Reserved, was used for SPIR-V modules without reflection. Such sections
+    // are neither written nor loaded: the stripped module is always derived
+    // from the validated one.
+    clvk_binary_section_reserved_2 = 2,
+    // LLVM IR for compiled objects and libraries
+    clvk_binary_section_llvm_ir = 3,
+    // VK_UUID_SIZE bytes of pipelineCacheUUID followed by the data of a
+    // VkPipelineCache
+    clvk_binary_section_pipeline_cache = 4,
+};
+
+struct clvk_binary_section_table {
+    uint32_t num_sections;
+};
+
+struct clvk_binary_section {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset; // from the start of the binary
+    uint64_t size;
+};
+
+// Compute where each section goes in the binary and return the total size of
+// the binary.
+size_t layout_binary_sections(const std::vector<cvk_binary_section>& sections,
+                              std::vector<clvk_binary_section>& table) {
+    size_t offset = sizeof(clvk_binary_header) +
+                    sizeof(clvk_binary_section_table) +
+                    sections.size() * sizeof(clvk_binary_section);
+    table.clear();
+    for (auto& section : sections) {
+        offset = (offset + clvk_binary_section_alignment - 1) &
+                 ~(clvk_binary_section_alignment - 1);
+        table.push_back({section.type, 0, offset, section.size});
+        offset += section.size;
+    }
+    return offset;
+}
+
 } // namespace
 
 bool cvk_program::read_llvm_bitcode(const unsigned char* src, size_t size) {
@@ -827,12 +926,13 @@ void cvk_program::write_binary_header(unsigned char* dst) const {
 }
 
 cl_program_binary_type cvk_program::read_binary_header(const unsigned char* src,
-                                                       size_t size) {
+                                                       size_t size,
+                                                       uint32_t& version) {
     struct clvk_binary_header* header = (struct clvk_binary_header*)src;
-    if (size < sizeof(header)) {
+    if (size < sizeof(*header)) {
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
-    uint32_t magic, version, binary_type;
+    uint32_t magic, binary_type;
     COPY_WORD(&magic, &header->magic);
     COPY_WORD(&version, &header->version);
     COPY_WORD(&binary_type, &header->binary_type);
@@ -840,16 +940,122 @@ cl_program_binary_type cvk_program::read_binary_header(const unsigned char* src,
         cvk_info_fn("magic not found");
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
-    if (version != clvk_binary_version) {
+    if ((version != clvk_binary_version) &&
+        (version != clvk_binary_version_1)) {
         cvk_warn_fn("wrong version");
         return CL_PROGRAM_BINARY_TYPE_NONE;
     }
     return binary_type;
 }
 
+bool cvk_program::read_binary_sections(const unsigned char* src, size_t size,
+                                       cl_program_binary_type binary_type) {
+    auto table_offset = sizeof(clvk_binary_header);
+    if (size < table_offset + sizeof(clvk_binary_section_table)) {
+        cvk_error_fn("binary too small for section table");
+        return false;
+    }
+    clvk_binary_section_table table;
+    memcpy(&table, src + table_offset, sizeof(table));
+    auto sections_offset = table_offset + sizeof(clvk_binary_section_table);
+    if (table.num_sections > (size - sections_offset) /
+                                 sizeof(clvk_binary_section)) {
+        cvk_error_fn("binary too small for %u sections", table.num_sections);
+        return false;
+    }
+
+    bool found_code = false;
+    for (uint32_t i = 0; i < table.num_sections; i++) {
+        clvk_binary_section section;
+        memcpy(&section, src + sections_offset + i * sizeof(section),
+               sizeof(section));
+        if ((section.offset > size) || (section.size > size - section.offset)) {
+            cvk_error_fn("section %u is out of bounds", i);
+            return false;
+        }
+        auto data = src + section.offset;
+        switch (section.type) {
+        case clvk_binary_section_spirv:
+            if (binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE) {
+                found_code = m_binary.read(data, section.size);
+            }
+            break;
+        case clvk_binary_section_llvm_ir:
+            if (binary_type != CL_PROGRAM_BINARY_TYPE_EXECUTABLE) {
+                found_code = read_llvm_bitcode(data, section.size);
+            }
+            break;
+        case clvk_binary_section_pipeline_cache: {
+            // Only keep pipeline caches created for this device and driver
+            auto uuid = m_context->device()->pipeline_cache_uuid();
+            if ((section.size > VK_UUID_SIZE) &&
+                (memcmp(data, uuid, VK_UUID_SIZE) == 0)) {
+                m_loaded_pipeline_cache_data.assign(data + VK_UUID_SIZE,
+                                                    data + section.size);
+            } else {
+                cvk_info_fn("ignoring pipeline cache for another device");
+            }
+            break;
+        }
+        default:
+            cvk_info_fn("ignoring unknown section type %u", section.type);
+            break;
+        }
+    }
+
+    if (!found_code) {
+        cvk_error_fn("no code section found");
+    }
+    return found_code;
+}
+
+void cvk_program::snapshot_pipeline_cache() const {
+    m_binary_pipeline_cache_data.clear();
+    m_binary_pipeline_cache_snapshot = true;
+
+    if ((m_binary_type != CL_PROGRAM_BINARY_TYPE_EXECUTABLE) ||
+        (m_pipeline_cache == VK_NULL_HANDLE)) {
+        return;
+    }
+
+    // Embed the pipelines created so far
+    auto device = m_context->device();
+    std::vector<char> cache_data;
+    if (!device->get_pipeline_cache_data(m_pipeline_cache, cache_data) ||
+        cache_data.empty()) {
+        return;
+    }
+    auto uuid = device->pipeline_cache_uuid();
+    m_binary_pipeline_cache_data.assign(uuid, uuid + VK_UUID_SIZE);
+    m_binary_pipeline_cache_data.insert(m_binary_pipeline_cache_data.end(),
+                                        cache_data.begin(), cache_data.end());
+}
+
+std::vector<cvk_binary_section> cvk_program::binary_sections() const {
+    std::vector<cvk_binary_section> sections;
+    switch (m_binary_type) {
+    case CL_PROGRAM_BINARY_TYPE_LIBRARY:
+    case CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT:
+        sections.push_back(
+            {clvk_binary_section_llvm_ir, m_ir.data(), m_ir.size()});
+        break;
+    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
+        sections.push_back(
+            {clvk_binary_section_spirv, m_binary.spir_data(), m_binary.size()});
+        if (!m_binary_pipeline_cache_data.empty()) {
+            sections.push_back({clvk_binary_section_pipeline_cache,
+                                m_binary_pipeline_cache_data.data(),
+                                m_binary_pipeline_cache_data.size()});
+        }
+        break;
+    }
+    return sections;
+}
+
 bool cvk_program::read(const unsigned char* src, size_t size) {
     bool success = false;
-    auto binary_type = read_binary_header(src, size);
+    uint32_t version;
+    auto binary_type = read_binary_header(src, size, version);
     // if the binary does not have a clvk binary header, let's try to read
     // it first as a llvm ir buffer, then as a vulkan spirv buffer.
     if (binary_type == CL_PROGRAM_BINARY_TYPE_NONE) {
@@ -869,6 +1075,14 @@ bool cvk_program::read(const unsigned char* src, size_t size) {
         return success;
     }
 
+    if (version == clvk_binary_version) {
+        success = read_binary_sections(src, size, binary_type);
+        if (success) {
+            m_binary_type = binary_type;
+        }
+        return success;
+    }
+
     auto header_size = sizeof(struct clvk_binary_header);
     src += header_size;
     size -= header_size;
@@ -889,30 +1103,49 @@ bool cvk_program::read(const unsigned char* src, size_t size) {
 }
 
 bool cvk_program::write(unsigned char* dst) const {
-    write_binary_header(dst);
-    dst += sizeof(struct clvk_binary_header);
+    std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
 
-    switch (m_binary_type) {
-    case CL_PROGRAM_BINARY_TYPE_LIBRARY:
-    case CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT:
-        memcpy(dst, m_ir.data(), m_ir.size());
-        return true;
-    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
-        return m_binary.write(dst);
+    // Use the pipeline cache data binary_size() was computed for, if any, so
+    // that the binary fits even if pipelines were created since.
+    if (!m_binary_pipeline_cache_snapshot) {
+        snapshot_pipeline_cache();
     }
-    return false;
+
+    auto sections = binary_sections();
+    if (sections.empty()) {
+        return false;
+    }
+
+    std::vector<clvk_binary_section> table;
+    layout_binary_sections(sections, table);
+
+    write_binary_header(dst);
+    clvk_binary_section_table section_table = {
+        static_cast<uint32_t>(table.size())};
+    auto table_dst = dst + sizeof(clvk_binary_header);
+    memcpy(table_dst, &section_table, sizeof(section_table));
+    table_dst += sizeof(section_table);
+    memcpy(table_dst, table.data(), table.size() * sizeof(clvk_binary_section));
+
+    size_t end = table_dst + table.size() * sizeof(clvk_binary_section) - dst;
+    for (size_t i = 0; i < table.size(); i++) {
+        // Zero the padding so that binaries are reproducible
+        memset(dst + end, 0, table[i].offset - end);
+        memcpy(dst + table[i].offset, sections[i].data, sections[i].size);
+        end = table[i].offset + table[i].size;
+    }
+    return true;
 }
 
 size_t cvk_program::binary_size() const {
-    auto header_size = sizeof(struct clvk_binary_header);
-    switch (m_binary_type) {
-    case CL_PROGRAM_BINARY_TYPE_LIBRARY:
-    case CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT:
-        return header_size + m_ir.size();
-    case CL_PROGRAM_BINARY_TYPE_EXECUTABLE:
-        return header_size + m_binary.size();
-    }
-    return 0;
+    std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+    snapshot_pipeline_cache();
+    auto sections = binary_sections();
+    if (sections.empty()) {
+        return 0;
+    }
+    std::vector<clvk_binary_section> table;
+    return layout_binary_sections(sections, table);
 }
 
 std::string cvk_program::prepare_build_options(const cvk_device* device) const {
@@ -1094,13 +1327,102 @@ cl_int cvk_program::parse_user_spec_constants() {
 }
 
 #if COMPILER_AVAILABLE
+bool cvk_program::prepare_compile_request(bool build_to_ir,
+                                          const std::string& build_options,
+                                          cvk_compile_request& request) {
+    request.options = build_options;
+    request.build_to_ir = build_to_ir;
+    request.programs.clear();
+    if (m_operation == build_operation::link) {
+        for (auto input_program : m_input_programs) {
+            if (input_program->m_binary_type !=
+                    CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT &&
+                input_program->m_binary_type !=
+                    CL_PROGRAM_BINARY_TYPE_LIBRARY) {
+                return false;
+            }
+            request.programs.emplace_back(std::string{
+                input_program->m_ir.begin(), input_program->m_ir.end()});
+        }
+    } else {
+        if (m_source.empty() && !m_ir.empty()) {
+            request.programs.emplace_back(
+                std::string{m_ir.begin(), m_ir.end()});
+        } else {
+            request.programs.emplace_back(m_source);
+        }
+    }
+    return true;
+}
+
+cl_build_status
+cvk_program::complete_compile_request(bool build_to_ir,
+                                      cvk_compile_result& result) {
+    m_build_log = std::move(result.build_log);
+    if (result.status != 0) {
+        cvk_error_fn("failed to compile the program");
+        cvk_debug_fn("%s", m_build_log.c_str());
+        return CL_BUILD_ERROR;
+    }
+    if (build_to_ir) {
+        m_ir.clear();
+        auto size = result.binary.size() * sizeof(uint32_t);
+        m_ir.resize(size);
+        memcpy(m_ir.data(), result.binary.data(), size);
+    } else {
+        *m_binary.raw_binary() = std::move(result.binary);
+    }
+    return CL_BUILD_SUCCESS;
+}
+
 #ifndef CLSPV_ONLINE_COMPILER
+namespace {
+
+// Long-lived compile servers, only used with the clspv they were built with
+cvk_compile_service* get_compile_server() {
+    bool use_server =
+        config.compile_server && !config.compile_server_path().empty() &&
+        (!config.clspv_path.set || config.compile_server_path.set);
+    if (!use_server) {
+        return nullptr;
+    }
+    static cvk_compile_service server(std::max(config.compiler_workers(), 1u),
+                                      config.compile_server_path(),
+                                      config.compile_server_timeout_ms());
+    return server.available() ? &server : nullptr;
+}
+
+} // namespace
+
 cl_build_status cvk_program::do_build_inner_offline(bool build_to_ir,
                                                     bool build_from_il,
                                                     std::string& build_options,
                                                     std::string& tmp_folder) {
     TRACE_FUNCTION("build_to_ir", build_to_ir, "build_from_il", build_from_il,
                    "build_options", TRACE_STRING(build_options.c_str()));
+
+    // Use a compile server when possible, it avoids starting clspv and going
+    // through files for every build.
+    if (!build_from_il) {
+        auto server = get_compile_server();
+        cvk_compile_request request;
+        cvk_compile_result result;
+        if ((server != nullptr) &&
+            prepare_compile_request(build_to_ir, build_options, request) &&
+            server->compile(request, result)) {
+            return complete_compile_request(build_to_ir, result);
+        }
+    }
+
+    std::string fallback_tmp_folder;
+    if (tmp_folder.empty()) {
+        if (!create_temp_folder(fallback_tmp_folder)) {
+            return CL_BUILD_ERROR;
+        }
+        tmp_folder = fallback_tmp_folder;
+    }
+    temp_folder_deletion fallback_temp(fallback_tmp_folder);
+
     // Compose clspv command-line
     std::string cmd{config.clspv_path};
     cmd += " ";
@@ -1267,6 +1589,27 @@ cl_build_status cvk_program::do_build_inner_offline(bool build_to_ir,
 
 #else // #ifndef CLSPV_ONLINE_COMPILER
 
+namespace {
+
+void clspv_compile(const cvk_compile_request& request,
+                   cvk_compile_result& result) {
+    result.build_log.clear();
+    result.binary.clear();
+    result.status = clspv::CompileFromSourcesString(
+        request.programs, request.options, &result.binary, &result.build_log);
+}
+
+// Compile servers built with the same clspv, used to build programs
+// concurrently when compiler workers are requested
+cvk_compile_service& get_compile_service() {
+    static cvk_compile_service service(config.compiler_workers,
+                                       config.compile_server_path(),
+                                       config.compile_server_timeout_ms());
+    return service;
+}
+
+} // namespace
+
 cl_build_status cvk_program::do_build_inner_online(bool build_to_ir,
                                                    bool build_from_il,
                                                    std::string& build_options) {
@@ -1337,52 +1680,23 @@ cl_build_status cvk_program::do_build_inner_online(bool build_to_ir,
 #endif // ENABLE_SPIRV_IL
     }
     cvk_info("About to compile \"%s\"", build_options.c_str());
-    int status;
-    // clspv is based on LLVM. LLVM options parsing is done using global
-    // variable that are not thread safe. Thus, we need to lock call to clspv in
-    // order to ensure a thread safe execution.
-    {
+    cvk_compile_request request;
+    if (!prepare_compile_request(build_to_ir, build_options, request)) {
+        return CL_BUILD_ERROR;
+    }
+
+    cvk_compile_result result;
+    auto& service = get_compile_service();
+    if (!service.available() || !service.compile(request, result)) {
+        // clspv is based on LLVM. LLVM options parsing is done using global
+        // variable that are not thread safe. Thus, we need to lock call to
+        // clspv in order to ensure a thread safe execution.
         static std::mutex clspv_compile_mutex;
         std::lock_guard<std::mutex> clspv_compile_lock(clspv_compile_mutex);
-        std::vector<std::string> programs;
-        if (m_operation == build_operation::link) {
-            for (auto input_program : m_input_programs) {
-                if (input_program->m_binary_type !=
-                        CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT &&
-                    input_program->m_binary_type !=
-                        CL_PROGRAM_BINARY_TYPE_LIBRARY) {
-                    return CL_BUILD_ERROR;
-                }
-                programs.emplace_back(std::string{input_program->m_ir.begin(),
-                                                  input_program->m_ir.end()});
-            }
-        } else {
-            if (m_source.empty() && !m_ir.empty()) {
-                programs.emplace_back(std::string{m_ir.begin(), m_ir.end()});
-            } else {
-                programs.emplace_back(m_source);
-            }
-        }
-        m_build_log.clear();
-        if (build_to_ir) {
-            std::vector<uint32_t> ir;
-            status = clspv::CompileFromSourcesString(programs, build_options,
-                                                     &ir, &m_build_log);
-            m_ir.clear();
-            auto size = ir.size() * sizeof(uint32_t);
-            m_ir.resize(size);
-            memcpy(m_ir.data(), ir.data(), size);
-        } else {
-            status = clspv::CompileFromSourcesString(
-                programs, build_options, m_binary.raw_binary(), &m_build_log);
-        }
+        clspv_compile(request, result);
     }
-    if (status != 0) {
-        cvk_error_fn("failed to compile the program");
-        cvk_debug_fn("%s", m_build_log.c_str());
-        return CL_BUILD_ERROR;
-    }
-    return CL_BUILD_SUCCESS;
+
+    return complete_compile_request(build_to_ir, result);
 }
 
 #endif // #ifndef CLSPV_ONLINE_COMPILER
@@ -1399,22 +1713,18 @@ cl_build_status cvk_program::do_build_inner(const cvk_device* device) {
 #ifdef CLSPV_ONLINE_COMPILER
     use_tmp_folder =
         m_operation == build_operation::compile && m_num_input_programs > 0;
+#else
+    // Builds handled by a compile server only need a temporary folder for
+    // headers. One is created later if the server fails.
+    if (!build_from_il && (get_compile_server() != nullptr)) {
+        use_tmp_folder =
+            m_operation == build_operation::compile && m_num_input_programs > 0;
+    }
 #endif
 
     std::string tmp_folder;
-    if (use_tmp_folder) {
-        // Create temporary folder
-        std::filesystem::path tmp_prefix(config.compiler_temp_dir());
-        std::filesystem::path tmp_suffix("clvk-XXXXXX");
-        std::string tmp_template = (tmp_prefix / tmp_suffix).string();
-        const char* tmp = cvk_mkdtemp(tmp_template);
-        if (tmp == nullptr) {
-            cvk_error_fn("Could not create temporary folder \"%s\"",
-                         tmp_template.c_str());
-            return CL_BUILD_ERROR;
-        }
-        tmp_folder = tmp;
-        cvk_info("Created temporary folder \"%s\"", tmp_folder.c_str());
+    if (use_tmp_folder && !create_temp_folder(tmp_folder)) {
+        return CL_BUILD_ERROR;
     }
     temp_folder_deletion temp(tmp_folder);
 
@@ -1493,15 +1803,8 @@ void cvk_program::prepare_push_constant_range() {
 }
 
 bool cvk_program::check_capabilities(const cvk_device* device) {
-    // Get list of required SPIR-V capabilities.
-    std::vector<spv::Capability> capabilities;
-    if (!m_binary.get_capabilities(capabilities)) {
-        cvk_error("Failed to get required SPIR-V capabilities.");
-        return false;
-    }
-
     // Check that each required capability is supported by the device.
-    for (auto c : capabilities) {
+    for (auto c : m_binary.capabilities()) {
         cvk_info_fn("Program requires SPIR-V capability %d (%s).", c,
                     spirv_capability_to_string(c));
         if (!device->supports_capability(c)
@@ -1524,10 +1827,20 @@ void cvk_program::do_build() {
     // Destroy entry points from previous build
     m_entry_points.clear();
 
+    {
+        std::lock_guard<std::mutex> lock(m_binary_pipeline_cache_lock);
+        m_binary_pipeline_cache_snapshot = false;
+    }
+
     auto device = m_context->device();
 
     if (m_operation != build_operation::build_binary) {
-        cl_build_status status = do_build_inner(device);
+        cl_build_status status;
+        {
+            cvk_metric_scoped_timer timer(cvk_metric::program_build_time_ns);
+            status = do_build_inner(device);
+        }
+        cvk_metric_add(cvk_metric::program_builds);
 
         if ((m_binary_type != CL_PROGRAM_BINARY_TYPE_EXECUTABLE) ||
             (status != CL_BUILD_SUCCESS)) {
@@ -1536,8 +1849,22 @@ void cvk_program::do_build() {
         }
     }
 
-    // Load descriptor map
-    if (!m_binary.load_descriptor_map()) {
+    // Strip the reflection information if non-semantic info is not supported
+    // by the Vulkan implementation. This stripped binary is stored separately
+    // from |m_binary| because clvk needs to be able to provide the binary with
+    // reflection information for clGetProgramInfo.
+    const bool should_strip_reflection =
+        !device->is_vulkan_extension_enabled(
+            VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME)
+#ifdef USING_SWIFTSHADER
+        || true
+#endif
+        ;
+
+    // Load the descriptor map, get the required capabilities, hash the module
+    // and strip it in a single pass.
+    if (!m_binary.ingest(should_strip_reflection ? &m_stripped_binary
+                                                 : nullptr)) {
         cvk_error("Could not load descriptor map for SPIR-V binary.");
         complete_operation(device, CL_BUILD_ERROR);
         return;
@@ -1550,24 +1877,37 @@ void cvk_program::do_build() {
 
     prepare_push_constant_range();
 
-    bool cache_hit =
-        device->get_pipeline_cache(m_binary.code(), m_pipeline_cache);
+    bool cache_hit = device->get_pipeline_cache(
+        m_binary.sha1(), m_pipeline_cache, m_loaded_pipeline_cache_data);
+    m_loaded_pipeline_cache_data.clear();
+    cvk_metric_add(cache_hit ? cvk_metric::pipeline_cache_hits
+                             : cvk_metric::pipeline_cache_misses);
     if (m_pipeline_cache == VK_NULL_HANDLE) {
         complete_operation(device, CL_BUILD_ERROR);
         return;
     }
 
-    if (!cache_hit) {
-        // Validate
-        // TODO validate with different rules depending on the binary type
-        if (m_binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE) {
-            spirv_validation_options validation_options{};
-            validation_options.uniform_buffer_std_layout =
-                m_context->device()->supports_ubo_stdlayout();
-            if (!validate_binary(m_binary, validation_options)) {
-                complete_operation(device, CL_BUILD_ERROR);
-                return;
-            }
+    // Validate, unless this exact module is already known to be valid.
+    // Binaries provided by the application are untrusted input: their
+    // pipeline cache section does not prove anything about them, only a
+    // validation record does.
+    // TODO validate with different rules depending on the binary type
+    spirv_validation_options validation_options{};
+    validation_options.uniform_buffer_std_layout =
+        m_context->device()->supports_ubo_stdlayout();
+    auto key = validation_key(m_binary.sha1(), device->vulkan_spirv_env(),
+                              validation_options);
+    bool from_application = m_operation == build_operation::build_binary;
+    bool known_valid = device->is_module_validated(key) ||
+                       (cache_hit && !from_application);
+    if ((m_binary_type == CL_PROGRAM_BINARY_TYPE_EXECUTABLE) && !known_valid) {
+        bool validated;
+        if (!validate_binary(m_binary, validation_options, validated)) {
+            complete_operation(device, CL_BUILD_ERROR);
+            return;
+        }
+        if (validated) {
+            device->record_module_validated(key);
         }
     }
 
@@ -1591,25 +1931,9 @@ void cvk_program::do_build() {
         m_literal_samplers.emplace_back(sampler);
     }
 
-    // Strip the reflection information if non-semantic info is not supported
-    // by the Vulkan implementation. This stripped binary is stored separately
-    // from |m_binary| because clvk needs to be able to provide the binary with
-    // reflection information for clGetProgramInfo.
     const uint32_t* spir_data = m_binary.spir_data();
     size_t spir_size = m_binary.spir_size();
-    const bool should_strip_reflection =
-        !device->is_vulkan_extension_enabled(
-            VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME)
-#ifdef USING_SWIFTSHADER
-        || true
-#endif
-        ;
     if (should_strip_reflection) {
-        if (!m_binary.strip_reflection(&m_stripped_binary)) {
-            cvk_error_fn("couldn't strip reflection from SPIR-V module");
-            complete_operation(device, CL_BUILD_ERROR);
-            return;
-        }
         spir_data = m_stripped_binary.data();
         spir_size = m_stripped_binary.size() * sizeof(uint32_t);
     }
@@ -2173,6 +2497,7 @@ cvk_entry_point::create_pipeline(const cvk_spec_constant_map& spec_constants) {
     if (m_pipelines.count(spec_constants)) {
         VkPipeline pipeline = m_pipelines.at(spec_constants);
         cvk_info("reusing pipeline %p for kernel %s", pipeline, m_name.c_str());
+        cvk_metric_add(cvk_metric::pipelines_reused);
         return pipeline;
     }
 
@@ -2249,6 +2574,7 @@ cvk_entry_point::create_pipeline(const cvk_spec_constant_map& spec_constants) {
 
     // Add to pipeline cache
     m_pipelines[spec_constants] = pipeline;
+    cvk_metric_add(cvk_metric::pipelines_created);
 
     cvk_info("created pipeline %p for kernel %s", pipeline, m_name.c_str());
 
@@ -2296,10 +2622,13 @@ bool cvk_entry_point::allocate_descriptor_sets(VkDescriptorSet* ds) {
                         vulkan_error_string(res));
         }
         m_first_allocation_failure = false;
+        cvk_metric_add(cvk_metric::descriptor_set_allocation_failures);
         return false;
     }
 
     m_nb_descriptor_set_allocated += m_descriptor_set_layouts.size();
+    cvk_metric_add(cvk_metric::descriptor_sets_allocated,
+                   m_descriptor_set_layouts.size());
     TRACE_CNT(descriptor_set_allocated_counter, m_nb_descriptor_set_allocated);
 
     return true;
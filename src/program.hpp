@@ -28,12 +28,15 @@
 #include "spirv-tools/libspirv.h"
 #include "spirv/1.0/spirv.hpp"
 
+#include "compile_protocol.hpp"
 #include "config.hpp"
 #include "init.hpp"
 #include "log.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "objects.hpp"
 #include "printf.hpp"
+#include "sha1.hpp"
 #include "utils.hpp"
 
 const int SPIR_WORD_SIZE = 4;
@@ -204,6 +207,13 @@ struct printf_buffer_desc_info {
     uint32_t size = 0;
 };
 
+// A section of a clvk program binary
+struct cvk_binary_section {
+    uint32_t type;
+    const void* data;
+    size_t size;
+};
+
 struct spirv_validation_options {
     bool uniform_buffer_std_layout = false;
 };
@@ -237,13 +247,16 @@ class spir_binary {
 
 public:
     spir_binary(spv_target_env env)
-        : m_loaded_from_binary(false), m_target_env(env) {
+        : m_loaded_from_binary(false) {
         m_context = spvContextCreate(env);
     }
     ~spir_binary() { spvContextDestroy(m_context); }
     CHECK_RETURN bool load(const char* fname);
     CHECK_RETURN bool load(std::istream& istream, uint32_t size);
-    CHECK_RETURN bool load_descriptor_map();
+    // Parse the module once to load the descriptor map, collect the required
+    // capabilities and compute the hash of the module. When `stripped` is not
+    // null, it receives a copy of the module without reflection instructions.
+    CHECK_RETURN bool ingest(std::vector<uint32_t>* stripped);
     CHECK_RETURN bool save(std::ostream& ostream) const;
     CHECK_RETURN bool save(const char* fname) const;
     CHECK_RETURN bool read(const unsigned char* src, size_t size);
@@ -272,8 +285,12 @@ public:
     required_work_group_size(const std::string& kernel) const {
         return m_reqd_work_group_sizes.at(kernel);
     }
-    CHECK_RETURN bool
-    get_capabilities(std::vector<spv::Capability>& capabilities) const;
+    // Capabilities required by the module, valid after ingest().
+    const std::vector<spv::Capability>& capabilities() const {
+        return m_capabilities;
+    }
+    // Hash of the module, valid after ingest().
+    const cvk_sha1_hash& sha1() const { return m_sha1; }
     static constexpr uint32_t MAX_DESCRIPTOR_SETS = 3;
 
     const std::unordered_map<pushconstant, pushconstant_desc>&
@@ -342,8 +359,6 @@ public:
         m_reqd_work_group_sizes[kernel] = {x, y, z};
     }
 
-    bool strip_reflection(std::vector<uint32_t>* stripped);
-
     const constant_data_buffer_info* constant_data_buffer() const {
         return m_constant_data_buffer.get();
     }
@@ -400,8 +415,9 @@ private:
     kernels_reqd_work_group_size_map m_reqd_work_group_sizes;
     std::unordered_map<std::string, std::string> m_kernels_attributes;
     kernels_flags_map m_flags;
+    std::vector<spv::Capability> m_capabilities;
+    cvk_sha1_hash m_sha1{};
     bool m_loaded_from_binary;
-    spv_target_env m_target_env;
 };
 
 enum class build_operation
@@ -454,6 +470,7 @@ public:
         vkFreeDescriptorSets(m_device->vulkan_device(), m_descriptor_pool, 1,
                              &ds);
         m_nb_descriptor_set_allocated--;
+        cvk_metric_add(cvk_metric::descriptor_sets_freed);
         TRACE_CNT(descriptor_set_allocated_counter,
                   m_nb_descriptor_set_allocated);
     }
@@ -570,7 +587,8 @@ struct cvk_program : public _cl_program, api_object<object_magic::program> {
         : api_object(ctx), m_num_devices(1U),
           m_binary_type(CL_PROGRAM_BINARY_TYPE_NONE),
           m_shader_module(VK_NULL_HANDLE),
-          m_binary(m_context->device()->vulkan_spirv_env()) {
+          m_binary(m_context->device()->vulkan_spirv_env()),
+          m_pipeline_cache(VK_NULL_HANDLE) {
         m_dev_status[m_context->device()] = CL_BUILD_NONE;
     }
 
@@ -717,7 +735,14 @@ private:
     void write_binary_header(unsigned char* dst) const;
     CHECK_RETURN cl_program_binary_type
 
-    read_binary_header(const unsigned char* src, size_t size);
+    read_binary_header(const unsigned char* src, size_t size,
+                       uint32_t& version);
+    CHECK_RETURN bool read_binary_sections(const unsigned char* src,
+                                           size_t size,
+                                           cl_program_binary_type binary_type);
+    // Must be called with m_binary_pipeline_cache_lock held
+    void snapshot_pipeline_cache() const;
+    std::vector<cvk_binary_section> binary_sections() const;
 
 public:
     CHECK_RETURN bool read(const unsigned char* src, size_t size);
@@ -864,6 +889,11 @@ private:
     CHECK_RETURN cl_build_status do_build_inner(const cvk_device* device);
 
 #if COMPILER_AVAILABLE
+    CHECK_RETURN bool prepare_compile_request(bool build_to_ir,
+                                              const std::string& build_options,
+                                              cvk_compile_request& request);
+    CHECK_RETURN cl_build_status
+    complete_compile_request(bool build_to_ir, cvk_compile_result& result);
 #ifndef CLSPV_ONLINE_COMPILER
     CHECK_RETURN cl_build_status
     do_build_inner_offline(bool build_to_ir, bool build_from_il,
@@ -905,6 +935,12 @@ private:
         m_entry_points;
     std::vector<uint32_t> m_stripped_binary;
     VkPipelineCache m_pipeline_cache;
+    // Data loaded from the sections of a binary, used by the next build
+    std::vector<char> m_loaded_pipeline_cache_data;
+    // Pipeline cache data embedded in the binary returned to the application
+    mutable std::mutex m_binary_pipeline_cache_lock;
+    mutable std::vector<char> m_binary_pipeline_cache_data;
+    mutable bool m_binary_pipeline_cache_snapshot{};
     std::unique_ptr<cvk_buffer> m_module_constant_data_buffer;
     std::unordered_map<uint32_t, user_spec_constant_data> m_user_spec_constants;
 };
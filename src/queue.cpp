@@ -12,18 +12,23 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <chrono>
+#include <iterator>
 #include <thread>
 #include <unordered_set>
 
 #include "config.hpp"
 #include "init.hpp"
 #include "memory.hpp"
+#include "metrics.hpp"
 #include "queue.hpp"
 #include "queue_controller.hpp"
 #include "tracing.hpp"
 #include "utils.hpp"
 
+std::atomic<uint64_t> cvk_command::s_next_trace_id{1};
+
 static cvk_executor_thread_pool* get_thread_pool() {
     auto state = get_or_init_global_state();
     return state->thread_pool();
@@ -37,11 +42,15 @@ cvk_command_queue::cvk_command_queue(
       m_properties_array(std::move(properties_array)), m_executor(nullptr),
       m_command_batch(nullptr), m_vulkan_queue(device->vulkan_queue_allocate()),
       m_command_pool(device, m_vulkan_queue.queue_family()),
+      m_query_pools(device),
       m_max_cmd_batch_size(device->get_max_cmd_batch_size()),
       m_max_first_cmd_batch_size(device->get_max_first_cmd_batch_size()),
       m_max_cmd_group_size(device->get_max_cmd_group_size()),
       m_max_first_cmd_group_size(device->get_max_first_cmd_group_size()),
-      m_nb_batch_in_flight(0), m_nb_group_in_flight(0) {
+      m_nb_batch_in_flight(0), m_nb_group_in_flight(0),
+      m_printf_slices_per_buffer(1), m_printf_slice_size(0),
+      m_printf_slice_stride(0),
+      m_batch_timing_enabled(false) {
 
     m_groups.push_back(std::make_unique<cvk_command_group>());
 
@@ -49,11 +58,21 @@ cvk_command_queue::cvk_command_queue(
         cvk_warn_fn("out-of-order execution enabled, will be ignored");
     }
 
-    if (config.dynamic_batches) {
+    if (config.latency_batches) {
+        if (config.dynamic_batches) {
+            cvk_warn_fn("latency_batches enabled, ignoring dynamic_batches");
+        }
+        m_controllers.push_back(
+            std::make_unique<cvk_queue_controller_batch_latency>(this));
+    } else if (config.dynamic_batches) {
         m_controllers.push_back(
             std::make_unique<cvk_queue_controller_batch_parameters>(this));
     }
 
+    for (auto& controller : m_controllers) {
+        m_batch_timing_enabled |= controller->needs_batch_timing();
+    }
+
     TRACE_CNT_VAR_INIT(batch_in_flight_counter,
                        "clvk-queue_" + std::to_string((uintptr_t)this) +
                            "-batches");
@@ -71,6 +90,22 @@ cl_int cvk_command_queue::init() {
         return CL_OUT_OF_RESOURCES;
     }
 
+    if (config.batch_recording_threads > 1) {
+        for (uint32_t i = 0; i < config.batch_recording_threads; i++) {
+            auto pool = std::make_unique<cvk_command_pool>(
+                m_device, m_vulkan_queue.queue_family(),
+                VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            if (pool->init() != VK_SUCCESS) {
+                return CL_OUT_OF_RESOURCES;
+            }
+            m_secondary_command_pools.push_back(std::move(pool));
+        }
+        for (uint32_t i = 1; i < config.batch_recording_threads; i++) {
+            m_recording_workers.push_back(
+                std::make_unique<cvk_recording_worker>());
+        }
+    }
+
     return CL_SUCCESS;
 }
 
@@ -176,6 +211,8 @@ cl_int cvk_command_queue::enqueue_command_with_retry(cvk_command* cmd,
 }
 
 cl_int cvk_command_queue::enqueue_command(cvk_command* cmd, _cl_event** event) {
+    TRACE_FUNCTION(TRACE_FLOW(cmd->trace_id()), "queue", (uintptr_t)this,
+                   "cmd", (uintptr_t)cmd);
 
     cl_int err;
 
@@ -185,6 +222,11 @@ cl_int cvk_command_queue::enqueue_command(cvk_command* cmd, _cl_event** event) {
         return err;
     }
 
+    err = cmd->acquire_queue_resources();
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
     // Enqueue the command
     std::lock_guard<std::mutex> lock(m_lock);
     if (cmd->can_be_batched()) {
@@ -226,6 +268,8 @@ cl_int cvk_command_queue::enqueue_command(cvk_command* cmd, _cl_event** event) {
         enqueue_command(cmd);
     }
 
+    cvk_metrics_command_enqueued(cmd->type());
+
     cvk_debug_fn("enqueued command %p (%s), event %p", cmd,
                  cl_command_type_to_string(cmd->type()), cmd->event());
 
@@ -294,6 +338,7 @@ cl_int cvk_command_queue::end_current_command_batch(bool from_flush) {
         if (!m_command_batch->end()) {
             return CL_OUT_OF_RESOURCES;
         }
+        cvk_metrics_batch_submitted(m_command_batch->batch_size());
         enqueue_command(m_command_batch);
 
         for (auto& controller : m_controllers) {
@@ -307,6 +352,28 @@ cl_int cvk_command_queue::end_current_command_batch(bool from_flush) {
     return CL_SUCCESS;
 }
 
+void cvk_command_queue::simulate_batch_completed(
+    cl_uint batch_size, uint64_t record_ns, uint64_t execution_ns,
+    cl_uint* max_cmd_batch_size, cl_uint* max_first_cmd_batch_size) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto& controller : m_controllers) {
+        controller->update_after_batch_completed(batch_size, record_ns,
+                                                 execution_ns);
+        controller->update_after_end_current_command_batch(false);
+    }
+    *max_cmd_batch_size = m_max_cmd_batch_size;
+    *max_first_cmd_batch_size = m_max_first_cmd_batch_size;
+}
+
+void cvk_command_queue::batch_completed(cl_uint batch_size, uint64_t record_ns,
+                                        uint64_t execution_ns) {
+    for (auto& controller : m_controllers) {
+        controller->update_after_batch_completed(batch_size, record_ns,
+                                                 execution_ns);
+    }
+    batch_completed();
+}
+
 cl_int cvk_command_queue::wait_for_events(cl_uint num_events,
                                           const cl_event* event_list) {
     cl_int ret = CL_SUCCESS;
@@ -442,6 +509,22 @@ cvk_executor_thread::extract_cmds_required_by(bool only_non_batch_cmds,
     return output;
 }
 
+void cvk_recording_worker::worker() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true) {
+        m_cv.wait(lock, [this] { return m_shutdown || m_task; });
+        if (!m_task) {
+            return;
+        }
+        auto task = m_task;
+        lock.unlock();
+        task();
+        lock.lock();
+        m_task = nullptr;
+        m_cv.notify_all();
+    }
+}
+
 void cvk_executor_thread::executor() {
     cvk_set_current_thread_name_if_supported("clvk-executor");
 
@@ -553,37 +636,215 @@ cl_int cvk_command_queue::finish() {
     return CL_SUCCESS;
 }
 
-VkResult cvk_command_pool::allocate_command_buffer(VkCommandBuffer* cmdbuf) {
+cl_int cvk_command_queue::acquire_printf_slice(uint32_t* slice) {
+    std::lock_guard<std::mutex> lock(m_printf_lock);
+
+    auto it = std::find(m_printf_slices_in_use.begin(),
+                        m_printf_slices_in_use.end(), false);
+
+    // Slices may be held by commands that wait for events that will only be
+    // completed after more commands are enqueued, so add a printf buffer
+    // rather than waiting for a slice to be released.
+    if (it == m_printf_slices_in_use.end()) {
+        TRACE_FUNCTION("num_buffers", m_printf_buffers.size());
+        if (m_printf_buffers.empty()) {
+            uint32_t align = m_device->mem_base_addr_align() / 8;
+            m_printf_slices_per_buffer =
+                std::max(config.printf_buffer_slices(), 1u);
+            m_printf_slice_size = m_context->get_printf_buffersize();
+            m_printf_slice_stride =
+                round_up(static_cast<uint32_t>(m_printf_slice_size), align);
+        }
+        cl_int status;
+        auto buffer = cvk_buffer::create(
+            context(), 0, m_printf_slice_stride * m_printf_slices_per_buffer,
+            nullptr, &status);
+        if (status != CL_SUCCESS) {
+            cvk_error_fn("Could not create printf buffer");
+            return status;
+        }
+        m_printf_buffers.push_back(std::move(buffer));
+        auto first_slice = m_printf_slices_in_use.size();
+        m_printf_slices_in_use.resize(first_slice + m_printf_slices_per_buffer,
+                                      false);
+        it = m_printf_slices_in_use.begin() + first_slice;
+    }
+
+    *slice = std::distance(m_printf_slices_in_use.begin(), it);
+    *it = true;
+
+    // Reset the number of bytes written to the slice
+    auto buffer = m_printf_buffers[*slice / m_printf_slices_per_buffer].get();
+    auto offset = printf_slice_offset(*slice);
+    if (!buffer->map_write_only()) {
+        cvk_error_fn("Could not reset printf buffer");
+        *it = false;
+        return CL_OUT_OF_RESOURCES;
+    }
+    memset(pointer_offset(buffer->host_va(), offset), 0, 4);
+    buffer->unmap_to_write(offset, 4);
 
-    std::lock_guard<std::mutex> lock(m_lock);
+    return CL_SUCCESS;
+}
+
+void cvk_command_queue::release_printf_slice(uint32_t slice) {
+    std::vector<std::unique_ptr<cvk_buffer>> unused_buffers;
+    {
+        std::lock_guard<std::mutex> lock(m_printf_lock);
+        CVK_ASSERT(m_printf_slices_in_use[slice]);
+        m_printf_slices_in_use[slice] = false;
+
+        // Only keep the first printf buffer once no slice is in use so that
+        // the buffers added for bursts of printf kernels are not kept forever
+        if ((m_printf_buffers.size() > 1) &&
+            (std::find(m_printf_slices_in_use.begin(),
+                       m_printf_slices_in_use.end(),
+                       true) == m_printf_slices_in_use.end())) {
+            TRACE_FUNCTION("num_buffers", m_printf_buffers.size());
+            unused_buffers.assign(
+                std::make_move_iterator(m_printf_buffers.begin() + 1),
+                std::make_move_iterator(m_printf_buffers.end()));
+            m_printf_buffers.resize(1);
+            m_printf_slices_in_use.resize(m_printf_slices_per_buffer);
+        }
+    }
+    // The unused buffers are destroyed without holding the lock
+}
+
+VkResult cvk_command_pool::add_generation() {
+    auto gen = std::make_unique<pool_generation>();
+    gen->num_in_use = 0;
+
+    VkCommandPoolCreateInfo createInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, m_flags,
+        m_queue_family};
+
+    auto vkdev = m_device->vulkan_device();
+    auto res = vkCreateCommandPool(vkdev, &createInfo, nullptr, &gen->pool);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    uint32_t num_command_buffers =
+        std::max<uint32_t>(config.command_buffers_per_pool, 1u);
+    gen->command_buffers.resize(num_command_buffers);
 
     VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, 0, m_command_pool,
-        VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        1 // commandBufferCount
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, 0, gen->pool, m_level,
+        num_command_buffers // commandBufferCount
     };
 
-    return vkAllocateCommandBuffers(m_device->vulkan_device(),
-                                    &commandBufferAllocateInfo, cmdbuf);
+    res = vkAllocateCommandBuffers(vkdev, &commandBufferAllocateInfo,
+                                   gen->command_buffers.data());
+    if (res != VK_SUCCESS) {
+        vkDestroyCommandPool(vkdev, gen->pool, nullptr);
+        return res;
+    }
+
+    gen->available = gen->command_buffers;
+
+    m_current = m_generations.size();
+    m_generations.push_back(std::move(gen));
+
+    cvk_debug_fn("%zu command pools", m_generations.size());
+
+    return VK_SUCCESS;
 }
 
-void cvk_command_pool::free_command_buffer(VkCommandBuffer buf) {
-    std::lock_guard<std::mutex> lock(m_lock);
-    vkFreeCommandBuffers(m_device->vulkan_device(), m_command_pool, 1, &buf);
+VkResult cvk_command_pool::reset_generation(pool_generation& gen) {
+    CVK_ASSERT(gen.num_in_use == 0);
+
+    auto res = vkResetCommandPool(m_device->vulkan_device(), gen.pool, 0);
+    if (res != VK_SUCCESS) {
+        return res;
+    }
+
+    gen.available = gen.command_buffers;
+
+    return VK_SUCCESS;
 }
 
-bool cvk_command_buffer::begin() {
+VkResult cvk_command_pool::allocate_command_buffer(VkCommandBuffer* cmdbuf,
+                                                   uint32_t* generation) {
+
+    std::lock_guard<std::mutex> lock(m_ring_lock);
+
+    if (m_generations[m_current]->available.empty()) {
+        // Move on to the next pool whose command buffers have all retired,
+        // or create a new one if there is none
+        uint32_t num_generations = m_generations.size();
+        bool found = false;
+        for (uint32_t i = 1; i <= num_generations; i++) {
+            uint32_t idx = (m_current + i) % num_generations;
+            auto& gen = *m_generations[idx];
+            if (gen.num_in_use == 0) {
+                auto res = reset_generation(gen);
+                if (res != VK_SUCCESS) {
+                    return res;
+                }
+                m_current = idx;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            auto res = add_generation();
+            if (res != VK_SUCCESS) {
+                return res;
+            }
+        }
+    }
+
+    auto& gen = *m_generations[m_current];
+    *cmdbuf = gen.available.back();
+    gen.available.pop_back();
+    gen.num_in_use++;
+    *generation = m_current;
+
+    return VK_SUCCESS;
+}
+
+void cvk_command_pool::free_command_buffer(VkCommandBuffer buf,
+                                           uint32_t generation) {
+    std::lock_guard<std::mutex> lock(m_ring_lock);
+
+    auto& gen = *m_generations[generation];
+    CVK_ASSERT(gen.num_in_use > 0);
+    gen.num_in_use--;
 
-    if (!m_queue->allocate_command_buffer(&m_command_buffer)) {
+    // Command buffers can be begun again straight away when they are reset
+    // individually. Otherwise they wait for the whole pool to be reset.
+    if (m_flags & VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT) {
+        gen.available.push_back(buf);
+    }
+}
+
+bool cvk_command_buffer::begin(VkCommandBufferUsageFlags flags) {
+
+    if (m_pool->allocate_command_buffer(&m_command_buffer,
+                                        &m_pool_generation) != VK_SUCCESS) {
         return false;
     }
 
-    cvk_command_pool_lock_holder lock(m_queue);
+    std::lock_guard<cvk_command_pool> lock(*m_pool);
+
+    // Secondary command buffers only ever contain compute and transfer
+    // commands, so there is no render pass state to inherit.
+    VkCommandBufferInheritanceInfo inheritanceInfo = {
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        nullptr,
+        VK_NULL_HANDLE, // renderPass
+        0,              // subpass
+        VK_NULL_HANDLE, // framebuffer
+        VK_FALSE,       // occlusionQueryEnable
+        0,              // queryFlags
+        0,              // pipelineStatistics
+    };
 
     VkCommandBufferBeginInfo beginInfo = {
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr,
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-        nullptr // pInheritanceInfo
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr, flags,
+        is_secondary() ? &inheritanceInfo : nullptr // pInheritanceInfo
     };
 
     VkResult res = vkBeginCommandBuffer(m_command_buffer, &beginInfo);
@@ -615,29 +876,30 @@ bool cvk_command_buffer::submit_and_wait() {
 cl_int cvk_command_kernel::update_global_push_constants(
     cvk_command_buffer& command_buffer) {
     auto program = m_kernel->program();
+    auto& layout = m_kernel->launch_layout();
 
-    if (auto pc = program->push_constant(pushconstant::global_offset)) {
+    if (auto pc = layout.global_offset) {
         CVK_ASSERT(pc->size == 12);
         vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
                            VK_SHADER_STAGE_COMPUTE_BIT, pc->offset, pc->size,
                            &m_ndrange.offset);
     }
 
-    if (auto pc = program->push_constant(pushconstant::enqueued_local_size)) {
+    if (auto pc = layout.enqueued_local_size) {
         CVK_ASSERT(pc->size == 12);
         vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
                            VK_SHADER_STAGE_COMPUTE_BIT, pc->offset, pc->size,
                            &m_ndrange.lws);
     }
 
-    if (auto pc = program->push_constant(pushconstant::global_size)) {
+    if (auto pc = layout.global_size) {
         CVK_ASSERT(pc->size == 12);
         vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
                            VK_SHADER_STAGE_COMPUTE_BIT, pc->offset, pc->size,
                            &m_ndrange.gws);
     }
 
-    if (auto pc = program->push_constant(pushconstant::num_workgroups)) {
+    if (auto pc = layout.num_workgroups) {
         CVK_ASSERT(pc->size == 12);
         uint32_t num_workgroups[3] = {m_ndrange.gws[0] / m_ndrange.lws[0],
                                       m_ndrange.gws[1] / m_ndrange.lws[1],
@@ -653,8 +915,7 @@ cl_int cvk_command_kernel::update_global_push_constants(
                            &num_workgroups);
     }
 
-    if (auto pc =
-            program->push_constant(pushconstant::module_constants_pointer)) {
+    if (auto pc = layout.module_constants_pointer) {
         CVK_ASSERT(pc->size == 8);
 
         auto buffer = program->module_constant_data_buffer();
@@ -665,77 +926,30 @@ cl_int cvk_command_kernel::update_global_push_constants(
                            &dev_addr);
     }
 
-    if (auto pc = program->push_constant(pushconstant::printf_buffer_pointer)) {
+    if (auto pc = layout.printf_buffer_pointer) {
         CVK_ASSERT(pc->size == 8);
         CVK_ASSERT(program->uses_printf());
 
-        auto buffer = m_queue->get_printf_buffer();
+        CVK_ASSERT(m_printf_slice != NO_PRINTF_SLICE);
+        auto buffer = m_queue->get_printf_buffer(m_printf_slice);
         if (buffer == nullptr) {
             cvk_error_fn("printf buffer was not created");
             return CL_OUT_OF_RESOURCES;
         }
-        auto dev_addr = buffer->device_address();
+        auto dev_addr = buffer->device_address() +
+                        m_queue->printf_slice_offset(m_printf_slice);
 
         vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
                            VK_SHADER_STAGE_COMPUTE_BIT, pc->offset, pc->size,
                            &dev_addr);
     }
 
-    uint32_t image_metadata_pc_start = UINT32_MAX;
-    uint32_t image_metadata_pc_end = 0;
-    if (const auto* md = m_kernel->get_image_metadata()) {
-        for (const auto& md : *md) {
-            if (md.second.has_valid_order()) {
-                auto order_offset = md.second.order_offset;
-                image_metadata_pc_start =
-                    std::min(image_metadata_pc_start, order_offset);
-                image_metadata_pc_end =
-                    std::max(image_metadata_pc_end,
-                             order_offset + (uint32_t)sizeof(uint32_t));
-            }
-            if (md.second.has_valid_data_type()) {
-                auto data_type_offset = md.second.data_type_offset;
-                image_metadata_pc_start =
-                    std::min(image_metadata_pc_start, data_type_offset);
-                image_metadata_pc_end =
-                    std::max(image_metadata_pc_end,
-                             data_type_offset + (uint32_t)sizeof(uint32_t));
-            }
-        }
-    }
-    if (const auto* md = m_kernel->get_sampler_metadata()) {
-        for (const auto& md : *md) {
-            auto offset = md.second;
-            image_metadata_pc_start = std::min(image_metadata_pc_start, offset);
-            image_metadata_pc_end = std::max(
-                image_metadata_pc_end, offset + (uint32_t)sizeof(uint32_t));
-        }
-    }
-    if (image_metadata_pc_start < image_metadata_pc_end) {
-        uint32_t offset = image_metadata_pc_start & ~0x3U;
-        uint32_t size = round_up(image_metadata_pc_end - offset, 4);
-        CVK_ASSERT(offset + size <= m_argument_values->pod_data().size());
+    auto& pod_data = m_argument_values->pod_data();
+    for (auto& pc : layout.pod_push_constants) {
+        CVK_ASSERT(pc.offset + pc.size <= pod_data.size());
         vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
-                           VK_SHADER_STAGE_COMPUTE_BIT, offset, size,
-                           &m_argument_values->pod_data()[offset]);
-    }
-    if (m_kernel->has_pod_arguments() &&
-        !m_kernel->has_pod_buffer_arguments()) {
-        for (auto& arg : m_kernel->arguments()) {
-            if (arg.kind == kernel_argument_kind::pod_pushconstant ||
-                arg.kind == kernel_argument_kind::pointer_pushconstant) {
-                CVK_ASSERT(arg.offset + arg.size <=
-                           m_argument_values->pod_data().size());
-
-                // Vulkan valid usage states push constants can only be updated
-                // in chunks whose offset and size are a multiple of 4.
-                uint32_t size = round_up(arg.size, 4);
-                uint32_t offset = arg.offset & ~0x3U;
-                vkCmdPushConstants(command_buffer, m_kernel->pipeline_layout(),
-                                   VK_SHADER_STAGE_COMPUTE_BIT, offset, size,
-                                   &m_argument_values->pod_data()[offset]);
-            }
-        }
+                           VK_SHADER_STAGE_COMPUTE_BIT, pc.offset, pc.size,
+                           &pod_data[pc.offset]);
     }
     return CL_SUCCESS;
 }
@@ -757,77 +971,21 @@ cl_int cvk_command_kernel::dispatch_uniform_region_within_vklimits(
         num_workgroups[i] = region.gws[i] / region.lws[i];
     };
 
-    auto program = m_kernel->program();
-    auto constants = program->spec_constants();
-    // TODO: if all kernels in the module use the same reqd_workgroup_size ,
-    // clspv will not generate specialization constants for workgroup size, but
-    // these values should be error checked.
-    uint32_t wgsize_x_id = 0;
-    auto where = constants.find(spec_constant::workgroup_size_x);
-    if (where != constants.end()) {
-        wgsize_x_id = where->second;
-    }
-    uint32_t wgsize_y_id = 1;
-    where = constants.find(spec_constant::workgroup_size_y);
-    if (where != constants.end()) {
-        wgsize_y_id = where->second;
-    }
-    uint32_t wgsize_z_id = 2;
-    where = constants.find(spec_constant::workgroup_size_z);
-    if (where != constants.end()) {
-        wgsize_z_id = where->second;
-    }
-
-    cvk_spec_constant_map specConstants = {
-        {wgsize_x_id, region.lws[0]},
-        {wgsize_y_id, region.lws[1]},
-        {wgsize_z_id, region.lws[2]},
-    };
-    for (auto const& spec_value :
-         m_argument_values->specialization_constants()) {
-        specConstants[spec_value.first] = spec_value.second;
-    }
-    // Clspv allocates a spec constant for work dimensions if get_work_dim() is
-    // used.
-    where = constants.find(spec_constant::work_dim);
-    if (where != constants.end()) {
-        uint32_t dim_id = where->second;
-        specConstants[dim_id] = m_dimensions;
-    }
-
-    where = constants.find(spec_constant::subgroup_max_size);
-    if (where != constants.end()) {
-        uint32_t size_id = where->second;
-        specConstants[size_id] = m_queue->device()->sub_group_size();
-    }
-
-    // Clspv can allocate spec constants for global offset.
-    where = constants.find(spec_constant::global_offset_x);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[0];
-    }
-    where = constants.find(spec_constant::global_offset_y);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[1];
-    }
-    where = constants.find(spec_constant::global_offset_z);
-    if (where != constants.end()) {
-        uint32_t offset_id = where->second;
-        specConstants[offset_id] = m_ndrange.offset[2];
-    }
-
-    m_pipeline = m_kernel->create_pipeline(specConstants);
-
-    if (m_pipeline == VK_NULL_HANDLE) {
+    auto pipeline = m_kernel->get_pipeline(*m_argument_values, m_dimensions,
+                                           m_ndrange.offset, region.lws);
+    if (pipeline == VK_NULL_HANDLE) {
         return CL_OUT_OF_RESOURCES;
     }
 
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-                      m_pipeline);
+    // Regions split to fit within the device limits share their pipeline
+    if (pipeline != m_pipeline) {
+        m_pipeline = pipeline;
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipeline);
+    }
 
-    if (auto pc = program->push_constant(pushconstant::region_offset)) {
+    auto& layout = m_kernel->launch_layout();
+    if (auto pc = layout.region_offset) {
         CVK_ASSERT(pc->size == 12);
         uint32_t region_offsets[3] = {
             m_ndrange.offset[0] + region.offset[0],
@@ -839,7 +997,7 @@ cl_int cvk_command_kernel::dispatch_uniform_region_within_vklimits(
                            &region_offsets);
     }
 
-    if (auto pc = program->push_constant(pushconstant::region_group_offset)) {
+    if (auto pc = layout.region_group_offset) {
         CVK_ASSERT(pc->size == 12);
         uint32_t region_group_offsets[3] = {
             region.offset[0] / m_ndrange.lws[0],
@@ -854,32 +1012,6 @@ cl_int cvk_command_kernel::dispatch_uniform_region_within_vklimits(
     vkCmdDispatch(command_buffer, num_workgroups[0], num_workgroups[1],
                   num_workgroups[2]);
 
-    // If we have a kernel that requires serial execution (i.e. regions are not
-    // executed in parallel with other regions or other kernels) then serialize
-    // the command buffer
-    if (m_kernel->requires_serialized_execution()) {
-        VkMemoryBarrier memoryBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER,
-                                         nullptr, VK_ACCESS_SHADER_WRITE_BIT,
-                                         VK_ACCESS_MEMORY_READ_BIT |
-                                             VK_ACCESS_MEMORY_WRITE_BIT};
-
-        // Workaround for a bug on some NVIDIA devices.
-        // This should already be covered by VK_ACCESS_MEMORY_READ_BIT.
-        memoryBarrier.dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(
-            command_buffer,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // srcStageMask
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, // dstStageMask
-            0,                                    // dependencyFlags
-            1,                                    // memoryBarrierCount
-            &memoryBarrier,
-            0,        // bufferMemoryBarrierCount
-            nullptr,  // pBufferMemoryBarriers
-            0,        // imageMemoryBarrierCount
-            nullptr); // pImageMemoryBarriers
-    }
-
     return CL_SUCCESS;
 }
 
@@ -1023,38 +1155,42 @@ cl_int cvk_command_kernel::build_and_dispatch_regions(
     return CL_SUCCESS;
 }
 
-cl_int
-cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
+cl_int cvk_command_kernel::prepare_batchable_inner() {
 
     // TODO check against the size specified at compile time, if any
     // TODO CL_INVALID_KERNEL_ARGS if the kernel argument values have not been
     // specified.
 
-    m_argument_values = m_kernel->argument_values();
-    m_argument_values->retain_resources();
+    auto argument_values = m_kernel->argument_values();
+    argument_values->retain_resources();
 
     // Setup descriptors
-    if (!m_argument_values->setup_descriptor_sets()) {
-        m_argument_values->release_resources();
-        m_argument_values = nullptr;
+    if (!argument_values->setup_descriptor_sets()) {
+        argument_values->release_resources();
         return CL_OUT_OF_RESOURCES;
     }
 
+    // Commands recorded in a command buffer are built again when they are
+    // updated. The previous values are only released now so that their
+    // descriptors can be copied.
+    if (m_argument_values) {
+        m_argument_values->release_resources();
+    }
+    m_argument_values = argument_values;
+    m_pipeline = VK_NULL_HANDLE;
+
     // Setup printf buffer descriptor if needed
     if (m_kernel->program()->uses_printf()) {
-        // Create and initialize the printf buffer
-        auto buffer = m_queue->get_or_create_printf_buffer();
-        auto err = m_queue->reset_printf_buffer();
-        if (err != CL_SUCCESS) {
-            return err;
-        }
+        CVK_ASSERT(m_printf_slice != NO_PRINTF_SLICE);
+        auto buffer = m_queue->get_printf_buffer(m_printf_slice);
 
         if (m_kernel->program()->printf_buffer_info().type ==
             module_buffer_type::storage_buffer) {
 
-            VkDescriptorBufferInfo bufferInfo = {buffer->vulkan_buffer(),
-                                                 0, // offset
-                                                 VK_WHOLE_SIZE};
+            VkDescriptorBufferInfo bufferInfo = {
+                buffer->vulkan_buffer(),
+                m_queue->printf_slice_offset(m_printf_slice),
+                m_queue->printf_slice_size()};
 
             auto* ds = m_argument_values->descriptor_sets();
             VkWriteDescriptorSet writeDescriptorSet = {
@@ -1075,6 +1211,13 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
         }
     }
 
+    return CL_SUCCESS;
+}
+
+cl_int
+cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
+    CVK_ASSERT(m_argument_values);
+
     // Bind descriptors and update push constants
     if (m_kernel->num_set_layouts() > 0) {
         vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
@@ -1121,17 +1264,24 @@ cvk_command_kernel::build_batchable_inner(cvk_command_buffer& command_buffer) {
     return CL_SUCCESS;
 }
 
-cl_int cvk_command_kernel::do_post_action() {
-    if (m_kernel->uses_printf()) {
-        auto buffer = m_queue->get_printf_buffer();
-        if (buffer == nullptr) {
-            cvk_error_fn("printf buffer was not created");
-            return CL_OUT_OF_RESOURCES;
-        }
+cl_int cvk_command_kernel::acquire_queue_resources() {
+    if (!m_kernel->uses_printf() || (m_printf_slice != NO_PRINTF_SLICE)) {
+        return CL_SUCCESS;
+    }
+    return m_queue->acquire_printf_slice(&m_printf_slice);
+}
 
-        return cvk_printf(buffer, m_kernel->program()->printf_descriptors(),
-                          m_queue->context()->get_printf_callback(),
-                          m_queue->context()->get_printf_userdata());
+cl_int cvk_command_kernel::do_post_action() {
+    if (m_printf_slice != NO_PRINTF_SLICE) {
+        auto err = cvk_printf(m_queue->get_printf_buffer(m_printf_slice),
+                              m_queue->printf_slice_offset(m_printf_slice),
+                              m_queue->printf_slice_size(),
+                              m_kernel->program()->printf_descriptors(),
+                              m_queue->context()->get_printf_callback(),
+                              m_queue->context()->get_printf_userdata());
+        m_queue->release_printf_slice(m_printf_slice);
+        m_printf_slice = NO_PRINTF_SLICE;
+        return err;
     }
 
     return CL_SUCCESS;
@@ -1182,29 +1332,36 @@ cl_int cvk_command_batchable::build() {
 cl_int cvk_command_batchable::build(cvk_command_buffer& command_buffer) {
     CVK_ASSERT(m_command_buffer == nullptr ||
                (*m_command_buffer == command_buffer));
-    // Create query pool
-    VkQueryPoolCreateInfo query_pool_create_info = {
-        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-        nullptr,
-        0,                            // flags
-        VK_QUERY_TYPE_TIMESTAMP,      // queryType
-        NUM_POOL_QUERIES_PER_COMMAND, // queryCount
-        0,                            // pipelineStatistics
-    };
 
-    bool profiling = m_queue->has_property(CL_QUEUE_PROFILING_ENABLE);
+    auto err = prepare();
+    if (err != CL_SUCCESS) {
+        return err;
+    }
+
+    return record(command_buffer);
+}
 
-    if (profiling && m_queue->profiling_on_device()) {
-        auto vkdev = m_queue->device()->vulkan_device();
-        auto res = vkCreateQueryPool(vkdev, &query_pool_create_info, nullptr,
-                                     &m_query_pool);
-        if (res != VK_SUCCESS) {
+cl_int cvk_command_batchable::prepare() {
+    bool profiling = m_queue->has_property(CL_QUEUE_PROFILING_ENABLE);
+    bool timestamps = (profiling && m_queue->profiling_on_device()) ||
+                      m_queue->gpu_tracing_enabled();
+
+    // Query pools are recycled by the queue rather than created for every
+    // command
+    if (timestamps && (m_query_pool == VK_NULL_HANDLE)) {
+        m_query_pool = m_queue->query_pools().acquire();
+        if (m_query_pool == VK_NULL_HANDLE) {
             return CL_OUT_OF_RESOURCES;
         }
     }
 
-    // Sample timestamp if profiling
-    if (profiling && m_queue->profiling_on_device()) {
+    return prepare_batchable_inner();
+}
+
+cl_int cvk_command_batchable::record(cvk_command_buffer& command_buffer) {
+    // Sample timestamp if profiling or tracing
+    bool timestamps = m_query_pool != VK_NULL_HANDLE;
+    if (timestamps) {
         vkCmdResetQueryPool(command_buffer, m_query_pool, 0,
                             NUM_POOL_QUERIES_PER_COMMAND);
         vkCmdWriteTimestamp(command_buffer,
@@ -1217,8 +1374,7 @@ cl_int cvk_command_batchable::build(cvk_command_buffer& command_buffer) {
         return err;
     }
 
-    // Sample timestamp if profiling
-    if (profiling && m_queue->profiling_on_device()) {
+    if (timestamps) {
         vkCmdWriteTimestamp(command_buffer,
                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, m_query_pool,
                             POOL_QUERY_CMD_END);
@@ -1250,6 +1406,29 @@ cl_int cvk_command_batchable::get_timestamp_query_results(cl_ulong* start,
     return CL_COMPLETE;
 }
 
+void cvk_command_batchable::trace_gpu_execution(cl_ulong sync_dev,
+                                                cl_ulong sync_host) {
+#ifdef CLVK_PERFETTO_ENABLE
+    if (m_query_pool == VK_NULL_HANDLE) {
+        return;
+    }
+
+    cl_ulong start, end;
+    if (get_timestamp_query_results(&start, &end) != CL_COMPLETE) {
+        return;
+    }
+
+    auto dev = m_queue->device();
+    trace_gpu_slice((uintptr_t)m_queue->vulkan_queue().queue(), m_type,
+                    dev->device_timer_to_host(start, sync_dev, sync_host),
+                    dev->device_timer_to_host(end, sync_dev, sync_host),
+                    trace_id());
+#else
+    UNUSED(sync_dev);
+    UNUSED(sync_host);
+#endif
+}
+
 cl_int cvk_command_batchable::do_action() {
     CVK_ASSERT(m_command_buffer);
 
@@ -1257,20 +1436,246 @@ cl_int cvk_command_batchable::do_action() {
         return CL_OUT_OF_RESOURCES;
     }
 
+    if (m_queue->gpu_tracing_enabled()) {
+        cl_ulong sync_dev, sync_host;
+        if (m_queue->device()->get_device_host_timer(&sync_dev, &sync_host) ==
+            CL_SUCCESS) {
+            trace_gpu_execution(sync_dev, sync_host);
+        }
+    }
+
     return do_post_action();
 }
 
+cl_int cvk_command_batch::build_command(cvk_command_batchable* cmd) {
+    if (!m_command_buffer) {
+        // Create command buffer and start recording on first call
+        m_command_buffer = std::make_unique<cvk_command_buffer>(m_queue);
+        if (!m_command_buffer->begin()) {
+            return CL_OUT_OF_RESOURCES;
+        }
+        if (m_queue->batch_timing_enabled()) {
+            cvk_command_pool_lock_holder lock(m_queue);
+            begin_timing();
+        }
+    }
+    cvk_command_pool_lock_holder lock(m_queue);
+
+    return cmd->build(*m_command_buffer);
+}
+
+bool cvk_command_batch::end() {
+    if (records_in_parallel()) {
+        return record_commands();
+    }
+
+    cvk_command_pool_lock_holder lock(m_queue);
+    if (m_queue->batch_timing_enabled()) {
+        end_timing();
+    }
+    return m_command_buffer->end();
+}
+
+bool cvk_command_batch::record_commands() {
+    TRACE_FUNCTION("batch_size", m_commands.size());
+    CVK_ASSERT(!m_command_buffer);
+
+    // Only split batches large enough for every thread to record at least
+    // one full chunk
+    size_t num_commands = m_commands.size();
+    size_t min_chunk_size =
+        std::max<uint32_t>(config.batch_recording_chunk_size, 1u);
+    uint32_t num_chunks =
+        std::min<size_t>(m_queue->num_secondary_command_pools(),
+                         std::max<size_t>(num_commands / min_chunk_size, 1));
+    size_t chunk_size = (num_commands + num_chunks - 1) / num_chunks;
+
+    m_command_buffer = std::make_unique<cvk_command_buffer>(m_queue);
+    if (!m_command_buffer->begin()) {
+        return false;
+    }
+
+    cvk_command_pool_lock_holder lock(m_queue);
+
+    if (m_queue->batch_timing_enabled()) {
+        begin_timing();
+    }
+
+    if (num_chunks == 1) {
+        for (auto& cmd : m_commands) {
+            if (cmd->record(*m_command_buffer) != CL_SUCCESS) {
+                return false;
+            }
+        }
+    } else {
+        cvk_debug_fn("recording batch %p in %u chunks of up to %zu commands",
+                     this, num_chunks, chunk_size);
+
+        m_chunk_command_buffers.resize(num_chunks);
+        std::vector<cl_int> errors(num_chunks);
+        for (uint32_t chunk = 1; chunk < num_chunks; chunk++) {
+            m_queue->recording_worker(chunk)->run(
+                [this, chunk, chunk_size, &errors] {
+                    errors[chunk] = record_chunk(chunk, chunk_size);
+                });
+        }
+        errors[0] = record_chunk(0, chunk_size);
+        for (uint32_t chunk = 1; chunk < num_chunks; chunk++) {
+            m_queue->recording_worker(chunk)->wait();
+        }
+
+        for (uint32_t chunk = 0; chunk < num_chunks; chunk++) {
+            if (errors[chunk] != CL_SUCCESS) {
+                cvk_error_fn("could not record chunk %u of batch %p", chunk,
+                             this);
+                return false;
+            }
+        }
+
+        // Pipeline barriers recorded in a secondary command buffer also apply
+        // to the commands of the previous ones, so the chunks are executed
+        // with the same ordering guarantees as a single command buffer.
+        std::vector<VkCommandBuffer> chunks;
+        for (auto& cmdbuf : m_chunk_command_buffers) {
+            chunks.push_back(*cmdbuf);
+        }
+        vkCmdExecuteCommands(*m_command_buffer, chunks.size(), chunks.data());
+    }
+
+    if (m_queue->batch_timing_enabled()) {
+        end_timing();
+    }
+
+    return m_command_buffer->end();
+}
+
+cl_int cvk_command_batch::record_chunk(uint32_t chunk, size_t chunk_size) {
+    auto pool = m_queue->secondary_command_pool(chunk);
+    auto cmdbuf = std::make_unique<cvk_command_buffer>(m_queue, pool);
+    if (!cmdbuf->begin()) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    std::lock_guard<cvk_command_pool> lock(*pool);
+
+    size_t first = chunk * chunk_size;
+    size_t last = std::min(first + chunk_size, m_commands.size());
+    for (size_t i = first; i < last; i++) {
+        auto err = m_commands[i]->record(*cmdbuf);
+        if (err != CL_SUCCESS) {
+            return err;
+        }
+    }
+
+    if (!cmdbuf->end()) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    m_chunk_command_buffers[chunk] = std::move(cmdbuf);
+
+    return CL_SUCCESS;
+}
+
+void cvk_command_batch::begin_timing() {
+    // Without timestamp support on the queue, fall back to measuring the
+    // execution from the host.
+    if (!m_queue->device()->vulkan_limits().timestampComputeAndGraphics) {
+        return;
+    }
+
+    m_query_pool = m_queue->query_pools().acquire();
+    if (m_query_pool == VK_NULL_HANDLE) {
+        cvk_warn_fn("could not create query pool, timing batch from the host");
+        return;
+    }
+
+    vkCmdResetQueryPool(*m_command_buffer, m_query_pool, 0,
+                        NUM_POOL_QUERIES_PER_BATCH);
+    vkCmdWriteTimestamp(*m_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        m_query_pool, POOL_QUERY_BATCH_START);
+}
+
+void cvk_command_batch::end_timing() {
+    if (m_query_pool != VK_NULL_HANDLE) {
+        vkCmdWriteTimestamp(*m_command_buffer,
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool,
+                            POOL_QUERY_BATCH_END);
+    }
+    m_record_duration = cvk_event::sample_clock() - m_record_start;
+}
+
+void cvk_command_batch::trace_gpu_execution() {
+    TRACE_FUNCTION("queue", (uintptr_t) & (*m_queue), "batch_size",
+                   batch_size());
+
+    // All commands are converted to the host clock with the same calibration
+    cl_ulong sync_dev, sync_host;
+    if (m_queue->device()->get_device_host_timer(&sync_dev, &sync_host) !=
+        CL_SUCCESS) {
+        return;
+    }
+
+    for (auto& cmd : m_commands) {
+        cmd->trace_gpu_execution(sync_dev, sync_host);
+    }
+}
+
+uint64_t cvk_command_batch::execution_duration(uint64_t submit_start) {
+    uint64_t host_duration = cvk_event::sample_clock() - submit_start;
+    if (m_query_pool == VK_NULL_HANDLE) {
+        return host_duration;
+    }
+
+    uint64_t timestamps[NUM_POOL_QUERIES_PER_BATCH];
+    auto dev = m_queue->device();
+    auto res = vkGetQueryPoolResults(
+        dev->vulkan_device(), m_query_pool, 0, NUM_POOL_QUERIES_PER_BATCH,
+        sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS ||
+        timestamps[POOL_QUERY_BATCH_END] < timestamps[POOL_QUERY_BATCH_START]) {
+        return host_duration;
+    }
+
+    return dev->timestamp_to_ns(timestamps[POOL_QUERY_BATCH_END] -
+                                timestamps[POOL_QUERY_BATCH_START]);
+}
+
 cl_int cvk_command_batch::do_action() {
 
     cvk_info("executing batch of %lu commands", m_commands.size());
 
+    uint64_t submit_start = 0;
+    if (m_queue->batch_timing_enabled()) {
+        submit_start = cvk_event::sample_clock();
+    }
+
     if (!m_command_buffer->submit_and_wait()) {
         return CL_OUT_OF_RESOURCES;
     }
 
-    m_queue->batch_completed();
+    if (m_queue->gpu_tracing_enabled()) {
+        trace_gpu_execution();
+    }
 
-    return CL_COMPLETE;
+    // Decode the printf output of the commands once the whole batch has
+    // retired, on the thread executing the batch
+    cl_int status = CL_COMPLETE;
+    for (auto& cmd : m_commands) {
+        auto err = cmd->do_post_action();
+        if (err != CL_SUCCESS && status == CL_COMPLETE) {
+            status = err;
+        }
+    }
+
+    if (m_queue->batch_timing_enabled()) {
+        m_queue->batch_completed(batch_size(), m_record_duration,
+                                 execution_duration(submit_start));
+    } else {
+        m_queue->batch_completed();
+    }
+
+    return status;
 }
 
 cl_int cvk_command_buffer_host_copy::do_action() {
@@ -1293,6 +1698,60 @@ cl_int cvk_command_buffer_host_copy::do_action() {
     return success ? CL_COMPLETE : CL_OUT_OF_RESOURCES;
 }
 
+cl_int cvk_command_svm_memcpy::do_action() {
+    bool success = true;
+
+    if (m_src_buffer != nullptr) {
+        success = m_src_buffer->copy_to(m_dst_ptr, m_src_offset, m_size);
+    } else if (m_dst_buffer != nullptr) {
+        success = m_dst_buffer->copy_from(m_src_ptr, m_dst_offset, m_size);
+    } else {
+        memcpy(m_dst_ptr, m_src_ptr, m_size);
+    }
+
+    return success ? CL_COMPLETE : CL_OUT_OF_RESOURCES;
+}
+
+cl_int cvk_command_svm_free::do_action() {
+    if (m_callback != nullptr) {
+        m_callback(m_queue, m_pointers.size(), m_pointers.data(), m_user_data);
+    } else {
+        for (auto ptr : m_pointers) {
+            m_queue->context()->remove_svm_allocation(ptr);
+        }
+    }
+
+    return CL_COMPLETE;
+}
+
+cl_int cvk_command_semaphores::do_action() {
+    std::vector<VkSemaphore> semaphores;
+    for (auto& sem : m_semaphores) {
+        semaphores.push_back(sem->vulkan_semaphore());
+    }
+
+    std::vector<VkSemaphore> none;
+    auto& queue = m_queue->vulkan_queue();
+    VkResult res;
+    if (m_type == CL_COMMAND_SEMAPHORE_WAIT_KHR) {
+        res = queue.submit(semaphores, none);
+    } else {
+        res = queue.submit(none, semaphores);
+    }
+    if (res != VK_SUCCESS) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    // Commands are executed one after the other, the semaphore operations
+    // must have completed before the next command starts
+    res = queue.wait_idle();
+    if (res != VK_SUCCESS) {
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    return CL_COMPLETE;
+}
+
 struct rectangle {
 public:
     void set_params(const std::array<size_t, 3>& origin, size_t slicep,
@@ -1411,6 +1870,12 @@ cl_int cvk_command_copy_host_buffer_rect::do_action() {
 
     m_copier.do_copy(dir, src_base, dst_base);
 
+    if (dir == cvk_rectangle_copier::direction::A_TO_B) {
+        cvk_metric_add(cvk_metric::bytes_copied_from_device, m_copier.size());
+    } else {
+        cvk_metric_add(cvk_metric::bytes_copied_to_device, m_copier.size());
+    }
+
     return CL_COMPLETE;
 }
 
@@ -1507,7 +1972,8 @@ cl_int cvk_command_map_buffer::do_action() {
         return false;
     }
 
-    if (m_buffer->has_flags(CL_MEM_USE_HOST_PTR)) {
+    if (m_buffer->has_flags(CL_MEM_USE_HOST_PTR) &&
+        !m_buffer->uses_imported_host_ptr()) {
         auto dst = m_mapping.buffer->host_ptr();
         dst = pointer_offset(dst, m_offset);
         success = m_buffer->copy_to(dst, m_offset, m_size);
@@ -1525,7 +1991,8 @@ cl_int cvk_command_unmap_buffer::do_action() {
 
     auto mapping = m_buffer->remove_mapping(m_mapped_ptr);
 
-    if (m_buffer->has_flags(CL_MEM_USE_HOST_PTR)) {
+    if (m_buffer->has_flags(CL_MEM_USE_HOST_PTR) &&
+        !m_buffer->uses_imported_host_ptr() && (mapping.size != 0)) {
         auto src = m_buffer->host_ptr();
         src = pointer_offset(src, mapping.offset);
         success = mapping.buffer->copy_from(src, mapping.offset, mapping.size);
@@ -1834,6 +2301,31 @@ cl_int cvk_command_image_image_copy::build_batchable_inner(
     return CL_SUCCESS;
 }
 
+cl_int cvk_command_device_copy_buffer::build_batchable_inner(
+    cvk_command_buffer& cmdbuf) {
+    VkBufferCopy region = {
+        m_src_buffer->vulkan_buffer_offset() + m_src_offset, // srcOffset
+        m_dst_buffer->vulkan_buffer_offset() + m_dst_offset, // dstOffset
+        m_size,                                              // size
+    };
+
+    vkCmdCopyBuffer(cmdbuf, m_src_buffer->vulkan_buffer(),
+                    m_dst_buffer->vulkan_buffer(), 1, &region);
+
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_device_fill_buffer::build_batchable_inner(
+    cvk_command_buffer& cmdbuf) {
+    CVK_ASSERT((m_offset % 4 == 0) && (m_size % 4 == 0));
+
+    vkCmdFillBuffer(cmdbuf, m_buffer->vulkan_buffer(),
+                    m_buffer->vulkan_buffer_offset() + m_offset, m_size,
+                    m_data);
+
+    return CL_SUCCESS;
+}
+
 cl_int cvk_command_fill_image::do_action() {
     // TODO use bigger memcpy's when possible
     size_t num_elems = m_region[2] * m_region[1] * m_region[0];
@@ -1845,12 +2337,11 @@ cl_int cvk_command_fill_image::do_action() {
     return CL_COMPLETE;
 }
 
-cl_int
-cvk_command_image_init::build_batchable_inner(cvk_command_buffer& cmdbuf) {
-
-    bool needs_copy = m_image->init_data() != nullptr;
-
-    // Transition image layout to GENERAL or TRANSFER_DST_OPTIMAL.
+static void image_layout_barrier(cvk_command_buffer& cmdbuf, VkImage image,
+                                 VkPipelineStageFlags src_stage,
+                                 VkAccessFlags src_access,
+                                 VkImageLayout old_layout,
+                                 VkImageLayout new_layout) {
     VkImageSubresourceRange subresourceRange = {
         VK_IMAGE_ASPECT_COLOR_BIT, // aspectMask
         0,                         // baseMipLevel
@@ -1859,24 +2350,20 @@ cvk_command_image_init::build_batchable_inner(cvk_command_buffer& cmdbuf) {
         VK_REMAINING_ARRAY_LAYERS, // layerCount
     };
 
-    VkImageLayout layout = needs_copy ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-                                      : VK_IMAGE_LAYOUT_GENERAL;
-
     VkImageMemoryBarrier imageBarrier = {
         VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         nullptr,
-        0,                                                      // srcAccessMask
+        src_access,                                             // srcAccessMask
         VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, // dstAccessMask
-        VK_IMAGE_LAYOUT_UNDEFINED,                              // oldLayout
-        layout,                                                 // newLayout
-        0,                       // srcQueueFamilyIndex
-        0,                       // dstQueueFamilyIndex
-        m_image->vulkan_image(), // image
-        subresourceRange,        // subresourceRange
+        old_layout,                                             // oldLayout
+        new_layout,                                             // newLayout
+        0,                // srcQueueFamilyIndex
+        0,                // dstQueueFamilyIndex
+        image,            // image
+        subresourceRange, // subresourceRange
     };
 
-    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+    vkCmdPipelineBarrier(cmdbuf, src_stage, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
                          0,              // dependencyFlags
                          0,              // memoryBarrierCount
                          nullptr,        // pMemoryBarriers
@@ -1884,82 +2371,105 @@ cvk_command_image_init::build_batchable_inner(cvk_command_buffer& cmdbuf) {
                          nullptr,        // pBufferMemoryBarriers
                          1,              // imageMemoryBarrierCount
                          &imageBarrier); // pImageMemoryBarriers
+}
 
-    // Set up a buffer->image copy to initialize the image contents.
-    if (needs_copy) {
-        uint32_t row_length = m_image->row_pitch() ? m_image->row_pitch() /
-                                                         m_image->element_size()
-                                                   : m_image->width();
-        uint32_t image_height =
-            m_image->slice_pitch()
-                ? m_image->slice_pitch() / row_length / m_image->element_size()
-                : m_image->height();
-        uint32_t layer_count = 1;
-        if ((m_image->type() == CL_MEM_OBJECT_IMAGE1D_ARRAY) ||
-            (m_image->type() == CL_MEM_OBJECT_IMAGE2D_ARRAY)) {
-            layer_count = m_image->array_size();
-        }
-        VkImageSubresourceLayers subresource = {
-            VK_IMAGE_ASPECT_COLOR_BIT, // aspectMask
-            0,                         // mipLevel
-            0,                         // baseArrayLayer
-            layer_count,               // layerCount
-        };
-        VkExtent3D extent;
+cl_int
+cvk_command_image_init::build_batchable_inner(cvk_command_buffer& cmdbuf) {
+    // Transition image layout to GENERAL.
+    image_layout_barrier(cmdbuf, m_image->vulkan_image(),
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    return CL_SUCCESS;
+}
+
+cl_int cvk_command_external_mem_objects::build_batchable_inner(
+    cvk_command_buffer& cmdbuf) {
+    bool acquire = type() == CL_COMMAND_ACQUIRE_EXTERNAL_MEM_OBJECTS_KHR;
+    uint32_t queue_family = m_queue->vulkan_queue().queue_family();
+    uint32_t src_family = acquire ? VK_QUEUE_FAMILY_EXTERNAL : queue_family;
+    uint32_t dst_family = acquire ? queue_family : VK_QUEUE_FAMILY_EXTERNAL;
 
-        extent.width = m_image->width();
-        extent.height = m_image->height();
-        extent.depth = m_image->depth();
+    // The access mask of the external side of the transfer is ignored
+    VkAccessFlags access =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    VkAccessFlags src_access = acquire ? 0 : access;
+    VkAccessFlags dst_access = acquire ? access : 0;
 
-        switch (m_image->type()) {
-        case CL_MEM_OBJECT_IMAGE2D:
-        case CL_MEM_OBJECT_IMAGE2D_ARRAY:
-            extent.depth = 1;
-            break;
-        case CL_MEM_OBJECT_IMAGE1D_BUFFER:
-        case CL_MEM_OBJECT_IMAGE1D:
-        case CL_MEM_OBJECT_IMAGE1D_ARRAY:
-            extent.height = 1;
-            extent.depth = 1;
-            break;
-        default:
-            break;
+    VkImageSubresourceRange subresourceRange = {
+        VK_IMAGE_ASPECT_COLOR_BIT, // aspectMask
+        0,                         // baseMipLevel
+        VK_REMAINING_MIP_LEVELS,   // levelCount
+        0,                         // baseArrayLayer
+        VK_REMAINING_ARRAY_LAYERS, // layerCount
+    };
+
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    for (cvk_mem* mem : m_mem_objects) {
+        if (mem->is_image_type()) {
+            auto image = static_cast<cvk_image*>(mem);
+            imageBarriers.push_back({
+                VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                nullptr,
+                src_access,              // srcAccessMask
+                dst_access,              // dstAccessMask
+                VK_IMAGE_LAYOUT_GENERAL, // oldLayout
+                VK_IMAGE_LAYOUT_GENERAL, // newLayout
+                src_family,              // srcQueueFamilyIndex
+                dst_family,              // dstQueueFamilyIndex
+                image->vulkan_image(),   // image
+                subresourceRange,        // subresourceRange
+            });
+        } else {
+            auto buffer = static_cast<cvk_buffer*>(mem);
+            bufferBarriers.push_back({
+                VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                nullptr,
+                src_access,              // srcAccessMask
+                dst_access,              // dstAccessMask
+                src_family,              // srcQueueFamilyIndex
+                dst_family,              // dstQueueFamilyIndex
+                buffer->vulkan_buffer(), // buffer
+                0,                       // offset
+                VK_WHOLE_SIZE,           // size
+            });
         }
+    }
 
-        VkBufferImageCopy copy = {
-            0,            // bufferOffset
-            row_length,   // bufferRowLength
-            image_height, // bufferImageHeight
-            subresource,  // imageSubresource
-            {0, 0, 0},    // imageOffset
-            extent,       // imageExtent
-        };
-        vkCmdCopyBufferToImage(cmdbuf, m_image->init_data()->vulkan_buffer(),
-                               m_image->vulkan_image(),
-                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
-
-        // Transition image layout to GENERAL.
-        VkImageMemoryBarrier imageBarrier = {
-            VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            nullptr,
-            VK_ACCESS_TRANSFER_WRITE_BIT,         // srcAccessMask
-            VK_ACCESS_MEMORY_READ_BIT,            // dstAccessMask
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, // oldLayout
-            VK_IMAGE_LAYOUT_GENERAL,              // newLayout
-            0,                                    // srcQueueFamilyIndex
-            0,                                    // dstQueueFamilyIndex
-            m_image->vulkan_image(),              // image
-            subresourceRange,                     // subresourceRange
-        };
-        vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                             0,              // dependencyFlags
-                             0,              // memoryBarrierCount
-                             nullptr,        // pMemoryBarriers
-                             0,              // bufferMemoryBarrierCount
-                             nullptr,        // pBufferMemoryBarriers
-                             1,              // imageMemoryBarrierCount
-                             &imageBarrier); // pImageMemoryBarriers
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,       // dependencyFlags
+                         0,       // memoryBarrierCount
+                         nullptr, // pMemoryBarriers
+                         static_cast<uint32_t>(bufferBarriers.size()),
+                         bufferBarriers.data(),
+                         static_cast<uint32_t>(imageBarriers.size()),
+                         imageBarriers.data());
+
+    return CL_SUCCESS;
+}
+
+cl_int
+cvk_command_image_upload::build_batchable_inner(cvk_command_buffer& cmdbuf) {
+    auto image = m_image->vulkan_image();
+
+    // Transition image layout to TRANSFER_DST_OPTIMAL before the first copy.
+    // Copies of the other chunks write to different regions of the image.
+    if (m_first) {
+        image_layout_barrier(cmdbuf, image, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0, VK_IMAGE_LAYOUT_UNDEFINED,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    }
+
+    vkCmdCopyBufferToImage(cmdbuf, m_staging->vulkan_buffer(), image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &m_region);
+
+    // Transition image layout to GENERAL after the last copy.
+    if (m_last) {
+        image_layout_barrier(cmdbuf, image, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_ACCESS_TRANSFER_WRITE_BIT,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_IMAGE_LAYOUT_GENERAL);
     }
 
     return CL_SUCCESS;
@@ -15,6 +15,9 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 
 #include "config.hpp"
@@ -24,6 +27,7 @@
 #include "objects.hpp"
 #include "printf.hpp"
 #include "queue_controller.hpp"
+#include "semaphore.hpp"
 #include "tracing.hpp"
 
 struct cvk_command;
@@ -88,47 +92,168 @@ private:
     bool m_running;
 };
 
+// Thread kept alive for the lifetime of a queue to record chunks of its
+// batches in parallel, so that no thread is created for every batch. It runs
+// one task at a time.
+struct cvk_recording_worker {
+
+    cvk_recording_worker() : m_shutdown(false) {
+        m_thread = std::make_unique<std::thread>(&cvk_recording_worker::worker,
+                                                 this);
+    }
+
+    ~cvk_recording_worker() {
+        m_lock.lock();
+        m_shutdown = true;
+        m_cv.notify_all();
+        m_lock.unlock();
+        m_thread->join();
+    }
+
+    void run(std::function<void()>&& task) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        CVK_ASSERT(!m_task);
+        m_task = std::move(task);
+        m_cv.notify_all();
+    }
+
+    // Wait for the task passed to run() to complete
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_cv.wait(lock, [this] { return !m_task; });
+    }
+
+private:
+    void worker();
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    std::function<void()> m_task;
+    bool m_shutdown;
+    std::unique_ptr<std::thread> m_thread;
+};
+
+// Command buffers are recycled rather than allocated and freed for every
+// batch. They are handed out from a ring of Vulkan command pools, each holding
+// a fixed number of pre-allocated command buffers. Once the current pool has
+// handed out all its command buffers, the ring moves on to the next pool whose
+// command buffers have all been returned, and resets it with
+// vkResetCommandPool. New pools are only created when all pools still have
+// command buffers in use.
+//
+// Handing out and returning command buffers never touches the Vulkan command
+// pools that may be recorded into, so only recording requires holding the
+// lock returned by lock()/unlock().
 struct cvk_command_pool {
 
-    cvk_command_pool(cvk_device* device, uint32_t queue_family)
-        : m_device(device), m_queue_family(queue_family),
-          m_command_pool(VK_NULL_HANDLE) {}
+    cvk_command_pool(
+        cvk_device* device, uint32_t queue_family,
+        VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
+        : m_device(device), m_queue_family(queue_family), m_level(level),
+          m_flags(0), m_current(0) {}
 
     ~cvk_command_pool() {
-        if (m_command_pool != VK_NULL_HANDLE) {
-            vkDestroyCommandPool(m_device->vulkan_device(), m_command_pool,
-                                 nullptr);
+        for (auto& gen : m_generations) {
+            vkDestroyCommandPool(m_device->vulkan_device(), gen->pool, nullptr);
         }
     }
 
     CHECK_RETURN VkResult init() {
-        VkCommandPoolCreateFlags flags = 0;
         if (m_device->is_driver_behavior_enabled(
                 cvk_device::use_reset_command_buffer_bit)) {
-            flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            m_flags |= VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
         }
 
-        // Create command pool
-        VkCommandPoolCreateInfo createInfo = {
-            VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, flags,
-            m_queue_family};
-
-        return vkCreateCommandPool(m_device->vulkan_device(), &createInfo,
-                                   nullptr, &m_command_pool);
+        std::lock_guard<std::mutex> lock(m_ring_lock);
+        return add_generation();
     }
 
-    VkResult allocate_command_buffer(VkCommandBuffer* buf);
-    void free_command_buffer(VkCommandBuffer buf);
+    // Hand out a command buffer ready to be begun. `generation` identifies the
+    // pool it belongs to and must be passed back to free_command_buffer.
+    VkResult allocate_command_buffer(VkCommandBuffer* buf,
+                                     uint32_t* generation);
+    void free_command_buffer(VkCommandBuffer buf, uint32_t generation);
+
+    VkCommandBufferLevel level() const { return m_level; }
 
     void lock() { m_lock.lock(); }
 
     void unlock() { m_lock.unlock(); }
 
 private:
+    struct pool_generation {
+        VkCommandPool pool;
+        std::vector<VkCommandBuffer> command_buffers;
+        // Command buffers that can be begun without resetting the pool
+        std::vector<VkCommandBuffer> available;
+        uint32_t num_in_use;
+    };
+
+    VkResult add_generation();
+    VkResult reset_generation(pool_generation& gen);
+
     cvk_device* m_device;
     uint32_t m_queue_family;
-    VkCommandPool m_command_pool;
+    VkCommandBufferLevel m_level;
+    VkCommandPoolCreateFlags m_flags;
+    std::mutex m_lock;
+    std::mutex m_ring_lock;
+    std::vector<std::unique_ptr<pool_generation>> m_generations;
+    uint32_t m_current;
+};
+
+// Timestamp query pools of a queue are recycled rather than created and
+// destroyed for every timed batch or command. All pools hold QUERIES_PER_POOL
+// queries and are reset when they are recorded into.
+struct cvk_query_pool_cache {
+
+    static const uint32_t QUERIES_PER_POOL = 2;
+
+    cvk_query_pool_cache(cvk_device* device) : m_device(device) {}
+
+    ~cvk_query_pool_cache() {
+        for (auto pool : m_pools) {
+            vkDestroyQueryPool(m_device->vulkan_device(), pool, nullptr);
+        }
+    }
+
+    // Return VK_NULL_HANDLE if no pool is available and none can be created
+    VkQueryPool acquire() {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_pools.empty()) {
+                auto pool = m_pools.back();
+                m_pools.pop_back();
+                return pool;
+            }
+        }
+
+        VkQueryPoolCreateInfo create_info = {
+            VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            nullptr,
+            0,                       // flags
+            VK_QUERY_TYPE_TIMESTAMP, // queryType
+            QUERIES_PER_POOL,        // queryCount
+            0,                       // pipelineStatistics
+        };
+        VkQueryPool pool;
+        auto res = vkCreateQueryPool(m_device->vulkan_device(), &create_info,
+                                     nullptr, &pool);
+        if (res != VK_SUCCESS) {
+            return VK_NULL_HANDLE;
+        }
+        return pool;
+    }
+
+    void release(VkQueryPool pool) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pools.push_back(pool);
+    }
+
+private:
+    cvk_device* m_device;
     std::mutex m_lock;
+    std::vector<VkQueryPool> m_pools;
 };
 
 struct cvk_command_queue : public _cl_command_queue,
@@ -166,43 +291,60 @@ struct cvk_command_queue : public _cl_command_queue,
                config.queue_profiling_use_timestamp_queries;
     }
 
-    CHECK_RETURN bool allocate_command_buffer(VkCommandBuffer* cmdbuf) {
-        return m_command_pool.allocate_command_buffer(cmdbuf) == VK_SUCCESS;
+    // Whether the execution of commands on the device is measured for the GPU
+    // tracks of Perfetto traces
+    bool gpu_tracing_enabled() const {
+        return TRACE_GPU_ENABLED() && config.perfetto_gpu_tracks &&
+               m_device->has_timer_support();
     }
 
-    void free_command_buffer(VkCommandBuffer cmdbuf) {
-        return m_command_pool.free_command_buffer(cmdbuf);
+    cvk_command_pool* command_pool() { return &m_command_pool; }
+
+    // Report a batch that completed with the given timings to the controllers
+    // and let them size the next batches as if a batch had just been ended.
+    // Returns the resulting maximum batch sizes. Only used by unit tests.
+    void simulate_batch_completed(cl_uint batch_size, uint64_t record_ns,
+                                  uint64_t execution_ns,
+                                  cl_uint* max_cmd_batch_size,
+                                  cl_uint* max_first_cmd_batch_size);
+
+    cvk_query_pool_cache& query_pools() { return m_query_pools; }
+
+    // Pools used to record the secondary command buffers of a batch in
+    // parallel, one per recording thread.
+    uint32_t num_secondary_command_pools() const {
+        return m_secondary_command_pools.size();
+    }
+    cvk_command_pool* secondary_command_pool(uint32_t index) {
+        return m_secondary_command_pools[index].get();
     }
 
-    cvk_buffer* get_or_create_printf_buffer() {
-        CVK_ASSERT(m_context != nullptr);
-        if (!m_printf_buffer) {
-            cl_int status;
-            m_printf_buffer = cvk_buffer::create(
-                context(), 0, m_context->get_printf_buffersize(), nullptr,
-                &status);
-            CVK_ASSERT(status == CL_SUCCESS);
-        }
-        return m_printf_buffer.get();
+    // Workers recording all the chunks but the first, which is recorded by
+    // the thread ending the batch. Only used with the command pool locked.
+    cvk_recording_worker* recording_worker(uint32_t chunk) {
+        return m_recording_workers[chunk - 1].get();
     }
 
-    cvk_buffer* get_printf_buffer() {
-        if (!m_printf_buffer) {
-            return nullptr;
-        }
-        return m_printf_buffer.get();
+    // Kernels using printf each write to their own slice of a printf buffer
+    // shared by the queue so that they can be batched. Acquiring a slice never
+    // waits for one to be released: when all the slices are in use, a new
+    // printf buffer is allocated with as many slices. The added buffers are
+    // released once no slice is in use.
+    CHECK_RETURN cl_int acquire_printf_slice(uint32_t* slice);
+    void release_printf_slice(uint32_t slice);
+
+    cvk_buffer* get_printf_buffer(uint32_t slice) {
+        std::lock_guard<std::mutex> lock(m_printf_lock);
+        return m_printf_buffers[slice / m_printf_slices_per_buffer].get();
     }
 
-    cl_int reset_printf_buffer() {
-        if (m_printf_buffer && m_printf_buffer->map_write_only()) {
-            memset(m_printf_buffer->host_va(), 0, 4);
-            m_printf_buffer->unmap_to_write(0, 4);
-            return CL_SUCCESS;
-        }
-        cvk_error_fn("Could not reset printf buffer");
-        return CL_OUT_OF_RESOURCES;
+    // Offset of the slice in its printf buffer
+    VkDeviceSize printf_slice_offset(uint32_t slice) const {
+        return (slice % m_printf_slices_per_buffer) * m_printf_slice_stride;
     }
 
+    VkDeviceSize printf_slice_size() const { return m_printf_slice_size; }
+
     void command_pool_lock() { m_command_pool.lock(); }
 
     void command_pool_unlock() { m_command_pool.unlock(); }
@@ -223,6 +365,14 @@ struct cvk_command_queue : public _cl_command_queue,
         uint64_t batches = m_nb_batch_in_flight.fetch_sub(1);
         TRACE_CNT(batch_in_flight_counter, batches - 1);
     }
+    void batch_completed(cl_uint batch_size, uint64_t record_ns,
+                         uint64_t execution_ns);
+
+    bool batch_timing_enabled() const { return m_batch_timing_enabled; }
+
+    cvk_event_wait_estimator& event_wait_estimator() {
+        return m_event_wait_estimator;
+    }
 
     void group_sent() {
         uint64_t group = m_nb_group_in_flight.fetch_add(1);
@@ -263,6 +413,9 @@ private:
 
     cvk_vulkan_queue_wrapper& m_vulkan_queue;
     cvk_command_pool m_command_pool;
+    std::vector<std::unique_ptr<cvk_command_pool>> m_secondary_command_pools;
+    std::vector<std::unique_ptr<cvk_recording_worker>> m_recording_workers;
+    cvk_query_pool_cache m_query_pools;
 
     cl_uint m_max_cmd_batch_size;
     cl_uint m_max_first_cmd_batch_size;
@@ -275,12 +428,21 @@ private:
     TRACE_CNT_VAR(batch_in_flight_counter);
     TRACE_CNT_VAR(group_in_flight_counter);
 
-    std::unique_ptr<cvk_buffer> m_printf_buffer;
+    std::mutex m_printf_lock;
+    std::vector<std::unique_ptr<cvk_buffer>> m_printf_buffers;
+    uint32_t m_printf_slices_per_buffer;
+    VkDeviceSize m_printf_slice_size;
+    VkDeviceSize m_printf_slice_stride;
+    std::vector<bool> m_printf_slices_in_use;
 
     std::vector<std::unique_ptr<cvk_queue_controller>> m_controllers;
+    bool m_batch_timing_enabled;
+
+    cvk_event_wait_estimator m_event_wait_estimator;
 
     friend struct cvk_queue_controller;
     friend struct cvk_queue_controller_batch_parameters;
+    friend struct cvk_queue_controller_batch_latency;
 };
 
 static inline cvk_command_queue* icd_downcast(cl_command_queue queue) {
@@ -359,15 +521,25 @@ private:
 
 struct cvk_command_buffer {
     cvk_command_buffer(cvk_command_queue* queue)
-        : m_queue(queue), m_command_buffer(VK_NULL_HANDLE) {}
+        : cvk_command_buffer(queue, queue->command_pool()) {}
+
+    cvk_command_buffer(cvk_command_queue* queue, cvk_command_pool* pool)
+        : m_queue(queue), m_pool(pool), m_command_buffer(VK_NULL_HANDLE),
+          m_pool_generation(0) {}
 
     ~cvk_command_buffer() {
         if (m_command_buffer != VK_NULL_HANDLE) {
-            m_queue->free_command_buffer(m_command_buffer);
+            m_pool->free_command_buffer(m_command_buffer, m_pool_generation);
         }
     }
 
-    CHECK_RETURN bool begin();
+    bool is_secondary() const {
+        return m_pool->level() == VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    }
+
+    CHECK_RETURN bool
+    begin(VkCommandBufferUsageFlags flags =
+              VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
     CHECK_RETURN bool end() {
         auto res = vkEndCommandBuffer(m_command_buffer);
@@ -380,7 +552,9 @@ struct cvk_command_buffer {
 
 protected:
     cvk_command_queue_holder m_queue;
+    cvk_command_pool* m_pool;
     VkCommandBuffer m_command_buffer;
+    uint32_t m_pool_generation;
 };
 
 #define CLVK_COMMAND_BATCH 0x5000
@@ -390,7 +564,9 @@ struct cvk_command {
 
     cvk_command(cl_command_type type, cvk_command_queue* queue)
         : m_type(type), m_queue(queue),
-          m_event(new cvk_event(m_queue->context(), this, queue)) {}
+          m_event(new cvk_event(m_queue->context(), this, queue)),
+          m_trace_id(s_next_trace_id.fetch_add(1, std::memory_order_relaxed)) {
+    }
 
     virtual ~cvk_command() { m_event->release(); }
 
@@ -421,6 +597,11 @@ struct cvk_command {
     // never have data movement requirements of their own.
     virtual bool is_data_movement() const { return false; }
 
+    // Acquire the queue resources the command needs to be executed. Called
+    // without holding the queue lock so that it is possible to wait for
+    // resources held by commands already enqueued to be released.
+    CHECK_RETURN virtual cl_int acquire_queue_resources() { return CL_SUCCESS; }
+
     void add_dependency(cvk_event* dep) {
         dep->retain();
         m_event_deps.push_back(dep);
@@ -465,6 +646,10 @@ struct cvk_command {
 
     cvk_command_queue* queue() const { return m_queue; }
 
+    // Identifies the command in traces. Unlike its address, it is never
+    // reused by another command.
+    uint64_t trace_id() const { return m_trace_id; }
+
     const std::vector<cvk_event*>& dependencies() const { return m_event_deps; }
 
     virtual const std::vector<cvk_mem*> memory_objects() const {
@@ -488,6 +673,8 @@ protected:
 
 private:
     std::vector<cvk_event*> m_event_deps;
+    uint64_t m_trace_id;
+    static std::atomic<uint64_t> s_next_trace_id;
 };
 
 struct cvk_command_buffer_base : public cvk_command {
@@ -571,6 +758,11 @@ struct cvk_rectangle_copier {
 
     void do_copy(direction dir, void* src_base, void* dst_base);
 
+    // Number of bytes copied by do_copy
+    size_t size() const {
+        return m_region[0] * m_region[1] * m_region[2] * m_elem_size;
+    }
+
 private:
     size_t initialize_pitch(size_t default_pitch, size_t region_pitch) {
         return default_pitch == 0 ? region_pitch : default_pitch;
@@ -634,6 +826,45 @@ private:
     size_t m_size;
 };
 
+// Copy between host memory and an SVM allocation, or between two host
+// allocations. The buffer of a pointer that is not in an SVM allocation is
+// null.
+struct cvk_command_svm_memcpy final : public cvk_command {
+
+    cvk_command_svm_memcpy(cvk_command_queue* q, void* dst_ptr,
+                           const void* src_ptr, size_t size,
+                           cvk_buffer* dst_buffer, size_t dst_offset,
+                           cvk_buffer* src_buffer, size_t src_offset)
+        : cvk_command(CL_COMMAND_SVM_MEMCPY, q), m_dst_ptr(dst_ptr),
+          m_src_ptr(src_ptr), m_size(size), m_dst_buffer(dst_buffer),
+          m_dst_offset(dst_offset), m_src_buffer(src_buffer),
+          m_src_offset(src_offset) {
+        CVK_ASSERT((dst_buffer == nullptr) || (src_buffer == nullptr));
+    }
+
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override {
+        std::vector<cvk_mem*> mems;
+        if (m_dst_buffer != nullptr) {
+            mems.push_back(m_dst_buffer);
+        }
+        if (m_src_buffer != nullptr) {
+            mems.push_back(m_src_buffer);
+        }
+        return mems;
+    }
+
+private:
+    void* m_dst_ptr;
+    const void* m_src_ptr;
+    size_t m_size;
+    cvk_buffer_holder m_dst_buffer;
+    size_t m_dst_offset;
+    cvk_buffer_holder m_src_buffer;
+    size_t m_src_offset;
+};
+
 struct cvk_command_copy_buffer_rect final : public cvk_command {
     cvk_command_copy_buffer_rect(cvk_command_queue* queue,
                                  cvk_buffer* src_buffer, cvk_buffer* dst_buffer,
@@ -686,8 +917,7 @@ struct cvk_command_batchable : public cvk_command {
 
     virtual ~cvk_command_batchable() {
         if (m_query_pool != VK_NULL_HANDLE) {
-            auto vkdev = m_queue->device()->vulkan_device();
-            vkDestroyQueryPool(vkdev, m_query_pool, nullptr);
+            m_queue->query_pools().release(m_query_pool);
         }
     }
 
@@ -697,8 +927,19 @@ struct cvk_command_batchable : public cvk_command {
     CHECK_RETURN cl_int get_timestamp_query_results(cl_ulong* start,
                                                     cl_ulong* end);
 
+    // Add the execution of the command to the GPU track of its queue
+    void trace_gpu_execution(cl_ulong sync_dev, cl_ulong sync_host);
+
     CHECK_RETURN cl_int build();
     CHECK_RETURN cl_int build(cvk_command_buffer& cmdbuf);
+
+    // Building a command is split in two steps so that recording can be
+    // deferred, possibly to another thread. prepare() captures everything
+    // that depends on the state at enqueue time (e.g. kernel arguments) and
+    // record() only records Vulkan commands from the prepared state.
+    CHECK_RETURN cl_int prepare();
+    CHECK_RETURN cl_int record(cvk_command_buffer& cmdbuf);
+    CHECK_RETURN virtual cl_int prepare_batchable_inner() { return CL_SUCCESS; }
     CHECK_RETURN virtual cl_int
     build_batchable_inner(cvk_command_buffer& cmdbuf) = 0;
     CHECK_RETURN cl_int do_action() override;
@@ -742,7 +983,8 @@ private:
     std::unique_ptr<cvk_command_buffer> m_command_buffer;
     VkQueryPool m_query_pool;
 
-    static const int NUM_POOL_QUERIES_PER_COMMAND = 2;
+    static const int NUM_POOL_QUERIES_PER_COMMAND =
+        cvk_query_pool_cache::QUERIES_PER_POOL;
     static const int POOL_QUERY_CMD_START = 0;
     static const int POOL_QUERY_CMD_END = 1;
 
@@ -787,24 +1029,25 @@ struct cvk_command_kernel final : public cvk_command_batchable {
                        const cvk_ndrange& ndrange)
         : cvk_command_batchable(CL_COMMAND_NDRANGE_KERNEL, q), m_kernel(kernel),
           m_dimensions(dims), m_ndrange(ndrange), m_pipeline(VK_NULL_HANDLE),
-          m_argument_values(nullptr) {}
+          m_argument_values(nullptr), m_printf_slice(NO_PRINTF_SLICE) {}
 
     ~cvk_command_kernel() {
         if (m_argument_values) {
             m_argument_values->release_resources();
         }
+        if (m_printf_slice != NO_PRINTF_SLICE) {
+            m_queue->release_printf_slice(m_printf_slice);
+        }
     }
 
+    CHECK_RETURN cl_int acquire_queue_resources() override final;
+
+    CHECK_RETURN cl_int prepare_batchable_inner() override final;
     CHECK_RETURN cl_int
     build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
 
     CHECK_RETURN cl_int do_post_action() override final;
 
-    bool can_be_batched() const override final {
-        return !m_kernel->uses_printf() &&
-               cvk_command_batchable::can_be_batched();
-    }
-
     const std::vector<cvk_mem*> memory_objects() const override {
         std::vector<cvk_mem*> ret;
         std::shared_ptr<cvk_kernel_argument_values> argvals = m_argument_values;
@@ -814,6 +1057,14 @@ struct cvk_command_kernel final : public cvk_command_batchable {
         return argvals->memory_objects();
     }
 
+    cvk_kernel* kernel() const { return m_kernel; }
+    uint32_t dimensions() const { return m_dimensions; }
+    const cvk_ndrange& ndrange() const { return m_ndrange; }
+
+    // Only used for commands recorded in a command buffer, which are built
+    // again once their NDRange has been updated.
+    void set_ndrange(const cvk_ndrange& ndrange) { m_ndrange = ndrange; }
+
 private:
     CHECK_RETURN cl_int
     build_and_dispatch_regions(cvk_command_buffer& command_buffer);
@@ -833,24 +1084,36 @@ private:
     cvk_ndrange m_ndrange;
     VkPipeline m_pipeline;
     std::shared_ptr<cvk_kernel_argument_values> m_argument_values;
+
+    static constexpr uint32_t NO_PRINTF_SLICE = UINT32_MAX;
+    uint32_t m_printf_slice;
 };
 
 struct cvk_command_batch : public cvk_command {
     cvk_command_batch(cvk_command_queue* queue)
-        : cvk_command(CLVK_COMMAND_BATCH, queue) {}
+        : cvk_command(CLVK_COMMAND_BATCH, queue), m_query_pool(VK_NULL_HANDLE),
+          m_record_start(0), m_record_duration(0) {}
+
+    ~cvk_command_batch() {
+        if (m_query_pool != VK_NULL_HANDLE) {
+            m_queue->query_pools().release(m_query_pool);
+        }
+    }
 
     cl_int do_action() override final;
     cl_int add_command(cvk_command_batchable* cmd) {
-        if (!m_command_buffer) {
-            // Create command buffer and start recording on first call
-            m_command_buffer = std::make_unique<cvk_command_buffer>(m_queue);
-            if (!m_command_buffer->begin()) {
-                return CL_OUT_OF_RESOURCES;
-            }
+        if (m_commands.empty() && m_queue->batch_timing_enabled()) {
+            m_record_start = cvk_event::sample_clock();
         }
-        cvk_command_pool_lock_holder lock(m_queue);
 
-        cl_int ret = cmd->build(*m_command_buffer);
+        cl_int ret;
+        if (records_in_parallel()) {
+            // Only capture the state of the command, it is recorded when the
+            // batch ends
+            ret = cmd->prepare();
+        } else {
+            ret = build_command(cmd);
+        }
         if (ret != CL_SUCCESS) {
             return ret;
         }
@@ -862,10 +1125,7 @@ struct cvk_command_batch : public cvk_command {
         return ret;
     }
 
-    CHECK_RETURN bool end() {
-        cvk_command_pool_lock_holder lock(m_queue);
-        return m_command_buffer->end();
-    }
+    CHECK_RETURN bool end();
 
     cl_uint batch_size() { return m_commands.size(); }
 
@@ -907,9 +1167,38 @@ struct cvk_command_batch : public cvk_command {
     }
 
 private:
+    // Batches are recorded in parallel when the queue has pools to record
+    // secondary command buffers from. Commands are then only prepared when
+    // they are added and recorded when the batch ends, split in chunks
+    // recorded by separate threads into secondary command buffers that the
+    // batch's command buffer executes in order.
+    bool records_in_parallel() const {
+        return m_queue->num_secondary_command_pools() > 0;
+    }
+
+    CHECK_RETURN cl_int build_command(cvk_command_batchable* cmd);
+    CHECK_RETURN bool record_commands();
+    CHECK_RETURN cl_int record_chunk(uint32_t chunk, size_t chunk_size);
+
+    void begin_timing();
+    void end_timing();
+    uint64_t execution_duration(uint64_t submit_start);
+    void trace_gpu_execution();
+
     std::vector<std::unique_ptr<cvk_command_batchable>> m_commands;
     std::unique_ptr<cvk_command_buffer> m_command_buffer;
+    std::vector<std::unique_ptr<cvk_command_buffer>> m_chunk_command_buffers;
     cl_ulong m_sync_dev, m_sync_host;
+
+    // Used to measure the batch for the queue controllers
+    VkQueryPool m_query_pool;
+    uint64_t m_record_start;
+    uint64_t m_record_duration;
+
+    static const int NUM_POOL_QUERIES_PER_BATCH =
+        cvk_query_pool_cache::QUERIES_PER_POOL;
+    static const int POOL_QUERY_BATCH_START = 0;
+    static const int POOL_QUERY_BATCH_END = 1;
 };
 
 struct cvk_command_map_buffer final : public cvk_command_buffer_base_region {
@@ -942,8 +1231,9 @@ private:
 struct cvk_command_unmap_buffer final : public cvk_command_buffer_base {
 
     cvk_command_unmap_buffer(cvk_command_queue* queue, cvk_buffer* buffer,
-                             void* map_ptr)
-        : cvk_command_buffer_base(queue, CL_COMMAND_UNMAP_MEM_OBJECT, buffer),
+                             void* map_ptr,
+                             cl_command_type type = CL_COMMAND_UNMAP_MEM_OBJECT)
+        : cvk_command_buffer_base(queue, type, buffer),
           m_mapped_ptr(map_ptr) {}
     CHECK_RETURN cl_int do_action() override final;
 
@@ -964,6 +1254,69 @@ struct cvk_command_dep : public cvk_command {
     const std::vector<cvk_mem*> memory_objects() const override { return {}; }
 };
 
+// Free SVM allocations or pass them to the application's callback
+struct cvk_command_svm_free final : public cvk_command {
+    using callback_type = void(CL_CALLBACK*)(cl_command_queue queue,
+                                             cl_uint num_svm_pointers,
+                                             void* svm_pointers[],
+                                             void* user_data);
+
+    cvk_command_svm_free(cvk_command_queue* queue, std::vector<void*>&& ptrs,
+                         callback_type callback, void* user_data)
+        : cvk_command(CL_COMMAND_SVM_FREE, queue), m_pointers(std::move(ptrs)),
+          m_callback(callback), m_user_data(user_data) {}
+
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override { return {}; }
+
+private:
+    std::vector<void*> m_pointers;
+    callback_type m_callback;
+    void* m_user_data;
+};
+
+// Wait on or signal semaphores with an empty submission to the Vulkan queue
+struct cvk_command_semaphores final : public cvk_command {
+    cvk_command_semaphores(cvk_command_queue* queue, cl_command_type type,
+                           std::vector<cvk_semaphore_holder>&& semaphores)
+        : cvk_command(type, queue), m_semaphores(std::move(semaphores)) {}
+
+    CHECK_RETURN cl_int do_action() override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override { return {}; }
+
+private:
+    std::vector<cvk_semaphore_holder> m_semaphores;
+};
+
+// Transfer the ownership of memory objects imported from another API from the
+// external queue family on acquire, and back to it on release. Images are in
+// the VK_IMAGE_LAYOUT_GENERAL layout on both sides of the transfer.
+struct cvk_command_external_mem_objects final : public cvk_command_batchable {
+    cvk_command_external_mem_objects(cvk_command_queue* queue,
+                                     cl_command_type type,
+                                     std::vector<cvk_mem_holder>&& mem_objects)
+        : cvk_command_batchable(type, queue),
+          m_mem_objects(std::move(mem_objects)) {}
+
+    // Acquiring images initialises their layout
+    bool is_data_movement() const override { return true; }
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override {
+        std::vector<cvk_mem*> ret;
+        for (auto& mem : m_mem_objects) {
+            ret.push_back(mem);
+        }
+        return ret;
+    }
+
+private:
+    std::vector<cvk_mem_holder> m_mem_objects;
+};
+
 struct cvk_command_buffer_image_copy final : public cvk_command_batchable {
     cvk_command_buffer_image_copy(cl_command_type type,
                                   cvk_command_queue* queue, cvk_buffer* buffer,
@@ -1005,6 +1358,55 @@ private:
     cl_command_type m_copy_type;
 };
 
+// Buffer copies and fills executed on the device. Used in command buffers,
+// where commands cannot be executed on the host, and for SVM allocations.
+struct cvk_command_device_copy_buffer final : public cvk_command_batchable {
+    cvk_command_device_copy_buffer(
+        cvk_command_queue* queue, cvk_buffer* src, cvk_buffer* dst,
+        size_t src_offset, size_t dst_offset, size_t size,
+        cl_command_type type = CL_COMMAND_COPY_BUFFER)
+        : cvk_command_batchable(type, queue),
+          m_src_buffer(src), m_dst_buffer(dst), m_src_offset(src_offset),
+          m_dst_offset(dst_offset), m_size(size) {}
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override final {
+        return {m_src_buffer, m_dst_buffer};
+    }
+
+private:
+    cvk_buffer_holder m_src_buffer;
+    cvk_buffer_holder m_dst_buffer;
+    size_t m_src_offset;
+    size_t m_dst_offset;
+    size_t m_size;
+};
+
+struct cvk_command_device_fill_buffer final : public cvk_command_batchable {
+    // `offset` and `size` must be multiples of 4
+    cvk_command_device_fill_buffer(
+        cvk_command_queue* queue, cvk_buffer* buffer, size_t offset,
+        size_t size, uint32_t data,
+        cl_command_type type = CL_COMMAND_FILL_BUFFER)
+        : cvk_command_batchable(type, queue),
+          m_buffer(buffer), m_offset(offset), m_size(size), m_data(data) {}
+
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+
+    const std::vector<cvk_mem*> memory_objects() const override final {
+        return {m_buffer};
+    }
+
+private:
+    cvk_buffer_holder m_buffer;
+    size_t m_offset;
+    size_t m_size;
+    uint32_t m_data;
+};
+
 struct cvk_command_combine final : public cvk_command {
     cvk_command_combine(cvk_command_queue* queue, cl_command_type type,
                         std::vector<std::unique_ptr<cvk_command>>&& commands)
@@ -1193,8 +1595,33 @@ struct cvk_command_image_init final : public cvk_command_batchable {
     bool is_data_movement() const override { return true; }
     CHECK_RETURN cl_int
     build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
-    ~cvk_command_image_init() { m_image->discard_init_data(); }
 
 private:
     cvk_image_holder m_image;
 };
+
+// Copy a chunk of the host data of an image from a staging buffer. The first
+// chunk transitions the image to a layout suitable for copies and the last
+// one transitions it to the layout used by all other commands.
+struct cvk_command_image_upload final : public cvk_command_batchable {
+
+    cvk_command_image_upload(cvk_command_queue* queue, cvk_image* image,
+                             const cvk_buffer* staging,
+                             const VkBufferImageCopy& region, bool first,
+                             bool last)
+        : cvk_command_batchable(CLVK_COMMAND_IMAGE_INIT, queue),
+          m_image(image), m_staging(staging), m_region(region),
+          m_first(first), m_last(last) {
+        CVK_ASSERT(!m_image->is_backed_by_buffer_view());
+    }
+    bool is_data_movement() const override { return true; }
+    CHECK_RETURN cl_int
+    build_batchable_inner(cvk_command_buffer& cmdbuf) override final;
+
+private:
+    cvk_image_holder m_image;
+    const cvk_buffer* m_staging;
+    VkBufferImageCopy m_region;
+    bool m_first;
+    bool m_last;
+};
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "queue_controller.hpp"
 #include "queue.hpp"
 
@@ -182,3 +184,106 @@ void cvk_queue_controller_batch_parameters::
     }
     update_trace_counter();
 }
+
+// Number of batches over which the per-command costs are averaged. Until that
+// many batches have completed, all samples have the same weight so that the
+// estimates settle quickly. Older samples then decay exponentially.
+static const uint32_t BATCH_LATENCY_AVERAGE_WINDOW = 4;
+
+cvk_queue_controller_batch_latency::cvk_queue_controller_batch_latency(
+    cvk_command_queue* queue)
+    : cvk_queue_controller(queue),
+      m_max_cmd_batch_size_limit(queue->device()->get_max_cmd_batch_size()),
+      m_target_batch_ns(config.batch_target_duration_us() * 1000ull),
+      m_first_batch_budget_ns(config.first_batch_latency_budget_us() * 1000ull),
+      m_execution_ns_per_cmd(0), m_record_ns_per_cmd(0), m_num_samples(0) {
+    TRACE_CNT_VAR_INIT(max_cmd_batch_size_counter,
+                       "clvk-queue_" + std::to_string((uintptr_t)this) +
+                           "-max_batch_size");
+    TRACE_CNT_VAR_INIT(max_first_cmd_batch_size_counter,
+                       "clvk-queue_" + std::to_string((uintptr_t)this) +
+                           "-max_first_batch_size");
+    TRACE_CNT_VAR_INIT(execution_ns_per_cmd_counter,
+                       "clvk-queue_" + std::to_string((uintptr_t)this) +
+                           "-execution_ns_per_cmd");
+    TRACE_CNT_VAR_INIT(record_ns_per_cmd_counter,
+                       "clvk-queue_" + std::to_string((uintptr_t)this) +
+                           "-record_ns_per_cmd");
+
+    update_trace_counter();
+}
+
+void cvk_queue_controller_batch_latency::update_trace_counter() {
+    TRACE_CNT(max_cmd_batch_size_counter, m_queue->m_max_cmd_batch_size);
+    TRACE_CNT(max_first_cmd_batch_size_counter,
+              m_queue->m_max_first_cmd_batch_size);
+    TRACE_CNT(execution_ns_per_cmd_counter, m_execution_ns_per_cmd);
+    TRACE_CNT(record_ns_per_cmd_counter, m_record_ns_per_cmd);
+}
+
+cl_uint cvk_queue_controller_batch_latency::converge(cl_uint current,
+                                                     cl_uint wanted) {
+    // Ignore changes smaller than 1/8th of the current size. Streams mixing
+    // small and large kernels otherwise keep resizing batches by a few
+    // commands around the same value.
+    cl_uint delta = current > wanted ? current - wanted : wanted - current;
+    if (delta * 8 <= current) {
+        return current;
+    }
+    return wanted;
+}
+
+void cvk_queue_controller_batch_latency::update_after_batch_completed(
+    cl_uint batch_size, uint64_t record_ns, uint64_t execution_ns) {
+    if (batch_size == 0) {
+        return;
+    }
+    uint64_t execution_per_cmd = execution_ns / batch_size;
+    uint64_t record_per_cmd = record_ns / batch_size;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t weight =
+        std::min(m_num_samples + 1, BATCH_LATENCY_AVERAGE_WINDOW);
+    m_execution_ns_per_cmd =
+        (m_execution_ns_per_cmd * (weight - 1) + execution_per_cmd) / weight;
+    m_record_ns_per_cmd =
+        (m_record_ns_per_cmd * (weight - 1) + record_per_cmd) / weight;
+    m_num_samples++;
+}
+
+void cvk_queue_controller_batch_latency::update_after_end_current_command_batch(
+    bool from_flush) {
+    TRACE_FUNCTION();
+    (void)from_flush;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_num_samples == 0) {
+        // Keep the device defaults until we have measured a batch.
+        update_trace_counter();
+        return;
+    }
+    uint64_t execution_per_cmd = std::max<uint64_t>(m_execution_ns_per_cmd, 1);
+    uint64_t record_per_cmd = m_record_ns_per_cmd;
+
+    // Size batches so that their execution lasts about the target duration.
+    uint64_t batch_size = m_target_batch_ns / execution_per_cmd;
+    batch_size =
+        std::clamp<uint64_t>(batch_size, 1, m_max_cmd_batch_size_limit);
+
+    // Nothing executes before the first batch has been fully recorded, so both
+    // recording and execution count against the first batch latency budget.
+    uint64_t first_batch_size =
+        m_first_batch_budget_ns / (execution_per_cmd + record_per_cmd);
+    first_batch_size = std::clamp<uint64_t>(first_batch_size, 1, batch_size);
+
+    m_queue->m_max_cmd_batch_size =
+        converge(m_queue->m_max_cmd_batch_size, batch_size);
+    m_queue->m_max_first_cmd_batch_size =
+        converge(m_queue->m_max_first_cmd_batch_size, first_batch_size);
+
+    // max_first_cmd_batch_size should not get bigger than max_cmd_batch_size.
+    if (m_queue->m_max_cmd_batch_size < m_queue->m_max_first_cmd_batch_size) {
+        m_queue->m_max_first_cmd_batch_size = m_queue->m_max_cmd_batch_size;
+    }
+    update_trace_counter();
+}
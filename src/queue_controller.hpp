@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <mutex>
+
 #include "queue.hpp"
 
 struct cvk_queue_controller {
@@ -27,6 +29,21 @@ struct cvk_queue_controller {
 
     virtual void update_after_empty_flush() {}
 
+    // Whether the controller needs the execution time of each batch to be
+    // measured and reported through update_after_batch_completed.
+    virtual bool needs_batch_timing() const { return false; }
+
+    // Called from the executor thread once a batch has completed. 'record_ns'
+    // is the host time spent recording the batch and 'execution_ns' the time
+    // the device spent executing it.
+    virtual void update_after_batch_completed(cl_uint batch_size,
+                                              uint64_t record_ns,
+                                              uint64_t execution_ns) {
+        (void)batch_size;
+        (void)record_ns;
+        (void)execution_ns;
+    }
+
 protected:
     cvk_command_queue* m_queue;
 };
@@ -55,3 +72,31 @@ private:
     TRACE_CNT_VAR(max_first_cmd_batch_size_limit_hit_counter);
     TRACE_CNT_VAR(last_batch_size_counter);
 };
+
+struct cvk_queue_controller_batch_latency : public cvk_queue_controller {
+    cvk_queue_controller_batch_latency(cvk_command_queue* queue);
+
+    void update_after_end_current_command_batch(bool from_flush) override final;
+
+    bool needs_batch_timing() const override final { return true; }
+
+    void update_after_batch_completed(cl_uint batch_size, uint64_t record_ns,
+                                      uint64_t execution_ns) override final;
+
+private:
+    void update_trace_counter();
+    static cl_uint converge(cl_uint current, cl_uint wanted);
+
+    std::mutex m_lock;
+    cl_uint m_max_cmd_batch_size_limit;
+    uint64_t m_target_batch_ns;
+    uint64_t m_first_batch_budget_ns;
+    uint64_t m_execution_ns_per_cmd;
+    uint64_t m_record_ns_per_cmd;
+    uint32_t m_num_samples;
+
+    TRACE_CNT_VAR(max_cmd_batch_size_counter);
+    TRACE_CNT_VAR(max_first_cmd_batch_size_counter);
+    TRACE_CNT_VAR(execution_ns_per_cmd_counter);
+    TRACE_CNT_VAR(record_ns_per_cmd_counter);
+};
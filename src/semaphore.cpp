@@ -13,15 +13,27 @@
 // limitations under the License.
 
 #include "semaphore.hpp"
+#include "log.hpp"
 
 cl_int cvk_semaphore::init() {
 
     auto vkdev = m_context->device()->vulkan_device();
 
+    VkExportSemaphoreCreateInfo export_info = {
+        VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO, nullptr,
+        0 // handleTypes
+    };
+    for (auto type : m_export_handle_types) {
+        export_info.handleTypes |= vulkan_external_semaphore_handle_type(type);
+    }
+
     VkSemaphoreCreateInfo info = {
         VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, nullptr,
         0 // flags
     };
+    if (export_info.handleTypes != 0) {
+        info.pNext = &export_info;
+    }
 
     auto res = vkCreateSemaphore(vkdev, &info, nullptr, &m_semaphore);
     if (res != VK_SUCCESS) {
@@ -30,3 +42,56 @@ cl_int cvk_semaphore::init() {
 
     return CL_SUCCESS;
 }
+
+cl_int
+cvk_semaphore::import_fd(cl_external_semaphore_handle_type_khr handle_type,
+                         int fd) {
+    auto device = m_context->device();
+
+    VkSemaphoreImportFlags flags = 0;
+    if (handle_type == CL_SEMAPHORE_HANDLE_SYNC_FD_KHR) {
+        flags |= VK_SEMAPHORE_IMPORT_TEMPORARY_BIT;
+    }
+
+    VkImportSemaphoreFdInfoKHR info = {
+        VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+        nullptr,
+        m_semaphore,
+        flags,
+        vulkan_external_semaphore_handle_type(handle_type),
+        fd,
+    };
+
+    auto res =
+        device->vkfns().vkImportSemaphoreFdKHR(device->vulkan_device(), &info);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not import semaphore file descriptor: %s",
+                     vulkan_error_string(res));
+        return CL_INVALID_VALUE;
+    }
+
+    return CL_SUCCESS;
+}
+
+cl_int
+cvk_semaphore::export_fd(cl_external_semaphore_handle_type_khr handle_type,
+                         int* fd) {
+    auto device = m_context->device();
+
+    VkSemaphoreGetFdInfoKHR info = {
+        VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+        nullptr,
+        m_semaphore,
+        vulkan_external_semaphore_handle_type(handle_type),
+    };
+
+    auto res =
+        device->vkfns().vkGetSemaphoreFdKHR(device->vulkan_device(), &info, fd);
+    if (res != VK_SUCCESS) {
+        cvk_error_fn("could not export semaphore file descriptor: %s",
+                     vulkan_error_string(res));
+        return CL_OUT_OF_RESOURCES;
+    }
+
+    return CL_SUCCESS;
+}
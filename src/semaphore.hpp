@@ -21,18 +21,34 @@
 #include "objects.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <vector>
 
 struct cvk_semaphore : public _cl_semaphore_khr,
                        api_object<object_magic::semaphore> {
-    cvk_semaphore(cvk_context* context, cl_semaphore_type_khr type,
-                  std::vector<cl_device_id>&& devices,
-                  std::vector<cl_semaphore_properties_khr>&& properties)
+    cvk_semaphore(
+        cvk_context* context, cl_semaphore_type_khr type,
+        std::vector<cl_device_id>&& devices,
+        std::vector<cl_semaphore_properties_khr>&& properties,
+        std::vector<cl_external_semaphore_handle_type_khr>&& export_types)
         : api_object(context), m_type(type), m_devices(std::move(devices)),
-          m_properties(std::move(properties)), m_semaphore(VK_NULL_HANDLE) {}
+          m_properties(std::move(properties)),
+          m_export_handle_types(std::move(export_types)),
+          m_semaphore(VK_NULL_HANDLE) {}
 
     CHECK_RETURN cl_int init();
 
+    // Import the payload of a semaphore from a file descriptor. Opaque file
+    // descriptors are imported permanently, sync file descriptors only until
+    // the next wait on the semaphore. The file descriptor is owned by the
+    // semaphore when the import is successful.
+    CHECK_RETURN cl_int
+    import_fd(cl_external_semaphore_handle_type_khr handle_type, int fd);
+
+    // Export the payload of the semaphore as a new file descriptor
+    CHECK_RETURN cl_int
+    export_fd(cl_external_semaphore_handle_type_khr handle_type, int* fd);
+
     virtual ~cvk_semaphore() {
         if (m_semaphore != VK_NULL_HANDLE) {
             auto vkdev = m_context->device()->vulkan_device();
@@ -44,6 +60,16 @@ struct cvk_semaphore : public _cl_semaphore_khr,
         return m_properties;
     }
     const std::vector<cl_device_id>& devices() const { return m_devices; }
+    const std::vector<cl_external_semaphore_handle_type_khr>&
+    export_handle_types() const {
+        return m_export_handle_types;
+    }
+    bool can_export(cl_external_semaphore_handle_type_khr handle_type) const {
+        return std::find(m_export_handle_types.begin(),
+                         m_export_handle_types.end(),
+                         handle_type) != m_export_handle_types.end();
+    }
+    VkSemaphore vulkan_semaphore() const { return m_semaphore; }
     bool can_be_used_with_device(const cvk_device* device) const {
         for (auto devapi : m_devices) {
             auto dev = static_cast<cvk_device*>(devapi);
@@ -68,9 +94,12 @@ private:
     cl_semaphore_type_khr m_type;
     std::vector<cl_device_id> m_devices;
     std::vector<cl_semaphore_properties_khr> m_properties;
+    std::vector<cl_external_semaphore_handle_type_khr> m_export_handle_types;
     VkSemaphore m_semaphore;
 };
 
+using cvk_semaphore_holder = refcounted_holder<cvk_semaphore>;
+
 static inline cvk_semaphore* icd_downcast(cl_semaphore_khr sem) {
     return static_cast<cvk_semaphore*>(sem);
 }
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstring>
 
 #include "sha1.hpp"
@@ -181,35 +182,53 @@ static void sha1_process_block(cvk_sha1_hash& H, uint32_t block[16]) {
     H[4] += e;
 }
 
-cvk_sha1_hash cvk_sha1(const void* data, uint32_t length) {
-    const uint8_t* data_i8 = reinterpret_cast<const uint8_t*>(data);
-
+cvk_sha1_stream::cvk_sha1_stream() : m_length(0), m_block_used(0) {
     // Initialize state (constants defined in Section 5.3.1).
-    cvk_sha1_hash H;
-    H[0] = 0x67452301;
-    H[1] = 0xefcdab89;
-    H[2] = 0x98badcfe;
-    H[3] = 0x10325476;
-    H[4] = 0xc3d2e1f0;
+    m_hash[0] = 0x67452301;
+    m_hash[1] = 0xefcdab89;
+    m_hash[2] = 0x98badcfe;
+    m_hash[3] = 0x10325476;
+    m_hash[4] = 0xc3d2e1f0;
+}
+
+void cvk_sha1_stream::update(const void* data, size_t length) {
+    const uint8_t* data_i8 = reinterpret_cast<const uint8_t*>(data);
+    uint8_t* block_i8 = reinterpret_cast<uint8_t*>(m_block);
 
-    uint32_t original_length = length;
+    m_length += length;
 
-    // Local buffer used for processing each block.
-    uint32_t block[16];
-    uint8_t* block_i8 = reinterpret_cast<uint8_t*>(block);
+    // Complete a partially filled block first.
+    if (m_block_used > 0) {
+        size_t count = std::min<size_t>(64 - m_block_used, length);
+        memcpy(block_i8 + m_block_used, data_i8, count);
+        m_block_used += count;
+        data_i8 += count;
+        length -= count;
+        if (m_block_used < 64) {
+            return;
+        }
+        sha1_process_block(m_hash, m_block);
+        m_block_used = 0;
+    }
 
     // Process data in 512-bit blocks.
     while (length >= 64) {
         // Copy block to local buffer and process it.
-        memcpy(block, data_i8, 64);
-        sha1_process_block(H, block);
+        memcpy(m_block, data_i8, 64);
+        sha1_process_block(m_hash, m_block);
 
         length -= 64;
         data_i8 += 64;
     }
 
-    // Copy remaining data to local buffer.
-    memcpy(block, data_i8, length);
+    // Keep the remaining data for the next update.
+    memcpy(block_i8, data_i8, length);
+    m_block_used = length;
+}
+
+cvk_sha1_hash cvk_sha1_stream::finish() {
+    uint8_t* block_i8 = reinterpret_cast<uint8_t*>(m_block);
+    uint32_t length = m_block_used;
 
     // Add padding to the last block as described in Section 5.1.1.
 
@@ -223,17 +242,20 @@ cvk_sha1_hash cvk_sha1(const void* data, uint32_t length) {
     if (padding < 8) {
         // No room for the message length.
         // Process this block as is, and then create a new one.
-        sha1_process_block(H, block);
-        memset(block, 0x00, 64);
+        sha1_process_block(m_hash, m_block);
+        memset(m_block, 0x00, 64);
     }
 
-    // Set last 4 bytes to original length (in bits), stored big-endian.
-    block[15] = reverse_bytes(original_length * 8);
+    // Set last 8 bytes to original length (in bits), stored big-endian.
+    uint64_t length_bits = m_length * 8;
+    m_block[14] = reverse_bytes(static_cast<uint32_t>(length_bits >> 32));
+    m_block[15] = reverse_bytes(static_cast<uint32_t>(length_bits));
 
     // Process final block.
-    sha1_process_block(H, block);
+    sha1_process_block(m_hash, m_block);
 
     // Correct endianness of the result.
+    cvk_sha1_hash H = m_hash;
     H[0] = reverse_bytes(H[0]);
     H[1] = reverse_bytes(H[1]);
     H[2] = reverse_bytes(H[2]);
@@ -242,3 +264,9 @@ cvk_sha1_hash cvk_sha1(const void* data, uint32_t length) {
 
     return H;
 }
+
+cvk_sha1_hash cvk_sha1(const void* data, uint32_t length) {
+    cvk_sha1_stream stream;
+    stream.update(data, length);
+    return stream.finish();
+}
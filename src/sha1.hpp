@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 
 constexpr unsigned SHA1_DIGEST_NUM_WORDS = 5;
@@ -22,3 +23,18 @@ using cvk_sha1_hash = std::array<uint32_t, 5>;
 
 // Compute the SHA-1 hash for `length` bytes of `data`.
 cvk_sha1_hash cvk_sha1(const void* data, uint32_t length);
+
+// Compute the SHA-1 hash of data provided in several chunks. The result is
+// the same as hashing the concatenation of all the chunks with cvk_sha1.
+struct cvk_sha1_stream {
+    cvk_sha1_stream();
+
+    void update(const void* data, size_t length);
+    cvk_sha1_hash finish();
+
+private:
+    cvk_sha1_hash m_hash;
+    uint64_t m_length;
+    uint32_t m_block[16];
+    size_t m_block_used;
+};
@@ -12,6 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
 #include "tracing.hpp"
 #include "config.hpp"
 #include "queue.hpp"
@@ -24,6 +28,35 @@ PERFETTO_TRACK_EVENT_STATIC_STORAGE();
 static std::unique_ptr<perfetto::TracingSession> gTracingSession;
 #endif
 
+static perfetto::Track get_gpu_track(uint64_t vulkan_queue) {
+    static std::mutex lock;
+    static std::unordered_set<uint64_t> named_tracks;
+
+    perfetto::Track track(vulkan_queue);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (named_tracks.insert(vulkan_queue).second) {
+        auto desc = track.Serialize();
+        desc.set_name("clvk-vkqueue_" + std::to_string(vulkan_queue) + "-gpu");
+        perfetto::TrackEvent::SetTrackDescriptor(track, desc);
+    }
+
+    return track;
+}
+
+void trace_gpu_slice(uint64_t vulkan_queue, cl_command_type type,
+                     uint64_t start, uint64_t end, uint64_t flow_id) {
+    auto track = get_gpu_track(vulkan_queue);
+    auto clock = perfetto::protos::pbzero::BUILTIN_CLOCK_MONOTONIC;
+
+    TRACE_EVENT_BEGIN(CLVK_PERFETTO_CATEGORY,
+                      perfetto::StaticString(cl_command_type_to_string(type)),
+                      track, perfetto::TraceTimestamp{clock, start},
+                      perfetto::TerminatingFlow::ProcessScoped(flow_id));
+    TRACE_EVENT_END(CLVK_PERFETTO_CATEGORY, track,
+                    perfetto::TraceTimestamp{clock, end});
+}
+
 #endif // CLVK_PERFETTO_ENABLE
 
 void init_tracing() {
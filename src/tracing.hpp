@@ -54,6 +54,15 @@ PERFETTO_DEFINE_CATEGORIES(
     name = std::make_unique<perfetto::CounterTrack>(                           \
         perfetto::DynamicString(string_##name))
 
+#define TRACE_FLOW(id) perfetto::Flow::ProcessScoped(id)
+#define TRACE_GPU_ENABLED() TRACE_EVENT_CATEGORY_ENABLED(CLVK_PERFETTO_CATEGORY)
+
+// Emit a slice for a command on the GPU track of a Vulkan queue. start and end
+// are CLOCK_MONOTONIC timestamps. The slice terminates the flow started with
+// TRACE_FLOW(flow_id).
+void trace_gpu_slice(uint64_t vulkan_queue, cl_command_type type,
+                     uint64_t start, uint64_t end, uint64_t flow_id);
+
 #elif CVK_ENABLE_TIMING
 
 #include "timing.hpp"
@@ -77,6 +86,9 @@ PERFETTO_DEFINE_CATEGORIES(
 #define TRACE_CNT_VAR(name)
 #define TRACE_CNT_VAR_INIT(name, value)
 
+#define TRACE_FLOW(id)
+#define TRACE_GPU_ENABLED() false
+
 #else // CLVK_PERFETTO_ENABLE
 
 #define TRACE_STRING()
@@ -90,6 +102,9 @@ PERFETTO_DEFINE_CATEGORIES(
 #define TRACE_CNT_VAR(name)
 #define TRACE_CNT_VAR_INIT(name, value)
 
+#define TRACE_FLOW(id)
+#define TRACE_GPU_ENABLED() false
+
 #endif // CLVK_PERFETTO_ENABLE
 
 void init_tracing();
@@ -12,8 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "compile_service.hpp"
 #include "device.hpp"
 #include "log.hpp"
+#include "log_ring.hpp"
+#include "program.hpp"
+#include "queue.hpp"
+
+#include <cstdarg>
+#include <cstring>
 
 #include <vulkan/vulkan.h>
 
@@ -47,4 +54,221 @@ const config_struct* CL_API_CALL clvk_get_config() {
     return nullptr;
 #endif
 }
+
+cl_bool CL_API_CALL clvk_compile_with_server(const char* server_path,
+                                             uint32_t timeout_ms,
+                                             const char* source, int* status) {
+#if defined(CLVK_UNIT_TESTING_ENABLED) && COMPILER_AVAILABLE
+    std::string path =
+        server_path != nullptr ? server_path : config.compile_server_path();
+    cvk_compile_service service(1, path, timeout_ms);
+    cvk_compile_request request;
+    request.programs.emplace_back(source);
+    request.build_to_ir = false;
+    cvk_compile_result result;
+    if (!service.available() || !service.compile(request, result)) {
+        return CL_FALSE;
+    }
+    *status = result.status;
+    return CL_TRUE;
+#else
+    UNUSED(server_path);
+    UNUSED(timeout_ms);
+    UNUSED(source);
+    UNUSED(status);
+    return CL_FALSE;
+#endif
+}
+
+int CL_API_CALL clvk_export_buffer_memory_fd(cl_device_id device,
+                                             const void* data, size_t size) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    assert(device != nullptr && icd_downcast(device)->is_valid());
+    auto dev = icd_downcast(device);
+    auto vkdev = dev->vulkan_device();
+    if (dev->vkfns().vkGetMemoryFdKHR == nullptr) {
+        return -1;
+    }
+
+    // Use the same buffer usage as clvk so that the memory requirements of
+    // the importing buffer match
+    VkBufferUsageFlags usage =
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT |
+        VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT;
+    if (dev->uses_physical_addressing()) {
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    }
+
+    auto handle_type = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+    auto features = dev->external_buffer_features(usage, handle_type);
+    if (!(features & VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT) ||
+        (features & VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT)) {
+        return -1;
+    }
+
+    const VkExternalMemoryBufferCreateInfo externalInfo = {
+        VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO, nullptr,
+        static_cast<VkExternalMemoryHandleTypeFlags>(handle_type)};
+    const VkBufferCreateInfo createInfo = {
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        &externalInfo,
+        0, // flags
+        size,
+        usage,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,       // queueFamilyIndexCount
+        nullptr, // pQueueFamilyIndices
+    };
+    VkBuffer buffer;
+    if (vkCreateBuffer(vkdev, &createInfo, nullptr, &buffer) != VK_SUCCESS) {
+        return -1;
+    }
+    VkMemoryRequirements memreqs;
+    vkGetBufferMemoryRequirements(vkdev, buffer, &memreqs);
+    vkDestroyBuffer(vkdev, buffer, nullptr);
+
+    auto type_index = dev->memory_type_index_for_buffer(memreqs.memoryTypeBits);
+    if (type_index == VK_MAX_MEMORY_TYPES) {
+        return -1;
+    }
+
+    const VkExportMemoryAllocateInfo exportInfo = {
+        VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO, nullptr,
+        static_cast<VkExternalMemoryHandleTypeFlags>(handle_type)};
+    const VkMemoryAllocateFlagsInfo flagsInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, &exportInfo,
+        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+    const VkMemoryAllocateInfo allocInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        dev->uses_physical_addressing() ? static_cast<const void*>(&flagsInfo)
+                                        : static_cast<const void*>(&exportInfo),
+        memreqs.size,
+        type_index,
+    };
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(vkdev, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        return -1;
+    }
+
+    int fd = -1;
+    void* ptr;
+    if (vkMapMemory(vkdev, memory, 0, VK_WHOLE_SIZE, 0, &ptr) == VK_SUCCESS) {
+        memcpy(ptr, data, size);
+        const VkMappedMemoryRange range = {
+            VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, memory, 0,
+            VK_WHOLE_SIZE};
+        vkFlushMappedMemoryRanges(vkdev, 1, &range);
+        vkUnmapMemory(vkdev, memory);
+
+        const VkMemoryGetFdInfoKHR fdInfo = {
+            VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR, nullptr, memory,
+            handle_type};
+        if (dev->vkfns().vkGetMemoryFdKHR(vkdev, &fdInfo, &fd) !=
+            VK_SUCCESS) {
+            fd = -1;
+        }
+    }
+
+    // The payload is kept alive by the exported file descriptor
+    vkFreeMemory(vkdev, memory, nullptr);
+
+    return fd;
+#else
+    UNUSED(device);
+    UNUSED(data);
+    UNUSED(size);
+    return -1;
+#endif
+}
+
+void CL_API_CALL clvk_queue_report_batch(cl_command_queue queue,
+                                         cl_uint batch_size, uint64_t record_ns,
+                                         uint64_t execution_ns,
+                                         cl_uint* max_cmd_batch_size,
+                                         cl_uint* max_first_cmd_batch_size) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    assert(queue != nullptr && icd_downcast(queue)->is_valid());
+    icd_downcast(queue)->simulate_batch_completed(
+        batch_size, record_ns, execution_ns, max_cmd_batch_size,
+        max_first_cmd_batch_size);
+#else
+    UNUSED(queue);
+    UNUSED(batch_size);
+    UNUSED(record_ns);
+    UNUSED(execution_ns);
+    UNUSED(max_cmd_batch_size);
+    UNUSED(max_first_cmd_batch_size);
+#endif
+}
+
+double CL_API_CALL clvk_work_group_size_score(const uint32_t* global_size,
+                                              const uint32_t* local_size,
+                                              uint32_t subgroup_size,
+                                              uint64_t target_num_groups) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    return cvk_device::work_group_size_score(
+        {global_size[0], global_size[1], global_size[2]},
+        {local_size[0], local_size[1], local_size[2]}, subgroup_size,
+        target_num_groups);
+#else
+    UNUSED(global_size);
+    UNUSED(local_size);
+    UNUSED(subgroup_size);
+    UNUSED(target_num_groups);
+    return 0.0;
+#endif
+}
+
+size_t CL_API_CALL clvk_strip_spirv(const uint32_t* code, size_t num_words,
+                                    uint32_t* stripped,
+                                    size_t stripped_num_words) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    spir_binary binary(SPV_ENV_UNIVERSAL_1_0);
+    binary.use(std::vector<uint32_t>(code, code + num_words));
+    std::vector<uint32_t> result;
+    if (!binary.ingest(&result)) {
+        return 0;
+    }
+    if ((stripped != nullptr) && (stripped_num_words >= result.size())) {
+        memcpy(stripped, result.data(), result.size() * sizeof(uint32_t));
+    }
+    return result.size();
+#else
+    UNUSED(code);
+    UNUSED(num_words);
+    UNUSED(stripped);
+    UNUSED(stripped_num_words);
+    return 0;
+#endif
+}
+
+void CL_API_CALL clvk_log_ring_reset(uint32_t records_per_thread) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    cvk_log_ring_reset(records_per_thread);
+#else
+    UNUSED(records_per_thread);
+#endif
+}
+
+void CL_API_CALL clvk_log_ring_append(const char* fmt, ...) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    va_list args;
+    va_start(args, fmt);
+    cvk_log_ring_append(loglevel::debug, fmt, args);
+    va_end(args);
+#else
+    UNUSED(fmt);
+#endif
+}
+
+void CL_API_CALL clvk_log_ring_dump(FILE* file) {
+#ifdef CLVK_UNIT_TESTING_ENABLED
+    cvk_log_ring_dump(file);
+#else
+    UNUSED(file);
+#endif
+}
 } // extern "C"
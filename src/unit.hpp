@@ -20,6 +20,8 @@
 
 #include <CL/cl.h>
 
+#include <cstdio>
+
 extern "C" {
 
 void CL_API_CALL clvk_override_device_max_compute_work_group_count(
@@ -28,6 +30,56 @@ void CL_API_CALL clvk_override_device_max_compute_work_group_count(
 void CL_API_CALL clvk_restore_device_properties(cl_device_id device);
 
 const config_struct* CL_API_CALL clvk_get_config();
+
+// Build `source` with a compile service running a single compile server
+// started from `server_path` (the configured server when NULL). Returns
+// whether the service handled the build, and the compiler's status in
+// `status` when it did.
+cl_bool CL_API_CALL clvk_compile_with_server(const char* server_path,
+                                             uint32_t timeout_ms,
+                                             const char* source, int* status);
+
+// Export `size` bytes of memory initialised with `data` as an opaque file
+// descriptor that buffers created on `device` can be imported from, as
+// another Vulkan application would. Returns -1 when the device cannot export
+// such memory.
+int CL_API_CALL clvk_export_buffer_memory_fd(cl_device_id device,
+                                             const void* data, size_t size);
+
+// Report a batch of `batch_size` commands that took `record_ns` to record and
+// `execution_ns` to execute to the batch controllers of `queue`, then return
+// the maximum batch sizes they select for the next batches.
+void CL_API_CALL clvk_queue_report_batch(cl_command_queue queue,
+                                         cl_uint batch_size, uint64_t record_ns,
+                                         uint64_t execution_ns,
+                                         cl_uint* max_cmd_batch_size,
+                                         cl_uint* max_first_cmd_batch_size);
+
+// Score the work-group size `local_size` for `global_size` on a device with
+// `subgroup_size` invocations per subgroup that needs `target_num_groups`
+// work-groups to be filled. Higher scores are better.
+double CL_API_CALL clvk_work_group_size_score(const uint32_t* global_size,
+                                              const uint32_t* local_size,
+                                              uint32_t subgroup_size,
+                                              uint64_t target_num_groups);
+
+// Strip the non-semantic instructions from the SPIR-V module of `num_words`
+// words at `code` as clvk does for devices that do not support them. Returns
+// the size in words of the stripped module, copied to `stripped` if it can
+// hold `stripped_num_words` words, or 0 if the module cannot be parsed.
+size_t CL_API_CALL clvk_strip_spirv(const uint32_t* code, size_t num_words,
+                                    uint32_t* stripped,
+                                    size_t stripped_num_words);
+
+// Discard all the records of the binary log rings and use rings of
+// `records_per_thread` records from now on.
+void CL_API_CALL clvk_log_ring_reset(uint32_t records_per_thread);
+
+// Append a message to the binary log ring of the calling thread.
+void CL_API_CALL clvk_log_ring_append(const char* fmt, ...);
+
+// Format the records of all the binary log rings to `file`.
+void CL_API_CALL clvk_log_ring_dump(FILE* file);
 }
 
 template <typename T> struct clvk_config_scoped_override {
@@ -30,6 +30,11 @@
 #include <pthread.h>
 #endif
 
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 char* cvk_mkdtemp(std::string& tmpl) {
 #ifdef WIN32
     if (_mktemp_s(&tmpl.front(), tmpl.size() + 1) != 0) {
@@ -86,3 +91,49 @@ void cvk_set_current_thread_name_if_supported(const std::string& name) {
     pthread_setname_np(pthread_self(), name.c_str());
 #endif
 }
+
+bool cvk_reserve_address_range(void* addr, size_t size) {
+#ifdef WIN32
+    UNUSED(addr);
+    UNUSED(size);
+    return false;
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#ifdef MAP_FIXED_NOREPLACE
+    flags |= MAP_FIXED_NOREPLACE;
+#endif
+    // Without MAP_FIXED_NOREPLACE, addr is only a hint
+    void* ret = mmap(addr, size, PROT_NONE, flags, -1, 0);
+    if (ret == MAP_FAILED) {
+        return false;
+    }
+    if (ret != addr) {
+        munmap(ret, size);
+        return false;
+    }
+    return true;
+#endif
+}
+
+void cvk_release_address_range(void* addr, size_t size) {
+#ifdef WIN32
+    UNUSED(addr);
+    UNUSED(size);
+#else
+    munmap(addr, size);
+#endif
+}
+
+size_t cvk_fd_size(int fd) {
+#ifdef WIN32
+    UNUSED(fd);
+    return 0;
+#else
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end <= 0) {
+        return 0;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return static_cast<size_t>(end);
+#endif
+}
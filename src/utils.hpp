@@ -19,6 +19,11 @@
 #include <cassert>
 #include <thread>
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
 #include <vulkan/vulkan.h>
 
 #ifndef _MSC_VER
@@ -30,6 +35,13 @@
 char* cvk_mkdtemp(std::string& tmpl);
 int cvk_exec(const std::string& cmd, std::string* output = nullptr);
 void cvk_set_current_thread_name_if_supported(const std::string&);
+// Reserve the host virtual address range [addr, addr + size) without backing
+// it with memory. Return false if the range is not available.
+bool cvk_reserve_address_range(void* addr, size_t size);
+void cvk_release_address_range(void* addr, size_t size);
+// Return the size of the object a file descriptor refers to, or 0 when it
+// cannot be queried because the file descriptor is not seekable.
+size_t cvk_fd_size(int fd);
 
 #define CVK_VK_CHECK_INTERNAL(logfn, res, msg)                                 \
     do {                                                                       \
@@ -62,6 +74,16 @@ static inline void* pointer_offset(const void* ptr, size_t offset) {
     return reinterpret_cast<void*>(ptrint + offset);
 }
 
+// Hint to the CPU that the calling thread is busy-waiting
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||            \
+    defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#endif
+}
+
 template <typename T> static inline T ceil_div(T num, T divisor) {
     CVK_ASSERT(divisor != 0);
     return num / divisor + (num % divisor != 0);
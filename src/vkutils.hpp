@@ -19,6 +19,7 @@
 
 #include <vulkan/vulkan.h>
 
+#include "metrics.hpp"
 #include "tracing.hpp"
 #include "utils.hpp"
 
@@ -54,6 +55,7 @@ struct cvk_vulkan_queue_wrapper {
         TRACE_BEGIN("vkQueueSubmit");
         auto ret = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
         TRACE_END();
+        cvk_metrics_queue_submission(m_queue);
         if (ret != VK_SUCCESS) {
             cvk_error_fn("could not submit work to queue: %s",
                          vulkan_error_string(ret));
@@ -82,6 +84,7 @@ struct cvk_vulkan_queue_wrapper {
         TRACE_BEGIN("vkQueueSubmit");
         auto ret = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
         TRACE_END();
+        cvk_metrics_queue_submission(m_queue);
         if (ret != VK_SUCCESS) {
             cvk_error_fn("could not submit work to queue: %s",
                          vulkan_error_string(ret));
@@ -90,6 +93,42 @@ struct cvk_vulkan_queue_wrapper {
         return ret;
     }
 
+    // Submit a batch without command buffers that only waits on and signals
+    // semaphores.
+    CHECK_RETURN VkResult
+    submit(const std::vector<VkSemaphore>& wait_semaphores,
+           const std::vector<VkSemaphore>& signal_semaphores) {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        std::vector<VkPipelineStageFlags> wait_stages(
+            wait_semaphores.size(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+        VkSubmitInfo submitInfo = {
+            VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            nullptr,
+            static_cast<uint32_t>(wait_semaphores.size()),
+            wait_semaphores.data(),
+            wait_stages.data(),
+            0,       // commandBufferCount
+            nullptr, // pCommandBuffers
+            static_cast<uint32_t>(signal_semaphores.size()),
+            signal_semaphores.data(),
+        };
+
+        TRACE_BEGIN("vkQueueSubmit");
+        auto ret = vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE);
+        TRACE_END();
+        cvk_metrics_queue_submission(m_queue);
+        if (ret != VK_SUCCESS) {
+            cvk_error_fn("could not submit work to queue: %s",
+                         vulkan_error_string(ret));
+        }
+
+        m_num_submissions++;
+
+        return ret;
+    }
+
     CHECK_RETURN VkResult wait_idle() {
         std::lock_guard<std::mutex> lock(m_lock);
 
@@ -107,6 +146,8 @@ struct cvk_vulkan_queue_wrapper {
 
     uint32_t queue_family() { return m_queue_family; }
 
+    VkQueue queue() const { return m_queue; }
+
 private:
     std::mutex m_lock;
     VkQueue m_queue;
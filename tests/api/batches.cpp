@@ -0,0 +1,165 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+
+#include "testcl.hpp"
+#include "unit.hpp"
+
+#include <algorithm>
+#include <vector>
+
+TEST_F(WithCommandQueue, ManyInstancesWithLatencyBatches) {
+
+    static const unsigned NUM_INSTANCES = 1000;
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id)
+    {
+        out[id] = id;
+    }
+    )";
+
+    CLVK_CONFIG_ASSERT_GT(max_entry_points_instances, NUM_INSTANCES);
+
+    // Batch controllers are attached when the queue is created
+    auto cfg_latency_batches =
+        CLVK_CONFIG_SCOPED_OVERRIDE(latency_batches, bool, true, true);
+    auto queue = CreateCommandQueue(device(), 0);
+
+    // Create kernel
+    auto kernel = CreateKernel(program_source, "test_simple");
+
+    // Create buffer
+    size_t buffer_size = NUM_INSTANCES * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                               buffer_size, nullptr);
+
+    // Dispatch kernel, flushing regularly to let the controller see batches
+    // complete
+    size_t gws = 1;
+    size_t lws = 1;
+
+    SetKernelArg(kernel, 0, buffer);
+    for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+        SetKernelArg(kernel, 1, &i);
+        auto err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &gws,
+                                          &lws, 0, nullptr, nullptr);
+        ASSERT_CL_SUCCESS(err);
+        if (i % 100 == 99) {
+            ASSERT_CL_SUCCESS(clFlush(queue));
+        }
+    }
+    Finish(queue);
+
+    // Check the expected result
+    auto data =
+        EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0, buffer_size);
+    for (cl_uint i = 0; i < NUM_INSTANCES; ++i) {
+        EXPECT_EQ(data[i], static_cast<cl_uint>(i));
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+}
+
+TEST_F(WithCommandQueue, LatencyControllerAdaptsBatchSizes) {
+    auto cfg_latency_batches =
+        CLVK_CONFIG_SCOPED_OVERRIDE(latency_batches, bool, true, true);
+    auto cfg_target = CLVK_CONFIG_SCOPED_OVERRIDE(batch_target_duration_us,
+                                                  uint32_t, 2000, true);
+    auto cfg_budget = CLVK_CONFIG_SCOPED_OVERRIDE(
+        first_batch_latency_budget_us, uint32_t, 220, true);
+    auto queue = CreateCommandQueue(device(), 0);
+
+    // The device defaults are kept until a batch has been measured, the
+    // default batch size is the largest the controller selects
+    cl_uint max_batch, max_first_batch;
+    clvk_queue_report_batch(queue, 0, 0, 0, &max_batch, &max_first_batch);
+    cl_uint limit = max_batch;
+
+    // 10us of execution and 1us of recording per command: batches of 2ms hold
+    // 200 commands and first batches of 220us hold 20. The controller ignores
+    // changes smaller than 1/8th of the current size.
+    clvk_queue_report_batch(queue, 10, 10000, 100000, &max_batch,
+                            &max_first_batch);
+    cl_uint expected = std::min(200u, limit);
+    EXPECT_NEAR(max_batch, expected, expected / 8);
+    cl_uint expected_first = std::min(20u, max_batch);
+    EXPECT_NEAR(max_first_batch, expected_first, expected_first / 8);
+
+    // Commands becoming 4 times slower shrink batches towards 50 commands
+    // within a few batches
+    cl_uint previous = max_batch;
+    for (int i = 0; i < 16; i++) {
+        clvk_queue_report_batch(queue, 10, 10000, 400000, &max_batch,
+                                &max_first_batch);
+        EXPECT_LE(max_batch, previous);
+        previous = max_batch;
+    }
+    EXPECT_GE(max_batch, std::min(45u, limit));
+    EXPECT_LE(max_batch, std::min(60u, limit));
+    EXPECT_LE(max_first_batch, 6u);
+
+    // Stable timings leave the batch sizes unchanged
+    clvk_queue_report_batch(queue, 10, 10000, 400000, &max_batch,
+                            &max_first_batch);
+    EXPECT_EQ(max_batch, previous);
+}
+
+TEST_F(WithCommandQueue, ManyInstancesRecordedInParallel) {
+
+    static const unsigned NUM_INSTANCES = 256;
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id, uint val)
+    {
+        out[id] = id + val;
+    }
+    )";
+
+    // Recording workers are started when the queue is created
+    auto cfg_threads =
+        CLVK_CONFIG_SCOPED_OVERRIDE(batch_recording_threads, uint32_t, 4, true);
+    auto cfg_chunk_size = CLVK_CONFIG_SCOPED_OVERRIDE(
+        batch_recording_chunk_size, uint32_t, 8, true);
+    auto queue = CreateCommandQueue(device(), 0);
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+    size_t buffer_size = NUM_INSTANCES * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    // Record several large batches so that the workers are reused
+    size_t gws = 1;
+    for (cl_uint val = 0; val < 3; val++) {
+        SetKernelArg(kernel, 2, &val);
+        for (cl_uint i = 0; i < NUM_INSTANCES; i++) {
+            SetKernelArg(kernel, 1, &i);
+            auto err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &gws,
+                                              nullptr, 0, nullptr, nullptr);
+            ASSERT_CL_SUCCESS(err);
+        }
+        Finish(queue);
+
+        std::vector<cl_uint> data(NUM_INSTANCES);
+        auto err = clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, buffer_size,
+                                       data.data(), 0, nullptr, nullptr);
+        ASSERT_CL_SUCCESS(err);
+        for (cl_uint i = 0; i < NUM_INSTANCES; ++i) {
+            EXPECT_EQ(data[i], i + val);
+        }
+    }
+}
+
+#endif
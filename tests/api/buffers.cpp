@@ -0,0 +1,76 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "testcl.hpp"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+TEST_F(WithCommandQueue, UseHostPtrBufferAligned) {
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out)
+    {
+        size_t gid = get_global_id(0);
+        out[gid] = gid;
+    }
+    )";
+
+    // Use a page-aligned allocation whose size is a multiple of the page size
+    // so that it can be imported as the buffer's memory where supported.
+    static const size_t ALIGNMENT = 64 * 1024;
+    static const size_t NUM_ELEMENTS = ALIGNMENT / sizeof(cl_uint);
+    size_t buffer_size = NUM_ELEMENTS * sizeof(cl_uint);
+
+    std::vector<char> storage(buffer_size + ALIGNMENT);
+    void* host_ptr = storage.data();
+    size_t space = storage.size();
+    ASSERT_NE(std::align(ALIGNMENT, buffer_size, host_ptr, space), nullptr);
+    memset(host_ptr, 0, buffer_size);
+
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                               buffer_size, host_ptr);
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+    SetKernelArg(kernel, 0, buffer);
+
+    size_t gws = NUM_ELEMENTS;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+
+    // Mapping a CL_MEM_USE_HOST_PTR buffer must return host_ptr with up to
+    // date contents
+    auto data =
+        EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0, buffer_size);
+    EXPECT_EQ(static_cast<void*>(data), host_ptr);
+    for (cl_uint i = 0; i < NUM_ELEMENTS; ++i) {
+        EXPECT_EQ(data[i], i);
+    }
+
+    // Host writes made while the buffer is mapped must be visible to the
+    // device after unmapping
+    EnqueueUnmapMemObject(buffer, data);
+    data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_WRITE, 0,
+                                     buffer_size);
+    for (cl_uint i = 0; i < NUM_ELEMENTS; ++i) {
+        data[i] = NUM_ELEMENTS - i;
+    }
+    EnqueueUnmapMemObject(buffer, data);
+
+    std::vector<cl_uint> readback(NUM_ELEMENTS);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, readback.data());
+    for (cl_uint i = 0; i < NUM_ELEMENTS; ++i) {
+        EXPECT_EQ(readback[i], NUM_ELEMENTS - i);
+    }
+}
@@ -0,0 +1,156 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "testcl.hpp"
+
+#define GET_EXTENSION_FUNCTION(name)                                           \
+    auto name = reinterpret_cast<name##_fn>(                                   \
+        clGetExtensionFunctionAddressForPlatform(platform(), #name));          \
+    ASSERT_NE(name, nullptr)
+
+TEST_F(WithCommandQueue, CommandBufferMutableDispatch) {
+    REQUIRE_EXTENSION("cl_khr_command_buffer_mutable_dispatch");
+
+    GET_EXTENSION_FUNCTION(clCreateCommandBufferKHR);
+    GET_EXTENSION_FUNCTION(clCommandNDRangeKernelKHR);
+    GET_EXTENSION_FUNCTION(clFinalizeCommandBufferKHR);
+    GET_EXTENSION_FUNCTION(clEnqueueCommandBufferKHR);
+    GET_EXTENSION_FUNCTION(clUpdateMutableCommandsKHR);
+    GET_EXTENSION_FUNCTION(clReleaseCommandBufferKHR);
+
+    static const char* source = R"(
+kernel void test(global uint* out, uint val) {
+    out[get_global_id(0)] = val;
+}
+)";
+
+    const size_t num_elems = 16;
+    const size_t buffer_size = num_elems * sizeof(cl_uint);
+
+    auto kernel = CreateKernel(source, "test");
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE, buffer_size, nullptr);
+
+    cl_uint zero = 0;
+    EnqueueFillBuffer(buffer, &zero, sizeof(zero), 0, buffer_size);
+    Finish();
+
+    cl_uint val = 1;
+    SetKernelArg(kernel, 0, buffer);
+    SetKernelArg(kernel, 1, &val);
+
+    // Record a command buffer
+    cl_command_queue queue = m_queue;
+    cl_command_buffer_properties_khr properties[] = {
+        CL_COMMAND_BUFFER_FLAGS_KHR, CL_COMMAND_BUFFER_MUTABLE_KHR, 0};
+    cl_int err;
+    auto command_buffer = clCreateCommandBufferKHR(1, &queue, properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    size_t gws = num_elems;
+    cl_mutable_command_khr command;
+    err = clCommandNDRangeKernelKHR(command_buffer, nullptr, nullptr, kernel, 1,
+                                    nullptr, &gws, nullptr, 0, nullptr,
+                                    nullptr, &command);
+    ASSERT_CL_SUCCESS(err);
+
+    err = clFinalizeCommandBufferKHR(command_buffer);
+    ASSERT_CL_SUCCESS(err);
+
+    // Arguments are captured when the command is recorded
+    val = 7;
+    SetKernelArg(kernel, 1, &val);
+
+    err = clEnqueueCommandBufferKHR(0, nullptr, command_buffer, 0, nullptr,
+                                    nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    auto data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                          buffer_size);
+    for (size_t i = 0; i < num_elems; i++) {
+        EXPECT_EQ(data[i], 1u);
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+
+    // Update the argument and shrink the NDRange
+    cl_uint new_val = 2;
+    cl_mutable_dispatch_arg_khr arg = {1, sizeof(new_val), &new_val};
+    size_t new_gws = num_elems / 2;
+    cl_mutable_dispatch_config_khr config = {};
+    config.command = command;
+    config.num_args = 1;
+    config.arg_list = &arg;
+    config.global_work_size = &new_gws;
+
+    cl_command_buffer_update_type_khr config_type =
+        CL_STRUCTURE_TYPE_MUTABLE_DISPATCH_CONFIG_KHR;
+    const void* configs[] = {&config};
+    err = clUpdateMutableCommandsKHR(command_buffer, 1, &config_type, configs);
+    ASSERT_CL_SUCCESS(err);
+
+    err = clEnqueueCommandBufferKHR(0, nullptr, command_buffer, 0, nullptr,
+                                    nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                     buffer_size);
+    for (size_t i = 0; i < num_elems; i++) {
+        EXPECT_EQ(data[i], i < new_gws ? 2u : 1u);
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+
+    // An invalid config makes the whole update fail without applying the
+    // valid configs that precede it
+    cl_uint ignored_val = 3;
+    cl_mutable_dispatch_arg_khr valid_arg = {1, sizeof(ignored_val),
+                                             &ignored_val};
+    cl_mutable_dispatch_config_khr valid_config = {};
+    valid_config.command = command;
+    valid_config.num_args = 1;
+    valid_config.arg_list = &valid_arg;
+
+    cl_mutable_dispatch_arg_khr invalid_arg = {2, sizeof(ignored_val),
+                                               &ignored_val};
+    cl_mutable_dispatch_config_khr invalid_config = {};
+    invalid_config.command = command;
+    invalid_config.num_args = 1;
+    invalid_config.arg_list = &invalid_arg;
+
+    cl_command_buffer_update_type_khr config_types[] = {config_type,
+                                                        config_type};
+    const void* failing_configs[] = {&valid_config, &invalid_config};
+    err = clUpdateMutableCommandsKHR(command_buffer, 2, config_types,
+                                     failing_configs);
+    ASSERT_EQ(err, CL_INVALID_ARG_INDEX);
+
+    EnqueueFillBuffer(buffer, &zero, sizeof(zero), 0, buffer_size);
+    err = clEnqueueCommandBufferKHR(0, nullptr, command_buffer, 0, nullptr,
+                                    nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                     buffer_size);
+    for (size_t i = 0; i < num_elems; i++) {
+        EXPECT_EQ(data[i], i < new_gws ? 2u : 0u);
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+
+    err = clReleaseCommandBufferKHR(command_buffer);
+    ASSERT_CL_SUCCESS(err);
+}
@@ -14,6 +14,20 @@
 
 #include "testcl.hpp"
 
+#include "spirv-tools/libspirv.hpp"
+#include "spirv-tools/optimizer.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 TEST_F(WithContext, DISABLED_NOCOMPILER(BuildLog)) {
     static const char* source_warning =
         "#warning THIS IS A WARNING\nvoid kernel test(){}\n";
@@ -377,6 +391,203 @@ TEST_F(WithCommandQueue, ProgramBinaryExecutable) {
     ASSERT_EQ(result[3], 3);
 }
 
+namespace {
+
+// Layout of the sections of clvk program binaries, see src/program.cpp
+const size_t binary_header_size = 3 * sizeof(uint32_t);
+const uint32_t binary_section_spirv = 1;
+const uint32_t binary_section_pipeline_cache = 4;
+// Pipeline cache sections start with the pipelineCacheUUID of the device
+const size_t pipeline_cache_uuid_size = 16;
+
+struct binary_section {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Return the type and payload of the sections of a program binary
+std::vector<std::pair<uint32_t, std::vector<uint8_t>>>
+GetBinarySections(const std::vector<uint8_t>& binary) {
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> sections;
+    if (binary.size() < binary_header_size + sizeof(uint32_t)) {
+        return sections;
+    }
+    uint32_t num_sections;
+    memcpy(&num_sections, &binary[binary_header_size], sizeof(num_sections));
+    for (uint32_t i = 0; i < num_sections; i++) {
+        binary_section sec;
+        memcpy(&sec,
+               &binary[binary_header_size + sizeof(uint32_t) + i * sizeof(sec)],
+               sizeof(sec));
+        auto payload = binary.begin() + sec.offset;
+        sections.emplace_back(
+            sec.type, std::vector<uint8_t>(payload, payload + sec.size));
+    }
+    return sections;
+}
+
+std::vector<uint8_t> GetBinarySection(const std::vector<uint8_t>& binary,
+                                      uint32_t type) {
+    for (auto& section : GetBinarySections(binary)) {
+        if (section.first == type) {
+            return section.second;
+        }
+    }
+    return {};
+}
+
+// Build a program binary with the header of `binary` and the given sections
+std::vector<uint8_t> BuildBinary(
+    const std::vector<uint8_t>& binary,
+    const std::vector<std::pair<uint32_t, std::vector<uint8_t>>>& sections) {
+    size_t offset = binary_header_size + sizeof(uint32_t) +
+                    sections.size() * sizeof(binary_section);
+    std::vector<binary_section> table;
+    for (auto& section : sections) {
+        offset = (offset + 15) & ~15;
+        table.push_back({section.first, 0, offset, section.second.size()});
+        offset += section.second.size();
+    }
+
+    std::vector<uint8_t> result(offset);
+    memcpy(result.data(), binary.data(), binary_header_size);
+    uint32_t num_sections = sections.size();
+    memcpy(&result[binary_header_size], &num_sections, sizeof(num_sections));
+    memcpy(&result[binary_header_size + sizeof(uint32_t)], table.data(),
+           table.size() * sizeof(binary_section));
+    for (size_t i = 0; i < sections.size(); i++) {
+        memcpy(&result[table[i].offset], sections[i].second.data(),
+               sections[i].second.size());
+    }
+    return result;
+}
+
+} // namespace
+
+// Test that binaries using the original format, a header followed by the
+// SPIR-V module, can still be loaded.
+TEST_F(WithCommandQueue, ProgramBinaryExecutableVersion1) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        uint gid = get_global_id(0);
+        output[gid] = gid + 1;
+      }
+    )";
+    auto program = CreateAndBuildProgram(source);
+    auto built_binary = GetProgramBinary(program);
+
+    auto spirv = GetBinarySection(built_binary, binary_section_spirv);
+    ASSERT_FALSE(spirv.empty());
+
+    const uint32_t header[3] = {0x6B766C63, 1,
+                                CL_PROGRAM_BINARY_TYPE_EXECUTABLE};
+    std::vector<uint8_t> v1_binary(binary_header_size + spirv.size());
+    memcpy(v1_binary.data(), header, binary_header_size);
+    memcpy(&v1_binary[binary_header_size], spirv.data(), spirv.size());
+
+    auto binary_program = CreateAndBuildProgramWithBinary(v1_binary);
+    ASSERT_EQ(GetProgramBinaryType(binary_program),
+              CL_PROGRAM_BINARY_TYPE_EXECUTABLE);
+
+    const size_t gws = 4;
+    const size_t buffer_size = gws * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+    auto kernel = CreateKernel(binary_program, "test");
+    SetKernelArg(kernel, 0, buffer);
+
+    cl_uint result[gws] = {0};
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    EnqueueReadBuffer(buffer, CL_BLOCKING, 0, buffer_size, result);
+
+    for (cl_uint i = 0; i < gws; i++) {
+        EXPECT_EQ(result[i], i + 1);
+    }
+}
+
+// Test that the reserved section that used to hold the stripped module is
+// not trusted: a module that does not match the main one must not be used.
+TEST_F(WithCommandQueue, ProgramBinaryIgnoresStrippedSection) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        uint gid = get_global_id(0);
+        output[gid] = gid + 2;
+      }
+    )";
+    auto program = CreateAndBuildProgram(source);
+    auto built_binary = GetProgramBinary(program);
+
+    auto spirv = GetBinarySection(built_binary, binary_section_spirv);
+    ASSERT_FALSE(spirv.empty());
+
+    // Rebuild a binary with the module and a bogus stripped module
+    const std::vector<uint8_t> bogus(64, 0xDE);
+    auto binary =
+        BuildBinary(built_binary, {{binary_section_spirv, spirv}, {2, bogus}});
+
+    auto binary_program = CreateAndBuildProgramWithBinary(binary);
+
+    const size_t gws = 4;
+    const size_t buffer_size = gws * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+    auto kernel = CreateKernel(binary_program, "test");
+    SetKernelArg(kernel, 0, buffer);
+
+    cl_uint result[gws] = {0};
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    EnqueueReadBuffer(buffer, CL_BLOCKING, 0, buffer_size, result);
+
+    for (cl_uint i = 0; i < gws; i++) {
+        EXPECT_EQ(result[i], i + 2);
+    }
+}
+
+// Test that a binary whose pipeline cache was created for another device or
+// driver can still be loaded and produces correct results.
+TEST_F(WithCommandQueue, ProgramBinaryIgnoresForeignPipelineCache) {
+    static const char* source = R"(
+      kernel void test(global uint *output) {
+        uint gid = get_global_id(0);
+        output[gid] = gid * 3;
+      }
+    )";
+    auto program = CreateAndBuildProgram(source);
+    auto built_binary = GetProgramBinary(program);
+
+    auto spirv = GetBinarySection(built_binary, binary_section_spirv);
+    ASSERT_FALSE(spirv.empty());
+
+    // Replace the pipeline cache, if any, with one for another UUID
+    auto foreign_cache =
+        GetBinarySection(built_binary, binary_section_pipeline_cache);
+    if (foreign_cache.size() <= pipeline_cache_uuid_size) {
+        foreign_cache.assign(pipeline_cache_uuid_size + 256, 0x5A);
+    }
+    for (size_t i = 0; i < pipeline_cache_uuid_size; i++) {
+        foreign_cache[i] = ~foreign_cache[i];
+    }
+    auto binary = BuildBinary(
+        built_binary, {{binary_section_spirv, spirv},
+                       {binary_section_pipeline_cache, foreign_cache}});
+
+    auto binary_program = CreateAndBuildProgramWithBinary(binary);
+
+    const size_t gws = 4;
+    const size_t buffer_size = gws * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size);
+    auto kernel = CreateKernel(binary_program, "test");
+    SetKernelArg(kernel, 0, buffer);
+
+    cl_uint result[gws] = {0};
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    EnqueueReadBuffer(buffer, CL_BLOCKING, 0, buffer_size, result);
+
+    for (cl_uint i = 0; i < gws; i++) {
+        EXPECT_EQ(result[i], i * 3);
+    }
+}
+
 TEST_F(WithCommandQueue, LinkPrograms) {
     static const char* sourceA = R"(
       extern void bar(global uint *dst, global uint *src);
@@ -497,4 +708,91 @@ TEST_F(WithContext, UnsupportedCapabilities) {
     ASSERT_TRUE(build_log.find("Device does not support SPIR-V capability") !=
                 std::string::npos);
 }
+
+TEST(SpirvStrip, MatchesSpirvTools) {
+    // Non-semantic instructions at module scope and in functions, referring
+    // to strings and results that are kept and to other non-semantic results
+    static const char* source = R"(
+               OpCapability Shader
+               OpExtension "SPV_KHR_non_semantic_info"
+          %1 = OpExtInstImport "GLSL.std.450"
+          %2 = OpExtInstImport "NonSemantic.DebugPrintf"
+          %3 = OpExtInstImport "NonSemantic.clvk.test"
+               OpMemoryModel Logical GLSL450
+               OpEntryPoint GLCompute %main "main"
+               OpExecutionMode %main LocalSize 1 1 1
+        %str = OpString "stripped"
+               OpSource OpenCL_C 120 %str
+       %void = OpTypeVoid
+      %float = OpTypeFloat 32
+    %float_1 = OpConstant %float 1
+       %fn_t = OpTypeFunction %void
+          %4 = OpExtInst %void %3 1 %str %float_1
+       %main = OpFunction %void None %fn_t
+      %entry = OpLabel
+          %5 = OpExtInst %float %1 Sqrt %float_1
+          %6 = OpExtInst %void %2 1 %str %5
+          %7 = OpExtInst %void %3 2 %4 %6
+               OpReturn
+               OpFunctionEnd
+    )";
+
+    spvtools::SpirvTools tools(SPV_ENV_UNIVERSAL_1_0);
+    std::vector<uint32_t> module;
+    ASSERT_TRUE(tools.Assemble(source, &module));
+
+    std::vector<uint32_t> expected;
+    spvtools::Optimizer opt(SPV_ENV_UNIVERSAL_1_0);
+    opt.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+    spvtools::OptimizerOptions options;
+    options.set_run_validator(false);
+    ASSERT_TRUE(opt.Run(module.data(), module.size(), &expected, options));
+    ASSERT_LT(expected.size(), module.size());
+
+    auto size = clvk_strip_spirv(module.data(), module.size(), nullptr, 0);
+    ASSERT_GT(size, 0u);
+    std::vector<uint32_t> stripped(size);
+    ASSERT_EQ(clvk_strip_spirv(module.data(), module.size(), stripped.data(),
+                               stripped.size()),
+              size);
+    EXPECT_EQ(stripped, expected);
+}
+#endif
+
+#if CLVK_UNIT_TESTING_ENABLED && !defined(WIN32)
+static const char* compile_server_source = "kernel void foo() {}";
+
+TEST(CompileServer, BuildsProgram) {
+    int status;
+    ASSERT_TRUE(
+        clvk_compile_with_server(nullptr, 0, compile_server_source, &status));
+    EXPECT_EQ(status, 0);
+}
+
+TEST(CompileServer, MissingServer) {
+    int status;
+    EXPECT_FALSE(clvk_compile_with_server("/nonexistent/clvk-compile-server",
+                                          0, compile_server_source, &status));
+}
+
+TEST(CompileServer, HungServerTimesOut) {
+    // A server that never answers
+    char path[] = "/tmp/clvk-hung-compile-server-XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    static const char script[] = "#!/bin/sh\nexec sleep 600\n";
+    auto written = write(fd, script, sizeof(script) - 1);
+    fchmod(fd, S_IRWXU);
+    close(fd);
+    ASSERT_EQ(written, static_cast<ssize_t>(sizeof(script) - 1));
+
+    auto start = std::chrono::steady_clock::now();
+    int status;
+    EXPECT_FALSE(
+        clvk_compile_with_server(path, 100, compile_server_source, &status));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_LT(elapsed, std::chrono::seconds(60));
+
+    unlink(path);
+}
 #endif
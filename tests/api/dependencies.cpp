@@ -75,3 +75,42 @@ TEST_F(WithCommandQueue, InOrderQueueStopsExecutionAfterFailedCommand) {
     GetEventInfo(mapev, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
     ASSERT_NE(status, CL_COMPLETE);
 }
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+TEST_F(WithCommandQueue, WaitForEventsSpinning) {
+    auto cfg = CLVK_CONFIG_SCOPED_OVERRIDE(event_wait_spin_max_us, uint32_t,
+                                           1000, true);
+
+    static const char* program_source = R"(
+    kernel void test_simple(global uint* out, uint id)
+    {
+        out[0] = id;
+    }
+    )";
+
+    auto kernel = CreateKernel(program_source, "test_simple");
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, sizeof(cl_uint), nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    // Wait for each kernel to complete as a request/response application
+    // would, whether spinning or blocking the status must be final
+    size_t gws = 1;
+    for (cl_uint i = 0; i < 100; i++) {
+        SetKernelArg(kernel, 1, &i);
+        cl_event event;
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr, 0, nullptr,
+                             &event);
+        Flush();
+        WaitForEvent(event);
+
+        cl_int status;
+        GetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+        EXPECT_EQ(status, CL_COMPLETE);
+        clReleaseEvent(event);
+    }
+
+    cl_uint result;
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(result), &result);
+    EXPECT_EQ(result, 99u);
+}
+#endif
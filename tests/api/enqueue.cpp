@@ -16,6 +16,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <memory>
 #include <thread>
 
 TEST_F(WithCommandQueue, ManyInstancesInFlight) {
@@ -236,6 +237,106 @@ TEST_F(WithCommandQueue, PodUBO) {
     Finish();
 }
 
+// Enqueue a kernel while only changing some of its arguments between launches,
+// so that the argument values of each launch are built from those of the
+// previous launch.
+TEST_F(WithCommandQueue, ChangeSomeArgumentsBetweenEnqueues) {
+    static const unsigned NUM_INDICES = 8;
+
+    static const char* program_source = R"(
+    kernel void test(global uint* out, uint index, int a, global uint* out2)
+    {
+        out[index] = a + index;
+        out2[index] = a - index;
+    }
+    )";
+
+    auto kernel = CreateKernel(program_source, " -pod-ubo ", "test");
+
+    size_t buffer_size = NUM_INDICES * sizeof(cl_uint);
+    auto buffer_a = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                 buffer_size, nullptr);
+    auto buffer_b = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                 buffer_size, nullptr);
+    auto buffer_c = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                 buffer_size, nullptr);
+
+    cl_int a = 100;
+    SetKernelArg(kernel, 2, &a);
+    SetKernelArg(kernel, 3, buffer_c);
+
+    // For each index, launch once with only the POD arguments changed and
+    // once with only a buffer argument changed.
+    size_t gws = 1;
+    for (cl_uint i = 0; i < NUM_INDICES; i++) {
+        SetKernelArg(kernel, 0, buffer_a);
+        SetKernelArg(kernel, 1, &i);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+        SetKernelArg(kernel, 0, buffer_b);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+    }
+    Finish();
+
+    cl_mem buffers[] = {buffer_a, buffer_b};
+    for (auto buffer : buffers) {
+        auto data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                              buffer_size);
+        for (cl_uint i = 0; i < NUM_INDICES; i++) {
+            EXPECT_EQ(data[i], a + i);
+        }
+        EnqueueUnmapMemObject(buffer, data);
+    }
+    auto data = EnqueueMapBuffer<cl_uint>(buffer_c, CL_TRUE, CL_MAP_READ, 0,
+                                          buffer_size);
+    for (cl_uint i = 0; i < NUM_INDICES; i++) {
+        EXPECT_EQ(data[i], a - i);
+    }
+    EnqueueUnmapMemObject(buffer_c, data);
+    Finish();
+}
+
+TEST_F(WithCommandQueue, RepeatedLaunchesWithDifferentShapes) {
+    static const char* program_source = R"(
+    kernel void test(global uint* out, local uint* scratch)
+    {
+        uint lid = get_local_id(0);
+        scratch[lid] = get_local_size(0) + get_global_offset(0);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        out[get_global_id(0)] = scratch[get_local_size(0) - 1 - lid];
+    }
+    )";
+
+    auto kernel = CreateKernel(program_source, "test");
+
+    static const size_t GWS = 16;
+    size_t buffer_size = 2 * GWS * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                               buffer_size, nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    // Go through the shapes twice so that the second round reuses the
+    // launch state of the first one.
+    for (int round = 0; round < 2; round++) {
+        for (size_t lws : {1, 2, 4, 8}) {
+            for (size_t offset : {0, 1}) {
+                size_t goff = offset * GWS;
+                size_t gws = GWS;
+                SetKernelArg(kernel, 1, lws * sizeof(cl_uint), nullptr);
+                EnqueueNDRangeKernel(kernel, 1, &goff, &gws, &lws);
+
+                auto data = EnqueueMapBuffer<cl_uint>(
+                    buffer, CL_TRUE, CL_MAP_READ, goff * sizeof(cl_uint),
+                    GWS * sizeof(cl_uint));
+                for (size_t i = 0; i < GWS; i++) {
+                    EXPECT_EQ(data[i], lws + goff);
+                }
+                EnqueueUnmapMemObject(buffer, data);
+            }
+        }
+    }
+    Finish();
+}
+
 TEST_F(WithCommandQueue, PodPushConstant) {
     static const char* program_source =
         "kernel void test(global int* out, int a, int4 b, int c) { *out = a + "
@@ -0,0 +1,321 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "testcl.hpp"
+
+#include <algorithm>
+#include <vector>
+
+TEST_F(WithCommandQueue, SemaphoreSignalThenWait) {
+    REQUIRE_EXTENSION("cl_khr_semaphore");
+
+    auto clCreateSemaphoreWithPropertiesKHR =
+        reinterpret_cast<clCreateSemaphoreWithPropertiesKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clCreateSemaphoreWithPropertiesKHR"));
+    auto clEnqueueSignalSemaphoresKHR =
+        reinterpret_cast<clEnqueueSignalSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueSignalSemaphoresKHR"));
+    auto clEnqueueWaitSemaphoresKHR =
+        reinterpret_cast<clEnqueueWaitSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueWaitSemaphoresKHR"));
+    auto clReleaseSemaphoreKHR = reinterpret_cast<clReleaseSemaphoreKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform(),
+                                                 "clReleaseSemaphoreKHR"));
+    ASSERT_NE(clCreateSemaphoreWithPropertiesKHR, nullptr);
+    ASSERT_NE(clEnqueueSignalSemaphoresKHR, nullptr);
+    ASSERT_NE(clEnqueueWaitSemaphoresKHR, nullptr);
+    ASSERT_NE(clReleaseSemaphoreKHR, nullptr);
+
+    cl_semaphore_properties_khr properties[] = {
+        CL_SEMAPHORE_TYPE_KHR, CL_SEMAPHORE_TYPE_BINARY_KHR, 0};
+    cl_int err;
+    auto sem = clCreateSemaphoreWithPropertiesKHR(m_context, properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    // A wait on a semaphore signalled earlier in the same queue completes
+    err = clEnqueueSignalSemaphoresKHR(m_queue, 1, &sem, nullptr, 0, nullptr,
+                                       nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    cl_event event;
+    err = clEnqueueWaitSemaphoresKHR(m_queue, 1, &sem, nullptr, 0, nullptr,
+                                     &event);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    cl_int status;
+    GetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    EXPECT_EQ(status, CL_COMPLETE);
+    clReleaseEvent(event);
+
+    ASSERT_CL_SUCCESS(clReleaseSemaphoreKHR(sem));
+}
+
+static bool HasSemaphoreHandleType(cl_device_id device, cl_device_info param,
+                                   cl_external_semaphore_handle_type_khr type) {
+    size_t size;
+    if (clGetDeviceInfo(device, param, 0, nullptr, &size) != CL_SUCCESS) {
+        return false;
+    }
+    std::vector<cl_external_semaphore_handle_type_khr> types(
+        size / sizeof(cl_external_semaphore_handle_type_khr));
+    if (clGetDeviceInfo(device, param, size, types.data(), nullptr) !=
+        CL_SUCCESS) {
+        return false;
+    }
+    return std::find(types.begin(), types.end(), type) != types.end();
+}
+
+static bool
+SupportsSemaphoreRoundTrip(cl_device_id device,
+                           cl_external_semaphore_handle_type_khr type) {
+    return HasSemaphoreHandleType(
+               device, CL_DEVICE_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR, type) &&
+           HasSemaphoreHandleType(
+               device, CL_DEVICE_SEMAPHORE_IMPORT_HANDLE_TYPES_KHR, type);
+}
+
+TEST_F(WithCommandQueue, SemaphoreOpaqueFdRoundTrip) {
+    REQUIRE_EXTENSION("cl_khr_external_semaphore_opaque_fd");
+    cl_external_semaphore_handle_type_khr handle_type =
+        CL_SEMAPHORE_HANDLE_OPAQUE_FD_KHR;
+    if (!SupportsSemaphoreRoundTrip(device(), handle_type)) {
+        GTEST_SKIP() << "Opaque file descriptor semaphores not supported";
+    }
+
+    auto clCreateSemaphoreWithPropertiesKHR =
+        reinterpret_cast<clCreateSemaphoreWithPropertiesKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clCreateSemaphoreWithPropertiesKHR"));
+    auto clGetSemaphoreHandleForTypeKHR =
+        reinterpret_cast<clGetSemaphoreHandleForTypeKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clGetSemaphoreHandleForTypeKHR"));
+    auto clEnqueueSignalSemaphoresKHR =
+        reinterpret_cast<clEnqueueSignalSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueSignalSemaphoresKHR"));
+    auto clEnqueueWaitSemaphoresKHR =
+        reinterpret_cast<clEnqueueWaitSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueWaitSemaphoresKHR"));
+    auto clReleaseSemaphoreKHR = reinterpret_cast<clReleaseSemaphoreKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform(),
+                                                 "clReleaseSemaphoreKHR"));
+    ASSERT_NE(clCreateSemaphoreWithPropertiesKHR, nullptr);
+    ASSERT_NE(clGetSemaphoreHandleForTypeKHR, nullptr);
+    ASSERT_NE(clEnqueueSignalSemaphoresKHR, nullptr);
+    ASSERT_NE(clEnqueueWaitSemaphoresKHR, nullptr);
+    ASSERT_NE(clReleaseSemaphoreKHR, nullptr);
+
+    cl_semaphore_properties_khr export_properties[] = {
+        CL_SEMAPHORE_TYPE_KHR,
+        CL_SEMAPHORE_TYPE_BINARY_KHR,
+        CL_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR,
+        handle_type,
+        CL_SEMAPHORE_EXPORT_HANDLE_TYPES_LIST_END_KHR,
+        0};
+    cl_int err;
+    auto exported = clCreateSemaphoreWithPropertiesKHR(
+        m_context, export_properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    int fd = -1;
+    err = clGetSemaphoreHandleForTypeKHR(exported, device(), handle_type,
+                                         sizeof(fd), &fd, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    ASSERT_GE(fd, 0);
+
+    // The imported semaphore shares its payload with the exported one
+    cl_semaphore_properties_khr import_properties[] = {
+        CL_SEMAPHORE_TYPE_KHR, CL_SEMAPHORE_TYPE_BINARY_KHR,
+        static_cast<cl_semaphore_properties_khr>(handle_type),
+        static_cast<cl_semaphore_properties_khr>(fd), 0};
+    auto imported = clCreateSemaphoreWithPropertiesKHR(
+        m_context, import_properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    err = clEnqueueSignalSemaphoresKHR(m_queue, 1, &exported, nullptr, 0,
+                                       nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    cl_event event;
+    err = clEnqueueWaitSemaphoresKHR(m_queue, 1, &imported, nullptr, 0,
+                                     nullptr, &event);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    cl_int status;
+    GetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    EXPECT_EQ(status, CL_COMPLETE);
+    clReleaseEvent(event);
+
+    ASSERT_CL_SUCCESS(clReleaseSemaphoreKHR(imported));
+    ASSERT_CL_SUCCESS(clReleaseSemaphoreKHR(exported));
+}
+
+TEST_F(WithCommandQueue, SemaphoreSyncFdRoundTrip) {
+    REQUIRE_EXTENSION("cl_khr_external_semaphore_sync_fd");
+    cl_external_semaphore_handle_type_khr handle_type =
+        CL_SEMAPHORE_HANDLE_SYNC_FD_KHR;
+    if (!SupportsSemaphoreRoundTrip(device(), handle_type)) {
+        GTEST_SKIP() << "Sync file descriptor semaphores not supported";
+    }
+
+    auto clCreateSemaphoreWithPropertiesKHR =
+        reinterpret_cast<clCreateSemaphoreWithPropertiesKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clCreateSemaphoreWithPropertiesKHR"));
+    auto clGetSemaphoreHandleForTypeKHR =
+        reinterpret_cast<clGetSemaphoreHandleForTypeKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clGetSemaphoreHandleForTypeKHR"));
+    auto clReImportSemaphoreSyncFdKHR =
+        reinterpret_cast<clReImportSemaphoreSyncFdKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clReImportSemaphoreSyncFdKHR"));
+    auto clEnqueueSignalSemaphoresKHR =
+        reinterpret_cast<clEnqueueSignalSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueSignalSemaphoresKHR"));
+    auto clEnqueueWaitSemaphoresKHR =
+        reinterpret_cast<clEnqueueWaitSemaphoresKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueWaitSemaphoresKHR"));
+    auto clReleaseSemaphoreKHR = reinterpret_cast<clReleaseSemaphoreKHR_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform(),
+                                                 "clReleaseSemaphoreKHR"));
+    ASSERT_NE(clCreateSemaphoreWithPropertiesKHR, nullptr);
+    ASSERT_NE(clGetSemaphoreHandleForTypeKHR, nullptr);
+    ASSERT_NE(clReImportSemaphoreSyncFdKHR, nullptr);
+    ASSERT_NE(clEnqueueSignalSemaphoresKHR, nullptr);
+    ASSERT_NE(clEnqueueWaitSemaphoresKHR, nullptr);
+    ASSERT_NE(clReleaseSemaphoreKHR, nullptr);
+
+    cl_semaphore_properties_khr export_properties[] = {
+        CL_SEMAPHORE_TYPE_KHR,
+        CL_SEMAPHORE_TYPE_BINARY_KHR,
+        CL_SEMAPHORE_EXPORT_HANDLE_TYPES_KHR,
+        handle_type,
+        CL_SEMAPHORE_EXPORT_HANDLE_TYPES_LIST_END_KHR,
+        0};
+    cl_int err;
+    auto exported = clCreateSemaphoreWithPropertiesKHR(
+        m_context, export_properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    cl_semaphore_properties_khr properties[] = {
+        CL_SEMAPHORE_TYPE_KHR, CL_SEMAPHORE_TYPE_BINARY_KHR, 0};
+    auto imported =
+        clCreateSemaphoreWithPropertiesKHR(m_context, properties, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    // Sync file descriptors can only be exported once the signal operation
+    // has been submitted
+    err = clEnqueueSignalSemaphoresKHR(m_queue, 1, &exported, nullptr, 0,
+                                       nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    // A sync file descriptor of -1 is valid and means already signalled
+    int fd = -1;
+    err = clGetSemaphoreHandleForTypeKHR(exported, device(), handle_type,
+                                         sizeof(fd), &fd, nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    ASSERT_CL_SUCCESS(clReImportSemaphoreSyncFdKHR(imported, nullptr, fd));
+
+    cl_event event;
+    err = clEnqueueWaitSemaphoresKHR(m_queue, 1, &imported, nullptr, 0,
+                                     nullptr, &event);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    cl_int status;
+    GetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+    EXPECT_EQ(status, CL_COMPLETE);
+    clReleaseEvent(event);
+
+    ASSERT_CL_SUCCESS(clReleaseSemaphoreKHR(imported));
+    ASSERT_CL_SUCCESS(clReleaseSemaphoreKHR(exported));
+}
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+TEST_F(WithCommandQueue, ExternalMemoryOpaqueFdImport) {
+    REQUIRE_EXTENSION("cl_khr_external_memory_opaque_fd");
+
+    auto clEnqueueAcquireExternalMemObjectsKHR =
+        reinterpret_cast<clEnqueueAcquireExternalMemObjectsKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueAcquireExternalMemObjectsKHR"));
+    auto clEnqueueReleaseExternalMemObjectsKHR =
+        reinterpret_cast<clEnqueueReleaseExternalMemObjectsKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clEnqueueReleaseExternalMemObjectsKHR"));
+    ASSERT_NE(clEnqueueAcquireExternalMemObjectsKHR, nullptr);
+    ASSERT_NE(clEnqueueReleaseExternalMemObjectsKHR, nullptr);
+
+    const size_t NUM_ELEMENTS = 1024;
+    const size_t size = NUM_ELEMENTS * sizeof(cl_uint);
+    std::vector<cl_uint> data(NUM_ELEMENTS);
+    for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+        data[i] = static_cast<cl_uint>(i);
+    }
+
+    int fd = clvk_export_buffer_memory_fd(device(), data.data(), size);
+    if (fd < 0) {
+        GTEST_SKIP() << "Device cannot export opaque file descriptor memory";
+    }
+
+    cl_mem_properties properties[] = {
+        CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR,
+        static_cast<cl_mem_properties>(fd), 0};
+    cl_int err;
+    holder<cl_mem> buffer = clCreateBufferWithProperties(
+        m_context, properties, CL_MEM_READ_WRITE, size, nullptr, &err);
+    ASSERT_CL_SUCCESS(err);
+
+    static const char* source = R"(
+kernel void test(global uint* buffer) {
+    size_t gid = get_global_id(0);
+    buffer[gid] += 1;
+}
+)";
+    auto kernel = CreateKernel(source, "test");
+    SetKernelArg(kernel, 0, buffer);
+
+    cl_mem mem = buffer;
+    err = clEnqueueAcquireExternalMemObjectsKHR(m_queue, 1, &mem, 0, nullptr,
+                                                nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    size_t gws = NUM_ELEMENTS;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+
+    // The contents written by the exporter must be visible after the acquire
+    std::vector<cl_uint> result(NUM_ELEMENTS);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, size, result.data());
+    for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+        EXPECT_EQ(result[i], data[i] + 1) << "at index " << i;
+    }
+
+    err = clEnqueueReleaseExternalMemObjectsKHR(m_queue, 1, &mem, 0, nullptr,
+                                                nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+}
+#endif
@@ -852,4 +852,50 @@ TEST_F(WithCommandQueue, ImageInitAtCreation) {
     EXPECT_TRUE(success);
 }
 
+TEST_F(WithCommandQueue, ImageCopyHostPtrStagedInChunks) {
+    auto cfg = CLVK_CONFIG_SCOPED_OVERRIDE(host_image_copy, bool, false, true);
+
+    const size_t IMAGE_WIDTH = 64;
+    const size_t IMAGE_HEIGHT = 64;
+    const size_t IMAGE_DEPTH = 4;
+    const size_t IMAGE_SIZE = IMAGE_WIDTH * IMAGE_HEIGHT * IMAGE_DEPTH;
+
+    std::vector<cl_uchar> host_data(IMAGE_SIZE);
+    for (size_t i = 0; i < IMAGE_SIZE; i++) {
+        host_data[i] = static_cast<cl_uchar>(i * 7);
+    }
+
+    cl_image_format format = {CL_R, CL_UNSIGNED_INT8};
+    cl_image_desc desc = {
+        CL_MEM_OBJECT_IMAGE3D, // image_type
+        IMAGE_WIDTH,           // image_width
+        IMAGE_HEIGHT,          // image_height
+        IMAGE_DEPTH,           // image_depth
+        0,                     // image_array_size
+        0,                     // image_row_pitch
+        0,                     // image_slice_pitch
+        0,                     // num_mip_levels
+        0,                     // num_samples
+        nullptr,               // buffer
+    };
+
+    // Upload in chunks of rows (1 kB) and of whole slices (16 kB)
+    for (uint32_t staging_size_kb : {1u, 16u}) {
+        auto cfg_staging =
+            CLVK_CONFIG_SCOPED_OVERRIDE(image_upload_staging_size_kb, uint32_t,
+                                        staging_size_kb, true);
+
+        auto image = CreateImage(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 &format, &desc, host_data.data());
+
+        std::vector<cl_uchar> read_data(IMAGE_SIZE, 0);
+        size_t origin[3] = {0, 0, 0};
+        size_t region[3] = {IMAGE_WIDTH, IMAGE_HEIGHT, IMAGE_DEPTH};
+        EnqueueReadImage(image, CL_TRUE, origin, region, 0, 0,
+                         read_data.data());
+
+        EXPECT_EQ(read_data, host_data);
+    }
+}
+
 #endif
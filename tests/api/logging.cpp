@@ -0,0 +1,133 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+
+#include "testcl.hpp"
+#include "unit.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace {
+
+class LogRing : public ::testing::Test {
+protected:
+    void SetUp() override { clvk_log_ring_reset(16); }
+    void TearDown() override {
+        clvk_log_ring_reset(clvk_get_config()->log_ring_size);
+    }
+
+    std::string Dump() {
+        FILE* file = tmpfile();
+        EXPECT_NE(file, nullptr);
+        if (file == nullptr) {
+            return "";
+        }
+        clvk_log_ring_dump(file);
+        rewind(file);
+        std::string contents;
+        char buf[256];
+        size_t size;
+        while ((size = fread(buf, 1, sizeof(buf), file)) > 0) {
+            contents.append(buf, size);
+        }
+        fclose(file);
+        return contents;
+    }
+};
+
+} // namespace
+
+TEST_F(LogRing, CapturesMessagesInOrder) {
+    clvk_log_ring_append("first\n");
+    clvk_log_ring_append("second %u\n", 2u);
+    clvk_log_ring_append("third %s\n", "message");
+
+    EXPECT_EQ(Dump(), "[CLVK] first\n"
+                      "[CLVK] second 2\n"
+                      "[CLVK] third message\n");
+}
+
+TEST_F(LogRing, OverwritesOldestRecords) {
+    clvk_log_ring_reset(4);
+    for (int i = 0; i < 10; i++) {
+        clvk_log_ring_append("message %d\n", i);
+    }
+
+    EXPECT_EQ(Dump(), "[CLVK] message 6\n"
+                      "[CLVK] message 7\n"
+                      "[CLVK] message 8\n"
+                      "[CLVK] message 9\n");
+}
+
+TEST_F(LogRing, CopiesStringArguments) {
+    // Strings are copied when captured, not when the ring is dumped
+    char str[] = "before";
+    clvk_log_ring_append("%s|%5s|%-3s|%s\n", str, "ab", "c", nullptr);
+    strcpy(str, "after");
+
+    EXPECT_EQ(Dump(), "[CLVK] before|   ab|c  |(null)\n");
+}
+
+TEST_F(LogRing, FormatsArguments) {
+    int value = 0;
+    void* ptr = &value;
+    size_t size = 4096;
+    long long negative = -12345678901LL;
+    unsigned long long hex = 0xdeadbeefcafeULL;
+
+    clvk_log_ring_append("%d %i %u %x %X %o %c %%\n", -42, 7, 42u, 255u, 255u,
+                         8u, 'z');
+    clvk_log_ring_append("%zu %lld %llx %hhu %hd %ld\n", size, negative, hex,
+                         300, 70000, -5L);
+    clvk_log_ring_append("%.2f %e %g %Lf\n", 3.14159, 1.5, 0.25, 2.5L);
+    clvk_log_ring_append("%p %08x %+d\n", ptr, 0xabu, 3);
+
+    char expected[512];
+    snprintf(expected, sizeof(expected),
+             "[CLVK] %d %i %u %x %X %o %c %%\n"
+             "[CLVK] %zu %lld %llx %hhu %hd %ld\n"
+             "[CLVK] %.2f %e %g %Lf\n"
+             "[CLVK] %p %08x %+d\n",
+             -42, 7, 42u, 255u, 255u, 8u, 'z', size, negative, hex, 300, 70000,
+             -5L, 3.14159, 1.5, 0.25, 2.5L, ptr, 0xabu, 3);
+    EXPECT_EQ(Dump(), expected);
+}
+
+TEST_F(LogRing, FormatsUncapturableMessagesEagerly) {
+    // '*' widths cannot be captured, these records are formatted when
+    // appended
+    clvk_log_ring_append("%*d|%.*s\n", 4, 1, 2, "abc");
+    clvk_log_ring_append("%d %d %d %d %d %d %d %d %d %d %d %d %d\n", 1, 2, 3,
+                         4, 5, 6, 7, 8, 9, 10, 11, 12, 13);
+
+    EXPECT_EQ(Dump(), "[CLVK]    1|ab\n"
+                      "[CLVK] 1 2 3 4 5 6 7 8 9 10 11 12 13\n");
+}
+
+TEST_F(LogRing, MergesThreadRingsInTimestampOrder) {
+    clvk_log_ring_append("main before\n");
+    std::thread thread([] { clvk_log_ring_append("worker\n"); });
+    thread.join();
+    clvk_log_ring_append("main after\n");
+
+    EXPECT_EQ(Dump(), "[CLVK] main before\n"
+                      "[CLVK] worker\n"
+                      "[CLVK] main after\n");
+}
+
+#endif
@@ -0,0 +1,125 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "testcl.hpp"
+
+#include <vector>
+
+TEST_F(WithCommandQueue, MapUnalignedWindows) {
+    static const size_t NUM_ELEMENTS = 1024;
+    size_t buffer_size = NUM_ELEMENTS * sizeof(cl_uint);
+
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE, buffer_size);
+    std::vector<cl_uint> init(NUM_ELEMENTS, 0);
+    EnqueueWriteBuffer(buffer, CL_TRUE, 0, buffer_size, init.data());
+
+    // Bring the initial contents into the host caches then overwrite them on
+    // the device
+    auto stale =
+        EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0, buffer_size);
+    EnqueueUnmapMemObject(buffer, stale);
+    const cl_uint pattern = 0xdeadbeef;
+    EnqueueFillBuffer(buffer, &pattern, sizeof(pattern), 0, buffer_size);
+
+    // Only the mapped windows are flushed, their contents must reach the
+    // device while the rest of the buffer, including the bytes that share
+    // non-coherent atoms with the windows, is untouched
+    const size_t windows[][2] = {{3, 5}, {100, 1}, {NUM_ELEMENTS - 7, 7}};
+    for (auto& window : windows) {
+        auto data = EnqueueMapBuffer<cl_uint>(
+            buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+            window[0] * sizeof(cl_uint), window[1] * sizeof(cl_uint));
+        for (size_t i = 0; i < window[1]; i++) {
+            data[i] = window[0] + i;
+        }
+        EnqueueUnmapMemObject(buffer, data);
+    }
+
+    auto data =
+        EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0, buffer_size);
+    for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+        bool in_window = false;
+        for (auto& window : windows) {
+            in_window |= (i >= window[0]) && (i < window[0] + window[1]);
+        }
+        EXPECT_EQ(data[i], in_window ? i : pattern);
+    }
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+}
+
+TEST_F(WithCommandQueue, MapSamePointerTwice) {
+    static const size_t NUM_ELEMENTS = 256;
+    size_t buffer_size = NUM_ELEMENTS * sizeof(cl_uint);
+
+    std::vector<cl_uint> init(NUM_ELEMENTS);
+    for (cl_uint i = 0; i < NUM_ELEMENTS; i++) {
+        init[i] = i;
+    }
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                               buffer_size, init.data());
+
+    // Overlapping read mappings may return the same pointer and are all valid
+    // until they have been unmapped
+    auto first = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                           buffer_size);
+    auto second = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                            buffer_size / 2);
+    EXPECT_EQ(first, second);
+
+    cl_uint map_count;
+    GetMemObjectInfo(buffer, CL_MEM_MAP_COUNT, sizeof(map_count), &map_count,
+                     nullptr);
+    EXPECT_EQ(map_count, 2);
+
+    EnqueueUnmapMemObject(buffer, second);
+    Finish();
+    for (cl_uint i = 0; i < NUM_ELEMENTS; i++) {
+        EXPECT_EQ(first[i], i);
+    }
+    EnqueueUnmapMemObject(buffer, first);
+    Finish();
+}
+
+TEST_F(WithCommandQueue, MapSamePointerWriteThenRead) {
+    static const size_t NUM_ELEMENTS = 1024;
+    size_t buffer_size = NUM_ELEMENTS * sizeof(cl_uint);
+
+    // Offset the host pointer so that it cannot be imported and the buffer
+    // contents are copied back from it on unmap
+    std::vector<cl_uint> storage(NUM_ELEMENTS + 1, 0);
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                               buffer_size, storage.data() + 1);
+
+    auto write = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_WRITE, 0,
+                                           buffer_size);
+    auto read = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                          4 * sizeof(cl_uint));
+    ASSERT_EQ(write, read);
+
+    // Unmapping either mapping leaves the other one valid, writes through the
+    // pointer must reach the buffer once both have been unmapped
+    EnqueueUnmapMemObject(buffer, read);
+    Finish();
+    for (cl_uint i = 0; i < NUM_ELEMENTS; i++) {
+        write[i] = i;
+    }
+    EnqueueUnmapMemObject(buffer, write);
+
+    std::vector<cl_uint> result(NUM_ELEMENTS);
+    EnqueueReadBuffer(buffer, CL_TRUE, 0, buffer_size, result.data());
+    for (cl_uint i = 0; i < NUM_ELEMENTS; i++) {
+        EXPECT_EQ(result[i], i);
+    }
+}
@@ -43,3 +43,34 @@ TEST(Platform, DeviceQueryWithMultipleTypes) {
         ASSERT_EQ(err, CL_SUCCESS);
     }
 }
+
+TEST_F(WithCommandQueue, RuntimeMetrics) {
+    using clGetRuntimeMetricsCLVK_fn = cl_int(CL_API_CALL*)(
+        size_t param_value_size, void* param_value,
+        size_t* param_value_size_ret);
+    auto clGetRuntimeMetricsCLVK = reinterpret_cast<clGetRuntimeMetricsCLVK_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform(),
+                                                 "clGetRuntimeMetricsCLVK"));
+    ASSERT_NE(clGetRuntimeMetricsCLVK, nullptr);
+
+    auto buffer = CreateBuffer(CL_MEM_READ_WRITE, sizeof(cl_uint), nullptr);
+    cl_uint zero = 0;
+    EnqueueFillBuffer(buffer, &zero, sizeof(zero), 0, sizeof(zero));
+    Finish();
+
+    size_t size;
+    cl_int err = clGetRuntimeMetricsCLVK(0, nullptr, &size);
+    ASSERT_CL_SUCCESS(err);
+    ASSERT_GT(size, 1u);
+
+    // Leave room for metrics updated between the two queries
+    std::string metrics(size * 2, '\0');
+    err = clGetRuntimeMetricsCLVK(metrics.size(), metrics.data(), &size);
+    ASSERT_CL_SUCCESS(err);
+    metrics.resize(size - 1);
+
+    EXPECT_EQ(metrics.front(), '{');
+    EXPECT_EQ(metrics.back(), '}');
+    EXPECT_NE(metrics.find("\"commands_enqueued\":"), std::string::npos);
+    EXPECT_NE(metrics.find("\"CL_COMMAND_FILL_BUFFER\":"), std::string::npos);
+}
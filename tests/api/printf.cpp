@@ -195,4 +195,68 @@ TEST_F(WithCommandQueueAndPrintf, VectorLen16) {
     ASSERT_STREQ(m_printf_output.c_str(), message);
 }
 
+TEST_F(WithCommandQueueAndPrintf, BatchedPrintfKernels) {
+    // Enqueue more kernels than there are printf buffer slices so that more
+    // slices have to be allocated
+    auto cfg1 =
+        CLVK_CONFIG_SCOPED_OVERRIDE(printf_buffer_slices, uint32_t, 2, true);
+
+    const char* source = R"(
+    kernel void test_printf(uint id) {
+      printf("kernel %u\n", id);
+    }
+    )";
+    auto kernel = CreateKernel(source, "test_printf");
+
+    std::string message;
+    size_t gws = 1;
+    size_t lws = 1;
+    for (cl_uint i = 0; i < 8; i++) {
+        SetKernelArg(kernel, 0, sizeof(i), &i);
+        EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 0, nullptr,
+                             nullptr);
+        message += "kernel " + std::to_string(i) + "\n";
+    }
+    Finish();
+
+    ASSERT_STREQ(m_printf_output.c_str(), message.c_str());
+}
+
+TEST_F(WithCommandQueueAndPrintf, PrintfKernelsWaitingForUserEvent) {
+    // Enqueuing kernels must not wait for printf buffer slices held by
+    // kernels that can only run once the user event is completed
+    auto cfg1 =
+        CLVK_CONFIG_SCOPED_OVERRIDE(printf_buffer_slices, uint32_t, 2, true);
+
+    const char* source = R"(
+    kernel void test_printf(uint id) {
+      printf("kernel %u\n", id);
+    }
+    )";
+    auto kernel = CreateKernel(source, "test_printf");
+
+    // The printf buffers added for the first round are released once the
+    // queue is idle, and added again for the second one
+    std::string message;
+    for (cl_uint round = 0; round < 2; round++) {
+        auto uevent = CreateUserEvent();
+        cl_event wait_list = uevent;
+
+        size_t gws = 1;
+        size_t lws = 1;
+        for (cl_uint i = round * 8; i < (round + 1) * 8; i++) {
+            SetKernelArg(kernel, 0, sizeof(i), &i);
+            EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 1, &wait_list,
+                                 nullptr);
+            message += "kernel " + std::to_string(i) + "\n";
+        }
+        Flush();
+
+        SetUserEventStatus(uevent, CL_COMPLETE);
+        Finish();
+    }
+
+    ASSERT_STREQ(m_printf_output.c_str(), message.c_str());
+}
+
 #endif
@@ -110,6 +110,42 @@ TEST_F(WithProfiledCommandQueue, QueueProfilingMultipleBatchedKernels) {
     }
 }
 
+TEST_F(WithProfiledCommandQueue, QueueProfilingManyCommands) {
+    // Create kernel
+    auto kernel = CreateKernel(program_source, "donothing");
+
+    size_t gws = 1;
+    size_t lws = 1;
+
+    cl_int dummy = 42;
+    SetKernelArg(kernel, 0, &dummy);
+
+    // Timestamp query pools are recycled once commands complete, so run
+    // several rounds and check that every command gets its own timestamps
+    static const unsigned NUM_ROUNDS = 3;
+    static const unsigned NUM_COMMANDS = 64;
+    for (unsigned round = 0; round < NUM_ROUNDS; round++) {
+        std::vector<cl_event> events(NUM_COMMANDS);
+        for (auto& event : events) {
+            EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, &lws, 0, nullptr,
+                                 &event);
+        }
+        Finish();
+
+        for (auto event : events) {
+            cl_ulong ts_submit, ts_start, ts_end;
+            GetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT,
+                                  &ts_submit);
+            GetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+                                  &ts_start);
+            GetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, &ts_end);
+            EXPECT_GE(ts_start, ts_submit);
+            EXPECT_GE(ts_end, ts_start);
+            clReleaseEvent(event);
+        }
+    }
+}
+
 TEST_F(WithProfiledCommandQueue, QueueProfilingVsDeviceTimer) {
 
     // Check device timer functions are supported
@@ -0,0 +1,124 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "testcl.hpp"
+
+TEST_F(WithCommandQueue, SVMFillCopyMap) {
+    cl_device_svm_capabilities caps;
+    GetDeviceInfo(CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, nullptr);
+    if ((caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) == 0) {
+        GTEST_SKIP() << "Device does not support coarse-grained buffer SVM";
+    }
+
+    const size_t NUM_ELEMENTS = 1024;
+    const size_t size = NUM_ELEMENTS * sizeof(cl_uint);
+    auto src = static_cast<cl_uint*>(
+        clSVMAlloc(m_context, CL_MEM_READ_WRITE, size, 0));
+    auto dst = static_cast<cl_uint*>(
+        clSVMAlloc(m_context, CL_MEM_READ_WRITE, size, 0));
+    ASSERT_NE(src, nullptr);
+    ASSERT_NE(dst, nullptr);
+
+    cl_uint pattern = 0xdeadbeef;
+    auto err = clEnqueueSVMMemFill(m_queue, src, &pattern, sizeof(pattern),
+                                   size, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    err = clEnqueueSVMMemcpy(m_queue, CL_FALSE, dst, src, size, 0, nullptr,
+                             nullptr);
+    ASSERT_CL_SUCCESS(err);
+    err = clEnqueueSVMMap(m_queue, CL_TRUE, CL_MAP_READ, dst, size, 0, nullptr,
+                          nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+        EXPECT_EQ(dst[i], pattern);
+    }
+
+    err = clEnqueueSVMUnmap(m_queue, dst, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    clSVMFree(m_context, src);
+    clSVMFree(m_context, dst);
+}
+
+TEST_F(WithCommandQueue, SVMKernelPointerChasing) {
+    cl_device_svm_capabilities caps;
+    GetDeviceInfo(CL_DEVICE_SVM_CAPABILITIES, sizeof(caps), &caps, nullptr);
+    if ((caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER) == 0) {
+        GTEST_SKIP() << "Device does not support coarse-grained buffer SVM";
+    }
+
+    static const char* source = R"(
+struct node {
+    global struct node* next;
+    uint value;
+};
+
+kernel void test(global struct node* head, global uint* sum) {
+    uint total = 0;
+    for (global struct node* n = head; n != 0; n = n->next) {
+        total += n->value;
+    }
+    *sum = total;
+}
+)";
+    auto kernel = CreateKernel(source, "test");
+
+    struct node {
+        node* next;
+        cl_uint value;
+    };
+
+    const size_t NUM_NODES = 256;
+    const size_t size = NUM_NODES * sizeof(node);
+    auto nodes =
+        static_cast<node*>(clSVMAlloc(m_context, CL_MEM_READ_WRITE, size, 0));
+    auto sum = static_cast<cl_uint*>(
+        clSVMAlloc(m_context, CL_MEM_READ_WRITE, sizeof(cl_uint), 0));
+    ASSERT_NE(nodes, nullptr);
+    ASSERT_NE(sum, nullptr);
+
+    // Link the nodes backwards so that the list starts in the middle of the
+    // allocation
+    auto err = clEnqueueSVMMap(m_queue, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION,
+                               nodes, size, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    cl_uint expected = 0;
+    for (size_t i = 0; i < NUM_NODES; i++) {
+        nodes[i].next = (i == 0) ? nullptr : &nodes[i - 1];
+        nodes[i].value = static_cast<cl_uint>(i * 3 + 1);
+        expected += nodes[i].value;
+    }
+    err = clEnqueueSVMUnmap(m_queue, nodes, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+
+    ASSERT_CL_SUCCESS(
+        clSetKernelArgSVMPointer(kernel, 0, &nodes[NUM_NODES - 1]));
+    ASSERT_CL_SUCCESS(clSetKernelArgSVMPointer(kernel, 1, sum));
+
+    size_t gws = 1;
+    EnqueueNDRangeKernel(kernel, 1, nullptr, &gws, nullptr);
+
+    err = clEnqueueSVMMap(m_queue, CL_TRUE, CL_MAP_READ, sum, sizeof(cl_uint),
+                          0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    EXPECT_EQ(*sum, expected);
+    err = clEnqueueSVMUnmap(m_queue, sum, 0, nullptr, nullptr);
+    ASSERT_CL_SUCCESS(err);
+    Finish();
+
+    clSVMFree(m_context, nodes);
+    clSVMFree(m_context, sum);
+}
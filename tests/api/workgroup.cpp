@@ -14,6 +14,8 @@
 
 #include "testcl.hpp"
 
+#include <array>
+
 static const size_t BUFFER_SIZE = 1024;
 static const size_t LOCAL_SIZE = 2;
 
@@ -63,3 +65,70 @@ TEST_F(WithCommandQueue, LWS) {
     EnqueueUnmapMemObject(buffer, data);
     Finish();
 }
+
+TEST_F(WithCommandQueue, SuggestedLWSMatchesEnqueue) {
+    REQUIRE_EXTENSION("cl_khr_suggested_local_work_size");
+
+    auto clGetKernelSuggestedLocalWorkSizeKHR =
+        reinterpret_cast<clGetKernelSuggestedLocalWorkSizeKHR_fn>(
+            clGetExtensionFunctionAddressForPlatform(
+                platform(), "clGetKernelSuggestedLocalWorkSizeKHR"));
+    ASSERT_NE(clGetKernelSuggestedLocalWorkSizeKHR, nullptr);
+
+    static const char* source = R"(
+kernel void test(global uint* out) {
+    size_t gid = get_global_id(0) + get_global_id(1) * get_global_size(0);
+    out[gid * 2] = get_local_size(0);
+    out[gid * 2 + 1] = get_local_size(1);
+}
+)";
+
+    auto kernel = CreateKernel(source, "test");
+
+    size_t gws[2] = {96, 30};
+    size_t num_items = gws[0] * gws[1];
+    size_t buffer_size = num_items * 2 * sizeof(cl_uint);
+    auto buffer = CreateBuffer(CL_MEM_WRITE_ONLY, buffer_size, nullptr);
+    SetKernelArg(kernel, 0, buffer);
+
+    size_t suggested[2];
+    cl_int err = clGetKernelSuggestedLocalWorkSizeKHR(
+        m_queue, kernel, 2, nullptr, gws, suggested);
+    ASSERT_CL_SUCCESS(err);
+
+    EnqueueNDRangeKernel(kernel, 2, nullptr, gws, nullptr);
+    Finish();
+
+    // Partial work-groups report their actual size so only check the first
+    // work-item
+    auto data = EnqueueMapBuffer<cl_uint>(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                          buffer_size);
+    EXPECT_EQ(data[0], suggested[0]);
+    EXPECT_EQ(data[1], suggested[1]);
+    EnqueueUnmapMemObject(buffer, data);
+    Finish();
+}
+
+#ifdef CLVK_UNIT_TESTING_ENABLED
+TEST(WorkGroupSizeScore, PrefersSubgroupMultiples) {
+    static const uint32_t SUBGROUP_SIZE = 32;
+    static const uint64_t TARGET_NUM_GROUPS = 16;
+
+    auto score = [](std::array<uint32_t, 3> gws, std::array<uint32_t, 3> lws) {
+        return clvk_work_group_size_score(gws.data(), lws.data(),
+                                          SUBGROUP_SIZE, TARGET_NUM_GROUPS);
+    };
+
+    // All these sizes divide the global size and launch enough work-groups,
+    // only the use of the subgroups differs
+    std::array<uint32_t, 3> gws = {12288, 1, 1};
+    EXPECT_GT(score(gws, {32, 1, 1}), score(gws, {24, 1, 1}));
+    EXPECT_GT(score(gws, {64, 1, 1}), score(gws, {48, 1, 1}));
+    EXPECT_GT(score(gws, {96, 1, 1}), score(gws, {48, 1, 1}));
+    EXPECT_DOUBLE_EQ(score(gws, {64, 1, 1}), score(gws, {128, 1, 1}));
+
+    std::array<uint32_t, 3> gws2d = {256, 256, 1};
+    EXPECT_GT(score(gws2d, {8, 4, 1}), score(gws2d, {4, 4, 1}));
+    EXPECT_GT(score(gws2d, {16, 8, 1}), score(gws2d, {8, 2, 1}));
+}
+#endif
@@ -0,0 +1,528 @@
+// Copyright 2024 The clvk authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Micro-benchmarks for clvk. They only rely on core OpenCL features so that
+// they can run on any Vulkan implementation, including CPU ones such as
+// llvmpipe. Results are written as JSON to make it easy to track them between
+// releases.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define CL_TARGET_OPENCL_VERSION 120
+#include "CL/cl.h"
+
+#define CHECK_CL_ERRCODE(err)                                                  \
+    do {                                                                       \
+        if (err != CL_SUCCESS) {                                               \
+            fprintf(stderr, "%s:%d error after CL call: %d\n", __FILE__,       \
+                    __LINE__, err);                                            \
+            return false;                                                      \
+        }                                                                      \
+    } while (0)
+
+static const char* program_source = R"(
+kernel void empty() {}
+
+kernel void store(global uint* out, uint val)
+{
+    out[get_global_id(0)] = val;
+}
+)";
+
+static uint64_t sample_time_ns() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+struct bench_result {
+    std::string name;
+    std::string unit;
+    std::vector<std::pair<std::string, std::string>> params;
+    std::vector<double> samples;
+};
+
+struct bench_state {
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel empty_kernel;
+    cl_kernel store_kernel;
+    unsigned iterations;
+    std::vector<bench_result> results;
+
+    void add_result(const std::string& name, const std::string& unit,
+                    std::vector<std::pair<std::string, std::string>> params,
+                    std::vector<double>&& samples) {
+        results.push_back({name, unit, std::move(params), std::move(samples)});
+    }
+};
+
+static bool create_program(bench_state& state, const char* source,
+                           cl_program* program) {
+    cl_int err;
+    *program =
+        clCreateProgramWithSource(state.context, 1, &source, nullptr, &err);
+    CHECK_CL_ERRCODE(err);
+    err = clBuildProgram(*program, 1, &state.device, nullptr, nullptr, nullptr);
+    CHECK_CL_ERRCODE(err);
+    return true;
+}
+
+static bool setup(bench_state& state) {
+    cl_int err;
+
+    err = clGetPlatformIDs(1, &state.platform, nullptr);
+    CHECK_CL_ERRCODE(err);
+
+    err = clGetDeviceIDs(state.platform, CL_DEVICE_TYPE_ALL, 1, &state.device,
+                         nullptr);
+    CHECK_CL_ERRCODE(err);
+
+    state.context =
+        clCreateContext(nullptr, 1, &state.device, nullptr, nullptr, &err);
+    CHECK_CL_ERRCODE(err);
+
+    state.queue = clCreateCommandQueue(state.context, state.device, 0, &err);
+    CHECK_CL_ERRCODE(err);
+
+    if (!create_program(state, program_source, &state.program)) {
+        return false;
+    }
+
+    state.empty_kernel = clCreateKernel(state.program, "empty", &err);
+    CHECK_CL_ERRCODE(err);
+
+    state.store_kernel = clCreateKernel(state.program, "store", &err);
+    CHECK_CL_ERRCODE(err);
+
+    return true;
+}
+
+static void teardown(bench_state& state) {
+    clReleaseKernel(state.store_kernel);
+    clReleaseKernel(state.empty_kernel);
+    clReleaseProgram(state.program);
+    clReleaseCommandQueue(state.queue);
+    clReleaseContext(state.context);
+}
+
+// Time taken by a single empty kernel from enqueue to completion.
+static bool bench_enqueue_latency(bench_state& state) {
+    std::vector<double> samples;
+    size_t gws = 1;
+    for (unsigned i = 0; i < state.iterations; i++) {
+        auto start = sample_time_ns();
+        cl_int err = clEnqueueNDRangeKernel(state.queue, state.empty_kernel, 1,
+                                            nullptr, &gws, nullptr, 0, nullptr,
+                                            nullptr);
+        CHECK_CL_ERRCODE(err);
+        err = clFinish(state.queue);
+        CHECK_CL_ERRCODE(err);
+        samples.push_back((sample_time_ns() - start) / 1e3);
+    }
+    state.add_result("enqueue_latency_empty_kernel", "us", {},
+                     std::move(samples));
+    return true;
+}
+
+// Number of empty kernels executed per second when enqueued back to back.
+static bool bench_kernel_throughput(bench_state& state) {
+    static const unsigned num_kernels = 1000;
+    std::vector<double> samples;
+    size_t gws = 1;
+    for (unsigned i = 0; i < state.iterations; i++) {
+        auto start = sample_time_ns();
+        for (unsigned k = 0; k < num_kernels; k++) {
+            cl_int err = clEnqueueNDRangeKernel(state.queue, state.empty_kernel,
+                                                1, nullptr, &gws, nullptr, 0,
+                                                nullptr, nullptr);
+            CHECK_CL_ERRCODE(err);
+        }
+        cl_int err = clFinish(state.queue);
+        CHECK_CL_ERRCODE(err);
+        samples.push_back(num_kernels * 1e9 / (sample_time_ns() - start));
+    }
+    state.add_result("batched_kernel_throughput", "kernels/s",
+                     {{"kernels", std::to_string(num_kernels)}},
+                     std::move(samples));
+    return true;
+}
+
+// Host cost of setting an argument and enqueuing a kernel.
+static bool bench_set_arg_enqueue(bench_state& state) {
+    static const unsigned num_kernels = 1000;
+    cl_int err;
+    auto buffer = clCreateBuffer(state.context, CL_MEM_WRITE_ONLY,
+                                 sizeof(cl_uint), nullptr, &err);
+    CHECK_CL_ERRCODE(err);
+    err = clSetKernelArg(state.store_kernel, 0, sizeof(cl_mem), &buffer);
+    CHECK_CL_ERRCODE(err);
+
+    std::vector<double> samples;
+    size_t gws = 1;
+    for (unsigned i = 0; i < state.iterations; i++) {
+        auto start = sample_time_ns();
+        for (cl_uint k = 0; k < num_kernels; k++) {
+            err = clSetKernelArg(state.store_kernel, 1, sizeof(k), &k);
+            CHECK_CL_ERRCODE(err);
+            err = clEnqueueNDRangeKernel(state.queue, state.store_kernel, 1,
+                                         nullptr, &gws, nullptr, 0, nullptr,
+                                         nullptr);
+            CHECK_CL_ERRCODE(err);
+        }
+        samples.push_back((sample_time_ns() - start) / 1e3 / num_kernels);
+        err = clFinish(state.queue);
+        CHECK_CL_ERRCODE(err);
+    }
+    clReleaseMemObject(buffer);
+    state.add_result("set_arg_enqueue_cost", "us", {}, std::move(samples));
+    return true;
+}
+
+static const size_t transfer_sizes[] = {4 * 1024, 64 * 1024, 1024 * 1024,
+                                        16 * 1024 * 1024};
+
+// Bandwidth of blocking reads, writes and maps for a range of sizes.
+static bool bench_transfer_bandwidth(bench_state& state) {
+    for (auto size : transfer_sizes) {
+        cl_int err;
+        auto buffer = clCreateBuffer(state.context, CL_MEM_READ_WRITE, size,
+                                     nullptr, &err);
+        CHECK_CL_ERRCODE(err);
+        std::vector<char> host(size, 42);
+
+        std::vector<double> write_samples, read_samples, map_samples;
+        for (unsigned i = 0; i < state.iterations; i++) {
+            auto start = sample_time_ns();
+            err = clEnqueueWriteBuffer(state.queue, buffer, CL_TRUE, 0, size,
+                                       host.data(), 0, nullptr, nullptr);
+            CHECK_CL_ERRCODE(err);
+            auto end = sample_time_ns();
+            write_samples.push_back(size / 1e6 / ((end - start) / 1e9));
+
+            start = sample_time_ns();
+            err = clEnqueueReadBuffer(state.queue, buffer, CL_TRUE, 0, size,
+                                      host.data(), 0, nullptr, nullptr);
+            CHECK_CL_ERRCODE(err);
+            end = sample_time_ns();
+            read_samples.push_back(size / 1e6 / ((end - start) / 1e9));
+
+            start = sample_time_ns();
+            auto ptr = clEnqueueMapBuffer(state.queue, buffer, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                                          0, nullptr, nullptr, &err);
+            CHECK_CL_ERRCODE(err);
+            memset(ptr, i, size);
+            err = clEnqueueUnmapMemObject(state.queue, buffer, ptr, 0, nullptr,
+                                          nullptr);
+            CHECK_CL_ERRCODE(err);
+            err = clFinish(state.queue);
+            CHECK_CL_ERRCODE(err);
+            end = sample_time_ns();
+            map_samples.push_back(size / 1e6 / ((end - start) / 1e9));
+        }
+        clReleaseMemObject(buffer);
+
+        auto size_str = std::to_string(size);
+        state.add_result("write_buffer_bandwidth", "MB/s",
+                         {{"size", size_str}}, std::move(write_samples));
+        state.add_result("read_buffer_bandwidth", "MB/s", {{"size", size_str}},
+                         std::move(read_samples));
+        state.add_result("map_buffer_bandwidth", "MB/s", {{"size", size_str}},
+                         std::move(map_samples));
+    }
+    return true;
+}
+
+// Throughput of copies between two RGBA8 2D images.
+static bool bench_image_copy(bench_state& state) {
+    cl_bool image_support;
+    cl_int err = clGetDeviceInfo(state.device, CL_DEVICE_IMAGE_SUPPORT,
+                                 sizeof(image_support), &image_support,
+                                 nullptr);
+    CHECK_CL_ERRCODE(err);
+    if (!image_support) {
+        fprintf(stderr, "Skipping image benchmarks, images not supported\n");
+        return true;
+    }
+
+    static const size_t dims[] = {256, 1024, 2048};
+    cl_image_format format = {CL_RGBA, CL_UNORM_INT8};
+    for (auto dim : dims) {
+        cl_image_desc desc = {};
+        desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+        desc.image_width = dim;
+        desc.image_height = dim;
+        auto src = clCreateImage(state.context, CL_MEM_READ_WRITE, &format,
+                                 &desc, nullptr, &err);
+        CHECK_CL_ERRCODE(err);
+        auto dst = clCreateImage(state.context, CL_MEM_READ_WRITE, &format,
+                                 &desc, nullptr, &err);
+        CHECK_CL_ERRCODE(err);
+
+        size_t origin[3] = {0, 0, 0};
+        size_t region[3] = {dim, dim, 1};
+        std::vector<double> samples;
+        for (unsigned i = 0; i <= state.iterations; i++) {
+            auto start = sample_time_ns();
+            err = clEnqueueCopyImage(state.queue, src, dst, origin, origin,
+                                     region, 0, nullptr, nullptr);
+            CHECK_CL_ERRCODE(err);
+            err = clFinish(state.queue);
+            CHECK_CL_ERRCODE(err);
+            // The first copy includes the initialisation of the images
+            if (i != 0) {
+                auto bytes = dim * dim * 4;
+                samples.push_back(bytes / 1e6 /
+                                  ((sample_time_ns() - start) / 1e9));
+            }
+        }
+        clReleaseMemObject(dst);
+        clReleaseMemObject(src);
+
+        state.add_result("image_copy_throughput", "MB/s",
+                         {{"width", std::to_string(dim)},
+                          {"height", std::to_string(dim)}},
+                         std::move(samples));
+    }
+    return true;
+}
+
+// Time to build a program never seen before (cold) and the same program a
+// second time (warm).
+static bool bench_program_build(bench_state& state) {
+    std::vector<double> cold_samples, warm_samples;
+    for (unsigned i = 0; i < state.iterations; i++) {
+        // Make the source unique to defeat caches
+        std::string source = std::string(program_source) +
+                             "\n// bench " + std::to_string(sample_time_ns()) +
+                             "\n";
+        auto start = sample_time_ns();
+        cl_program program;
+        if (!create_program(state, source.c_str(), &program)) {
+            return false;
+        }
+        cold_samples.push_back((sample_time_ns() - start) / 1e6);
+        clReleaseProgram(program);
+
+        start = sample_time_ns();
+        if (!create_program(state, source.c_str(), &program)) {
+            return false;
+        }
+        warm_samples.push_back((sample_time_ns() - start) / 1e6);
+        clReleaseProgram(program);
+    }
+    state.add_result("program_build_time", "ms", {{"cache", "cold"}},
+                     std::move(cold_samples));
+    state.add_result("program_build_time", "ms", {{"cache", "warm"}},
+                     std::move(warm_samples));
+    return true;
+}
+
+// Time between a kernel becoming runnable and the host being woken up by
+// clWaitForEvents once it completed.
+static bool bench_event_wait(bench_state& state) {
+    std::vector<double> samples;
+    size_t gws = 1;
+    for (unsigned i = 0; i < state.iterations; i++) {
+        cl_int err;
+        auto uevent = clCreateUserEvent(state.context, &err);
+        CHECK_CL_ERRCODE(err);
+        cl_event event;
+        err = clEnqueueNDRangeKernel(state.queue, state.empty_kernel, 1,
+                                     nullptr, &gws, nullptr, 1, &uevent,
+                                     &event);
+        CHECK_CL_ERRCODE(err);
+        err = clFlush(state.queue);
+        CHECK_CL_ERRCODE(err);
+
+        auto start = sample_time_ns();
+        err = clSetUserEventStatus(uevent, CL_COMPLETE);
+        CHECK_CL_ERRCODE(err);
+        err = clWaitForEvents(1, &event);
+        CHECK_CL_ERRCODE(err);
+        samples.push_back((sample_time_ns() - start) / 1e3);
+
+        clReleaseEvent(event);
+        clReleaseEvent(uevent);
+    }
+    state.add_result("event_wait_latency", "us", {}, std::move(samples));
+    return true;
+}
+
+static std::string json_string(const std::string& str) {
+    std::string ret = "\"";
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            ret += "\\\"";
+            break;
+        case '\\':
+            ret += "\\\\";
+            break;
+        case '\n':
+            ret += "\\n";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                ret += buf;
+            } else {
+                ret += c;
+            }
+        }
+    }
+    return ret + "\"";
+}
+
+static std::string device_info_string(cl_device_id device,
+                                      cl_device_info info) {
+    size_t size;
+    if (clGetDeviceInfo(device, info, 0, nullptr, &size) != CL_SUCCESS) {
+        return "";
+    }
+    std::string ret(size, '\0');
+    clGetDeviceInfo(device, info, size, &ret[0], nullptr);
+    ret.resize(strlen(ret.c_str()));
+    return ret;
+}
+
+static void write_json(const bench_state& state, FILE* out) {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"device\": %s,\n",
+            json_string(device_info_string(state.device, CL_DEVICE_NAME))
+                .c_str());
+    fprintf(out, "  \"device_version\": %s,\n",
+            json_string(device_info_string(state.device, CL_DEVICE_VERSION))
+                .c_str());
+    fprintf(out, "  \"driver_version\": %s,\n",
+            json_string(device_info_string(state.device, CL_DRIVER_VERSION))
+                .c_str());
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t r = 0; r < state.results.size(); r++) {
+        auto& result = state.results[r];
+        auto sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (auto s : sorted) {
+            sum += s;
+        }
+        size_t n = sorted.size();
+        double median = n == 0 ? 0.0
+                        : n % 2 ? sorted[n / 2]
+                                : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": %s,\n", json_string(result.name).c_str());
+        fprintf(out, "      \"unit\": %s,\n", json_string(result.unit).c_str());
+        fprintf(out, "      \"params\": {");
+        for (size_t p = 0; p < result.params.size(); p++) {
+            fprintf(out, "%s%s: %s", p == 0 ? "" : ", ",
+                    json_string(result.params[p].first).c_str(),
+                    json_string(result.params[p].second).c_str());
+        }
+        fprintf(out, "},\n");
+        fprintf(out, "      \"iterations\": %zu,\n", n);
+        fprintf(out, "      \"min\": %g,\n", n ? sorted.front() : 0.0);
+        fprintf(out, "      \"median\": %g,\n", median);
+        fprintf(out, "      \"mean\": %g,\n", n ? sum / n : 0.0);
+        fprintf(out, "      \"max\": %g\n", n ? sorted.back() : 0.0);
+        fprintf(out, "    }%s\n", r + 1 == state.results.size() ? "" : ",");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [--output <file>] [--iterations <n>] "
+            "[--filter <substring>]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    const char* output = nullptr;
+    const char* filter = nullptr;
+    unsigned iterations = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = std::max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_state state{};
+    state.iterations = iterations;
+    if (!setup(state)) {
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<std::pair<const char*, std::function<bool(bench_state&)>>>
+        benchmarks = {
+            {"enqueue_latency", bench_enqueue_latency},
+            {"kernel_throughput", bench_kernel_throughput},
+            {"set_arg_enqueue", bench_set_arg_enqueue},
+            {"transfer_bandwidth", bench_transfer_bandwidth},
+            {"image_copy", bench_image_copy},
+            {"program_build", bench_program_build},
+            {"event_wait", bench_event_wait},
+        };
+
+    bool success = true;
+    for (auto& bench : benchmarks) {
+        if (filter != nullptr && strstr(bench.first, filter) == nullptr) {
+            continue;
+        }
+        fprintf(stderr, "Running %s\n", bench.first);
+        if (!bench.second(state)) {
+            fprintf(stderr, "Benchmark %s failed\n", bench.first);
+            success = false;
+        }
+    }
+
+    FILE* out = stdout;
+    if (output != nullptr) {
+        out = fopen(output, "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Could not open '%s'\n", output);
+            teardown(state);
+            return EXIT_FAILURE;
+        }
+    }
+    write_json(state, out);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    teardown(state);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -60,6 +61,26 @@ TEST_P(SHA1Test, Test) {
     EXPECT_EQ(expected, to_hex_string(result));
 }
 
+TEST_P(SHA1Test, Stream) {
+    std::string msg = GetParam().first;
+    std::string expected = GetParam().second;
+
+    ASSERT_EQ(msg.size() % 2, 0);
+    std::vector<uint8_t> data = hex_string_to_bytes(msg);
+
+    // Feed the data in chunks of varying sizes, not aligned to blocks.
+    cvk_sha1_stream stream;
+    size_t offset = 0;
+    size_t chunk = 1;
+    while (offset < data.size()) {
+        size_t size = std::min(chunk, data.size() - offset);
+        stream.update(data.data() + offset, size);
+        offset += size;
+        chunk = (chunk * 7) % 97 + 1;
+    }
+    EXPECT_EQ(expected, to_hex_string(stream.finish()));
+}
+
 std::pair<std::string, std::string> tests[] = {
 #include "tests.inc"
 };